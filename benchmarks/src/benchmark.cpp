@@ -0,0 +1,657 @@
+#include "benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sstream>
+
+namespace benchmark
+{
+
+std::vector<shape>& get_shapes()
+{
+    static std::vector<shape> shapes;
+    return shapes;
+}
+
+writer::writer(cbe_encode_process* process, int64_t window_size, sink on_flush)
+: process(process)
+, window(window_size)
+, on_flush(on_flush)
+, flushed_byte_count(0)
+, flush_count(0)
+{
+}
+
+void writer::begin()
+{
+    flushed_byte_count = 0;
+    flush_count = 0;
+    cbe_encode_begin(process, window.data(), window.size(), 0);
+}
+
+void writer::end()
+{
+    cbe_encode_status status = cbe_encode_end(process);
+    if(status != CBE_ENCODE_STATUS_OK)
+    {
+        fprintf(stderr, "encode failed with status %d\n", status);
+        exit(1);
+    }
+    if(on_flush)
+    {
+        on_flush(window.data(), cbe_encode_get_buffer_offset(process));
+    }
+}
+
+void writer::flush()
+{
+    const int64_t byte_count = cbe_encode_get_buffer_offset(process);
+    if(on_flush)
+    {
+        on_flush(window.data(), byte_count);
+    }
+    flushed_byte_count += byte_count;
+    flush_count++;
+    cbe_encode_set_buffer(process, window.data(), window.size());
+}
+
+template<typename F> void writer::retry(F encode_function)
+{
+    for(;;)
+    {
+        cbe_encode_status status = encode_function();
+        if(status == CBE_ENCODE_STATUS_OK)
+        {
+            return;
+        }
+        if(status != CBE_ENCODE_STATUS_NEED_MORE_ROOM || cbe_encode_get_buffer_offset(process) == 0)
+        {
+            fprintf(stderr, "encode failed with status %d (window size %d)\n", status, (int)window.size());
+            exit(1);
+        }
+        flush();
+    }
+}
+
+void writer::add_nil() {retry([&]() {return cbe_encode_add_nil(process);});}
+void writer::add_boolean(bool value) {retry([&]() {return cbe_encode_add_boolean(process, value);});}
+void writer::add_integer(int sign, uint64_t value) {retry([&]() {return cbe_encode_add_integer(process, sign, value);});}
+void writer::add_integer_128(int sign, uint128_ct value) {retry([&]() {return cbe_encode_add_integer_128(process, sign, value);});}
+void writer::add_float(double value, int significant_digits)
+{
+    retry([&]() {return cbe_encode_add_float(process, value, significant_digits);});
+}
+
+void writer::add_float_shortest(double value)
+{
+    retry([&]() {return cbe_encode_add_float_shortest(process, value);});
+}
+void writer::add_date(int year, int month, int day) {retry([&]() {return cbe_encode_add_date(process, year, month, day);});}
+void writer::add_time_tz(int hour, int minute, int second, int nanosecond, const char* timezone)
+{
+    retry([&]() {return cbe_encode_add_time_tz(process, hour, minute, second, nanosecond, timezone);});
+}
+void writer::add_timestamp_tz(int year, int month, int day, int hour, int minute, int second, int nanosecond, const char* timezone)
+{
+    retry([&]() {return cbe_encode_add_timestamp_tz(process, year, month, day, hour, minute, second, nanosecond, timezone);});
+}
+void writer::add_timestamp_loc(int year, int month, int day, int hour, int minute, int second, int nanosecond,
+                               int latitude, int longitude)
+{
+    retry([&]()
+    {
+        return cbe_encode_add_timestamp_loc(process, year, month, day, hour, minute, second, nanosecond, latitude, longitude);
+    });
+}
+void writer::add_template(const cbe_template* encode_template, const cbe_slot_value* values)
+{
+    retry([&]() {return cbe_encode_add_template(process, encode_template, values);});
+}
+void writer::list_begin() {retry([&]() {return cbe_encode_list_begin(process);});}
+void writer::unordered_map_begin() {retry([&]() {return cbe_encode_unordered_map_begin(process);});}
+void writer::container_end() {retry([&]() {return cbe_encode_container_end(process);});}
+
+// Strings are streamed so that they can span several windows.
+void writer::add_string(const char* value, int64_t byte_count)
+{
+    retry([&]() {return cbe_encode_string_begin(process, byte_count);});
+    const uint8_t* position = (const uint8_t*)value;
+    const uint8_t* const end = position + byte_count;
+    while(position < end)
+    {
+        int64_t chunk_byte_count = end - position;
+        cbe_encode_status status = cbe_encode_add_data(process, position, &chunk_byte_count);
+        position += chunk_byte_count;
+        if(status == CBE_ENCODE_STATUS_NEED_MORE_ROOM)
+        {
+            flush();
+        }
+        else if(status != CBE_ENCODE_STATUS_OK)
+        {
+            fprintf(stderr, "encode failed with status %d\n", status);
+            exit(1);
+        }
+    }
+}
+
+int64_t writer::get_byte_count() const
+{
+    return flushed_byte_count + cbe_encode_get_buffer_offset(process);
+}
+
+int64_t writer::get_flush_count() const
+{
+    return flush_count;
+}
+
+std::vector<uint8_t> encode_document(const shape& shape, int64_t* object_count)
+{
+    std::vector<char> process_backing_store(cbe_encode_process_size(0));
+    cbe_encode_process* process = (cbe_encode_process*)process_backing_store.data();
+    std::vector<uint8_t> document;
+    writer w(process, 65536, [&](const uint8_t* data, int64_t byte_count)
+    {
+        document.insert(document.end(), data, data + byte_count);
+    });
+    w.begin();
+    *object_count = shape.encode(w);
+    w.end();
+    return document;
+}
+
+int64_t g_decoded_object_count = 0;
+
+static bool counted() {g_decoded_object_count++; return true;}
+static bool on_nil(cbe_decode_process*) {return counted();}
+static bool on_boolean(cbe_decode_process*, bool) {return counted();}
+static bool on_integer(cbe_decode_process*, int, uint64_t) {return counted();}
+static bool on_integer_128(cbe_decode_process*, int, uint128_ct) {return counted();}
+static bool on_float(cbe_decode_process*, double) {return counted();}
+static bool on_decimal_float(cbe_decode_process*, dec64_ct) {return counted();}
+static bool on_date(cbe_decode_process*, int, int, int) {return counted();}
+static bool on_time_tz(cbe_decode_process*, int, int, int, int, const char*) {return counted();}
+static bool on_time_loc(cbe_decode_process*, int, int, int, int, int, int) {return counted();}
+static bool on_timestamp_tz(cbe_decode_process*, int, int, int, int, int, int, int, const char*) {return counted();}
+static bool on_timestamp_loc(cbe_decode_process*, int, int, int, int, int, int, int, int, int) {return counted();}
+static bool on_container_begin(cbe_decode_process*) {return counted();}
+static bool on_array_begin(cbe_decode_process*, int64_t) {return counted();}
+static bool on_array_data(cbe_decode_process*, const uint8_t*, int64_t) {return true;}
+
+const cbe_decode_callbacks* get_null_callbacks()
+{
+    static const cbe_decode_callbacks callbacks = []()
+    {
+        cbe_decode_callbacks result = {};
+        result.on_nil = on_nil;
+        result.on_boolean = on_boolean;
+        result.on_integer = on_integer;
+        result.on_integer_128 = on_integer_128;
+        result.on_float = on_float;
+        result.on_decimal_float = on_decimal_float;
+        result.on_date = on_date;
+        result.on_time_tz = on_time_tz;
+        result.on_time_loc = on_time_loc;
+        result.on_timestamp_tz = on_timestamp_tz;
+        result.on_timestamp_loc = on_timestamp_loc;
+        result.on_list_begin = on_container_begin;
+        result.on_unordered_map_begin = on_container_begin;
+        result.on_ordered_map_begin = on_container_begin;
+        result.on_metadata_map_begin = on_container_begin;
+        result.on_container_end = on_container_begin;
+        result.on_string_begin = on_array_begin;
+        result.on_bytes_begin = on_array_begin;
+        result.on_uri_begin = on_array_begin;
+        result.on_comment_begin = on_array_begin;
+        result.on_array_data = on_array_data;
+        return result;
+    }();
+    return &callbacks;
+}
+
+} // namespace benchmark
+
+using namespace benchmark;
+
+struct options
+{
+    std::string output_path;
+    std::string baseline_path;
+    std::string filter;
+    std::vector<std::string> corpus_paths;
+    std::vector<int64_t> chunk_sizes = {1, 16, 64, 256, 1500, 4096, 65536, 1048576};
+    double min_seconds = 0.5;
+    double threshold_percent = 10;
+};
+
+struct result
+{
+    std::string name;
+    int64_t iterations;
+    int64_t bytes_per_iteration;
+    int64_t objects_per_iteration;
+    double mb_per_s;
+    double objects_per_s;
+    int64_t latency_ns_p50;
+    int64_t latency_ns_p99;
+    int64_t resumes_per_iteration;
+};
+
+typedef std::chrono::steady_clock benchmark_clock;
+
+static result run(const options& opts,
+                  const std::string& name,
+                  int64_t bytes_per_iteration,
+                  int64_t objects_per_iteration,
+                  std::function<void()> iteration)
+{
+    std::vector<int64_t> latencies;
+    const auto min_duration = std::chrono::duration<double>(opts.min_seconds);
+    const auto start = benchmark_clock::now();
+    auto end = start;
+
+    // Warm up caches and the branch predictor before measuring.
+    iteration();
+
+    while(latencies.size() < 10 || end - start < min_duration)
+    {
+        const auto iteration_start = benchmark_clock::now();
+        iteration();
+        end = benchmark_clock::now();
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - iteration_start).count());
+    }
+
+    int64_t total_ns = 0;
+    for(int64_t latency: latencies)
+    {
+        total_ns += latency;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const double seconds = total_ns / 1e9;
+    const int64_t iterations = latencies.size();
+
+    return result
+    {
+        name,
+        iterations,
+        bytes_per_iteration,
+        objects_per_iteration,
+        bytes_per_iteration * iterations / seconds / 1e6,
+        objects_per_iteration * iterations / seconds,
+        latencies[iterations / 2],
+        latencies[std::min(iterations - 1, iterations * 99 / 100)],
+        0,
+    };
+}
+
+static void report(const result& r)
+{
+    fprintf(stderr, "%-40s %10.1f MB/s %14.0f objects/s  p50 %9lld ns  p99 %9lld ns",
+            r.name.c_str(), r.mb_per_s, r.objects_per_s, (long long)r.latency_ns_p50, (long long)r.latency_ns_p99);
+    if(r.resumes_per_iteration > 0)
+    {
+        fprintf(stderr, "  %lld resumes", (long long)r.resumes_per_iteration);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void decode_or_exit(const std::string& name, const std::vector<uint8_t>& data)
+{
+    cbe_decode_status status = cbe_decode(get_null_callbacks(), NULL, data.data(), data.size(), 0);
+    if(status != CBE_DECODE_STATUS_OK)
+    {
+        fprintf(stderr, "%s: decode failed with status %d\n", name.c_str(), status);
+        exit(1);
+    }
+}
+
+// Decodes the document the way a network receiver would, feeding it at most
+// chunk_size bytes at a time and carrying any bytes the decoder didn't consume
+// over to the front of the next chunk. Returns the number of feeds that
+// stopped in the middle of an object.
+static int64_t decode_chunked_or_exit(const std::string& name, const std::vector<uint8_t>& data, int64_t chunk_size)
+{
+    static std::vector<char> process_backing_store(cbe_decode_process_size(0));
+    static std::vector<uint8_t> staging;
+    cbe_decode_process* process = (cbe_decode_process*)process_backing_store.data();
+    cbe_decode_begin(process, get_null_callbacks(), NULL, 0);
+
+    int64_t resume_count = 0;
+    int64_t pending = 0;
+    for(int64_t offset = 0; offset < (int64_t)data.size(); offset += chunk_size)
+    {
+        const int64_t byte_count = std::min(chunk_size, (int64_t)data.size() - offset);
+        if((int64_t)staging.size() < pending + byte_count)
+        {
+            staging.resize(pending + byte_count);
+        }
+        memcpy(staging.data() + pending, data.data() + offset, byte_count);
+        pending += byte_count;
+
+        int64_t bytes_consumed = pending;
+        cbe_decode_status status = cbe_decode_feed(process, staging.data(), &bytes_consumed);
+        if(status == CBE_DECODE_STATUS_NEED_MORE_DATA)
+        {
+            resume_count++;
+        }
+        else if(status != CBE_DECODE_STATUS_OK)
+        {
+            fprintf(stderr, "%s: decode failed with status %d\n", name.c_str(), status);
+            exit(1);
+        }
+        pending -= bytes_consumed;
+        memmove(staging.data(), staging.data() + bytes_consumed, pending);
+    }
+
+    cbe_decode_status status = cbe_decode_end(process);
+    if(status != CBE_DECODE_STATUS_OK || pending != 0)
+    {
+        fprintf(stderr, "%s: decode failed with status %d (%lld bytes left over)\n",
+                name.c_str(), status, (long long)pending);
+        exit(1);
+    }
+    return resume_count;
+}
+
+// Sweeps the feed chunk size over a document. Sizes larger than the document
+// would all measure the same single feed, so only the first of them is run.
+static void run_decode_chunked(const options& opts,
+                               const std::string& prefix,
+                               const std::vector<uint8_t>& document,
+                               int64_t object_count,
+                               std::vector<result>& results)
+{
+    for(int64_t chunk_size: opts.chunk_sizes)
+    {
+        const std::string name = prefix + "/decode_chunked/" + std::to_string(chunk_size);
+        if(name.find(opts.filter) == std::string::npos)
+        {
+            continue;
+        }
+        const int64_t resume_count = decode_chunked_or_exit(name, document, chunk_size);
+        results.push_back(run(opts, name, document.size(), object_count,
+                              [&]() {decode_chunked_or_exit(name, document, chunk_size);}));
+        results.back().resumes_per_iteration = resume_count;
+        report(results.back());
+        if(chunk_size >= (int64_t)document.size())
+        {
+            break;
+        }
+    }
+}
+
+// Sweeps the encode buffer size over a shape. The encoder never splits a
+// scalar, so windows smaller than the largest scalar in a document are skipped.
+static void run_encode_chunked(const options& opts,
+                               const shape& shape,
+                               int64_t document_size,
+                               int64_t object_count,
+                               std::vector<result>& results)
+{
+    static const int64_t min_window_size = 64;
+    std::vector<char> process_backing_store(cbe_encode_process_size(0));
+    cbe_encode_process* process = (cbe_encode_process*)process_backing_store.data();
+
+    for(int64_t chunk_size: opts.chunk_sizes)
+    {
+        const std::string name = shape.name + "/encode_chunked/" + std::to_string(chunk_size);
+        if(chunk_size < min_window_size || name.find(opts.filter) == std::string::npos)
+        {
+            continue;
+        }
+        writer w(process, chunk_size, nullptr);
+        auto encode = [&]()
+        {
+            w.begin();
+            shape.encode(w);
+            w.end();
+        };
+        encode();
+        const int64_t flush_count = w.get_flush_count();
+        results.push_back(run(opts, name, document_size, object_count, encode));
+        results.back().resumes_per_iteration = flush_count;
+        report(results.back());
+        if(chunk_size >= document_size)
+        {
+            break;
+        }
+    }
+}
+
+// Decode-only benchmarks over pre-generated documents (see generate_corpus).
+static void run_corpus(const options& opts, std::vector<result>& results)
+{
+    for(const std::string& path: opts.corpus_paths)
+    {
+        const std::string prefix = "corpus:" + path.substr(path.find_last_of('/') + 1);
+        const std::string name = prefix + "/decode";
+        bool is_wanted = name.find(opts.filter) != std::string::npos;
+        for(int64_t chunk_size: opts.chunk_sizes)
+        {
+            is_wanted |= (prefix + "/decode_chunked/" + std::to_string(chunk_size)).find(opts.filter) != std::string::npos;
+        }
+        if(!is_wanted)
+        {
+            continue;
+        }
+        std::ifstream in(path, std::ios::binary);
+        if(!in)
+        {
+            fprintf(stderr, "Could not open corpus %s\n", path.c_str());
+            exit(2);
+        }
+        const std::vector<uint8_t> document((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        g_decoded_object_count = 0;
+        decode_or_exit(name, document);
+        const int64_t object_count = g_decoded_object_count;
+        if(name.find(opts.filter) != std::string::npos)
+        {
+            results.push_back(run(opts, name, document.size(), object_count, [&]() {decode_or_exit(name, document);}));
+            report(results.back());
+        }
+        run_decode_chunked(opts, prefix, document, object_count, results);
+    }
+}
+
+static std::vector<result> run_all(const options& opts)
+{
+    std::vector<result> results;
+    for(const shape& shape: get_shapes())
+    {
+        int64_t object_count = 0;
+        const std::vector<uint8_t> document = encode_document(shape, &object_count);
+        std::vector<char> process_backing_store(cbe_encode_process_size(0));
+        cbe_encode_process* process = (cbe_encode_process*)process_backing_store.data();
+        std::vector<uint8_t> encoded;
+        writer w(process, document.size(), [&](const uint8_t* data, int64_t byte_count)
+        {
+            encoded.assign(data, data + byte_count);
+        });
+
+        auto encode = [&]()
+        {
+            w.begin();
+            shape.encode(w);
+            w.end();
+        };
+        auto decode = [&](const std::vector<uint8_t>& data)
+        {
+            decode_or_exit(shape.name, data);
+        };
+
+        const std::vector<std::pair<std::string, std::function<void()>>> kinds =
+        {
+            {"encode", encode},
+            {"decode", [&]() {decode(document);}},
+            {"round_trip", [&]() {encode(); decode(encoded);}},
+        };
+        for(const auto& kind: kinds)
+        {
+            const std::string name = shape.name + "/" + kind.first;
+            if(name.find(opts.filter) == std::string::npos)
+            {
+                continue;
+            }
+            results.push_back(run(opts, name, document.size(), object_count, kind.second));
+            report(results.back());
+        }
+        run_decode_chunked(opts, shape.name, document, object_count, results);
+        run_encode_chunked(opts, shape, document.size(), object_count, results);
+    }
+    run_corpus(opts, results);
+    return results;
+}
+
+// Each benchmark is written on its own line so that baselines are easy to diff and parse.
+static std::string to_json(const std::vector<result>& results)
+{
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"library_version\": \"" << cbe_version() << "\",\n";
+    out << "  \"benchmarks\": [\n";
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const result& r = results[i];
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "    {\"name\": \"%s\", \"iterations\": %lld, \"bytes_per_iteration\": %lld, "
+                 "\"objects_per_iteration\": %lld, \"mb_per_s\": %.3f, \"objects_per_s\": %.1f, "
+                 "\"latency_ns_p50\": %lld, \"latency_ns_p99\": %lld, \"resumes_per_iteration\": %lld}%s\n",
+                 r.name.c_str(), (long long)r.iterations, (long long)r.bytes_per_iteration,
+                 (long long)r.objects_per_iteration, r.mb_per_s, r.objects_per_s,
+                 (long long)r.latency_ns_p50, (long long)r.latency_ns_p99, (long long)r.resumes_per_iteration,
+                 i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n";
+    out << "}\n";
+    return out.str();
+}
+
+static std::map<std::string, double> load_baseline(const std::string& path)
+{
+    std::ifstream in(path);
+    if(!in)
+    {
+        fprintf(stderr, "Could not open baseline %s\n", path.c_str());
+        exit(2);
+    }
+    const std::regex pattern("\"name\": \"([^\"]+)\".*\"mb_per_s\": ([-+0-9.eE]+)");
+    std::map<std::string, double> baseline;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        std::smatch match;
+        if(std::regex_search(line, match, pattern))
+        {
+            baseline[match[1]] = atof(match[2].str().c_str());
+        }
+    }
+    return baseline;
+}
+
+// Returns the number of benchmarks that regressed by more than the threshold.
+static int compare(const options& opts, const std::vector<result>& results)
+{
+    const std::map<std::string, double> baseline = load_baseline(opts.baseline_path);
+    int regression_count = 0;
+    fprintf(stderr, "\nComparison against %s (threshold %.1f%%):\n", opts.baseline_path.c_str(), opts.threshold_percent);
+    for(const result& r: results)
+    {
+        auto found = baseline.find(r.name);
+        if(found == baseline.end() || found->second <= 0)
+        {
+            fprintf(stderr, "%-40s %10.1f MB/s  (no baseline)\n", r.name.c_str(), r.mb_per_s);
+            continue;
+        }
+        const double change_percent = (r.mb_per_s - found->second) / found->second * 100;
+        const bool is_regression = change_percent < -opts.threshold_percent;
+        regression_count += is_regression;
+        fprintf(stderr, "%-40s %10.1f -> %10.1f MB/s  %+7.1f%%%s\n",
+                r.name.c_str(), found->second, r.mb_per_s, change_percent, is_regression ? "  REGRESSION" : "");
+    }
+    return regression_count;
+}
+
+static std::vector<int64_t> parse_chunk_sizes(const char* list)
+{
+    std::vector<int64_t> sizes;
+    std::stringstream in(list);
+    std::string item;
+    while(std::getline(in, item, ','))
+    {
+        const int64_t size = atoll(item.c_str());
+        if(size < 1)
+        {
+            fprintf(stderr, "Invalid chunk size: %s\n", item.c_str());
+            exit(2);
+        }
+        sizes.push_back(size);
+    }
+    std::sort(sizes.begin(), sizes.end());
+    return sizes;
+}
+
+static void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --output <file>      Write results as JSON to file (default: stdout)\n"
+            "  --compare <file>     Compare against a baseline JSON file, exiting with 1 on regression\n"
+            "  --threshold <pct>    Throughput drop that counts as a regression (default: 10)\n"
+            "  --min-time <sec>     Minimum run time per benchmark (default: 0.5)\n"
+            "  --filter <text>      Only run benchmarks whose name contains text\n"
+            "  --corpus <file>      Also benchmark decoding a CBE file (may be repeated)\n"
+            "  --chunk-sizes <list> Comma-separated feed/buffer sizes for the chunked sweeps\n"
+            "                       (default: 1,16,64,256,1500,4096,65536,1048576)\n",
+            program);
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if(i + 1 >= argc)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if(arg == "--output") opts.output_path = value;
+        else if(arg == "--compare") opts.baseline_path = value;
+        else if(arg == "--threshold") opts.threshold_percent = atof(value);
+        else if(arg == "--min-time") opts.min_seconds = atof(value);
+        else if(arg == "--filter") opts.filter = value;
+        else if(arg == "--corpus") opts.corpus_paths.push_back(value);
+        else if(arg == "--chunk-sizes") opts.chunk_sizes = parse_chunk_sizes(value);
+        else
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    const std::vector<result> results = run_all(opts);
+    const std::string json = to_json(results);
+    if(opts.output_path.empty())
+    {
+        fputs(json.c_str(), stdout);
+    }
+    else
+    {
+        std::ofstream(opts.output_path) << json;
+    }
+
+    if(!opts.baseline_path.empty() && compare(opts, results) > 0)
+    {
+        return 1;
+    }
+    return 0;
+}
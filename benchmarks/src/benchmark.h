@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cbe/cbe.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace benchmark
+{
+
+/**
+ * Drives an encode process through a fixed-size window. Whenever the encoder
+ * runs out of room, the window contents are handed to the sink and the window
+ * is reused, so a document of any size can be produced through a small buffer.
+ *
+ * Scalars are never split, so the window must be at least as large as the
+ * largest scalar in the document.
+ */
+class writer
+{
+public:
+    typedef std::function<void(const uint8_t* data, int64_t byte_count)> sink;
+
+    writer(cbe_encode_process* process, int64_t window_size, sink on_flush);
+
+    void begin();
+    void end();
+
+    void add_nil();
+    void add_boolean(bool value);
+    void add_integer(int sign, uint64_t value);
+    void add_integer_128(int sign, uint128_ct value);
+    void add_float(double value, int significant_digits);
+    void add_float_shortest(double value);
+    void add_date(int year, int month, int day);
+    void add_time_tz(int hour, int minute, int second, int nanosecond, const char* timezone);
+    void add_timestamp_tz(int year, int month, int day, int hour, int minute, int second, int nanosecond, const char* timezone);
+    void add_timestamp_loc(int year, int month, int day, int hour, int minute, int second, int nanosecond,
+                           int latitude, int longitude);
+    void add_string(const char* value, int64_t byte_count);
+    void add_template(const cbe_template* encode_template, const cbe_slot_value* values);
+    void list_begin();
+    void unordered_map_begin();
+    void container_end();
+
+    // Total bytes produced, including those still in the window.
+    int64_t get_byte_count() const;
+
+    // Number of times the window filled up and had to be flushed.
+    int64_t get_flush_count() const;
+
+private:
+    template<typename F> void retry(F encode_function);
+    void flush();
+
+    cbe_encode_process* process;
+    std::vector<uint8_t> window;
+    sink on_flush;
+    int64_t flushed_byte_count;
+    int64_t flush_count;
+};
+
+/**
+ * A document shape to benchmark. The encode function writes one complete
+ * document to the writer and returns the number of objects it encoded.
+ */
+struct shape
+{
+    std::string name;
+    std::function<int64_t(writer&)> encode;
+};
+
+/**
+ * Get all registered benchmark shapes.
+ */
+std::vector<shape>& get_shapes();
+
+/**
+ * Registers a shape at static initialization time.
+ */
+struct shape_registration
+{
+    shape_registration(const std::string& name, std::function<int64_t(writer&)> encode)
+    {
+        get_shapes().push_back({name, encode});
+    }
+};
+
+#define REGISTER_SHAPE(NAME, FUNCTION) \
+    static benchmark::shape_registration g_register_ ## NAME(#NAME, FUNCTION)
+
+/**
+ * Encode a shape into a newly allocated document.
+ */
+std::vector<uint8_t> encode_document(const shape& shape, int64_t* object_count);
+
+/**
+ * Number of objects seen by the null callbacks.
+ */
+extern int64_t g_decoded_object_count;
+
+/**
+ * Callbacks that accept every object, for benchmarking the decoder itself.
+ * Each decoded object increments g_decoded_object_count.
+ */
+const cbe_decode_callbacks* get_null_callbacks();
+
+} // namespace benchmark
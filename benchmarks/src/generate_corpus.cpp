@@ -0,0 +1,424 @@
+// Generates reproducible, production-shaped CBE documents for throughput
+// benchmarks. The output is a single top-level list of records, written in
+// chunks through the public encoder API so that arbitrarily large files can
+// be produced in constant memory.
+
+#include <cbe/cbe.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct options
+{
+    std::string output_path;
+    int64_t target_size = 100 * 1000 * 1000;
+    uint64_t seed = 1;
+    int key_count = 64;
+    int max_depth = 4;
+    int fields_per_record = 12;
+    int mean_string_length = 24;
+    double utf8_ratio = 0.2;
+    double small_int_ratio = 0.5;
+    double int64_ratio = 0.1;
+    double temporal_ratio = 0.1;
+    double nesting_ratio = 0.1;
+    double comment_ratio = 0.01;
+    double padding_ratio = 0.01;
+};
+
+// xorshift64*: fast, and identical output on every platform for a given seed.
+class random_source
+{
+public:
+    explicit random_source(uint64_t seed): state_(seed == 0 ? 0x9e3779b97f4a7c15ULL : seed) {}
+
+    uint64_t next()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 0x2545f4914f6cdd1dULL;
+    }
+
+    // Uniform in [0, limit)
+    uint64_t below(uint64_t limit) {return next() % limit;}
+
+    // Uniform in [0, 1)
+    double unit() {return (next() >> 11) * (1.0 / 9007199254740992.0);}
+
+    bool chance(double probability) {return unit() < probability;}
+
+private:
+    uint64_t state_;
+};
+
+static const int g_string_pool_size = 4096;
+static const int g_chunk_size = 4 * 1024 * 1024;
+
+class generator
+{
+public:
+    generator(const options& opts, FILE* file)
+    : opts_(opts)
+    , file_(file)
+    , random_(opts.seed)
+    , buffer_(g_chunk_size)
+    , process_backing_store_(cbe_encode_process_size(opts.max_depth + 2))
+    , process_((cbe_encode_process*)process_backing_store_.data())
+    {
+        build_keys();
+        build_strings();
+        cbe_encode_begin(process_, buffer_.data(), buffer_.size(), opts.max_depth + 2);
+    }
+
+    void generate()
+    {
+        check(cbe_encode_list_begin(process_));
+        while(bytes_written_ + cbe_encode_get_buffer_offset(process_) < opts_.target_size)
+        {
+            reserve();
+            if(random_.chance(opts_.comment_ratio))
+            {
+                const std::string comment = "record " + std::to_string(record_count_);
+                check(cbe_encode_add_comment(process_, comment.data(), comment.size()));
+            }
+            add_map(1);
+        }
+        check(cbe_encode_container_end(process_));
+        check(cbe_encode_end(process_));
+        flush();
+    }
+
+    int64_t get_record_count() const {return record_count_;}
+
+private:
+    void check(cbe_encode_status status)
+    {
+        if(status != CBE_ENCODE_STATUS_OK)
+        {
+            fprintf(stderr, "Encoder failed with status %d\n", status);
+            exit(1);
+        }
+    }
+
+    void flush()
+    {
+        const int64_t offset = cbe_encode_get_buffer_offset(process_);
+        if(fwrite(buffer_.data(), 1, offset, file_) != (size_t)offset)
+        {
+            perror("Could not write output");
+            exit(1);
+        }
+        bytes_written_ += offset;
+        cbe_encode_set_buffer(process_, buffer_.data(), buffer_.size());
+    }
+
+    // Flush before the chunk could overflow so that no add call ever stops
+    // part way through an object. The container state lives in the process,
+    // so flushing in the middle of a record is fine.
+    void reserve()
+    {
+        if(buffer_.size() - cbe_encode_get_buffer_offset(process_) < (size_t)max_object_size_)
+        {
+            flush();
+        }
+    }
+
+    void build_keys()
+    {
+        static const char* const words[] =
+        {
+            "id", "name", "type", "value", "status", "created", "updated", "owner",
+            "count", "total", "price", "label", "region", "source", "target", "score",
+        };
+        const int word_count = sizeof(words) / sizeof(*words);
+        for(int i = 0; i < opts_.key_count; i++)
+        {
+            std::string key = words[i % word_count];
+            if(i >= word_count)
+            {
+                key += "_" + std::to_string(i / word_count);
+            }
+            keys_.push_back(key);
+        }
+    }
+
+    void build_strings()
+    {
+        static const char* const ascii = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789 ";
+        static const char* const multibyte[] = {"é", "ß", "ø", "ü", "Ж", "λ", "日", "本", "語", "ー", "한", "😀"};
+        const int ascii_length = strlen(ascii);
+        const int multibyte_count = sizeof(multibyte) / sizeof(*multibyte);
+        int longest = 0;
+
+        for(int i = 0; i < g_string_pool_size; i++)
+        {
+            // Exponentially distributed lengths, capped to keep the tail sane.
+            int length = (int)(-std::log(1.0 - random_.unit()) * opts_.mean_string_length);
+            length = std::min(length, opts_.mean_string_length * 8);
+            const bool is_utf8 = random_.chance(opts_.utf8_ratio);
+            std::string string;
+            while((int)string.size() < length)
+            {
+                if(is_utf8 && random_.chance(0.3))
+                {
+                    string += multibyte[random_.below(multibyte_count)];
+                }
+                else
+                {
+                    string += ascii[random_.below(ascii_length)];
+                }
+            }
+            longest = std::max(longest, (int)string.size());
+            strings_.push_back(string);
+        }
+
+        // Room for the largest single object plus a key, comment, or padding.
+        max_object_size_ = longest * 2 + 1024;
+    }
+
+    void add_integer()
+    {
+        const int sign = random_.chance(0.25) ? -1 : 1;
+        const double roll = random_.unit();
+        uint64_t value;
+        if(roll < opts_.small_int_ratio)
+        {
+            value = random_.below(101);
+        }
+        else if(roll < opts_.small_int_ratio + opts_.int64_ratio)
+        {
+            value = (random_.next() >> 1) | (1ULL << 32);
+        }
+        else
+        {
+            static const int widths[] = {8, 16, 32};
+            value = random_.next() >> (64 - widths[random_.below(3)]);
+        }
+        check(cbe_encode_add_integer(process_, sign, value));
+    }
+
+    void add_temporal()
+    {
+        const int year = 1970 + random_.below(80);
+        const int month = 1 + random_.below(12);
+        const int day = 1 + random_.below(28);
+        const int hour = random_.below(24);
+        const int minute = random_.below(60);
+        const int second = random_.below(60);
+        const int nanosecond = random_.below(1000000000);
+        switch(random_.below(4))
+        {
+            case 0:
+                check(cbe_encode_add_date(process_, year, month, day));
+                break;
+            case 1:
+                check(cbe_encode_add_time_tz(process_, hour, minute, second, nanosecond, "Europe/Berlin"));
+                break;
+            case 2:
+                check(cbe_encode_add_timestamp_tz(process_, year, month, day, hour, minute, second, nanosecond, NULL));
+                break;
+            case 3:
+                check(cbe_encode_add_timestamp_loc(process_, year, month, day, hour, minute, second, nanosecond,
+                                                   (int)random_.below(18000) - 9000, (int)random_.below(36000) - 18000));
+                break;
+        }
+    }
+
+    void add_string()
+    {
+        const std::string& string = strings_[random_.below(g_string_pool_size)];
+        check(cbe_encode_add_string(process_, string.data(), string.size()));
+    }
+
+    void add_value(int depth)
+    {
+        reserve();
+        if(depth < opts_.max_depth && random_.chance(opts_.nesting_ratio))
+        {
+            if(random_.chance(0.6))
+            {
+                add_map(depth + 1);
+            }
+            else
+            {
+                add_list(depth + 1);
+            }
+            return;
+        }
+
+        if(random_.chance(opts_.temporal_ratio))
+        {
+            add_temporal();
+            return;
+        }
+
+        const uint64_t roll = random_.below(100);
+        if(roll < 40)
+        {
+            add_integer();
+        }
+        else if(roll < 75)
+        {
+            add_string();
+        }
+        else if(roll < 90)
+        {
+            check(cbe_encode_add_float(process_, (random_.unit() - 0.5) * 1e6, 0));
+        }
+        else if(roll < 96)
+        {
+            check(cbe_encode_add_boolean(process_, random_.next() & 1));
+        }
+        else if(roll < 98)
+        {
+            check(cbe_encode_add_nil(process_));
+        }
+        else
+        {
+            const std::string& string = strings_[random_.below(g_string_pool_size)];
+            check(cbe_encode_add_bytes(process_, (const uint8_t*)string.data(), string.size()));
+        }
+    }
+
+    void maybe_add_padding()
+    {
+        if(random_.chance(opts_.padding_ratio))
+        {
+            check(cbe_encode_add_padding(process_, 1 + random_.below(7)));
+        }
+    }
+
+    void add_map(int depth)
+    {
+        if(depth == 1)
+        {
+            record_count_++;
+        }
+        check(cbe_encode_unordered_map_begin(process_));
+        const int field_count = std::min(opts_.fields_per_record, opts_.key_count);
+        // Consecutive keys from a random starting point are always distinct.
+        const uint64_t start = random_.below(opts_.key_count);
+        for(int i = 0; i < field_count; i++)
+        {
+            const std::string& key = keys_[(start + i) % opts_.key_count];
+            reserve();
+            maybe_add_padding();
+            check(cbe_encode_add_string(process_, key.data(), key.size()));
+            add_value(depth);
+        }
+        check(cbe_encode_container_end(process_));
+    }
+
+    void add_list(int depth)
+    {
+        check(cbe_encode_list_begin(process_));
+        const int entry_count = random_.below(opts_.fields_per_record + 1);
+        for(int i = 0; i < entry_count; i++)
+        {
+            maybe_add_padding();
+            add_value(depth);
+        }
+        check(cbe_encode_container_end(process_));
+    }
+
+    const options& opts_;
+    FILE* file_;
+    random_source random_;
+    std::vector<uint8_t> buffer_;
+    std::vector<char> process_backing_store_;
+    cbe_encode_process* process_;
+    std::vector<std::string> keys_;
+    std::vector<std::string> strings_;
+    int64_t max_object_size_ = 0;
+    int64_t bytes_written_ = 0;
+    int64_t record_count_ = 0;
+};
+
+static int64_t parse_size(const char* value)
+{
+    char* end = NULL;
+    double size = strtod(value, &end);
+    switch(*end)
+    {
+        case 'k': case 'K': size *= 1e3; break;
+        case 'm': case 'M': size *= 1e6; break;
+        case 'g': case 'G': size *= 1e9; break;
+    }
+    return (int64_t)size;
+}
+
+static void print_usage(const char* program)
+{
+    fprintf(stderr,
+            "Usage: %s --output <file> [options]\n"
+            "  --size <bytes>           Approximate output size, with optional K/M/G suffix (default: 100M)\n"
+            "  --seed <n>               Random seed; the same seed and options give the same file (default: 1)\n"
+            "  --keys <n>               Number of distinct map keys (default: 64)\n"
+            "  --depth <n>              Maximum record nesting depth (default: 4)\n"
+            "  --fields <n>             Fields per map (default: 12)\n"
+            "  --string-length <n>      Mean string length in characters (default: 24)\n"
+            "  --utf8-ratio <0-1>       Fraction of strings containing multibyte characters (default: 0.2)\n"
+            "  --small-int-ratio <0-1>  Fraction of integers in the small int range (default: 0.5)\n"
+            "  --int64-ratio <0-1>      Fraction of integers needing 64-bit encoding (default: 0.1)\n"
+            "  --temporal-ratio <0-1>   Fraction of values that are dates, times, or timestamps (default: 0.1)\n"
+            "  --nesting-ratio <0-1>    Fraction of values that are nested containers (default: 0.1)\n"
+            "  --comment-ratio <0-1>    Fraction of records preceded by a comment (default: 0.01)\n"
+            "  --padding-ratio <0-1>    Fraction of entries preceded by padding (default: 0.01)\n",
+            program);
+}
+
+int main(int argc, char* argv[])
+{
+    options opts;
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if(i + 1 >= argc)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        const char* value = argv[++i];
+        if(arg == "--output") opts.output_path = value;
+        else if(arg == "--size") opts.target_size = parse_size(value);
+        else if(arg == "--seed") opts.seed = strtoull(value, NULL, 0);
+        else if(arg == "--keys") opts.key_count = atoi(value);
+        else if(arg == "--depth") opts.max_depth = atoi(value);
+        else if(arg == "--fields") opts.fields_per_record = atoi(value);
+        else if(arg == "--string-length") opts.mean_string_length = atoi(value);
+        else if(arg == "--utf8-ratio") opts.utf8_ratio = atof(value);
+        else if(arg == "--small-int-ratio") opts.small_int_ratio = atof(value);
+        else if(arg == "--int64-ratio") opts.int64_ratio = atof(value);
+        else if(arg == "--temporal-ratio") opts.temporal_ratio = atof(value);
+        else if(arg == "--nesting-ratio") opts.nesting_ratio = atof(value);
+        else if(arg == "--comment-ratio") opts.comment_ratio = atof(value);
+        else if(arg == "--padding-ratio") opts.padding_ratio = atof(value);
+        else
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    if(opts.output_path.empty() || opts.key_count < 1 || opts.max_depth < 1 || opts.fields_per_record < 1)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    FILE* file = fopen(opts.output_path.c_str(), "wb");
+    if(file == NULL)
+    {
+        perror(opts.output_path.c_str());
+        return 1;
+    }
+    generator gen(opts, file);
+    gen.generate();
+    fclose(file);
+    fprintf(stderr, "Wrote %lld records to %s\n", (long long)gen.get_record_count(), opts.output_path.c_str());
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include "benchmark.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using benchmark::writer;
+
+// Realistic document shapes. Each encode function returns the number of
+// objects (scalars, containers, and container ends) it wrote.
+
+static int64_t add_key(writer& w, const char* key)
+{
+    w.add_string(key, strlen(key));
+    return 1;
+}
+
+static int64_t encode_flat_map(writer& w)
+{
+    static const char* const keys[] =
+    {
+        "id", "name", "score", "is_active", "balance",
+        "parent_id", "city", "latitude", "is_verified", "credit_limit",
+        "account_number", "country", "longitude", "has_newsletter", "loyalty_points",
+        "region_code", "street", "altitude", "is_deleted", "overdraft",
+    };
+    const char* const name = "Ingrid Sørensen";
+    int64_t count = 0;
+    w.unordered_map_begin(); count++;
+    for(int i = 0; i < (int)(sizeof(keys) / sizeof(*keys)); i++)
+    {
+        count += add_key(w, keys[i]);
+        switch(i % 5)
+        {
+            case 0: w.add_integer(1, 1000000 + i); break;
+            case 1: w.add_string(name, strlen(name)); break;
+            case 2: w.add_float(0.1 * i + 95.25, 0); break;
+            case 3: w.add_boolean(i & 1); break;
+            case 4: w.add_integer(-1, 5000 + i); break;
+        }
+        count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+static int64_t encode_deep_nesting(writer& w)
+{
+    const int depth = 100;
+    int64_t count = 0;
+    for(int i = 0; i < depth; i++)
+    {
+        if(i & 1)
+        {
+            w.unordered_map_begin(); count++;
+            count += add_key(w, "child");
+        }
+        else
+        {
+            w.list_begin(); count++;
+            w.add_integer(1, i); count++;
+        }
+    }
+    w.add_nil(); count++;
+    for(int i = 0; i < depth; i++)
+    {
+        w.container_end(); count++;
+    }
+    return count;
+}
+
+static int64_t encode_long_strings(writer& w)
+{
+    static const std::string text = []()
+    {
+        std::string result;
+        while(result.size() < 4096)
+        {
+            result += "The quick brown fox jumps over the lazy dog. Größenwahn – 日本語テキスト. ";
+        }
+        return result;
+    }();
+    int64_t count = 0;
+    w.list_begin(); count++;
+    for(int i = 0; i < 8; i++)
+    {
+        w.add_string(text.data(), text.size()); count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+static int64_t encode_numeric_list(writer& w)
+{
+    int64_t count = 0;
+    w.list_begin(); count++;
+    uint64_t value = 1;
+    for(int i = 0; i < 1000; i++)
+    {
+        w.add_integer((i & 1) ? -1 : 1, value); count++;
+        value = value * 3 + 7;
+        if(value > 0xffffffffffffULL)
+        {
+            value = 1;
+        }
+    }
+    for(int i = 0; i < 1000; i++)
+    {
+        w.add_float(i * 0.25 - 100.0 + (i % 3) * 1.0e-7, 0); count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+static int64_t encode_temporal_records(writer& w)
+{
+    int64_t count = 0;
+    w.list_begin(); count++;
+    for(int i = 0; i < 100; i++)
+    {
+        w.unordered_map_begin(); count++;
+        count += add_key(w, "day");
+        w.add_date(2020, 1 + i % 12, 1 + i % 28); count++;
+        count += add_key(w, "opens");
+        w.add_time_tz(8, 30, 0, 0, "Europe/Berlin"); count++;
+        count += add_key(w, "created");
+        w.add_timestamp_tz(2020, 8, 30, 15, 33, 14, 19577323 + i, NULL); count++;
+        count += add_key(w, "observed");
+        w.add_timestamp_loc(1985, 10, 26, 1, 22, 16, 0, 3399, -11793); count++;
+        w.container_end(); count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+// API responses that differ only in a few values, written either object by
+// object or from a template with slots for those values. Each response is kept
+// small enough for the smallest encode window, since a template is never split.
+struct api_response
+{
+    int64_t id;
+    double score;
+    bool is_cached;
+    const char* name;
+};
+
+static api_response get_api_response(int index)
+{
+    static const char* const names[] = {"Ingrid Sørensen", "Bo", "Max Oberhauser"};
+    return {1000000 + index * 7919, index * 0.25, (index & 1) != 0, names[index % 3]};
+}
+
+static const int api_response_count = 500;
+
+// Objects in one response, counting both keys and values.
+static const int api_response_object_count = 13;
+
+static int64_t encode_api_responses(writer& w)
+{
+    int64_t count = 0;
+    w.list_begin(); count++;
+    for(int i = 0; i < api_response_count; i++)
+    {
+        const api_response response = get_api_response(i);
+        w.unordered_map_begin(); count++;
+        count += add_key(w, "id");
+        w.add_integer(1, (uint64_t)response.id); count++;
+        count += add_key(w, "result");
+        w.unordered_map_begin(); count++;
+        count += add_key(w, "score");
+        w.add_float(response.score, 0); count++;
+        count += add_key(w, "cached");
+        w.add_boolean(response.is_cached); count++;
+        count += add_key(w, "name");
+        w.add_string(response.name, strlen(response.name)); count++;
+        w.container_end(); count++;
+        w.container_end(); count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+static const cbe_template* get_api_response_template()
+{
+    static std::vector<uint64_t> template_backing_store(cbe_template_size(4) / sizeof(uint64_t) + 1);
+    static std::vector<uint8_t> skeleton(1000);
+    static const cbe_template* const encode_template = []()
+    {
+        cbe_template* const result = (cbe_template*)template_backing_store.data();
+        std::vector<char> process_backing_store(cbe_encode_process_size(0));
+        cbe_encode_process* const process = (cbe_encode_process*)process_backing_store.data();
+        const auto add_string = [&](const char* value) {cbe_encode_add_string(process, value, strlen(value));};
+
+        cbe_template_begin(result, 4);
+        cbe_encode_begin(process, skeleton.data(), skeleton.size(), 0);
+        cbe_encode_unordered_map_begin(process);
+        add_string("id");
+        cbe_encode_add_slot(process, result, "id", CBE_SLOT_TYPE_INTEGER);
+        add_string("result");
+        cbe_encode_unordered_map_begin(process);
+        add_string("score");
+        cbe_encode_add_slot(process, result, "score", CBE_SLOT_TYPE_FLOAT);
+        add_string("cached");
+        cbe_encode_add_slot(process, result, "cached", CBE_SLOT_TYPE_BOOLEAN);
+        add_string("name");
+        cbe_encode_add_slot(process, result, "name", CBE_SLOT_TYPE_STRING);
+        cbe_encode_container_end(process);
+        cbe_encode_container_end(process);
+        if(cbe_encode_end_template(process, result) != CBE_ENCODE_STATUS_OK)
+        {
+            fprintf(stderr, "failed to build the API response template\n");
+            exit(1);
+        }
+        return result;
+    }();
+    return encode_template;
+}
+
+static int64_t encode_api_responses_template(writer& w)
+{
+    const cbe_template* const encode_template = get_api_response_template();
+    int64_t count = 0;
+    w.list_begin(); count++;
+    for(int i = 0; i < api_response_count; i++)
+    {
+        const api_response response = get_api_response(i);
+        cbe_slot_value values[4];
+        values[0].integer = response.id;
+        values[1].floating_point = response.score;
+        values[2].boolean = response.is_cached;
+        values[3].string.start = response.name;
+        values[3].string.byte_count = strlen(response.name);
+        w.add_template(encode_template, values);
+        count += api_response_object_count;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+// Trade ticks as they arrive from a price feed: a price with 2 decimal places,
+// a rate with 4, a quantity, and a percentage change, all parsed from decimal
+// text.
+static int64_t encode_financial_ticks(writer& w, bool is_shortest)
+{
+    int64_t count = 0;
+    w.list_begin(); count++;
+    uint64_t seed = 12345;
+    for(int i = 0; i < 500; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const int cents = (int)((seed >> 33) % 100000);
+        const double values[] =
+        {
+            cents / 100.0,
+            (cents * 7 % 1000000) / 10000.0,
+            (double)(1 + cents % 500),
+            ((int)(seed >> 40) % 2000 - 1000) / 100.0,
+        };
+        w.list_begin(); count++;
+        for(double value: values)
+        {
+            if(is_shortest)
+            {
+                w.add_float_shortest(value);
+            }
+            else
+            {
+                w.add_float(value, 0);
+            }
+            count++;
+        }
+        w.container_end(); count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+// Ledger entries whose amounts (in the smallest unit of a currency or token)
+// need more than 64 bits, either as 128-bit integers or as decimal text.
+static int64_t encode_ledger_amounts(writer& w, bool is_text)
+{
+    int64_t count = 0;
+    w.list_begin(); count++;
+    uint64_t seed = 12345;
+    for(int i = 0; i < 1000; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const uint128_ct amount = (uint128_ct)(seed >> 40) << 64 | (seed * 0x9e3779b97f4a7c15ULL);
+        const int sign = (seed >> 63) ? -1 : 1;
+        if(is_text)
+        {
+            char text[41];
+            char* position = text + sizeof(text);
+            uint128_ct remaining = amount;
+            do
+            {
+                *--position = (char)('0' + (int)(remaining % 10));
+                remaining /= 10;
+            } while(remaining != 0);
+            if(sign < 0)
+            {
+                *--position = '-';
+            }
+            w.add_string(position, text + sizeof(text) - position);
+        }
+        else
+        {
+            w.add_integer_128(sign, amount);
+        }
+        count++;
+    }
+    w.container_end(); count++;
+    return count;
+}
+
+REGISTER_SHAPE(flat_map, encode_flat_map);
+REGISTER_SHAPE(deep_nesting, encode_deep_nesting);
+REGISTER_SHAPE(long_strings, encode_long_strings);
+REGISTER_SHAPE(numeric_list, encode_numeric_list);
+REGISTER_SHAPE(temporal_records, encode_temporal_records);
+REGISTER_SHAPE(api_responses, encode_api_responses);
+REGISTER_SHAPE(api_responses_template, encode_api_responses_template);
+REGISTER_SHAPE(financial_ticks_binary, [](writer& w) {return encode_financial_ticks(w, false);});
+REGISTER_SHAPE(financial_ticks_shortest, [](writer& w) {return encode_financial_ticks(w, true);});
+REGISTER_SHAPE(ledger_amounts_text, [](writer& w) {return encode_ledger_amounts(w, true);});
+REGISTER_SHAPE(ledger_amounts_integer_128, [](writer& w) {return encode_ledger_amounts(w, false);});
@@ -36,6 +36,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <smalltime/smalltime.h>
 #include <smalltime/nanotime.h>
@@ -62,6 +63,247 @@ extern "C" {
  */
 CBE_PUBLIC const char* cbe_version();
 
+/**
+ * Convert a decimal value in parts (as delivered by on_decimal_parts()) to the
+ * nearest double, without decimal arithmetic.
+ *
+ * This only succeeds when the result can be computed with a single correctly
+ * rounded multiply or divide, which covers significands of up to 15 digits
+ * with exponents within +-22 (a bit wider for shorter significands). When it
+ * returns false, fall back to a full conversion such as strtod() on
+ * "<significand>e<exponent>".
+ *
+ * @param sign The sign of the value (1 or -1).
+ * @param significand The significand.
+ * @param exponent The base-10 exponent.
+ * @param result Where to store the converted value.
+ * @return True if the value was converted.
+ */
+CBE_PUBLIC bool cbe_decimal_parts_to_double(int sign, uint64_t significand, int exponent, double* result);
+
+
+
+// ----------------
+// String Table API
+// ----------------
+
+/**
+ * A string intern table. Strings are registered once and then referred to by
+ * a small integer ID (assigned in registration order, starting at 0).
+ * Registered strings are copied into the table and NUL terminated, so the
+ * pointers returned by cbe_string_table_get() remain valid for the life of
+ * the table.
+ */
+struct cbe_string_table;
+
+/**
+ * Get the size of a string table's data.
+ * Use this to create a backing store for the table in the same manner as for
+ * the encode and decode processes.
+ *
+ * @param max_entries The maximum number of strings the table can hold.
+ * @param max_total_bytes The maximum combined length of all strings (not including NUL terminators).
+ * @return The table data size, or 0 if the arguments are invalid.
+ */
+CBE_PUBLIC int64_t cbe_string_table_size(int max_entries, int64_t max_total_bytes);
+
+/**
+ * Initialize an empty string table.
+ *
+ * @param table The table to initialize.
+ * @param max_entries The maximum number of strings (must match the value passed to cbe_string_table_size()).
+ * @param max_total_bytes The maximum combined length (must match the value passed to cbe_string_table_size()).
+ * @return true if the table was initialized.
+ */
+CBE_PUBLIC bool cbe_string_table_begin(struct cbe_string_table* table, int max_entries, int64_t max_total_bytes);
+
+/**
+ * Register a string. Registering a string that is already present returns its
+ * existing ID.
+ *
+ * @param table The table.
+ * @param string_start The start of the string.
+ * @param byte_count The length of the string in bytes.
+ * @return The string's ID, or -1 if the table is full.
+ */
+CBE_PUBLIC int cbe_string_table_add(struct cbe_string_table* table, const char* string_start, int64_t byte_count);
+
+/**
+ * Look up the ID of a registered string.
+ *
+ * @param table The table.
+ * @param string_start The start of the string.
+ * @param byte_count The length of the string in bytes.
+ * @return The string's ID, or -1 if it is not registered.
+ */
+CBE_PUBLIC int cbe_string_table_find(const struct cbe_string_table* table, const char* string_start, int64_t byte_count);
+
+/**
+ * Get a registered string by ID.
+ *
+ * @param table The table.
+ * @param id The string's ID.
+ * @param byte_count Out: The length of the string in bytes (may be NULL).
+ * @return A stable pointer to the NUL terminated string, or NULL if the ID is invalid.
+ */
+CBE_PUBLIC const char* cbe_string_table_get(const struct cbe_string_table* table, int id, int64_t* byte_count);
+
+/**
+ * Get the number of strings registered in a table.
+ *
+ * @param table The table.
+ * @return The number of strings.
+ */
+CBE_PUBLIC int cbe_string_table_get_entry_count(const struct cbe_string_table* table);
+
+
+
+// -------------
+// Page Pool API
+// -------------
+
+/**
+ * A pool of fixed-size pages for an encode process to write into (see
+ * cbe_encode_begin_paged()). The pages are stored inside the pool's own
+ * backing store, and are reused after each flush.
+ *
+ * The pool also records references to large payloads in caller memory (see
+ * cbe_encode_set_reference_threshold()), which are output in place rather
+ * than copied into a page.
+ */
+struct cbe_page_pool;
+
+/**
+ * Get the size of a page pool's data, including the pages themselves.
+ * Use this to create a backing store for the pool in the same manner as for
+ * the encode and decode processes.
+ *
+ * @param page_count The number of pages in the pool.
+ * @param page_size The size of each page in bytes.
+ * @param max_references The maximum number of payload references between flushes.
+ * @return The pool data size, or 0 if the arguments are invalid.
+ */
+CBE_PUBLIC int64_t cbe_page_pool_size(int page_count, int64_t page_size, int max_references);
+
+/**
+ * Initialize a page pool.
+ *
+ * @param pool The pool to initialize.
+ * @param page_count The number of pages (must match the value passed to cbe_page_pool_size()).
+ * @param page_size The size of each page (must match the value passed to cbe_page_pool_size()).
+ * @param max_references The maximum number of references (must match the value passed to cbe_page_pool_size()).
+ * @return true if the pool was initialized.
+ */
+CBE_PUBLIC bool cbe_page_pool_begin(struct cbe_page_pool* pool, int page_count, int64_t page_size, int max_references);
+
+
+
+// ------------
+// Template API
+// ------------
+
+/**
+ * A pre-encoded document skeleton, with slots for the values that change from
+ * one document to the next. Build one with cbe_encode_add_slot() and
+ * cbe_encode_end_template(), then add it to documents with
+ * cbe_encode_add_template().
+ */
+struct cbe_template;
+
+/**
+ * The kind of value that goes in a template slot.
+ */
+typedef enum
+{
+    CBE_SLOT_TYPE_INTEGER,
+    CBE_SLOT_TYPE_FLOAT,
+    CBE_SLOT_TYPE_BOOLEAN,
+    CBE_SLOT_TYPE_STRING,
+} cbe_slot_type;
+
+/**
+ * A value to put in a template slot. Set the member matching the slot's type.
+ */
+typedef union
+{
+    int64_t integer;
+    double floating_point;
+    bool boolean;
+    struct
+    {
+        const char* start;
+        int64_t byte_count;
+    } string;
+} cbe_slot_value;
+
+/**
+ * Get the size of a template's data.
+ * Use this to create a backing store for the template in the same manner as
+ * for the encode and decode processes.
+ *
+ * @param max_slot_count The maximum number of slots in the template.
+ * @return The template data size, or 0 if the argument is invalid.
+ */
+CBE_PUBLIC int cbe_template_size(int max_slot_count);
+
+/**
+ * Initialize a template.
+ *
+ * @param encode_template The template to initialize.
+ * @param max_slot_count The maximum number of slots (must match the value passed to cbe_template_size()).
+ * @return true if the template was initialized.
+ */
+CBE_PUBLIC bool cbe_template_begin(struct cbe_template* encode_template, int max_slot_count);
+
+/**
+ * Get the number of slots in a template.
+ *
+ * @param encode_template The template.
+ * @return The number of slots.
+ */
+CBE_PUBLIC int cbe_template_get_slot_count(const struct cbe_template* encode_template);
+
+/**
+ * Look up a slot by name. Slots are numbered in the order they were added.
+ *
+ * @param encode_template The template.
+ * @param name The slot's name.
+ * @return The slot's index, or -1 if there is no slot by that name.
+ */
+CBE_PUBLIC int cbe_template_find_slot(const struct cbe_template* encode_template, const char* name);
+
+
+
+// ---------------
+// Typed Array API
+// ---------------
+
+/**
+ * Element types of a typed array: a run of numbers of the same type, stored
+ * as one block of little-endian elements rather than one object per number.
+ *
+ * 16-bit floats are carried as raw bits; the library never converts them.
+ */
+typedef enum
+{
+    CBE_TYPED_ARRAY_INT8     = 0,
+    CBE_TYPED_ARRAY_INT16    = 1,
+    CBE_TYPED_ARRAY_INT32    = 2,
+    CBE_TYPED_ARRAY_INT64    = 3,
+    CBE_TYPED_ARRAY_FLOAT16  = 4,
+    CBE_TYPED_ARRAY_BFLOAT16 = 5,
+    CBE_TYPED_ARRAY_FLOAT32  = 6,
+    CBE_TYPED_ARRAY_FLOAT64  = 7,
+} cbe_typed_array_type;
+
+/**
+ * Get the size of one element of a typed array.
+ *
+ * @param type The element type.
+ * @return The element size in bytes, or 0 if type isn't a valid element type.
+ */
+CBE_PUBLIC int cbe_typed_array_element_size(cbe_typed_array_type type);
+
 
 
 // ------------
@@ -138,6 +380,31 @@ typedef enum
      */
     CBE_DECODE_ERROR_INTERNAL_BUG,
 
+    /**
+     * A time or timestamp referred to a timezone that isn't in the decoder's
+     * timezone table (see cbe_decode_set_timezone_table()).
+     */
+    CBE_DECODE_ERROR_INVALID_TIMEZONE_ID,
+
+    /**
+     * A value was decoded that needs a callback that isn't set (such as a
+     * 128-bit value without its optional callback), or that is too big for
+     * any of them.
+     */
+    CBE_DECODE_ERROR_VALUE_OUT_OF_RANGE,
+
+    /**
+     * A key dictionary declaration wasn't a list of distinct strings, or
+     * didn't fit in the decoder's key dictionary table.
+     */
+    CBE_DECODE_ERROR_INVALID_KEY_DICTIONARY,
+
+    /**
+     * A key reference wasn't in a map key position, or referred to a key
+     * that hasn't been declared (see cbe_decode_set_key_dictionary()).
+     */
+    CBE_DECODE_ERROR_INVALID_KEY_REFERENCE,
+
 } cbe_decode_status;
 
 /**
@@ -244,6 +511,73 @@ typedef struct
     bool (*on_array_data) (struct cbe_decode_process* decode_process,
                              const uint8_t* start,
                              int64_t byte_count);
+
+    // A UTC timestamp was decoded (optional). If set, it is called instead of
+    // on_timestamp_tz() for timestamps with no timezone.
+    bool (*on_nanotime) (struct cbe_decode_process* decode_process, nanotime value);
+
+    // A time or timestamp encoded with a timezone ID was decoded (optional). If
+    // these are not set, such values are reported via on_time_tz() and
+    // on_timestamp_tz() instead. timezone points into the timezone table.
+    bool (*on_time_tzid) (struct cbe_decode_process* decode_process, int hour, int minute, int second, int nanosecond, int timezone_id, const char* timezone);
+    bool (*on_timestamp_tzid) (struct cbe_decode_process* decode_process, int year, int month, int day, int hour, int minute, int second, int nanosecond, int timezone_id, const char* timezone);
+
+    // A map key registered in the decoder's map key table was decoded
+    // (optional). If set, it is called instead of on_string_begin() and
+    // on_array_data() for registered keys. symbol_id is the key's ID in the table.
+    bool (*on_map_key_symbol) (struct cbe_decode_process* decode_process, int symbol_id);
+
+    // A decimal floating point value was decoded (optional). If set, it is
+    // called instead of on_decimal_float() with the value as significand *
+    // 10^exponent, read straight from the encoded form without any decimal
+    // arithmetic. Sign will be 1 or -1. Infinities and NaNs have no parts, and
+    // still go to on_decimal_float().
+    bool (*on_decimal_parts) (struct cbe_decode_process* decode_process, int sign, uint64_t significand, int exponent);
+
+    /**
+     * A typed array has been opened (optional). Expect subsequent calls to
+     * on_typed_array_data() until element_count elements have been delivered.
+     * If this is not set, a typed array fails to decode with
+     * CBE_DECODE_ERROR_INVALID_ARRAY_DATA.
+     *
+     * @param decode_process The decode process.
+     * @param type The element type.
+     * @param element_count The total number of elements in the array.
+     */
+    bool (*on_typed_array_begin) (struct cbe_decode_process* decode_process,
+                                  cbe_typed_array_type type,
+                                  int64_t element_count);
+
+    /**
+     * Typed array data was decoded. Only whole elements are delivered, and
+     * start points into the document buffer (no copy is made), so the
+     * elements are little-endian, and only aligned if the document was
+     * encoded with cbe_encode_set_alignment() and is itself aligned.
+     *
+     * @param decode_process The decode process.
+     * @param start The start of the elements.
+     * @param element_count The number of elements in this fragment.
+     */
+    bool (*on_typed_array_data) (struct cbe_decode_process* decode_process,
+                                 const uint8_t* start,
+                                 int64_t element_count);
+
+    // A 128-bit fixed width integer, or a variable width integer too big for
+    // on_integer(), was decoded (optional). Sign will be 1 or -1. If this is
+    // not set, such values fail with CBE_DECODE_ERROR_VALUE_OUT_OF_RANGE.
+    bool (*on_integer_128) (struct cbe_decode_process* decode_process, int sign, uint128_ct value);
+
+    // A 128-bit binary floating point value was decoded (optional). If this is
+    // not set, such values fail with CBE_DECODE_ERROR_VALUE_OUT_OF_RANGE.
+    bool (*on_float_128) (struct cbe_decode_process* decode_process, float128_ct value);
+
+    // A 128-bit fixed width decimal float, or a decimal float that a 64-bit
+    // decimal float can't hold exactly (more than 16 digits, or an exponent
+    // outside of -398 to 369), was decoded (optional). on_decimal_parts()
+    // takes precedence for significands that fit in 64 bits. If this is not
+    // set, fixed width values and significands wider than 64 bits fail with
+    // CBE_DECODE_ERROR_VALUE_OUT_OF_RANGE.
+    bool (*on_decimal_float_128) (struct cbe_decode_process* decode_process, dec128_ct value);
 } cbe_decode_callbacks;
 
 
@@ -339,6 +673,68 @@ CBE_PUBLIC cbe_decode_status cbe_decode_feed(struct cbe_decode_process* decode_p
  */
 CBE_PUBLIC int64_t cbe_decode_get_stream_offset(struct cbe_decode_process* decode_process);
 
+/**
+ * Set the timezone table that timezone IDs refer to (see
+ * cbe_encode_set_timezone_table()). Times and timestamps encoded with a
+ * timezone ID are reported via on_time_tzid() and on_timestamp_tzid() (if
+ * set), with a pointer into this table. Without a table, they fail with
+ * CBE_DECODE_ERROR_INVALID_TIMEZONE_ID.
+ *
+ * Timezones encoded as strings are always reported as strings.
+ *
+ * Call this after cbe_decode_begin(). The table must remain valid for the
+ * life of the decode process.
+ *
+ * @param decode_process The decode process.
+ * @param timezone_table The timezone table (NULL = none).
+ */
+CBE_PUBLIC void cbe_decode_set_timezone_table(struct cbe_decode_process* decode_process,
+                                              const struct cbe_string_table* timezone_table);
+
+/**
+ * Set the symbol table used to resolve string map keys into IDs.
+ * Map keys that are in the table are reported via on_map_key_symbol() (if
+ * set). Other map keys are reported via the normal string callbacks.
+ *
+ * A map key no longer than the longest registered key is only decoded once it
+ * is entirely in the buffer, so each buffer passed to cbe_decode_feed() must
+ * be able to hold the longest registered key plus its header.
+ *
+ * Call this after cbe_decode_begin(). The table must remain valid for the
+ * life of the decode process.
+ *
+ * @param decode_process The decode process.
+ * @param map_key_table The map key table (NULL = none).
+ */
+CBE_PUBLIC void cbe_decode_set_map_key_table(struct cbe_decode_process* decode_process,
+                                             const struct cbe_string_table* map_key_table);
+
+/**
+ * Set the table that a stream's key dictionary is decoded into (see
+ * cbe_encode_add_key_dictionary()).
+ *
+ * Declared keys are validated once and added to the table. Map keys that
+ * refer to them are reported via on_map_key_symbol() if they're in the map
+ * key table, and otherwise via on_string_begin() and on_array_data() with a
+ * pointer into this table, without being validated again. The declaration
+ * itself is reported like any other metadata map, and later declarations
+ * add more keys. Without a table, key references fail with
+ * CBE_DECODE_ERROR_INVALID_KEY_REFERENCE.
+ *
+ * A declared key is only decoded once it is entirely in the buffer, so each
+ * buffer passed to cbe_decode_feed() must be able to hold the longest
+ * declared key plus its header.
+ *
+ * Call this after cbe_decode_begin(). The table must start out empty, have
+ * room for every declared key, and remain valid for the life of the decode
+ * process.
+ *
+ * @param decode_process The decode process.
+ * @param key_dictionary The key dictionary table (NULL = none).
+ */
+CBE_PUBLIC void cbe_decode_set_key_dictionary(struct cbe_decode_process* decode_process,
+                                              struct cbe_string_table* key_dictionary);
+
 /**
  * End a decoding process, checking for document validity.
  *
@@ -354,6 +750,30 @@ CBE_PUBLIC cbe_decode_status cbe_decode_end(struct cbe_decode_process* decode_pr
 
 struct cbe_encode_process;
 
+/**
+ * A point in an encode process that it can be rolled back to.
+ * Its contents are private to the library.
+ */
+struct cbe_savepoint
+{
+    uint64_t data[20];
+};
+
+/**
+ * One or more complete, already encoded objects that can be added to other
+ * documents with cbe_encode_add_raw(). Fill it with cbe_encode_get_fragment().
+ * The data isn't copied, so the buffer it was encoded into must outlive it.
+ */
+struct cbe_fragment
+{
+    const uint8_t* data;
+    int64_t byte_count;
+    // Private to the library.
+    int container_depth;
+    bool has_odd_object_count;
+    uint8_t unkeyable_positions;
+};
+
 /**
  * Status codes that can be returned by encoder functions.
  */
@@ -416,6 +836,22 @@ typedef enum
      */
     CBE_ENCODE_ERROR_MAX_CONTAINER_DEPTH_EXCEEDED,
 
+    /**
+     * Reading from or writing to a file descriptor failed (errno is set).
+     */
+    CBE_ENCODE_ERROR_FILE_IO,
+
+    /**
+     * A map couldn't be sorted for canonical output, because the map index
+     * was too small, or the map's contents left the buffer before it ended.
+     */
+    CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT,
+
+    /**
+     * An object didn't fit in the encode buffer even when it was empty.
+     */
+    CBE_ENCODE_ERROR_BUFFER_TOO_SMALL,
+
 } cbe_encode_status;
 
 
@@ -449,9 +885,226 @@ CBE_PUBLIC cbe_encode_status cbe_encode_begin(struct cbe_encode_process* encode_
                                               int64_t byte_count,
                                               int max_container_depth);
 
+/**
+ * Reallocate a buffer, in the manner of realloc().
+ *
+ * @param context The allocator context passed to cbe_encode_begin_growable().
+ * @param buffer The buffer to grow (NULL = allocate a new buffer).
+ * @param byte_count The new size of the buffer in bytes.
+ * @return The new buffer, or NULL if the allocation failed.
+ */
+typedef void* (*cbe_realloc_function)(void* context, void* buffer, size_t byte_count);
+
+/**
+ * Begin a new encoding process that owns a growable document buffer.
+ *
+ * Whenever the buffer fills up, it is grown geometrically using
+ * realloc_function, so that encode functions never return
+ * CBE_ENCODE_STATUS_NEED_MORE_ROOM unless the allocator fails.
+ *
+ * Use cbe_encode_take_buffer() to get the document once encoding is done.
+ *
+ * @param encode_process The encode process to initialize.
+ * @param initial_byte_count The initial size of the buffer (0 = default).
+ * @param realloc_function The function to allocate and grow the buffer with.
+ * @param allocator_context A context to pass to realloc_function.
+ * @param max_container_depth The maximum container depth to suppport (<=0 means use default).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_begin_growable(struct cbe_encode_process* encode_process,
+                                                       int64_t initial_byte_count,
+                                                       cbe_realloc_function realloc_function,
+                                                       void* allocator_context,
+                                                       int max_container_depth);
+
+/**
+ * Take ownership of the document buffer of a growable encode process.
+ *
+ * The buffer was allocated by the process's realloc function, and must be
+ * freed by the caller. The process no longer has a buffer after this call.
+ *
+ * @param encode_process The encode process.
+ * @param byte_count Filled with the number of bytes encoded into the buffer.
+ * @return The document buffer.
+ */
+CBE_PUBLIC uint8_t* cbe_encode_take_buffer(struct cbe_encode_process* encode_process, int64_t* byte_count);
+
+/**
+ * Begin a new encoding process that writes into a chain of pages.
+ *
+ * Whenever the current page can't hold the next object, the process moves on
+ * to the next page of the pool. Array data is split across pages; other
+ * objects are never split, so any unused space at the end of a page is
+ * skipped. Encode functions only return CBE_ENCODE_STATUS_NEED_MORE_ROOM when
+ * the pool runs out of pages (or an object is larger than a page), in which
+ * case you should call cbe_encode_flush_pages() and try again.
+ *
+ * The pool must remain valid for the life of the encode process, and must
+ * not be shared with another process.
+ *
+ * @param encode_process The encode process to initialize.
+ * @param page_pool The pool to take pages from.
+ * @param max_container_depth The maximum container depth to suppport (<=0 means use default).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_begin_paged(struct cbe_encode_process* encode_process,
+                                                    struct cbe_page_pool* page_pool,
+                                                    int max_container_depth);
+
+/**
+ * Get the size of the process data for a measuring encode process (see
+ * cbe_encode_begin_measure()). This is cbe_encode_process_size() plus the
+ * scratch area that a measuring process writes into.
+ *
+ * @param max_container_depth The maximum container depth to suppport (<=0 means use default).
+ * @return The process data size.
+ */
+CBE_PUBLIC int cbe_encode_measure_process_size(int max_container_depth);
+
+/**
+ * Begin a new encoding process that only measures the document.
+ * The process must have been allocated with cbe_encode_measure_process_size().
+ *
+ * The process accepts the same encode calls as any other, and makes the same
+ * encoding decisions (and returns the same errors), but writes nothing out.
+ * Use cbe_encode_get_measured_byte_count() afterwards to get the exact size
+ * of the encoded document, for example to allocate a buffer of that size.
+ * Byte array data is not read at all, and cbe_encode_add_bytes_from_fd()
+ * doesn't touch its file descriptors.
+ *
+ * @param encode_process The encode process.
+ * @param max_container_depth The maximum container depth to suppport (<=0 means use default).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_begin_measure(struct cbe_encode_process* encode_process,
+                                                       int max_container_depth);
+
+/**
+ * Get the number of bytes a measuring encode process has encoded so far.
+ *
+ * @param encode_process The encode process.
+ * @return The number of bytes, or -1 if this isn't a measuring process.
+ */
+CBE_PUBLIC int64_t cbe_encode_get_measured_byte_count(struct cbe_encode_process* encode_process);
+
+/**
+ * Reference large byte and string payloads instead of copying them (paged
+ * mode only).
+ *
+ * Data of at least threshold bytes passed to cbe_encode_add_bytes(),
+ * cbe_encode_add_string(), cbe_encode_add_typed_array(), or
+ * cbe_encode_add_data() (for a bytes, string or typed array) is not copied
+ * into the pages. Instead, the output refers to the
+ * caller's memory, which must stay valid and unchanged until the pages have
+ * been flushed. Once the pool's references are used up, data is copied again.
+ *
+ * @param encode_process The encode process.
+ * @param threshold The minimum payload size to reference (0 = never reference).
+ */
+CBE_PUBLIC void cbe_encode_set_reference_threshold(struct cbe_encode_process* encode_process, int64_t threshold);
+
+/**
+ * Add padding automatically so that data can be read in place with aligned
+ * loads, for example from a memory-mapped document.
+ *
+ * Fixed width integer and binary float payloads start at a multiple of their
+ * size (2, 4, 8, or 16 bytes), and the contents of byte and typed arrays at a
+ * multiple of alignment (or of the element size, if larger). Offsets are
+ * counted from the start of the document, including data that has already
+ * been flushed or handed back to the caller.
+ *
+ * Integer and float lists are added one value at a time while aligning.
+ * Fragments and parallel shards are encoded separately, so their contents are
+ * not aligned. Templates can't be added while aligning.
+ *
+ * @param encode_process The encode process.
+ * @param alignment The array alignment: a power of 2 up to 4096 (0 = don't align).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_set_alignment(struct cbe_encode_process* encode_process, int alignment);
+
+/**
+ * Get the size of the map index for canonical encoding.
+ *
+ * @param max_entry_count The most key-value pairs that will be in open maps
+ *                        at once (a map's pairs, plus those that came before
+ *                        it in the maps it is nested in).
+ * @param max_map_depth The most maps that will be nested in each other.
+ * @return The map index size in bytes.
+ */
+CBE_PUBLIC int64_t cbe_encode_canonical_index_size(int64_t max_entry_count, int max_map_depth);
+
+/**
+ * Make the output canonical, so that the same data always encodes to the same
+ * bytes, for hashing, signing and deduplication.
+ *
+ * Integers and binary floats always take the smallest form that holds their
+ * value exactly (the fixed width 128-bit functions encode compactly too),
+ * decimal significands are normalized, and padding and comments are left
+ * out. Unordered and metadata map entries are sorted by the bytes of their
+ * encoded keys (a key that is a prefix of another comes first). Ordered maps
+ * keep the order they were given in.
+ *
+ * A map is sorted when it ends, so its contents must still be in the buffer
+ * at that point. Growable buffers grow to hold another copy of the largest
+ * map while sorting it; fixed buffers need the same spare room. The map index
+ * records where each open map's entries are, and must stay valid until the
+ * document ends.
+ *
+ * Can only be set outside of any containers, and isn't supported in paged
+ * mode. Raw fragments, templates, parallel shards, byte arrays from file
+ * descriptors inside maps, and comments inside maps (which would occupy a key
+ * or value position) can't be canonicalized, and return
+ * CBE_ENCODE_ERROR_INVALID_ARGUMENT. Turning this on turns alignment off.
+ *
+ * @param encode_process The encode process.
+ * @param is_canonical If true, encode canonically.
+ * @param map_index The map index (may be NULL in measure mode, which doesn't sort).
+ * @param map_index_byte_count The size of the map index (see cbe_encode_canonical_index_size()).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_set_canonical(struct cbe_encode_process* encode_process,
+                                                      bool is_canonical,
+                                                      void* map_index,
+                                                      int64_t map_index_byte_count);
+
+/**
+ * Get the number of output segments in a paged encode process. The document
+ * is the concatenation of every segment, in order. A segment is either part
+ * of a page or a referenced payload.
+ *
+ * @param encode_process The encode process.
+ * @return The number of segments.
+ */
+CBE_PUBLIC int cbe_encode_get_segment_count(struct cbe_encode_process* encode_process);
+
+/**
+ * Get one of the output segments of a paged encode process, for example to
+ * build an iovec array for sendmsg().
+ *
+ * @param encode_process The encode process.
+ * @param index The index of the segment (0 to cbe_encode_get_segment_count() - 1).
+ * @param byte_count Filled with the length of the segment.
+ * @return The start of the segment, or NULL if the index is invalid.
+ */
+CBE_PUBLIC const uint8_t* cbe_encode_get_segment(struct cbe_encode_process* encode_process,
+                                                 int index,
+                                                 int64_t* byte_count);
+
+/**
+ * Write every output segment of a paged encode process to a file descriptor
+ * using writev(), and then start again from the first page of the pool.
+ *
+ * @param encode_process The encode process.
+ * @param fd The file descriptor to write to.
+ * @return The number of bytes written, or -1 on error (with errno set).
+ */
+CBE_PUBLIC int64_t cbe_encode_flush_pages(struct cbe_encode_process* encode_process, int fd);
+
 /**
  * Replace the document buffer in an encode process.
- * This also resets the buffer offset.
+ * This also resets the buffer offset, and ends growable or paged mode (take
+ * the buffer first if the process owned one).
  *
  * @param encode_process The encode process.
  * @param document_buffer A buffer to store the document in.
@@ -462,6 +1115,77 @@ CBE_PUBLIC cbe_encode_status cbe_encode_set_buffer(struct cbe_encode_process* en
                                                    uint8_t* document_buffer,
                                                    int64_t byte_count);
 
+/**
+ * Remember the current state of an encode process (its place in the buffer,
+ * and its container and array state), so that everything added after this
+ * point can be discarded with cbe_encode_rollback().
+ *
+ * @param encode_process The encode process.
+ * @param savepoint Filled with the current state.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_savepoint(struct cbe_encode_process* encode_process,
+                                                  struct cbe_savepoint* savepoint);
+
+/**
+ * Discard everything added to an encode process since a savepoint was taken.
+ *
+ * Savepoints can be rolled back to any number of times, and still work after
+ * a growable buffer has grown or a paged process has moved on to more pages.
+ * They can't be rolled back to once the data they cover has left the process,
+ * that is, after cbe_encode_set_buffer(), cbe_encode_flush_pages(),
+ * cbe_encode_take_buffer() or cbe_encode_add_bytes_from_fd(). Rolling back
+ * restores the innermost 64 containers that were open at the time, even if
+ * they have since been closed, except that in canonical mode the maps being
+ * sorted at the time must not have been closed. A savepoint can't be rolled
+ * back to while more than 64 of its containers are closed.
+ *
+ * @param encode_process The encode process.
+ * @param savepoint The savepoint to roll back to.
+ * @return The current encoder status (CBE_ENCODE_ERROR_INVALID_ARGUMENT if
+ *         the savepoint can no longer be rolled back to).
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_rollback(struct cbe_encode_process* encode_process,
+                                                 const struct cbe_savepoint* savepoint);
+
+/**
+ * Begin an encode process that continues a parent process's current list (or
+ * top level), so that parts of it can be encoded independently, for example on
+ * other threads. The shard encodes into its own page pool, and its output
+ * belongs right after everything the parent has encoded so far.
+ *
+ * The shard starts at the parent's container level and can't close the
+ * parent's containers. Call cbe_encode_end() on the shard to check that it's
+ * balanced. See cbe_encode_add_parallel() for a ready-made way to use shards.
+ *
+ * @param encode_process The shard's encode process (sized with the parent's max container depth).
+ * @param page_pool The pool to take pages from.
+ * @param parent The process being continued. Must not be inside a map or an array.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_begin_shard(struct cbe_encode_process* encode_process,
+                                                    struct cbe_page_pool* page_pool,
+                                                    struct cbe_encode_process* parent);
+
+/**
+ * Turn everything encoded so far into a fragment, to be added to other
+ * documents with cbe_encode_add_raw().
+ *
+ * Encode the objects into a fixed or growable buffer as usual, closing all
+ * containers, then call this instead of cbe_encode_end(). The fragment points
+ * into the document buffer, so the buffer must not be reused or grown while
+ * the fragment is in use. This lets a fragment be encoded and validated once
+ * (for example at startup), and then be spliced into documents with a single
+ * copy.
+ *
+ * @param encode_process The encode process.
+ * @param fragment Filled with the encoded objects.
+ * @return The current encoder status (CBE_ENCODE_ERROR_INVALID_ARGUMENT if
+ *         the process is paged or measuring).
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_get_fragment(struct cbe_encode_process* encode_process,
+                                                     struct cbe_fragment* fragment);
+
 /**
  * Get the current write offset into the encode buffer.
  * This points to one past the last byte written to the current buffer.
@@ -488,6 +1212,42 @@ CBE_PUBLIC int64_t cbe_encode_get_buffer_offset(struct cbe_encode_process* encod
  */
 CBE_PUBLIC int cbe_encode_get_document_depth(struct cbe_encode_process* encode_process);
 
+/**
+ * Set the timezone table used by cbe_encode_add_time_tzid() and
+ * cbe_encode_add_timestamp_tzid().
+ *
+ * Those functions encode the timezone's ID instead of its string, so the
+ * decoder must be given a table with the same timezones at the same IDs (see
+ * cbe_decode_set_timezone_table()).
+ *
+ * Call this after cbe_encode_begin(). The table must remain valid for the
+ * life of the encode process.
+ *
+ * @param encode_process The encode process.
+ * @param timezone_table The timezone table (NULL = none).
+ */
+CBE_PUBLIC void cbe_encode_set_timezone_table(struct cbe_encode_process* encode_process,
+                                              const struct cbe_string_table* timezone_table);
+
+/**
+ * Declare a key dictionary for the rest of the stream, so that repeated map
+ * keys take 2 bytes (for the first 128 keys) instead of their full length.
+ *
+ * This adds a top level metadata map with a "_keys" entry listing every key
+ * in the table in ID order. After that, map keys added with
+ * cbe_encode_add_string() that are in the table are encoded as references
+ * to their ID. Decoders need cbe_decode_set_key_dictionary() to read them.
+ *
+ * Can only be called once per process, at the top level. The table must
+ * hold valid UTF-8 keys, and must not change while the process uses it.
+ *
+ * @param encode_process The encode process.
+ * @param key_dictionary The keys to declare.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_key_dictionary(struct cbe_encode_process* encode_process,
+                                                           const struct cbe_string_table* key_dictionary);
+
 /**
  * End an encoding process, checking the document for validity.
  *
@@ -533,6 +1293,58 @@ CBE_PUBLIC cbe_encode_status cbe_encode_add_boolean(struct cbe_encode_process* e
  */
 CBE_PUBLIC cbe_encode_status cbe_encode_add_integer(struct cbe_encode_process* encode_process, int sign, uint64_t value);
 
+/**
+ * Add a 128-bit integer value to the document.
+ * Note that this will add a narrower type if it will fit. Values that don't
+ * fit in 64 bits are added as a variable width integer (up to 20 bytes).
+ *
+ * @param encode_process The encode process.
+ * @param sign The sign of the value (1 or -1).
+ * @param value The absolute value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_integer_128(struct cbe_encode_process* encode_process, int sign, uint128_ct value);
+
+/**
+ * Add a 128-bit integer value to the document in fixed width form (always 17
+ * bytes), which decodes through on_integer_128().
+ *
+ * @param encode_process The encode process.
+ * @param sign The sign of the value (1 or -1).
+ * @param value The absolute value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_integer_128_fixed(struct cbe_encode_process* encode_process, int sign, uint128_ct value);
+
+/**
+ * Add a complete list of signed integers to the document.
+ *
+ * Each value is encoded exactly as cbe_encode_add_integer() would encode it,
+ * but the checks and the room calculation are done once for the whole list.
+ * Either the entire list is added, or nothing is.
+ *
+ * @param encode_process The encode process.
+ * @param values The values to add. May be NULL iff count = 0.
+ * @param count The number of values.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_integer_list(struct cbe_encode_process* encode_process,
+                                                          const int64_t* values,
+                                                          int64_t count);
+
+/**
+ * Add a complete list of unsigned integers to the document.
+ * See cbe_encode_add_integer_list().
+ *
+ * @param encode_process The encode process.
+ * @param values The values to add. May be NULL iff count = 0.
+ * @param count The number of values.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_unsigned_integer_list(struct cbe_encode_process* encode_process,
+                                                                   const uint64_t* values,
+                                                                   int64_t count);
+
 /**
  * Add a floating point value to the document.
  * Note that this will add a narrower type if it will fit.
@@ -545,6 +1357,62 @@ CBE_PUBLIC cbe_encode_status cbe_encode_add_integer(struct cbe_encode_process* e
  */
 CBE_PUBLIC cbe_encode_status cbe_encode_add_float(struct cbe_encode_process* encode_process, double value, int significant_digits);
 
+/**
+ * Add a binary floating point value to the document in whichever encoding is
+ * smallest: a decimal float of up to 15 significant digits, a 32-bit float,
+ * or a 64-bit float.
+ *
+ * The decimal form is the shortest one that converts back to exactly the same
+ * double, so prices and other values that started out as decimal text (0.1,
+ * 19.99) typically take 3-4 bytes rather than 9, and decode to the same double.
+ * No decimal arithmetic is used: the check is limited to decimal exponents
+ * within +-22, which covers everyday magnitudes. Values that have no such form
+ * are added as cbe_encode_add_float() would add them with significant_digits = 0.
+ *
+ * @param encode_process The encode process.
+ * @param value The value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_float_shortest(struct cbe_encode_process* encode_process, double value);
+
+/**
+ * Add a 128-bit binary floating point value to the document.
+ * Note that this will add a 64 or 32-bit float if that's lossless, and the
+ * 128-bit fixed width form (17 bytes) otherwise.
+ *
+ * @param encode_process The encode process.
+ * @param value The value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_float_128(struct cbe_encode_process* encode_process, float128_ct value);
+
+/**
+ * Add a 128-bit binary floating point value to the document in fixed width
+ * form (always 17 bytes), which decodes through on_float_128().
+ *
+ * @param encode_process The encode process.
+ * @param value The value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_float_128_fixed(struct cbe_encode_process* encode_process, float128_ct value);
+
+/**
+ * Add a complete list of binary floating point values to the document.
+ *
+ * Each value is encoded exactly as cbe_encode_add_float() would encode it
+ * with significant_digits = 0 (as a 32-bit float if that's lossless, and a
+ * 64-bit float otherwise), but the checks and the room calculation are done
+ * once for the whole list. Either the entire list is added, or nothing is.
+ *
+ * @param encode_process The encode process.
+ * @param values The values to add. May be NULL iff count = 0.
+ * @param count The number of values.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_float_list(struct cbe_encode_process* encode_process,
+                                                        const double* values,
+                                                        int64_t count);
+
 /**
  * Add a decimal floating point value to the document.
  * Note that this will add a narrower type if it will fit.
@@ -557,6 +1425,56 @@ CBE_PUBLIC cbe_encode_status cbe_encode_add_float(struct cbe_encode_process* enc
  */
 CBE_PUBLIC cbe_encode_status cbe_encode_add_decimal_float(struct cbe_encode_process* encode_process, dec64_ct value, int significant_digits);
 
+/**
+ * Add a decimal floating point value of significand * 10^exponent to the
+ * document, without going through a decimal float type.
+ *
+ * The value is encoded exactly as cbe_encode_add_decimal_float() would encode
+ * the same decimal value (trailing zeros in the significand are moved into the
+ * exponent). The value must fit in a 64-bit decimal float: at most 16
+ * significant digits, and an exponent of -398 to 369 once the digits are
+ * shifted as a 64-bit decimal float would hold them (so 1 * 10^372 is
+ * accepted as 1000 * 10^369).
+ *
+ * @param encode_process The encode process.
+ * @param sign The sign of the value (1 or -1).
+ * @param significand The significand.
+ * @param exponent The base-10 exponent.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_decimal_parts(struct cbe_encode_process* encode_process,
+                                                         int sign,
+                                                         uint64_t significand,
+                                                         int exponent);
+
+/**
+ * Add a 128-bit decimal floating point value to the document as a compact
+ * decimal float, exactly (trailing zeros in the significand are moved into
+ * the exponent). Values that fit in a 64-bit decimal float encode the same as
+ * they would through cbe_encode_add_decimal_parts(). Infinities, NaNs, and
+ * values whose compact form would be bigger (around 32 or more digits) are
+ * added in fixed width form.
+ *
+ * The value is read directly from its IEEE 754 BID encoding (the one GCC uses
+ * on x86 and ARM), without any decimal arithmetic.
+ *
+ * @param encode_process The encode process.
+ * @param value The value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_decimal_float_128(struct cbe_encode_process* encode_process, dec128_ct value);
+
+/**
+ * Add a 128-bit decimal floating point value to the document in fixed width
+ * form (always 17 bytes, IEEE 754 BID encoding), which decodes through
+ * on_decimal_float_128().
+ *
+ * @param encode_process The encode process.
+ * @param value The value to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_decimal_float_128_fixed(struct cbe_encode_process* encode_process, dec128_ct value);
+
 /**
  * Add a date to the document.
  *
@@ -628,6 +1546,55 @@ CBE_PUBLIC cbe_encode_status cbe_encode_add_timestamp_tz(struct cbe_encode_proce
  */
 CBE_PUBLIC cbe_encode_status cbe_encode_add_timestamp_loc(struct cbe_encode_process* encode_process, int year, int month, int day, int hour, int minute, int second, int nanosecond, int latitude, int longitude);
 
+/**
+ * Add a time to the document, using a timezone registered in the encoder's
+ * timezone table. The timezone is encoded as its ID.
+ *
+ * @param encode_process The encode process.
+ * @param hour The hour (0-23).
+ * @param minute The minute (0-59).
+ * @param second The second (0-60) - 60 to support leap seconds.
+ * @param nanosecond The nanosecond (0-999999999).
+ * @param timezone_id The timezone's ID in the timezone table.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_time_tzid(struct cbe_encode_process* encode_process, int hour, int minute, int second, int nanosecond, int timezone_id);
+
+/**
+ * Add a timestamp to the document, using a timezone registered in the
+ * encoder's timezone table. The timezone is encoded as its ID.
+ *
+ * @param encode_process The encode process.
+ * @param year The year.
+ * @param month The month (1-12).
+ * @param day The day (1-31).
+ * @param hour The hour (0-23).
+ * @param minute The minute (0-59).
+ * @param second The second (0-60) - 60 to support leap seconds.
+ * @param nanosecond The nanosecond (0-999999999).
+ * @param timezone_id The timezone's ID in the timezone table.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_timestamp_tzid(struct cbe_encode_process* encode_process, int year, int month, int day, int hour, int minute, int second, int nanosecond, int timezone_id);
+
+/**
+ * Add a UTC timestamp to the document from a packed smalltime value.
+ *
+ * @param encode_process The encode process.
+ * @param value The timestamp (microsecond precision).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_smalltime(struct cbe_encode_process* encode_process, smalltime value);
+
+/**
+ * Add a UTC timestamp to the document from a packed nanotime value.
+ *
+ * @param encode_process The encode process.
+ * @param value The timestamp (nanosecond precision).
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_nanotime(struct cbe_encode_process* encode_process, nanotime value);
+
 /**
  * Begin a list in the document. Must be matched by an end container.
  *
@@ -709,6 +1676,180 @@ CBE_PUBLIC cbe_encode_status cbe_encode_add_bytes(struct cbe_encode_process* enc
                                                    const uint8_t* data,
                                                    int64_t byte_count);
 
+/**
+ * Convenience function: add a typed array (see cbe_encode_typed_array_begin())
+ * to a document. The elements are copied in with a single memcpy, or referenced
+ * in paged mode if they reach the reference threshold.
+ * Either the entire array is added, or nothing is.
+ *
+ * The element data must be little-endian (the host order on most platforms).
+ *
+ * @param encode_process The encode process.
+ * @param type The element type.
+ * @param elements The elements to add. May be NULL iff element_count = 0.
+ * @param element_count The number of elements.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_typed_array(struct cbe_encode_process* encode_process,
+                                                        cbe_typed_array_type type,
+                                                        const void* elements,
+                                                        int64_t element_count);
+
+/**
+ * Convenience function: add the contents of a file to a document as a byte
+ * array, without passing the contents through the document buffer.
+ *
+ * Everything encoded so far is written to output_fd first, then the file
+ * contents are moved from source_fd (starting at its current offset) straight
+ * to output_fd, using copy_file_range() or sendfile() where the platform
+ * supports it, and read()/write() otherwise. Encoding then continues at the
+ * start of the document buffer (or the first page of a paged process), so
+ * the caller must write out the rest of the document to output_fd as well.
+ *
+ * If CBE_ENCODE_ERROR_FILE_IO is returned, output_fd holds an incomplete
+ * document and the process should be abandoned.
+ *
+ * @param encode_process The encode process.
+ * @param source_fd The file descriptor to read the contents from.
+ * @param byte_count The number of bytes to copy from source_fd.
+ * @param output_fd The file descriptor the document is being written to.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_bytes_from_fd(struct cbe_encode_process* encode_process,
+                                                           int source_fd,
+                                                           int64_t byte_count,
+                                                           int output_fd);
+
+/**
+ * Add a pre-encoded fragment (see cbe_encode_get_fragment()) to a document.
+ *
+ * The fragment's bytes are copied in as-is, and the process carries on as if
+ * its objects had been added one by one: a fragment holding a map key and its
+ * value leaves a map expecting another key, and a fragment whose objects can't
+ * be map keys is rejected wherever one of them would land on a key.
+ * Either the entire fragment is added, or nothing is.
+ *
+ * @param encode_process The encode process.
+ * @param fragment The fragment to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_raw(struct cbe_encode_process* encode_process,
+                                                const struct cbe_fragment* fragment);
+
+/**
+ * Encodes the elements [first_index, first_index + element_count) of a
+ * parallel encode (see cbe_encode_add_parallel()).
+ *
+ * @param encode_process The shard's encode process.
+ * @param first_index The index of the first element to encode.
+ * @param element_count The number of elements to encode.
+ * @param context The context passed to cbe_encode_add_parallel().
+ * @return The encoder status.
+ */
+typedef cbe_encode_status (*cbe_encode_elements_function)(struct cbe_encode_process* encode_process,
+                                                          int64_t first_index,
+                                                          int64_t element_count,
+                                                          void* context);
+
+/**
+ * A worker's share of a parallel encode (see cbe_encode_add_parallel()).
+ */
+struct cbe_encode_shard
+{
+    // Sized with the parent's max container depth.
+    struct cbe_encode_process* process;
+    // Must hold the encoded form of a whole batch.
+    struct cbe_page_pool* page_pool;
+};
+
+/**
+ * Encode many elements of the current list (or top level) on worker threads,
+ * writing the result to output_fd.
+ *
+ * Each shard gets a thread for the duration of the call, and batches of
+ * batch_size elements are handed to the shards in turn. Each batch is encoded
+ * into its shard's page pool, and the pages are written to output_fd in
+ * element order with writev(), without copying. A shard starts on its next
+ * batch as soon as its last one has been written, while the other shards'
+ * batches are still being written.
+ *
+ * As with cbe_encode_add_bytes_from_fd(), everything encoded so far is written
+ * to output_fd first, and encoding continues at the start of the document
+ * buffer afterwards, so the caller must write out the rest of the document to
+ * output_fd as well. If an error is returned, output_fd may hold an incomplete
+ * document and the process should be abandoned.
+ *
+ * @param encode_process The encode process. Must not be inside a map or an array.
+ * @param element_count The number of elements to encode.
+ * @param batch_size The number of elements each shard encodes per round.
+ * @param encode_elements Called on the worker threads to encode elements.
+ * @param context Passed to encode_elements.
+ * @param shards The shards to encode with (up to 256).
+ * @param shard_count The number of shards.
+ * @param output_fd The file descriptor the document is being written to.
+ * @return The current encoder status (the first error from encode_elements
+ *         in element order, if any).
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_parallel(struct cbe_encode_process* encode_process,
+                                                     int64_t element_count,
+                                                     int64_t batch_size,
+                                                     cbe_encode_elements_function encode_elements,
+                                                     void* context,
+                                                     const struct cbe_encode_shard* shards,
+                                                     int shard_count,
+                                                     int output_fd);
+
+/**
+ * Add a slot to a template that is being encoded. The slot stands in for one
+ * object of the given type, which is filled in by cbe_encode_add_template().
+ *
+ * Build a template by encoding its skeleton into a fixed or growable buffer as
+ * usual, adding slots where the values go, then calling
+ * cbe_encode_end_template().
+ *
+ * @param encode_process The encode process.
+ * @param encode_template The template being built.
+ * @param name The slot's name (may be NULL). Not copied, so it must outlive the template.
+ * @param type The type of object that goes in the slot.
+ * @return The current encoder status (CBE_ENCODE_ERROR_INVALID_ARGUMENT if
+ *         the template is full, or the process is paged, measuring,
+ *         canonical, aligned or has a key dictionary).
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_slot(struct cbe_encode_process* encode_process,
+                                                 struct cbe_template* encode_template,
+                                                 const char* name,
+                                                 cbe_slot_type type);
+
+/**
+ * Finish building a template. Call this instead of cbe_encode_end().
+ * The template refers to the document buffer, so the buffer must not be
+ * reused or grown while the template is in use.
+ *
+ * @param encode_process The encode process.
+ * @param encode_template The template being built.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_end_template(struct cbe_encode_process* encode_process,
+                                                     struct cbe_template* encode_template);
+
+/**
+ * Add a template to a document, filling its slots with values.
+ *
+ * The skeleton is copied in as-is between the slots, and only the slot values
+ * are encoded, in their usual (smallest) encodings. As with
+ * cbe_encode_add_raw(), either the whole template is added, or nothing is.
+ * Templates can't be added to canonical or aligned processes, or once a key
+ * dictionary has been added (CBE_ENCODE_ERROR_INVALID_ARGUMENT).
+ *
+ * @param encode_process The encode process.
+ * @param encode_template The template to add.
+ * @param values A value for each slot, in slot order. May be NULL iff the template has no slots.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_add_template(struct cbe_encode_process* encode_process,
+                                                     const struct cbe_template* encode_template,
+                                                     const cbe_slot_value* values);
+
 /**
  * Convenience function: add a URI to a document.
  * This function does not preserve partial data in the encoded buffer. Either the
@@ -810,6 +1951,28 @@ CBE_PUBLIC cbe_encode_status cbe_encode_uri_begin(struct cbe_encode_process* enc
  */
 CBE_PUBLIC cbe_encode_status cbe_encode_comment_begin(struct cbe_encode_process* encode_process, int64_t byte_count);
 
+/**
+ * Begin a typed array in the document.
+ *
+ * This function "opens" a typed array field, encoding the type, element type
+ * and length portions. The encode process will expect subsequent
+ * cbe_encode_add_data() calls with the little-endian element data, for a
+ * total of element_count * cbe_typed_array_element_size(type) bytes.
+ * Once the field has been filled, it is considered "closed", and other fields
+ * may now be added to the document. A zero-length array is automatically closed
+ * in this function.
+ *
+ * Typed arrays can't be map keys.
+ *
+ * @param encode_process The encode process.
+ * @param type The element type.
+ * @param element_count The total number of elements to add.
+ * @return The current encoder status.
+ */
+CBE_PUBLIC cbe_encode_status cbe_encode_typed_array_begin(struct cbe_encode_process* encode_process,
+                                                          cbe_typed_array_type type,
+                                                          int64_t element_count);
+
 /**
  * Add data to the currently opened array field (string, bytes, uri, comment).
  *
@@ -835,6 +1998,46 @@ CBE_PUBLIC cbe_encode_status cbe_encode_add_data(struct cbe_encode_process* enco
 
 
 
+// --------------------
+// Canonicalization API
+// --------------------
+
+/**
+ * Rewrite an existing document in canonical form (see
+ * cbe_encode_set_canonical()), in a single streaming pass.
+ *
+ * The document is read from input_fd in chunks and decoded, and every object
+ * is encoded again into buffer, which is written to output_fd whenever it
+ * fills up. Open unordered and metadata maps stay in the buffer until they
+ * are sorted, so memory use is bounded by buffer and map_index: buffer must
+ * have room for the largest such map twice over (once as it comes in, and
+ * once while sorting it).
+ *
+ * @param input_fd The file descriptor to read the document from.
+ * @param output_fd The file descriptor to write the canonical document to.
+ * @param buffer The encode buffer.
+ * @param buffer_byte_count The size of the encode buffer.
+ * @param map_index The map index (see cbe_encode_canonical_index_size()).
+ * @param map_index_byte_count The size of the map index.
+ * @param max_container_depth The maximum container depth to suppport (<=0 means use default).
+ * @param encode_status Set to the encoder status (may be NULL). If the
+ *                      document couldn't be encoded or written, or input_fd
+ *                      couldn't be read (CBE_ENCODE_ERROR_FILE_IO), this
+ *                      returns CBE_DECODE_STATUS_STOPPED_IN_CALLBACK and
+ *                      encode_status says why.
+ * @return The decoder status.
+ */
+CBE_PUBLIC cbe_decode_status cbe_canonicalize(int input_fd,
+                                              int output_fd,
+                                              uint8_t* buffer,
+                                              int64_t buffer_byte_count,
+                                              void* map_index,
+                                              int64_t map_index_byte_count,
+                                              int max_container_depth,
+                                              cbe_encode_status* encode_status);
+
+
+
 #ifdef __cplusplus 
 }
 #endif
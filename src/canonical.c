@@ -0,0 +1,408 @@
+#include "cbe_internal.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+
+// ====
+// Data
+// ====
+
+// Must hold the largest object that the decoder needs in one piece.
+#define READ_BUFFER_SIZE 16384
+
+typedef struct
+{
+    struct cbe_encode_process* encode_process;
+    int output_fd;
+    // The element size of the typed array being copied.
+    int element_size;
+    // Why the encoder stopped the decoder.
+    cbe_encode_status status;
+} canonicalize_context;
+
+
+// ==============
+// Utility Macros
+// ==============
+
+#define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
+#define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
+
+// Encode, writing out what's been encoded so far and retrying whenever the
+// buffer is full. ENCODE_CALL can refer to encode_process.
+#define ENCODE(DECODE_PROCESS, ENCODE_CALL) \
+    canonicalize_context* const context = get_context(DECODE_PROCESS); \
+    struct cbe_encode_process* const encode_process = context->encode_process; \
+    cbe_encode_status status = ENCODE_CALL; \
+    while(status == CBE_ENCODE_STATUS_NEED_MORE_ROOM) \
+    { \
+        status = make_room(context); \
+        likely_if(status == CBE_ENCODE_STATUS_OK) \
+        { \
+            status = ENCODE_CALL; \
+        } \
+    } \
+    return check_status(context, status)
+
+
+// =======
+// Utility
+// =======
+
+static inline canonicalize_context* get_context(struct cbe_decode_process* const decode_process)
+{
+    return (canonicalize_context*)cbe_decode_get_user_context(decode_process);
+}
+
+// Open sorted maps have to stay in the buffer until they end, so if they're
+// all that's left in it, a map is too large. Otherwise the buffer is already
+// empty and can't hold the next object at all.
+static cbe_encode_status make_room(canonicalize_context* const context)
+{
+    struct cbe_encode_process* const encode_process = context->encode_process;
+    const int64_t byte_count = cbe_encode_get_buffer_offset(encode_process);
+    unlikely_if(!cbe_encode_write_buffered(encode_process, context->output_fd))
+    {
+        return CBE_ENCODE_ERROR_FILE_IO;
+    }
+    unlikely_if(cbe_encode_get_buffer_offset(encode_process) == byte_count)
+    {
+        KSLOG_DEBUG("Couldn't make any room");
+        return cbe_encode_is_sorting_map(encode_process) ? CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT
+                                                         : CBE_ENCODE_ERROR_BUFFER_TOO_SMALL;
+    }
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static inline bool check_status(canonicalize_context* const context, const cbe_encode_status status)
+{
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        KSLOG_DEBUG("Encoder stopped with status %d", status);
+        context->status = status;
+        return false;
+    }
+    return true;
+}
+
+// Array data goes in as it comes, making room as many times as it takes.
+static bool add_array_data(canonicalize_context* const context, const uint8_t* start, int64_t byte_count)
+{
+    while(byte_count > 0)
+    {
+        int64_t bytes_added = byte_count;
+        cbe_encode_status status = cbe_encode_add_data(context->encode_process, start, &bytes_added);
+        unlikely_if(status == CBE_ENCODE_STATUS_NEED_MORE_ROOM)
+        {
+            status = make_room(context);
+        }
+        else
+        {
+            bytes_added = byte_count;
+        }
+        unlikely_if(!check_status(context, status))
+        {
+            return false;
+        }
+        start += bytes_added;
+        byte_count -= bytes_added;
+    }
+    return true;
+}
+
+static bool on_nil(struct cbe_decode_process* const decode_process)
+{
+    ENCODE(decode_process, cbe_encode_add_nil(encode_process));
+}
+
+static bool on_boolean(struct cbe_decode_process* const decode_process, const bool value)
+{
+    ENCODE(decode_process, cbe_encode_add_boolean(encode_process, value));
+}
+
+static bool on_integer(struct cbe_decode_process* const decode_process, const int sign, const uint64_t value)
+{
+    ENCODE(decode_process, cbe_encode_add_integer(encode_process, sign, value));
+}
+
+static bool on_float(struct cbe_decode_process* const decode_process, const double value)
+{
+    ENCODE(decode_process, cbe_encode_add_float(encode_process, value, 0));
+}
+
+static bool on_decimal_float(struct cbe_decode_process* const decode_process, const dec64_ct value)
+{
+    ENCODE(decode_process, cbe_encode_add_decimal_float(encode_process, value, 0));
+}
+
+static bool on_decimal_parts(struct cbe_decode_process* const decode_process,
+                             const int sign,
+                             const uint64_t significand,
+                             const int exponent)
+{
+    ENCODE(decode_process, cbe_encode_add_decimal_parts(encode_process, sign, significand, exponent));
+}
+
+static bool on_date(struct cbe_decode_process* const decode_process, const int year, const int month, const int day)
+{
+    ENCODE(decode_process, cbe_encode_add_date(encode_process, year, month, day));
+}
+
+static bool on_time_tz(struct cbe_decode_process* const decode_process,
+                       const int hour, const int minute, const int second, const int nanosecond,
+                       const char* const timezone)
+{
+    ENCODE(decode_process, cbe_encode_add_time_tz(encode_process, hour, minute, second, nanosecond, timezone));
+}
+
+static bool on_time_loc(struct cbe_decode_process* const decode_process,
+                        const int hour, const int minute, const int second, const int nanosecond,
+                        const int latitude, const int longitude)
+{
+    ENCODE(decode_process, cbe_encode_add_time_loc(encode_process, hour, minute, second, nanosecond,
+                                                   latitude, longitude));
+}
+
+static bool on_timestamp_tz(struct cbe_decode_process* const decode_process,
+                            const int year, const int month, const int day,
+                            const int hour, const int minute, const int second, const int nanosecond,
+                            const char* const timezone)
+{
+    ENCODE(decode_process, cbe_encode_add_timestamp_tz(encode_process, year, month, day,
+                                                       hour, minute, second, nanosecond, timezone));
+}
+
+static bool on_timestamp_loc(struct cbe_decode_process* const decode_process,
+                             const int year, const int month, const int day,
+                             const int hour, const int minute, const int second, const int nanosecond,
+                             const int latitude, const int longitude)
+{
+    ENCODE(decode_process, cbe_encode_add_timestamp_loc(encode_process, year, month, day,
+                                                        hour, minute, second, nanosecond, latitude, longitude));
+}
+
+static bool on_list_begin(struct cbe_decode_process* const decode_process)
+{
+    ENCODE(decode_process, cbe_encode_list_begin(encode_process));
+}
+
+static bool on_unordered_map_begin(struct cbe_decode_process* const decode_process)
+{
+    ENCODE(decode_process, cbe_encode_unordered_map_begin(encode_process));
+}
+
+static bool on_ordered_map_begin(struct cbe_decode_process* const decode_process)
+{
+    ENCODE(decode_process, cbe_encode_ordered_map_begin(encode_process));
+}
+
+static bool on_metadata_map_begin(struct cbe_decode_process* const decode_process)
+{
+    ENCODE(decode_process, cbe_encode_metadata_map_begin(encode_process));
+}
+
+static bool on_container_end(struct cbe_decode_process* const decode_process)
+{
+    ENCODE(decode_process, cbe_encode_container_end(encode_process));
+}
+
+static bool on_string_begin(struct cbe_decode_process* const decode_process, const int64_t byte_count)
+{
+    ENCODE(decode_process, cbe_encode_string_begin(encode_process, byte_count));
+}
+
+static bool on_bytes_begin(struct cbe_decode_process* const decode_process, const int64_t byte_count)
+{
+    ENCODE(decode_process, cbe_encode_bytes_begin(encode_process, byte_count));
+}
+
+static bool on_uri_begin(struct cbe_decode_process* const decode_process, const int64_t byte_count)
+{
+    ENCODE(decode_process, cbe_encode_uri_begin(encode_process, byte_count));
+}
+
+// The canonical encoder drops the comment.
+static bool on_comment_begin(struct cbe_decode_process* const decode_process, const int64_t byte_count)
+{
+    ENCODE(decode_process, cbe_encode_comment_begin(encode_process, byte_count));
+}
+
+static bool on_array_data(struct cbe_decode_process* const decode_process,
+                          const uint8_t* const start,
+                          const int64_t byte_count)
+{
+    return add_array_data(get_context(decode_process), start, byte_count);
+}
+
+static bool on_typed_array_begin(struct cbe_decode_process* const decode_process,
+                                 const cbe_typed_array_type type,
+                                 const int64_t element_count)
+{
+    get_context(decode_process)->element_size = cbe_typed_array_element_size(type);
+    ENCODE(decode_process, cbe_encode_typed_array_begin(encode_process, type, element_count));
+}
+
+static bool on_typed_array_data(struct cbe_decode_process* const decode_process,
+                                const uint8_t* const start,
+                                const int64_t element_count)
+{
+    canonicalize_context* const context = get_context(decode_process);
+    return add_array_data(context, start, element_count * context->element_size);
+}
+
+static bool on_integer_128(struct cbe_decode_process* const decode_process, const int sign, const uint128_ct value)
+{
+    ENCODE(decode_process, cbe_encode_add_integer_128(encode_process, sign, value));
+}
+
+static bool on_float_128(struct cbe_decode_process* const decode_process, const float128_ct value)
+{
+    ENCODE(decode_process, cbe_encode_add_float_128(encode_process, value));
+}
+
+static bool on_decimal_float_128(struct cbe_decode_process* const decode_process, const dec128_ct value)
+{
+    ENCODE(decode_process, cbe_encode_add_decimal_float_128(encode_process, value));
+}
+
+static const cbe_decode_callbacks canonicalize_callbacks =
+{
+    .on_nil = on_nil,
+    .on_boolean = on_boolean,
+    .on_integer = on_integer,
+    .on_float = on_float,
+    .on_decimal_float = on_decimal_float,
+    .on_date = on_date,
+    .on_time_tz = on_time_tz,
+    .on_time_loc = on_time_loc,
+    .on_timestamp_tz = on_timestamp_tz,
+    .on_timestamp_loc = on_timestamp_loc,
+    .on_list_begin = on_list_begin,
+    .on_unordered_map_begin = on_unordered_map_begin,
+    .on_ordered_map_begin = on_ordered_map_begin,
+    .on_metadata_map_begin = on_metadata_map_begin,
+    .on_container_end = on_container_end,
+    .on_string_begin = on_string_begin,
+    .on_bytes_begin = on_bytes_begin,
+    .on_uri_begin = on_uri_begin,
+    .on_comment_begin = on_comment_begin,
+    .on_array_data = on_array_data,
+    .on_typed_array_begin = on_typed_array_begin,
+    .on_typed_array_data = on_typed_array_data,
+    .on_integer_128 = on_integer_128,
+    .on_float_128 = on_float_128,
+    .on_decimal_float_128 = on_decimal_float_128,
+    .on_decimal_parts = on_decimal_parts,
+};
+
+// Decode the whole of input_fd into the canonical encoder.
+static cbe_decode_status decode_input(struct cbe_decode_process* const decode_process,
+                                      canonicalize_context* const context,
+                                      const int input_fd)
+{
+    uint8_t chunk[READ_BUFFER_SIZE];
+    int64_t chunk_byte_count = 0;
+    for(;;)
+    {
+        const ssize_t bytes_read = read(input_fd, chunk + chunk_byte_count, sizeof(chunk) - chunk_byte_count);
+        unlikely_if(bytes_read < 0)
+        {
+            unlikely_if(errno == EINTR)
+            {
+                continue;
+            }
+            context->status = CBE_ENCODE_ERROR_FILE_IO;
+            return CBE_DECODE_STATUS_STOPPED_IN_CALLBACK;
+        }
+        unlikely_if(bytes_read == 0)
+        {
+            return cbe_decode_end(decode_process);
+        }
+        chunk_byte_count += bytes_read;
+
+        // The decoder stops after each top level object, so keep feeding it
+        // until it needs more data.
+        cbe_decode_status status = CBE_DECODE_STATUS_OK;
+        int64_t chunk_offset = 0;
+        while(status == CBE_DECODE_STATUS_OK && chunk_offset < chunk_byte_count)
+        {
+            int64_t bytes_consumed = chunk_byte_count - chunk_offset;
+            status = cbe_decode_feed(decode_process, chunk + chunk_offset, &bytes_consumed);
+            chunk_offset += bytes_consumed;
+        }
+        unlikely_if(status != CBE_DECODE_STATUS_OK && status != CBE_DECODE_STATUS_NEED_MORE_DATA)
+        {
+            return status;
+        }
+        chunk_byte_count -= chunk_offset;
+        memmove(chunk, chunk + chunk_offset, chunk_byte_count);
+    }
+}
+
+
+// ===
+// API
+// ===
+
+cbe_decode_status cbe_canonicalize(const int input_fd,
+                                   const int output_fd,
+                                   uint8_t* const buffer,
+                                   const int64_t buffer_byte_count,
+                                   void* const map_index,
+                                   const int64_t map_index_byte_count,
+                                   const int max_container_depth,
+                                   cbe_encode_status* const encode_status)
+{
+    KSLOG_DEBUG("(input_fd %d, output_fd %d, buffer %p, buffer_byte_count %d, map_index %p, map_index_byte_count %d)",
+        input_fd, output_fd, buffer, buffer_byte_count, map_index, map_index_byte_count);
+    unlikely_if(input_fd < 0 || output_fd < 0 || buffer == NULL || buffer_byte_count <= 0 || map_index == NULL)
+    {
+        return CBE_DECODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    char encode_process_backing_store[cbe_encode_process_size(max_container_depth)];
+    struct cbe_encode_process* const encode_process = (struct cbe_encode_process*)encode_process_backing_store;
+    char decode_process_backing_store[cbe_decode_process_size(max_container_depth)];
+    struct cbe_decode_process* const decode_process = (struct cbe_decode_process*)decode_process_backing_store;
+
+    canonicalize_context context =
+    {
+        .encode_process = encode_process,
+        .output_fd = output_fd,
+        .status = CBE_ENCODE_STATUS_OK,
+    };
+    unlikely_if(cbe_encode_begin(encode_process, buffer, buffer_byte_count, max_container_depth) != CBE_ENCODE_STATUS_OK ||
+                cbe_encode_set_canonical(encode_process, true, map_index, map_index_byte_count) != CBE_ENCODE_STATUS_OK)
+    {
+        return CBE_DECODE_ERROR_INVALID_ARGUMENT;
+    }
+    cbe_decode_status status = cbe_decode_begin(decode_process, &canonicalize_callbacks, &context, max_container_depth);
+    unlikely_if(status != CBE_DECODE_STATUS_OK)
+    {
+        return status;
+    }
+
+    status = decode_input(decode_process, &context, input_fd);
+    likely_if(status == CBE_DECODE_STATUS_OK)
+    {
+        context.status = cbe_encode_end(encode_process);
+        unlikely_if(context.status == CBE_ENCODE_STATUS_OK && !cbe_encode_write_buffered(encode_process, output_fd))
+        {
+            context.status = CBE_ENCODE_ERROR_FILE_IO;
+        }
+        unlikely_if(context.status != CBE_ENCODE_STATUS_OK)
+        {
+            status = CBE_DECODE_STATUS_STOPPED_IN_CALLBACK;
+        }
+    }
+
+    if(encode_status != NULL)
+    {
+        *encode_status = context.status;
+    }
+    return status;
+}
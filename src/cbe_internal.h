@@ -2,6 +2,7 @@
 #define cbe_internal_H
 
 #include "cbe/cbe.h"
+#include <string.h>
 
 typedef enum
 {
@@ -20,7 +21,11 @@ typedef enum
     TYPE_INT_NEG_64        = 0x6f,
     TYPE_FLOAT_BINARY_32   = 0x70,
     TYPE_FLOAT_BINARY_64   = 0x71,
-    // RESERVED 0x72 - 0x76
+    TYPE_INT_POS_128       = 0x72,
+    TYPE_INT_NEG_128       = 0x73,
+    TYPE_FLOAT_BINARY_128  = 0x74,
+    TYPE_FLOAT_DECIMAL_128 = 0x75,
+    // RESERVED 0x76
     TYPE_LIST              = 0x77,
     TYPE_MAP_UNORDERED     = 0x78,
     TYPE_MAP_ORDERED       = 0x79,
@@ -50,7 +55,11 @@ typedef enum
     TYPE_BYTES             = 0x91,
     TYPE_URI               = 0x92,
     TYPE_COMMENT           = 0x93,
-    // RESERVED 0x94 - 0x98
+    TYPE_TYPED_ARRAY       = 0x94,
+    TYPE_KEY_REFERENCE     = 0x95,
+    TYPE_TIME_ZONE_ID      = 0x96,
+    TYPE_TIMESTAMP_ZONE_ID = 0x97,
+    // RESERVED 0x98
     TYPE_DATE              = 0x99,
     TYPE_TIME              = 0x9a,
     TYPE_TIMESTAMP         = 0x9b,
@@ -62,8 +71,16 @@ typedef enum
     ARRAY_TYPE_BYTES,
     ARRAY_TYPE_URI,
     ARRAY_TYPE_COMMENT,
+    ARRAY_TYPE_TYPED,
 } array_type;
 
+// Get log2 of a typed array element type's size, or -1 if it's not a valid type.
+static inline int get_typed_array_element_size_shift(const int type)
+{
+    static const int8_t shifts[] = {0, 1, 2, 3, 1, 1, 2, 3};
+    return type >= 0 && type < (int)sizeof(shifts) ? shifts[type] : -1;
+}
+
 
 static inline int get_max_container_depth_or_default(int max_container_depth)
 {
@@ -80,10 +97,255 @@ static inline void zero_memory(void* const memory, const int byte_count)
     }
 }
 
+// UTF-8 decoding state, carried between the chunks of an array that is
+// streamed in pieces so that a character may straddle two chunks.
+typedef struct
+{
+    int bytes_remaining;
+    int accumulator;
+} cbe_utf8_context;
+
 bool cbe_validate_string(const uint8_t* const start, const int64_t byte_count);
 
+bool cbe_validate_string_chunk(cbe_utf8_context* const context, const uint8_t* const start, const int64_t byte_count);
+
 bool cbe_validate_uri(const uint8_t* const start, const int64_t byte_count);
 
 bool cbe_validate_comment(const uint8_t* const start, const int64_t byte_count);
 
+bool cbe_validate_comment_chunk(cbe_utf8_context* const context, const uint8_t* const start, const int64_t byte_count);
+
+// Powers of 10 that a double holds exactly (10^0 to 10^22).
+#define CBE_MAX_EXACT_POWER_OF_10 22
+extern const double cbe_exact_powers_of_10[CBE_MAX_EXACT_POWER_OF_10 + 1];
+
+// Limits of a 64-bit decimal float's coefficient and (quantum) exponent.
+#define MAX_DECIMAL_64_SIGNIFICAND 9999999999999999ULL
+#define MIN_DECIMAL_64_EXPONENT    (-398)
+#define MAX_DECIMAL_64_EXPONENT    369
+
+// Limits of a 128-bit decimal float's coefficient (10^34 - 1) and exponent.
+#define MAX_DECIMAL_128_SIGNIFICAND (((uint128_ct)0x1ed09bead87c0ULL << 64) | 0x378d8e63ffffffffULL)
+#define MIN_DECIMAL_128_EXPONENT    (-6176)
+#define MAX_DECIMAL_128_EXPONENT    6111
+
+// Largest RVLQ encoding of a 128-bit value (7 bits per byte).
+#define MAX_RVLQ_128_SIZE 19
+
+static inline int rvlq_encoded_size_128(uint128_ct value)
+{
+    int size = 1;
+    while(value >>= 7)
+    {
+        size++;
+    }
+    return size;
+}
+
+// Returns the number of bytes written. The caller makes sure there's room.
+static inline int rvlq_encode_128(uint128_ct value, uint8_t* const dst)
+{
+    const int size = rvlq_encoded_size_128(value);
+    for(int i = size - 1; i >= 0; i--)
+    {
+        dst[i] = (uint8_t)(value & 0x7f) | (i == size - 1 ? 0 : 0x80);
+        value >>= 7;
+    }
+    return size;
+}
+
+// Returns the number of bytes read, 0 if more data is needed, or -1 if the
+// value doesn't fit in 128 bits.
+static inline int rvlq_decode_128(uint128_ct* const value, const uint8_t* const src, const int64_t src_length)
+{
+    uint128_ct accumulator = 0;
+    for(int64_t i = 0; i < src_length; i++)
+    {
+        if((accumulator >> 121) != 0)
+        {
+            return -1;
+        }
+        accumulator = accumulator << 7 | (src[i] & 0x7f);
+        if((src[i] & 0x80) == 0)
+        {
+            *value = accumulator;
+            return (int)i + 1;
+        }
+    }
+    return 0;
+}
+
+// 128-bit decimal floats are handled in the IEEE 754 binary integer decimal
+// (BID) encoding, which is what GCC uses on x86 and ARM. Splitting and
+// building them only takes bit operations.
+
+// Returns false for infinities and NaNs. Non-canonical significands read as 0.
+static inline bool get_decimal_128_parts(const dec128_ct value,
+                                         bool* const is_negative,
+                                         uint128_ct* const significand,
+                                         int* const exponent)
+{
+    uint128_ct bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t high = (uint64_t)(bits >> 64);
+    *is_negative = (high >> 63) != 0;
+    if(((high >> 61) & 3) == 3)
+    {
+        if(((high >> 59) & 3) == 3)
+        {
+            return false;
+        }
+        *exponent = (int)((high >> 47) & 0x3fff) + MIN_DECIMAL_128_EXPONENT;
+        *significand = 0;
+        return true;
+    }
+    *exponent = (int)((high >> 49) & 0x3fff) + MIN_DECIMAL_128_EXPONENT;
+    *significand = bits & (((uint128_ct)1 << 113) - 1);
+    if(*significand > MAX_DECIMAL_128_SIGNIFICAND)
+    {
+        *significand = 0;
+    }
+    return true;
+}
+
+// The parts must be within the limits of a 128-bit decimal float.
+static inline dec128_ct make_decimal_128(const bool is_negative, const uint128_ct significand, const int exponent)
+{
+    const uint128_ct bits = ((uint128_ct)is_negative << 127) |
+                            ((uint128_ct)(exponent - MIN_DECIMAL_128_EXPONENT) << 113) |
+                            significand;
+    dec128_ct value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// FNV-1a, split into steps so that callers already walking a string can hash it in the same pass.
+#define STRING_TABLE_HASH_INIT 0x811c9dc5u
+
+static inline uint32_t cbe_string_table_hash_step(const uint32_t hash, const uint8_t ch)
+{
+    return (hash ^ ch) * 0x01000193u;
+}
+
+static inline uint32_t cbe_string_table_hash(const uint8_t* const start, const int64_t byte_count)
+{
+    uint32_t hash = STRING_TABLE_HASH_INIT;
+    for(int64_t i = 0; i < byte_count; i++)
+    {
+        hash = cbe_string_table_hash_step(hash, start[i]);
+    }
+    return hash;
+}
+
+// Validate a string as UTF-8 and hash it (as per cbe_string_table_hash()) in a single pass.
+bool cbe_validate_string_and_hash(const uint8_t* const start, const int64_t byte_count, uint32_t* const hash);
+
+int64_t cbe_string_table_get_longest_byte_count(const struct cbe_string_table* const table);
+
+uint32_t cbe_string_table_get_hash(const struct cbe_string_table* const table, const int id);
+
+int cbe_string_table_find_hashed(const struct cbe_string_table* const table,
+                                 const uint32_t hash,
+                                 const uint8_t* const start,
+                                 const int64_t byte_count);
+
+// The top level metadata map key that declares a stream's key dictionary.
+// Its value is a list of the keys, which later map keys refer to by index
+// (TYPE_KEY_REFERENCE followed by the index as an RVLQ).
+#define KEY_DICTIONARY_METADATA_KEY "_keys"
+
+// A time or timestamp whose timezone is in the timezone table that both sides
+// were given is encoded as TYPE_TIME_ZONE_ID or TYPE_TIMESTAMP_ZONE_ID, then
+// the timezone's ID in the table as an RVLQ, then the compact time value with
+// no timezone.
+
+// Start over at the pool's first page, and return it.
+uint8_t* cbe_page_pool_rewind(struct cbe_page_pool* const pool);
+
+// Close the current page (written up to position), and return the next page
+// (or NULL if the pool is exhausted).
+uint8_t* cbe_page_pool_next_page(struct cbe_page_pool* const pool, const uint8_t* const position);
+
+bool cbe_page_pool_can_add_reference(const struct cbe_page_pool* const pool);
+
+// Insert a reference to caller memory at position in the current page.
+// Writing then continues from position.
+bool cbe_page_pool_add_reference(struct cbe_page_pool* const pool,
+                                 const uint8_t* const position,
+                                 const uint8_t* const start,
+                                 const int64_t byte_count);
+
+int64_t cbe_page_pool_get_page_size(const struct cbe_page_pool* const pool);
+
+// Get the combined size of the pages after the current one.
+int64_t cbe_page_pool_get_free_byte_count(const struct cbe_page_pool* const pool);
+
+// Segments are the runs of bytes making up the output so far, in order.
+// position is where writing has reached in the current page.
+int cbe_page_pool_get_segment_count(const struct cbe_page_pool* const pool, const uint8_t* const position);
+
+const uint8_t* cbe_page_pool_get_segment(const struct cbe_page_pool* const pool,
+                                         const uint8_t* const position,
+                                         const int index,
+                                         int64_t* const byte_count);
+
+// Where writing had reached in the pool, for rolling back to later.
+typedef struct
+{
+    int current_page;
+    int reference_count;
+    int segment_count;
+    int64_t open_segment_offset;
+} cbe_page_pool_mark;
+
+cbe_page_pool_mark cbe_page_pool_get_mark(const struct cbe_page_pool* const pool);
+
+// Discard everything added after mark, and return the page it was in.
+uint8_t* cbe_page_pool_rollback(struct cbe_page_pool* const pool, const cbe_page_pool_mark mark);
+
+// Write every segment to fd, then rewind the pool.
+// Returns the number of bytes written, or -1 on error.
+int64_t cbe_page_pool_write(struct cbe_page_pool* const pool, const uint8_t* const position, const int fd);
+
+// Write all of the data to fd, retrying on short writes and interrupts.
+bool cbe_write_fully(const int fd, const uint8_t* data, int64_t byte_count);
+
+// Copy byte_count bytes from source_fd's current offset to output_fd, in the
+// kernel where possible. Returns false (with errno set) if either side fails
+// or the source ends early.
+bool cbe_copy_between_fds(const int output_fd, const int source_fd, int64_t byte_count);
+
+// Write everything encoded so far to fd, and carry on from the start of the
+// buffer (or the pool's first page). Open sorted maps stay in the buffer,
+// since they haven't been sorted yet.
+bool cbe_encode_write_buffered(struct cbe_encode_process* const process, const int fd);
+
+// True while a canonical encode process has a sorted map open, which has to
+// stay in the buffer until it ends.
+bool cbe_encode_is_sorting_map(struct cbe_encode_process* const process);
+
+// Account for the objects a shard has added since it was last absorbed, once
+// its output has been written after the process's own.
+void cbe_encode_absorb_shard(struct cbe_encode_process* const process, struct cbe_encode_process* const shard);
+
+// Where a template's slot value goes, as an offset into its skeleton.
+typedef struct
+{
+    const char* name;
+    int64_t offset;
+    cbe_slot_type type;
+} cbe_template_slot;
+
+// Returns false if the template is full.
+bool cbe_template_add_slot(struct cbe_template* const encode_template,
+                           const char* const name,
+                           const cbe_slot_type type,
+                           const int64_t offset);
+
+void cbe_template_set_skeleton(struct cbe_template* const encode_template, const struct cbe_fragment* const skeleton);
+
+const struct cbe_fragment* cbe_template_get_skeleton(const struct cbe_template* const encode_template);
+
+const cbe_template_slot* cbe_template_get_slots(const struct cbe_template* const encode_template);
+
 #endif // cbe_internal_H
@@ -12,6 +12,15 @@
 // Data
 // ====
 
+typedef enum
+{
+    KEY_DICTIONARY_IDLE,
+    // The declaring metadata key has been decoded, so its list comes next.
+    KEY_DICTIONARY_AWAITING_LIST,
+    // Inside the list of declared keys.
+    KEY_DICTIONARY_COLLECTING,
+} key_dictionary_state;
+
 struct cbe_decode_process
 {
     const cbe_decode_callbacks* callbacks;
@@ -22,6 +31,9 @@ struct cbe_decode_process
         const uint8_t* start;
         const uint8_t* end;
         const uint8_t* position;
+        // Where the object currently being decoded began. An incomplete
+        // object is rewound to here so that it is re-fed in its entirety.
+        const uint8_t* object_start;
         int64_t* bytes_consumed;
     } buffer;
     struct
@@ -29,9 +41,14 @@ struct cbe_decode_process
         bool is_inside_array;
         bool is_reading_byte_count;
         bool has_reported_byte_count;
+        bool is_prevalidated;
         array_type type;
+        // Typed arrays only: the element type, and log2 of its size.
+        cbe_typed_array_type element_type;
+        int element_size_shift;
         int64_t current_offset;
         int64_t byte_count;
+        cbe_utf8_context utf8_context;
     } array;
     struct
     {
@@ -39,6 +56,16 @@ struct cbe_decode_process
         int level;
         bool next_object_is_map_key;
     } container;
+    const struct cbe_string_table* timezone_table;
+    const struct cbe_string_table* map_key_table;
+    struct
+    {
+        // Where declared keys go (see cbe_decode_set_key_dictionary()).
+        struct cbe_string_table* table;
+        // Set while the top level container is a metadata map.
+        bool is_inside_header;
+        key_dictionary_state state;
+    } key_dictionary;
     bool is_inside_map[];
 };
 typedef struct cbe_decode_process cbe_decode_process;
@@ -51,9 +78,11 @@ typedef struct cbe_decode_process cbe_decode_process;
 #define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
 #define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
 
+// Safe to invoke more than once on the same exit path: only the bytes
+// consumed since the last update are added to the stream offset.
 #define UPDATE_STREAM_OFFSET(PROCESS) \
-    *(PROCESS)->buffer.bytes_consumed = (PROCESS)->buffer.position - (PROCESS)->buffer.start; \
-    (PROCESS)->stream_offset += *(PROCESS)->buffer.bytes_consumed
+    (PROCESS)->stream_offset += ((PROCESS)->buffer.position - (PROCESS)->buffer.start) - *(PROCESS)->buffer.bytes_consumed; \
+    *(PROCESS)->buffer.bytes_consumed = (PROCESS)->buffer.position - (PROCESS)->buffer.start
 
 
 // ==============
@@ -65,6 +94,7 @@ typedef struct cbe_decode_process cbe_decode_process;
     { \
         KSLOG_DEBUG("STOP AND EXIT: Require %d bytes but only %d available.", \
             (BYTE_COUNT), get_remaining_space_in_buffer(PROCESS)); \
+        (PROCESS)->buffer.position = (PROCESS)->buffer.object_start; \
         UPDATE_STREAM_OFFSET(PROCESS); \
         return CBE_DECODE_STATUS_NEED_MORE_DATA; \
     }
@@ -75,6 +105,7 @@ typedef struct cbe_decode_process cbe_decode_process;
         unlikely_if(bytes_read <= 0) \
         { \
             KSLOG_DEBUG("STOP AND EXIT: Not enough space remaining to read data (%d).", bytes_read); \
+            (PROCESS)->buffer.position = (PROCESS)->buffer.object_start; \
             UPDATE_STREAM_OFFSET(PROCESS); \
             return CBE_DECODE_STATUS_NEED_MORE_DATA; \
         } \
@@ -138,6 +169,14 @@ typedef struct cbe_decode_process cbe_decode_process;
         return CBE_DECODE_STATUS_STOPPED_IN_CALLBACK; \
     }
 
+#define STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(PROCESS, IS_OUT_OF_RANGE) \
+    unlikely_if(IS_OUT_OF_RANGE) \
+    { \
+        KSLOG_DEBUG("STOP AND EXIT: Value doesn't fit any of the callbacks that are set"); \
+        UPDATE_STREAM_OFFSET(PROCESS); \
+        return CBE_DECODE_ERROR_VALUE_OUT_OF_RANGE; \
+    }
+
 #define STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(PROCESS) \
     unlikely_if((PROCESS)->container.level + 1 >= (PROCESS)->container.max_depth) \
     { \
@@ -191,6 +230,87 @@ DEFINE_READ_FUNCTION(uint64_t,    uint64)
 DEFINE_READ_FUNCTION(float,       float32)
 DEFINE_READ_FUNCTION(double,      float64)
 
+static inline uint128_ct read_uint128(cbe_decode_process* const process)
+{
+    const uint128_ct value = (uint128_ct)read_uint64_le(process->buffer.position + 8) << 64 |
+                             read_uint64_le(process->buffer.position);
+    KSLOG_DATA_DEBUG(process->buffer.position, sizeof(value), NULL);
+    consume_bytes(process, sizeof(value));
+    return value;
+}
+
+static inline float128_ct read_float128(cbe_decode_process* const process)
+{
+    const uint128_ct bits = read_uint128(process);
+    float128_ct value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline dec128_ct read_decimal128(cbe_decode_process* const process)
+{
+    const uint128_ct bits = read_uint128(process);
+    dec128_ct value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline bool fits_in_decimal_64(const uint128_ct significand, const int exponent)
+{
+    return significand <= MAX_DECIMAL_64_SIGNIFICAND &&
+           exponent >= MIN_DECIMAL_64_EXPONENT &&
+           exponent <= MAX_DECIMAL_64_EXPONENT;
+}
+
+static inline bool fits_in_decimal_128(const uint128_ct significand, const int exponent)
+{
+    return significand <= MAX_DECIMAL_128_SIGNIFICAND &&
+           exponent >= MIN_DECIMAL_128_EXPONENT &&
+           exponent <= MAX_DECIMAL_128_EXPONENT;
+}
+
+// Read a compact float's parts straight from the encoded form: an exponent
+// field of (exponent magnitude << 2) | (exponent sign << 1) | significand sign,
+// then the significand (absent for zero). Infinities and NaNs use
+// extended-length exponent fields, and have no parts.
+// Significands wider than 128 bits have no parts either.
+// Returns the number of bytes read, or 0 if more data is needed.
+static inline int read_decimal_parts(const uint8_t* const src,
+                                     const int64_t byte_count,
+                                     bool* const has_parts,
+                                     int* const sign,
+                                     uint128_ct* const significand,
+                                     int* const exponent)
+{
+    uint64_t field = 0;
+    const int field_byte_count = rvlq_decode_64(&field, src, byte_count);
+    unlikely_if(field_byte_count <= 0)
+    {
+        return 0;
+    }
+    *has_parts = field_byte_count == rvlq_encoded_size_64(field) && (field >> 2) <= INT32_MAX;
+    unlikely_if(!*has_parts)
+    {
+        return field_byte_count;
+    }
+
+    *sign = (field & 1) ? -1 : 1;
+    unlikely_if((field >> 1) == 1)
+    {
+        *significand = 0;
+        *exponent = 0;
+        return field_byte_count;
+    }
+    *exponent = (field & 2) ? -(int)(field >> 2) : (int)(field >> 2);
+    const int significand_byte_count = rvlq_decode_128(significand, src + field_byte_count, byte_count - field_byte_count);
+    unlikely_if(significand_byte_count <= 0)
+    {
+        *has_parts = false;
+        return significand_byte_count < 0 ? field_byte_count : 0;
+    }
+    return field_byte_count + significand_byte_count;
+}
+
 static inline cbe_decode_status begin_object(cbe_decode_process* process, const int64_t initial_byte_count)
 {
     KSLOG_DEBUG("(process %p, initial_byte_count %d)", process, initial_byte_count);
@@ -211,16 +331,173 @@ static inline void end_object(cbe_decode_process* process)
     swap_map_key_value_status(process);
 }
 
+// Read the timezone ID that precedes a time or timestamp's value.
+static cbe_decode_status decode_timezone_id(cbe_decode_process* const process, int* const timezone_id)
+{
+    KSLOG_DEBUG("(process %p)", process);
+    const struct cbe_string_table* const table = process->timezone_table;
+    unlikely_if(table == NULL)
+    {
+        KSLOG_DEBUG("Timezone ID without a timezone table");
+        return CBE_DECODE_ERROR_INVALID_TIMEZONE_ID;
+    }
+
+    uint64_t index = 0;
+    const int byte_count = rvlq_decode_64(&index, process->buffer.position, get_remaining_space_in_buffer(process));
+    unlikely_if(byte_count < 0 || (byte_count > 0 && index >= (uint64_t)cbe_string_table_get_entry_count(table)))
+    {
+        KSLOG_DEBUG("Timezone ID that isn't in the timezone table");
+        return CBE_DECODE_ERROR_INVALID_TIMEZONE_ID;
+    }
+    STOP_AND_EXIT_IF_READ_FAILED(process, byte_count);
+
+    *timezone_id = (int)index;
+    return CBE_DECODE_STATUS_OK;
+}
+
+static inline bool is_map_key_symbol_candidate(const cbe_decode_process* const process)
+{
+    return process->map_key_table != NULL &&
+           process->callbacks->on_map_key_symbol != NULL &&
+           process->array.type == ARRAY_TYPE_STRING &&
+           process->is_inside_map[process->container.level] &&
+           process->container.next_object_is_map_key &&
+           process->array.byte_count <= cbe_string_table_get_longest_byte_count(process->map_key_table);
+}
+
+static inline bool is_key_dictionary_declaration_candidate(const cbe_decode_process* const process)
+{
+    return process->key_dictionary.table != NULL &&
+           process->key_dictionary.is_inside_header &&
+           process->container.level == 1 &&
+           process->container.next_object_is_map_key &&
+           process->array.type == ARRAY_TYPE_STRING &&
+           process->array.byte_count == sizeof(KEY_DICTIONARY_METADATA_KEY) - 1;
+}
+
+// A key dictionary declaration must be a list of strings.
+static cbe_decode_status check_key_dictionary_declaration(cbe_decode_process* const process, const cbe_type_field type)
+{
+    KSLOG_DEBUG("(process %p, type %02x)", process, type);
+    if(process->key_dictionary.state == KEY_DICTIONARY_AWAITING_LIST)
+    {
+        unlikely_if(type != TYPE_LIST)
+        {
+            KSLOG_DEBUG("Key dictionary isn't a list");
+            return CBE_DECODE_ERROR_INVALID_KEY_DICTIONARY;
+        }
+        process->key_dictionary.state = KEY_DICTIONARY_COLLECTING;
+        return CBE_DECODE_STATUS_OK;
+    }
+
+    if(type == TYPE_END_CONTAINER)
+    {
+        process->key_dictionary.state = KEY_DICTIONARY_IDLE;
+        return CBE_DECODE_STATUS_OK;
+    }
+    unlikely_if(type != TYPE_STRING && (type < TYPE_STRING_0 || type > TYPE_STRING_15))
+    {
+        KSLOG_DEBUG("Key dictionary entry isn't a string");
+        return CBE_DECODE_ERROR_INVALID_KEY_DICTIONARY;
+    }
+    return CBE_DECODE_STATUS_OK;
+}
+
+// Declared keys are validated and added to the table once they're entirely
+// in the buffer, and aren't validated again when they're reported.
+static cbe_decode_status add_key_dictionary_entry(cbe_decode_process* const process)
+{
+    KSLOG_DEBUG("(process %p)", process);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, process->array.byte_count);
+    unlikely_if(!cbe_validate_string(process->buffer.position, process->array.byte_count))
+    {
+        return CBE_DECODE_ERROR_INVALID_ARRAY_DATA;
+    }
+
+    struct cbe_string_table* const table = process->key_dictionary.table;
+    const int expected_id = cbe_string_table_get_entry_count(table);
+    unlikely_if(cbe_string_table_add(table, (const char*)process->buffer.position, process->array.byte_count) != expected_id)
+    {
+        KSLOG_DEBUG("Key dictionary entry is a duplicate, or the table is full");
+        return CBE_DECODE_ERROR_INVALID_KEY_DICTIONARY;
+    }
+    process->array.is_prevalidated = true;
+    return CBE_DECODE_STATUS_OK;
+}
+
+// Report a key reference as the declared key it refers to.
+static cbe_decode_status decode_key_reference(cbe_decode_process* const process)
+{
+    KSLOG_DEBUG("(process %p)", process);
+    const struct cbe_string_table* const table = process->key_dictionary.table;
+    unlikely_if(table == NULL ||
+                !process->is_inside_map[process->container.level] ||
+                !process->container.next_object_is_map_key)
+    {
+        KSLOG_DEBUG("Key reference without a key dictionary, or outside of a map key");
+        return CBE_DECODE_ERROR_INVALID_KEY_REFERENCE;
+    }
+
+    uint128_ct index = 0;
+    const int byte_count = rvlq_decode_128(&index, process->buffer.position, get_remaining_space_in_buffer(process));
+    unlikely_if(byte_count < 0 || (byte_count > 0 && index >= (uint128_ct)cbe_string_table_get_entry_count(table)))
+    {
+        KSLOG_DEBUG("Key reference to an undeclared key");
+        return CBE_DECODE_ERROR_INVALID_KEY_REFERENCE;
+    }
+    STOP_AND_EXIT_IF_READ_FAILED(process, byte_count);
+
+    const int id = (int)index;
+    int64_t key_byte_count = 0;
+    const uint8_t* const key = (const uint8_t*)cbe_string_table_get(table, id, &key_byte_count);
+    KSLOG_DEBUG("Key reference %d", id);
+    if(process->callbacks->on_map_key_symbol != NULL)
+    {
+        const int symbol_id = cbe_string_table_find_hashed(process->map_key_table,
+                                                           cbe_string_table_get_hash(table, id),
+                                                           key,
+                                                           key_byte_count);
+        if(symbol_id >= 0)
+        {
+            STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_map_key_symbol(process, symbol_id));
+            return CBE_DECODE_STATUS_OK;
+        }
+    }
+    STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_string_begin(process, key_byte_count));
+    STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_array_data(process, key, key_byte_count));
+    return CBE_DECODE_STATUS_OK;
+}
+
 static cbe_decode_status begin_array(cbe_decode_process* const process, array_type type, int64_t byte_count)
 {
     KSLOG_DEBUG("(process %p, array_type %d)", process, type);
 
     process->array.is_inside_array = true;
     process->array.has_reported_byte_count = false;
+    process->array.is_prevalidated = false;
+    process->array.utf8_context = (cbe_utf8_context){0};
     process->array.type = type;
     process->array.current_offset = 0;
     process->array.is_reading_byte_count = byte_count < 0;
     process->array.byte_count = byte_count >= 0 ? byte_count : 0;
+    process->array.element_size_shift = 0;
+
+    return CBE_DECODE_STATUS_OK;
+}
+
+static cbe_decode_status begin_typed_array(cbe_decode_process* const process, const int element_type)
+{
+    KSLOG_DEBUG("(process %p, element_type %d)", process, element_type);
+
+    const int element_size_shift = get_typed_array_element_size_shift(element_type);
+    unlikely_if(element_size_shift < 0 || process->callbacks->on_typed_array_begin == NULL)
+    {
+        KSLOG_DEBUG("Unsupported typed array of element type %d", element_type);
+        return CBE_DECODE_ERROR_INVALID_ARRAY_DATA;
+    }
+    begin_array(process, ARRAY_TYPE_TYPED, -1);
+    process->array.element_type = (cbe_typed_array_type)element_type;
+    process->array.element_size_shift = element_size_shift;
 
     return CBE_DECODE_STATUS_OK;
 }
@@ -229,19 +506,71 @@ static cbe_decode_status stream_array(cbe_decode_process* const process)
 {
     KSLOG_DEBUG("(process %p)", process);
 
+    // The array state is kept in the process, so everything read up to here
+    // (and each length byte below) has been fully consumed.
+    process->buffer.object_start = process->buffer.position;
+
     while(process->array.is_reading_byte_count)
     {
         STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, 1);
         uint8_t byte = read_uint8(process);
+        process->buffer.object_start = process->buffer.position;
         KSLOG_DEBUG("Read byte %02x", byte);
         process->array.byte_count = process->array.byte_count << 7 | (byte & 0x7f);
         if((byte & 0x80) == 0)
         {
             process->array.is_reading_byte_count = false;
+            // Typed arrays are measured in elements.
+            unlikely_if(process->array.byte_count > (INT64_MAX >> process->array.element_size_shift))
+            {
+                return CBE_DECODE_ERROR_ARRAY_FIELD_LENGTH_EXCEEDED;
+            }
+            process->array.byte_count <<= process->array.element_size_shift;
         }
         KSLOG_DEBUG("Byte count = %d, is_reading = %d", process->array.byte_count, process->array.is_reading_byte_count);
     }
 
+    unlikely_if(!process->array.has_reported_byte_count && process->key_dictionary.state == KEY_DICTIONARY_COLLECTING)
+    {
+        STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, add_key_dictionary_entry(process));
+    }
+    else unlikely_if(!process->array.has_reported_byte_count && is_key_dictionary_declaration_candidate(process))
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, process->array.byte_count);
+        if(memcmp(process->buffer.position, KEY_DICTIONARY_METADATA_KEY, process->array.byte_count) == 0)
+        {
+            KSLOG_DEBUG("Key dictionary declaration");
+            process->key_dictionary.state = KEY_DICTIONARY_AWAITING_LIST;
+        }
+    }
+
+    if(!process->array.has_reported_byte_count && is_map_key_symbol_candidate(process))
+    {
+        // Wait until the entire key is buffered so that it can be validated,
+        // hashed, and looked up in a single pass.
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, process->array.byte_count);
+        uint32_t hash = 0;
+        if(!cbe_validate_string_and_hash(process->buffer.position, process->array.byte_count, &hash))
+        {
+            return CBE_DECODE_ERROR_INVALID_ARRAY_DATA;
+        }
+        const int symbol_id = cbe_string_table_find_hashed(process->map_key_table,
+                                                           hash,
+                                                           process->buffer.position,
+                                                           process->array.byte_count);
+        if(symbol_id >= 0)
+        {
+            KSLOG_DEBUG("Map key symbol %d", symbol_id);
+            process->array.has_reported_byte_count = true;
+            STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_map_key_symbol(process, symbol_id));
+            consume_bytes(process, process->array.byte_count);
+            end_object(process);
+            process->array.is_inside_array = false;
+            return CBE_DECODE_STATUS_OK;
+        }
+        process->array.is_prevalidated = true;
+    }
+
     if(!process->array.has_reported_byte_count)
     {
         process->array.has_reported_byte_count = true;
@@ -260,6 +589,10 @@ static cbe_decode_status stream_array(cbe_decode_process* const process)
             case ARRAY_TYPE_COMMENT:
                 STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_comment_begin(process, process->array.byte_count));
                 break;
+            case ARRAY_TYPE_TYPED:
+                STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_typed_array_begin(process,
+                    process->array.element_type, process->array.byte_count >> process->array.element_size_shift));
+                break;
             default:
                 KSLOG_ERROR("%d: Unknown array type", process->array.type);
                 return CBE_DECODE_ERROR_INTERNAL_BUG;
@@ -268,7 +601,9 @@ static cbe_decode_status stream_array(cbe_decode_process* const process)
 
     const int64_t bytes_in_array = process->array.byte_count - process->array.current_offset;
     const int64_t space_in_buffer = get_remaining_space_in_buffer(process);
-    const int64_t bytes_to_stream = bytes_in_array <= space_in_buffer ? bytes_in_array : space_in_buffer;
+    int64_t bytes_to_stream = bytes_in_array <= space_in_buffer ? bytes_in_array : space_in_buffer;
+    // Only whole typed array elements are delivered. The rest stays in the buffer.
+    bytes_to_stream &= ~(((int64_t)1 << process->array.element_size_shift) - 1);
 
     KSLOG_DEBUG("Length: arr %d vs buf %d: %d bytes", bytes_in_array, space_in_buffer, bytes_to_stream);
     KSLOG_DATA_TRACE(process->buffer.position, bytes_to_stream, NULL);
@@ -278,7 +613,8 @@ static cbe_decode_status stream_array(cbe_decode_process* const process)
             STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_array_data(process, process->buffer.position, bytes_to_stream));
             break;
         case ARRAY_TYPE_STRING:
-            if(!cbe_validate_string(process->buffer.position, bytes_to_stream))
+            if(!process->array.is_prevalidated &&
+               !cbe_validate_string_chunk(&process->array.utf8_context, process->buffer.position, bytes_to_stream))
             {
                 return CBE_DECODE_ERROR_INVALID_ARRAY_DATA;
             }
@@ -292,21 +628,29 @@ static cbe_decode_status stream_array(cbe_decode_process* const process)
             STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_array_data(process, process->buffer.position, bytes_to_stream));
             break;
         case ARRAY_TYPE_COMMENT:
-            if(!cbe_validate_comment(process->buffer.position, bytes_to_stream))
+            if(!cbe_validate_comment_chunk(&process->array.utf8_context, process->buffer.position, bytes_to_stream))
             {
                 return CBE_DECODE_ERROR_INVALID_ARRAY_DATA;
             }
             STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_array_data(process, process->buffer.position, bytes_to_stream));
             break;
+        case ARRAY_TYPE_TYPED:
+            if(bytes_to_stream > 0)
+            {
+                STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_typed_array_data(process,
+                    process->buffer.position, bytes_to_stream >> process->array.element_size_shift));
+            }
+            break;
         default:
             KSLOG_ERROR("%d: Unknown array type", process->array.type);
             return CBE_DECODE_ERROR_INTERNAL_BUG;
     }
     consume_bytes(process, bytes_to_stream);
+    process->buffer.object_start = process->buffer.position;
     process->array.current_offset += bytes_to_stream;
 
     KSLOG_DEBUG("Streamed %d bytes into array", bytes_to_stream);
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, bytes_in_array - space_in_buffer);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, bytes_in_array - bytes_to_stream);
     end_object(process);
     process->array.is_inside_array = false;
 
@@ -363,8 +707,10 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
 
     process->buffer.start = data_start;
     process->buffer.position = data_start;
+    process->buffer.object_start = data_start;
     process->buffer.end = data_start + *byte_count;
     process->buffer.bytes_consumed = byte_count;
+    *byte_count = 0;
 
     #define BEGIN_OBJECT(SIZE) \
         STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, begin_object(process, SIZE));
@@ -380,8 +726,14 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
 
     while(process->buffer.position < process->buffer.end)
     {
+        process->buffer.object_start = process->buffer.position;
         const cbe_type_field type = read_uint8(process);
 
+        unlikely_if(process->key_dictionary.state != KEY_DICTIONARY_IDLE && type != TYPE_PADDING)
+        {
+            STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, check_key_dictionary_declaration(process, type));
+        }
+
         switch(type)
         {
             case TYPE_PADDING:
@@ -442,6 +794,10 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 process->container.level++;
                 process->is_inside_map[process->container.level] = true;
                 process->container.next_object_is_map_key = true;
+                unlikely_if(process->container.level == 1)
+                {
+                    process->key_dictionary.is_inside_header = true;
+                }
                 break;
             case TYPE_END_CONTAINER:
                 KSLOG_DEBUG("<End Container>");
@@ -450,6 +806,10 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 END_OBJECT();
                 process->container.level--;
                 process->container.next_object_is_map_key = process->is_inside_map[process->container.level];
+                unlikely_if(process->container.level == 0)
+                {
+                    process->key_dictionary.is_inside_header = false;
+                }
                 break;
 
             case TYPE_STRING_0: case TYPE_STRING_1: case TYPE_STRING_2: case TYPE_STRING_3:
@@ -470,6 +830,25 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_ ## NOTIFY_FRAGMENT(process, SIGN, read_ ## READ_FRAGMENT(process))); \
                 END_OBJECT();
 
+            // Integers that don't fit in 64 bits go to on_integer_128().
+            #define HANDLE_CASE_VARIABLE_INTEGER(SIGN) \
+            { \
+                uint128_ct value = 0; \
+                const int byte_count = rvlq_decode_128(&value, process->buffer.position, process->buffer.end - process->buffer.position); \
+                STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, byte_count < 0); \
+                STOP_AND_EXIT_IF_READ_FAILED(process, byte_count); \
+                likely_if((value >> 64) == 0) \
+                { \
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_integer(process, SIGN, (uint64_t)value)); \
+                } \
+                else \
+                { \
+                    STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, process->callbacks->on_integer_128 == NULL); \
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_integer_128(process, SIGN, value)); \
+                } \
+                END_OBJECT(); \
+            }
+
             case TYPE_INT_NEG_8:
                 HANDLE_CASE_INTEGER(uint8_t, -1, uint8, integer);
                 break;
@@ -483,12 +862,8 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 HANDLE_CASE_INTEGER(uint64_t, -1, uint64, integer);
                 break;
             case TYPE_INT_NEG:
-            {
-                uint64_t value = 0;
-                STOP_AND_EXIT_IF_READ_FAILED(process, rvlq_decode_64(&value, process->buffer.position, process->buffer.end - process->buffer.position));
-                STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_integer(process, -1, value));
+                HANDLE_CASE_VARIABLE_INTEGER(-1);
                 break;
-            }
             case TYPE_INT_POS_8:
                 HANDLE_CASE_INTEGER(uint8_t, 1, uint8, integer);
                 break;
@@ -502,10 +877,17 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 HANDLE_CASE_INTEGER(uint64_t, 1, uint64, integer);
                 break;
             case TYPE_INT_POS:
+                HANDLE_CASE_VARIABLE_INTEGER(1);
+                break;
+            case TYPE_INT_POS_128:
+            case TYPE_INT_NEG_128:
             {
-                uint64_t value = 0;
-                STOP_AND_EXIT_IF_READ_FAILED(process, rvlq_decode_64(&value, process->buffer.position, process->buffer.end - process->buffer.position));
-                STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_integer(process, 1, value));
+                KSLOG_DEBUG("<int128>");
+                STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, process->callbacks->on_integer_128 == NULL);
+                BEGIN_OBJECT(sizeof(uint128_ct));
+                const int sign = type == TYPE_INT_NEG_128 ? -1 : 1;
+                STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_integer_128(process, sign, read_uint128(process)));
+                END_OBJECT();
                 break;
             }
 
@@ -521,11 +903,45 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
             case TYPE_FLOAT_BINARY_64:
                 HANDLE_CASE_SCALAR(double, float64, float);
                 break;
+            case TYPE_FLOAT_BINARY_128:
+                STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, process->callbacks->on_float_128 == NULL);
+                HANDLE_CASE_SCALAR(float128_ct, float128, float_128);
+                break;
+            case TYPE_FLOAT_DECIMAL_128:
+                STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, process->callbacks->on_decimal_float_128 == NULL);
+                HANDLE_CASE_SCALAR(dec128_ct, decimal128, decimal_float_128);
+                break;
             case TYPE_FLOAT_DECIMAL:
             {
+                bool has_parts = false;
+                int sign = 1;
+                uint128_ct significand = 0;
+                int exponent = 0;
+                const int byte_count = read_decimal_parts(process->buffer.position,
+                                                          process->buffer.end - process->buffer.position,
+                                                          &has_parts, &sign, &significand, &exponent);
+                const bool is_narrow = (significand >> 64) == 0;
+                likely_if(byte_count == 0 || (has_parts && is_narrow && process->callbacks->on_decimal_parts != NULL))
+                {
+                    STOP_AND_EXIT_IF_READ_FAILED(process, byte_count);
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_decimal_parts(process, sign, (uint64_t)significand, exponent));
+                    END_OBJECT();
+                    break;
+                }
+                if(has_parts && !fits_in_decimal_64(significand, exponent) && process->callbacks->on_decimal_float_128 != NULL)
+                {
+                    STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, !fits_in_decimal_128(significand, exponent));
+                    STOP_AND_EXIT_IF_READ_FAILED(process, byte_count);
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_decimal_float_128(process,
+                        make_decimal_128(sign < 0, significand, exponent)));
+                    END_OBJECT();
+                    break;
+                }
+                STOP_AND_EXIT_IF_VALUE_OUT_OF_RANGE(process, has_parts && !is_narrow);
                 dec64_ct value = 0;
                 STOP_AND_EXIT_IF_READ_FAILED(process, cfloat_decode(process->buffer.position, process->buffer.end - process->buffer.position, &value));
                 STOP_AND_EXIT_IF_FAILED_CALLBACK(process, process->callbacks->on_decimal_float(process, value));
+                END_OBJECT();
                 break;
             }
             case TYPE_DATE:
@@ -537,6 +953,7 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 KSLOG_DEBUG("Date = %d.%02d.%02d", v.year, v.month, v.day);
                 STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
                     process->callbacks->on_date(process, v.year, v.month, v.day));
+                END_OBJECT();
                 break;
             }
             case TYPE_TIME:
@@ -565,6 +982,7 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                                 v.nanosecond, v.timezone.latitude, v.timezone.longitude));
                         break;
                 }
+                END_OBJECT();
                 break;
             }
             case TYPE_TIMESTAMP:
@@ -578,6 +996,13 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                     case CT_TZ_ZERO:
                         KSLOG_DEBUG("TS = %d.%02d.%02d-%d:%02d:%02d.%09d", v.date.year, v.date.month, v.date.day,
                                 v.time.hour, v.time.minute, v.time.second, v.time.nanosecond);
+                        if(process->callbacks->on_nanotime != NULL)
+                        {
+                            STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
+                                process->callbacks->on_nanotime(process, nanotime_new(v.date.year, v.date.month, v.date.day,
+                                    v.time.hour, v.time.minute, v.time.second, v.time.nanosecond)));
+                            break;
+                        }
                         STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
                             process->callbacks->on_timestamp_tz(process, v.date.year, v.date.month, v.date.day,
                                 v.time.hour, v.time.minute, v.time.second, v.time.nanosecond, NULL));
@@ -599,9 +1024,69 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                                 v.time.timezone.latitude, v.time.timezone.longitude));
                         break;
                 }
+                END_OBJECT();
                 break;
             }
+            case TYPE_TIME_ZONE_ID:
+            {
+                KSLOG_DEBUG("<Time with Timezone ID>");
+                int timezone_id = 0;
+                STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, decode_timezone_id(process, &timezone_id));
+                ct_time v;
+                STOP_AND_EXIT_IF_READ_FAILED(process, ct_time_decode(process->buffer.position,
+                    process->buffer.end - process->buffer.position, &v));
+                unlikely_if(v.timezone.type != CT_TZ_ZERO)
+                {
+                    KSLOG_DEBUG("Timezone ID on a value that has its own timezone");
+                    return CBE_DECODE_ERROR_INVALID_TIMEZONE_ID;
+                }
+                const char* const timezone = cbe_string_table_get(process->timezone_table, timezone_id, NULL);
+                KSLOG_DEBUG("Time = %d:%02d:%02d.%09d/#%d", v.hour, v.minute, v.second, v.nanosecond, timezone_id);
+                if(process->callbacks->on_time_tzid != NULL)
+                {
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
+                        process->callbacks->on_time_tzid(process, v.hour, v.minute, v.second, v.nanosecond,
+                            timezone_id, timezone));
+                }
+                else
+                {
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
+                        process->callbacks->on_time_tz(process, v.hour, v.minute, v.second, v.nanosecond, timezone));
+                }
+                END_OBJECT();
+                break;
+            }
+            case TYPE_TIMESTAMP_ZONE_ID:
+            {
+                KSLOG_DEBUG("<Timestamp with Timezone ID>");
+                int timezone_id = 0;
+                STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, decode_timezone_id(process, &timezone_id));
+                ct_timestamp v;
+                STOP_AND_EXIT_IF_READ_FAILED(process, ct_timestamp_decode(process->buffer.position,
+                    process->buffer.end - process->buffer.position, &v));
+                unlikely_if(v.time.timezone.type != CT_TZ_ZERO)
+                {
+                    KSLOG_DEBUG("Timezone ID on a value that has its own timezone");
+                    return CBE_DECODE_ERROR_INVALID_TIMEZONE_ID;
+                }
+                const char* const timezone = cbe_string_table_get(process->timezone_table, timezone_id, NULL);
+                KSLOG_DEBUG("TS = %d.%02d.%02d-%d:%02d:%02d.%09d/#%d", v.date.year, v.date.month, v.date.day,
+                        v.time.hour, v.time.minute, v.time.second, v.time.nanosecond, timezone_id);
+                if(process->callbacks->on_timestamp_tzid != NULL)
+                {
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
+                        process->callbacks->on_timestamp_tzid(process, v.date.year, v.date.month, v.date.day,
+                            v.time.hour, v.time.minute, v.time.second, v.time.nanosecond, timezone_id, timezone));
+                }
+                else
+                {
+                    STOP_AND_EXIT_IF_FAILED_CALLBACK(process,
+                        process->callbacks->on_timestamp_tz(process, v.date.year, v.date.month, v.date.day,
+                            v.time.hour, v.time.minute, v.time.second, v.time.nanosecond, timezone));
+                }
+                END_OBJECT();
                 break;
+            }
             case TYPE_STRING:
             {
                 KSLOG_DEBUG("<String>");
@@ -630,6 +1115,21 @@ cbe_decode_status cbe_decode_feed(cbe_decode_process* const process,
                 STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, stream_array(process));
                 break;
             }
+            case TYPE_TYPED_ARRAY:
+            {
+                KSLOG_DEBUG("<Typed Array>");
+                BEGIN_NONKEYABLE_OBJECT(1);
+                STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, begin_typed_array(process, read_uint8(process)));
+                STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, stream_array(process));
+                break;
+            }
+            case TYPE_KEY_REFERENCE:
+            {
+                KSLOG_DEBUG("<Key Reference>");
+                STOP_AND_EXIT_IF_DECODE_STATUS_NOT_OK(process, decode_key_reference(process));
+                END_OBJECT();
+                break;
+            }
             default:
                 if(type < TYPE_SMALLINT_MIN || type > TYPE_SMALLINT_MAX)
                 {
@@ -668,6 +1168,27 @@ int64_t cbe_decode_get_stream_offset(cbe_decode_process* const process)
     return process->stream_offset;
 }
 
+void cbe_decode_set_timezone_table(cbe_decode_process* const process,
+                                   const struct cbe_string_table* const timezone_table)
+{
+    KSLOG_DEBUG("(process %p, timezone_table %p)", process, timezone_table);
+    process->timezone_table = timezone_table;
+}
+
+void cbe_decode_set_map_key_table(cbe_decode_process* const process,
+                                  const struct cbe_string_table* const map_key_table)
+{
+    KSLOG_DEBUG("(process %p, map_key_table %p)", process, map_key_table);
+    process->map_key_table = map_key_table;
+}
+
+void cbe_decode_set_key_dictionary(cbe_decode_process* const process,
+                                   struct cbe_string_table* const key_dictionary)
+{
+    KSLOG_DEBUG("(process %p, key_dictionary %p)", process, key_dictionary);
+    process->key_dictionary.table = key_dictionary;
+}
+
 cbe_decode_status cbe_decode_end(cbe_decode_process* const process)
 {
     KSLOG_DEBUG("(process %p)", process);
@@ -676,6 +1197,12 @@ cbe_decode_status cbe_decode_end(cbe_decode_process* const process)
         return CBE_DECODE_ERROR_INVALID_ARGUMENT;
     }
 
+    // The last fed buffer (and its byte count) may no longer exist.
+    static const uint8_t empty_buffer[1] = {0};
+    int64_t bytes_consumed = 0;
+    process->buffer.start = process->buffer.position = process->buffer.end = empty_buffer;
+    process->buffer.bytes_consumed = &bytes_consumed;
+
     STOP_AND_EXIT_IF_IS_INSIDE_CONTAINER(process);
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
 
@@ -2,6 +2,7 @@
 #include <compact_float/compact_float.h>
 #include <compact_time/compact_time.h>
 #include <endianness/endianness.h>
+#include <math.h>
 #include <vlq/vlq.h>
 
 // #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
@@ -12,6 +13,29 @@
 // Data
 // ====
 
+// Must hold the largest object that isn't array data.
+#define MEASURE_SCRATCH_SIZE 256
+
+// An entry in the canonical map index. Each sorted map that is open gets a
+// frame, followed by one entry per key-value pair, as buffer offsets.
+typedef union
+{
+    struct
+    {
+        int64_t start;
+        int64_t value_start;
+        int64_t end;
+    } entry;
+    struct
+    {
+        // The enclosing sorted map's frame (only valid if index > 0).
+        int64_t previous;
+        int64_t contents_start;
+        int32_t level;
+        uint32_t buffer_generation;
+    } frame;
+} canonical_slot;
+
 struct cbe_encode_process
 {
     struct
@@ -19,24 +43,118 @@ struct cbe_encode_process
         const uint8_t* start;
         const uint8_t* end;
         uint8_t* position;
+        // Changes whenever the buffer's contents are handed back to the
+        // caller, after which older savepoints can't be rolled back to.
+        uint32_t generation;
+        // Where start is in the document, counting the bytes that are no
+        // longer in the buffer (not used in measure mode).
+        int64_t document_offset;
     } buffer;
     struct
+    {
+        // When set, the process owns the buffer and grows it instead of
+        // returning CBE_ENCODE_STATUS_NEED_MORE_ROOM.
+        cbe_realloc_function realloc;
+        void* context;
+    } allocator;
+    // When set, the process moves on to the pool's next page when the
+    // current one fills up.
+    struct cbe_page_pool* page_pool;
+    // In paged mode, byte and string payloads of at least this many bytes
+    // are referenced instead of copied (0 = always copy).
+    int64_t reference_threshold;
+    // When set, padding is added so that fixed width scalar payloads start
+    // at a multiple of their size, and byte and typed array contents at a
+    // multiple of this (or of the element size, if larger).
+    int alignment;
+    struct
+    {
+        // When set, the output is canonical (see cbe_encode_set_canonical()).
+        bool is_enabled;
+        // Set once a map has had more entries than the index can hold.
+        bool is_index_full;
+        canonical_slot* index;
+        int64_t capacity;
+        // The index is in use (a sorted map is open) while this is nonzero.
+        int64_t count;
+        // Where the innermost open sorted map's frame is in the index.
+        int64_t frame;
+    } canonical;
+    struct
     {
         bool is_inside_array;
         array_type type;
         int64_t current_offset;
         int64_t byte_count;
+        cbe_utf8_context utf8_context;
     } array;
     struct
     {
         int max_depth;
         int level;
+        // Shards start at their parent's level, and can't close its containers.
+        int base_level;
         bool next_object_is_map_key;
+        // Tracked for cbe_encode_get_fragment().
+        int deepest_level;
+        // Restored when a top level container ends, so that top level objects
+        // keep alternating between key and value status.
+        bool top_level_status_after_container;
+        // Bit 0 (1) is set once an object that can't be a map key has been
+        // added at an even (odd) position at the top level.
+        uint8_t unkeyable_top_level_positions;
     } container;
+    const struct cbe_string_table* timezone_table;
+    struct
+    {
+        // Map keys in this table are encoded as references once it has been
+        // declared (see cbe_encode_add_key_dictionary()).
+        const struct cbe_string_table* table;
+        // The number of keys that were declared.
+        int entry_count;
+    } key_dictionary;
+    struct
+    {
+        // When set, the process only counts the bytes it would have written,
+        // cycling a scratch area after is_inside_map as the buffer.
+        bool is_measuring;
+        int64_t byte_count;
+    } measure;
     bool is_inside_map[];
 };
 typedef struct cbe_encode_process cbe_encode_process;
 
+// A savepoint records whether each of this many innermost containers is a map.
+#define SAVEPOINT_MAX_ENCLOSING_MAPS 64
+
+// The contents of a struct cbe_savepoint.
+typedef struct
+{
+    int64_t buffer_offset;
+    int64_t document_offset;
+    int64_t measured_byte_count;
+    int64_t array_current_offset;
+    int64_t array_byte_count;
+    int64_t canonical_count;
+    int64_t canonical_frame;
+    // Bit n is is_inside_map for n levels out from container_level.
+    uint64_t enclosing_maps;
+    const struct cbe_string_table* key_dictionary;
+    cbe_page_pool_mark page_pool_mark;
+    cbe_utf8_context utf8_context;
+    uint32_t buffer_generation;
+    int container_level;
+    int deepest_level;
+    int key_dictionary_entry_count;
+    array_type array_type;
+    bool is_inside_array;
+    bool next_object_is_map_key;
+    bool top_level_status_after_container;
+    uint8_t unkeyable_top_level_positions;
+    bool canonical_is_index_full;
+} encode_savepoint;
+_Static_assert(sizeof(encode_savepoint) <= sizeof(struct cbe_savepoint), "struct cbe_savepoint is too small");
+
 typedef uint8_t cbe_encoded_type_field;
 
 
@@ -56,7 +174,8 @@ typedef uint8_t cbe_encoded_type_field;
 // ==============
 
 #define STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(PROCESS, REQUIRED_BYTES) \
-    unlikely_if(buff_remaining_length(PROCESS) < (int64_t)(REQUIRED_BYTES)) \
+    unlikely_if(buff_remaining_length(PROCESS) < (int64_t)(REQUIRED_BYTES) && \
+                !grow_buffer(PROCESS, REQUIRED_BYTES)) \
     { \
         KSLOG_DEBUG("STOP AND EXIT: Require %d bytes but only %d available.", \
             (REQUIRED_BYTES), buff_remaining_length(PROCESS)); \
@@ -66,6 +185,18 @@ typedef uint8_t cbe_encoded_type_field;
 #define STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(PROCESS, REQUIRED_BYTES) \
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(PROCESS, ((REQUIRED_BYTES) + sizeof(cbe_encoded_type_field)))
 
+// Lists added in a single call may span pages, so they get their own check.
+#define STOP_AND_EXIT_IF_LIST_WONT_FIT(PROCESS, REQUIRED_BYTES) \
+    likely_if((PROCESS)->page_pool == NULL) \
+    { \
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(PROCESS, REQUIRED_BYTES); \
+    } \
+    else unlikely_if(!paged_list_will_fit(PROCESS, REQUIRED_BYTES)) \
+    { \
+        KSLOG_DEBUG("STOP AND EXIT: %d byte list won't fit in the page pool", (REQUIRED_BYTES)); \
+        return CBE_ENCODE_STATUS_NEED_MORE_ROOM; \
+    }
+
 #define STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(PROCESS) \
     unlikely_if((PROCESS)->array.is_inside_array) \
     { \
@@ -99,14 +230,14 @@ typedef uint8_t cbe_encoded_type_field;
     }
 
 #define STOP_AND_EXIT_IF_IS_NOT_INSIDE_CONTAINER(PROCESS) \
-    unlikely_if((PROCESS)->container.level <= 0) \
+    unlikely_if((PROCESS)->container.level <= (PROCESS)->container.base_level) \
     { \
         KSLOG_DEBUG("STOP AND EXIT: We're not inside a container"); \
         return CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS; \
     }
 
 #define STOP_AND_EXIT_IF_IS_INSIDE_CONTAINER(PROCESS) \
-    unlikely_if((PROCESS)->container.level != 0) \
+    unlikely_if((PROCESS)->container.level != (PROCESS)->container.base_level) \
     { \
         KSLOG_DEBUG("STOP AND EXIT: There are still open containers when there shouldn't be"); \
         return CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS; \
@@ -129,6 +260,29 @@ typedef uint8_t cbe_encoded_type_field;
     }
 
 
+#define STOP_AND_EXIT_IF_MAP_INDEX_IS_FULL(PROCESS) \
+    unlikely_if(should_sort_maps(PROCESS) && (PROCESS)->canonical.count >= (PROCESS)->canonical.capacity) \
+    { \
+        KSLOG_DEBUG("STOP AND EXIT: The canonical map index is full"); \
+        return CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT; \
+    }
+
+// Fragment objects at even positions land on keys if a key is expected, and
+// odd ones land on keys if a value is expected.
+#define STOP_AND_EXIT_IF_FRAGMENT_IS_MISPLACED(PROCESS, FRAGMENT) \
+    unlikely_if((PROCESS)->is_inside_map[(PROCESS)->container.level] && \
+        ((FRAGMENT)->unkeyable_positions & (1 << !(PROCESS)->container.next_object_is_map_key))) \
+    { \
+        KSLOG_DEBUG("STOP AND EXIT: Fragment has an invalid map key type"); \
+        return CBE_ENCODE_ERROR_INCORRECT_MAP_KEY_TYPE; \
+    } \
+    unlikely_if((PROCESS)->container.level + (FRAGMENT)->container_depth >= (PROCESS)->container.max_depth) \
+    { \
+        KSLOG_DEBUG("STOP AND EXIT: Max depth %d exceeded", (PROCESS)->container.max_depth); \
+        return CBE_ENCODE_ERROR_MAX_CONTAINER_DEPTH_EXCEEDED; \
+    }
+
+
 // =======
 // Utility
 // =======
@@ -145,6 +299,15 @@ typedef uint8_t cbe_encoded_type_field;
 #define FITS_IN_DECIMAL_32(VALUE) ((VALUE) == (dec32_ct)(VALUE))
 #define FITS_IN_DECIMAL_64(VALUE) ((VALUE) == (dec64_ct)(VALUE))
 
+#define MIN_GROWABLE_BUFFER_SIZE 64
+
+// A memory page.
+#define MAX_ALIGNMENT 4096
+
+// Upper bound for a decimal float or a time with a timezone string
+// (up to 127 characters), including the type field.
+#define MAX_VARIABLE_LENGTH_SCALAR_SIZE 160
+
 static inline int64_t minimum_int64(const int64_t a, const int64_t b)
 {
     return a < b ? a : b;
@@ -155,9 +318,320 @@ static inline int64_t buff_remaining_length(cbe_encode_process* const process)
     return process->buffer.end - process->buffer.position;
 }
 
+static inline int64_t get_document_offset(cbe_encode_process* const process)
+{
+    const int64_t buffer_offset = process->buffer.position - process->buffer.start;
+    unlikely_if(process->measure.is_measuring)
+    {
+        return process->measure.byte_count + buffer_offset;
+    }
+    return process->buffer.document_offset + buffer_offset;
+}
+
+// Move on to the next page of the pool, if required_bytes will fit in a page.
+static bool advance_page(cbe_encode_process* const process, const int64_t required_bytes)
+{
+    unlikely_if(required_bytes > cbe_page_pool_get_page_size(process->page_pool))
+    {
+        KSLOG_DEBUG("%d bytes won't fit in a page", required_bytes);
+        return false;
+    }
+    uint8_t* const page = cbe_page_pool_next_page(process->page_pool, process->buffer.position);
+    unlikely_if(page == NULL)
+    {
+        return false;
+    }
+    process->buffer.document_offset = get_document_offset(process);
+    process->buffer.start = page;
+    process->buffer.position = page;
+    process->buffer.end = page + cbe_page_pool_get_page_size(process->page_pool);
+    return true;
+}
+
+// Count what's in the scratch area, and start writing over it again.
+static bool recycle_measure_scratch(cbe_encode_process* const process, const int64_t required_bytes)
+{
+    unlikely_if(required_bytes > MEASURE_SCRATCH_SIZE)
+    {
+        KSLOG_DEBUG("%d bytes won't fit in the measure scratch area", required_bytes);
+        return false;
+    }
+    process->measure.byte_count += process->buffer.position - process->buffer.start;
+    process->buffer.position = (uint8_t*)process->buffer.start;
+    return true;
+}
+
+// Count bytes that were never written to the scratch area.
+static inline void add_measured_bytes(cbe_encode_process* const process, const int64_t byte_count)
+{
+    process->measure.byte_count += byte_count;
+}
+
+// Make room for at least required_bytes, by growing an owned buffer
+// geometrically or by moving on to the next page.
+// Returns false if the buffer can't grow or the allocator failed.
+static bool grow_buffer(cbe_encode_process* const process, const int64_t required_bytes)
+{
+    unlikely_if(process->measure.is_measuring)
+    {
+        return recycle_measure_scratch(process, required_bytes);
+    }
+    unlikely_if(process->page_pool != NULL)
+    {
+        return advance_page(process, required_bytes);
+    }
+    unlikely_if(process->allocator.realloc == NULL)
+    {
+        return false;
+    }
+
+    const int64_t used = process->buffer.position - process->buffer.start;
+    int64_t new_size = process->buffer.end - process->buffer.start;
+    if(new_size < MIN_GROWABLE_BUFFER_SIZE)
+    {
+        new_size = MIN_GROWABLE_BUFFER_SIZE;
+    }
+    while(new_size - used < required_bytes)
+    {
+        new_size *= 2;
+    }
+
+    KSLOG_DEBUG("Growing buffer from %d to %d bytes", process->buffer.end - process->buffer.start, new_size);
+    uint8_t* const buffer = process->allocator.realloc(process->allocator.context,
+                                                       (uint8_t*)process->buffer.start,
+                                                       (size_t)new_size);
+    unlikely_if(buffer == NULL)
+    {
+        KSLOG_DEBUG("Allocator failed to provide %d bytes", new_size);
+        return false;
+    }
+    process->buffer.start = buffer;
+    process->buffer.position = buffer + used;
+    process->buffer.end = buffer + new_size;
+    return true;
+}
+
+// Make room for a scalar whose size isn't known until it's encoded.
+static inline void reserve_for_variable_length_scalar(cbe_encode_process* const process)
+{
+    unlikely_if((process->allocator.realloc != NULL || process->page_pool != NULL || process->measure.is_measuring) &&
+                buff_remaining_length(process) < MAX_VARIABLE_LENGTH_SCALAR_SIZE)
+    {
+        grow_buffer(process, MAX_VARIABLE_LENGTH_SCALAR_SIZE);
+    }
+}
+
+static inline bool should_reference_array_data(cbe_encode_process* const process,
+                                               const array_type type,
+                                               const int64_t byte_count)
+{
+    return process->reference_threshold > 0 &&
+           byte_count >= process->reference_threshold &&
+           (type == ARRAY_TYPE_BYTES || type == ARRAY_TYPE_STRING || type == ARRAY_TYPE_TYPED) &&
+           process->page_pool != NULL &&
+           cbe_page_pool_can_add_reference(process->page_pool);
+}
+
+static inline bool may_be_declared_key(cbe_encode_process* const process, const int64_t byte_count)
+{
+    return process->key_dictionary.entry_count > 0 &&
+           process->is_inside_map[process->container.level] &&
+           process->container.next_object_is_map_key &&
+           byte_count <= cbe_string_table_get_longest_byte_count(process->key_dictionary.table);
+}
+
+// Returns the key's ID in the key dictionary, or -1 if it wasn't declared.
+static inline int find_declared_key(cbe_encode_process* const process,
+                                    const uint8_t* const start,
+                                    const int64_t byte_count)
+{
+    const int id = cbe_string_table_find_hashed(process->key_dictionary.table,
+                                                cbe_string_table_hash(start, byte_count),
+                                                start,
+                                                byte_count);
+    return id < process->key_dictionary.entry_count ? id : -1;
+}
+
+static inline bool should_sort_maps(cbe_encode_process* const process)
+{
+    return process->canonical.is_enabled && !process->measure.is_measuring;
+}
+
+static inline bool is_inside_sorted_map(cbe_encode_process* const process)
+{
+    return process->canonical.count > 0 &&
+           process->canonical.index[process->canonical.frame].frame.level == process->container.level;
+}
+
+// Record where the current sorted map's key or value ended.
+static void note_sorted_map_object_end(cbe_encode_process* const process)
+{
+    unlikely_if(!is_inside_sorted_map(process) || process->canonical.is_index_full)
+    {
+        return;
+    }
+
+    canonical_slot* const index = process->canonical.index;
+    const int64_t offset = process->buffer.position - process->buffer.start;
+    unlikely_if(process->container.next_object_is_map_key)
+    {
+        index[process->canonical.count - 1].entry.end = offset;
+        return;
+    }
+
+    // A key has ended, which starts a new entry.
+    unlikely_if(process->canonical.count >= process->canonical.capacity)
+    {
+        KSLOG_DEBUG("The canonical map index is full");
+        process->canonical.is_index_full = true;
+        return;
+    }
+    canonical_slot* const entry = &index[process->canonical.count];
+    entry->entry.start = process->canonical.count - 1 == process->canonical.frame
+        ? index[process->canonical.frame].frame.contents_start
+        : index[process->canonical.count - 1].entry.end;
+    entry->entry.value_start = offset;
+    entry->entry.end = offset;
+    process->canonical.count++;
+}
+
 static inline void swap_map_key_value_status(cbe_encode_process* const process)
 {
     process->container.next_object_is_map_key = !process->container.next_object_is_map_key;
+    unlikely_if(process->canonical.count > 0)
+    {
+        note_sorted_map_object_end(process);
+    }
+}
+
+// Arrays and containers take up their key or value position when they begin,
+// but they aren't complete until the array data or the container ends.
+static inline void swap_map_key_value_status_at_begin(cbe_encode_process* const process)
+{
+    process->container.next_object_is_map_key = !process->container.next_object_is_map_key;
+}
+
+// Call after entering the map. The index must have room for the frame.
+static inline void begin_sorted_map(cbe_encode_process* const process)
+{
+    canonical_slot* const frame = &process->canonical.index[process->canonical.count];
+    frame->frame.previous = process->canonical.frame;
+    frame->frame.contents_start = process->buffer.position - process->buffer.start;
+    frame->frame.level = process->container.level;
+    frame->frame.buffer_generation = process->buffer.generation;
+    process->canonical.frame = process->canonical.count;
+    process->canonical.count++;
+}
+
+// Compare encoded objects byte by byte, with a prefix sorting first.
+static inline int compare_encoded(const uint8_t* const a, const int64_t a_byte_count,
+                                  const uint8_t* const b, const int64_t b_byte_count)
+{
+    const int result = memcmp(a, b, (size_t)minimum_int64(a_byte_count, b_byte_count));
+    likely_if(result != 0)
+    {
+        return result;
+    }
+    return (a_byte_count > b_byte_count) - (a_byte_count < b_byte_count);
+}
+
+// Entries are ordered by their encoded keys, and then by their encoded values
+// so that duplicate keys still have a deterministic order.
+static inline int compare_map_entries(const uint8_t* const buffer,
+                                      const canonical_slot* const a,
+                                      const canonical_slot* const b)
+{
+    const int result = compare_encoded(buffer + a->entry.start, a->entry.value_start - a->entry.start,
+                                       buffer + b->entry.start, b->entry.value_start - b->entry.start);
+    likely_if(result != 0)
+    {
+        return result;
+    }
+    return compare_encoded(buffer + a->entry.value_start, a->entry.end - a->entry.value_start,
+                           buffer + b->entry.value_start, b->entry.end - b->entry.value_start);
+}
+
+// Shell sort, since it works in place and needs no recursion.
+static void sort_map_entries(const uint8_t* const buffer, canonical_slot* const entries, const int64_t entry_count)
+{
+    int64_t gap = 1;
+    while(gap < entry_count / 3)
+    {
+        gap = gap * 3 + 1;
+    }
+    for(; gap > 0; gap /= 3)
+    {
+        for(int64_t i = gap; i < entry_count; i++)
+        {
+            const canonical_slot entry = entries[i];
+            int64_t j = i;
+            for(; j >= gap && compare_map_entries(buffer, &entries[j - gap], &entry) > 0; j -= gap)
+            {
+                entries[j] = entries[j - gap];
+            }
+            entries[j] = entry;
+        }
+    }
+}
+
+// Rearrange the current sorted map's contents so that its entries are in
+// order, and close its frame. The entries are assembled in the free space
+// after the map, so there must be room for another copy of the contents.
+static cbe_encode_status end_sorted_map(cbe_encode_process* const process)
+{
+    const int64_t frame_index = process->canonical.frame;
+    const canonical_slot frame = process->canonical.index[frame_index];
+    unlikely_if(process->canonical.is_index_full || frame.frame.buffer_generation != process->buffer.generation)
+    {
+        KSLOG_DEBUG("STOP AND EXIT: Map has too many entries, or its contents have left the buffer");
+        return CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT;
+    }
+
+    const int64_t contents_byte_count = (process->buffer.position - process->buffer.start) -
+                                        frame.frame.contents_start;
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, contents_byte_count);
+
+    uint8_t* const buffer = (uint8_t*)process->buffer.start;
+    canonical_slot* const entries = &process->canonical.index[frame_index + 1];
+    const int64_t entry_count = process->canonical.count - frame_index - 1;
+    sort_map_entries(buffer, entries, entry_count);
+
+    uint8_t* const sorted = process->buffer.position;
+    int64_t sorted_byte_count = 0;
+    for(int64_t i = 0; i < entry_count; i++)
+    {
+        const int64_t entry_byte_count = entries[i].entry.end - entries[i].entry.start;
+        memcpy(sorted + sorted_byte_count, buffer + entries[i].entry.start, (size_t)entry_byte_count);
+        sorted_byte_count += entry_byte_count;
+    }
+    memcpy(buffer + frame.frame.contents_start, sorted, (size_t)sorted_byte_count);
+
+    process->canonical.count = frame_index;
+    process->canonical.frame = frame.frame.previous;
+    return CBE_ENCODE_STATUS_OK;
+}
+
+// Top level objects alternate between key and value status just like map
+// contents do, so the status doubles as the parity of the object's position.
+static inline void note_unkeyable_object(cbe_encode_process* const process)
+{
+    if(process->container.level == 0)
+    {
+        process->container.unkeyable_top_level_positions |= 1 << process->container.next_object_is_map_key;
+    }
+}
+
+// Call before entering the container, after swapping key/value status.
+static inline void note_container_begin(cbe_encode_process* const process)
+{
+    if(process->container.level + 1 > process->container.deepest_level)
+    {
+        process->container.deepest_level = process->container.level + 1;
+    }
+    if(process->container.level == 0)
+    {
+        process->container.top_level_status_after_container = process->container.next_object_is_map_key;
+    }
 }
 
 static inline int get_array_length_field_width(const int64_t length)
@@ -175,6 +649,35 @@ static inline int get_array_length_field_width(const int64_t length)
     return size;
 }
 
+// The padding needed so that a payload following header_size bytes of type
+// and length fields starts at a multiple of alignment (a power of 2).
+static inline int get_alignment_padding(cbe_encode_process* const process, const int header_size, const int alignment)
+{
+    return (int)(-(get_document_offset(process) + header_size) & (alignment - 1));
+}
+
+// Fixed width scalars are aligned to their payload size.
+static inline int get_scalar_alignment_padding(cbe_encode_process* const process, const int payload_size)
+{
+    likely_if(process->alignment == 0)
+    {
+        return 0;
+    }
+    return get_alignment_padding(process, sizeof(cbe_encoded_type_field), payload_size);
+}
+
+static inline int get_array_alignment_padding(cbe_encode_process* const process,
+                                              const int header_size,
+                                              const int element_size)
+{
+    likely_if(process->alignment == 0)
+    {
+        return 0;
+    }
+    return get_alignment_padding(process, header_size,
+                                 element_size > process->alignment ? element_size : process->alignment);
+}
+
 static inline void add_primitive_type(cbe_encode_process* const process, const cbe_type_field type)
 {
     KSLOG_DEBUG("[%02x]", type);
@@ -213,6 +716,29 @@ static inline void add_primitive_rvlq(cbe_encode_process* const process, uint64_
         process->buffer.position += byte_count;
 }
 
+static inline void add_primitive_rvlq_128(cbe_encode_process* const process, const uint128_ct value)
+{
+    const int byte_count = rvlq_encode_128(value, process->buffer.position);
+    KSLOG_DATA_DEBUG(process->buffer.position, byte_count, NULL);
+    process->buffer.position += byte_count;
+}
+
+static inline void add_primitive_uint128(cbe_encode_process* const process, const uint128_ct value)
+{
+    write_uint64_le((uint64_t)value, process->buffer.position);
+    write_uint64_le((uint64_t)(value >> 64), process->buffer.position + 8);
+    KSLOG_DATA_DEBUG(process->buffer.position, sizeof(value), NULL);
+    process->buffer.position += sizeof(value);
+}
+
+static inline void add_primitive_padding(cbe_encode_process* const process, const int byte_count)
+{
+    for(int i = 0; i < byte_count; i++)
+    {
+        add_primitive_uint8(process, TYPE_PADDING);
+    }
+}
+
 static inline void add_primitive_bytes(cbe_encode_process* const process,
                                        const uint8_t* const bytes,
                                        const int64_t byte_count)
@@ -237,6 +763,7 @@ static inline void begin_array(cbe_encode_process* const process, array_type typ
     process->array.current_offset = 0;
     process->array.type = type;
     process->array.byte_count = byte_count;
+    process->array.utf8_context = (cbe_utf8_context){0};
 }
 
 static inline void end_array(cbe_encode_process* const process)
@@ -245,6 +772,11 @@ static inline void end_array(cbe_encode_process* const process)
     process->array.is_inside_array = false;
     process->array.current_offset = 0;
     process->array.byte_count = 0;
+    // Comments are dropped from canonical output, and don't count as objects.
+    unlikely_if(process->canonical.count > 0 && process->array.type != ARRAY_TYPE_COMMENT)
+    {
+        note_sorted_map_object_end(process);
+    }
 }
 
 static inline void add_array_length_field(cbe_encode_process* const process, const int64_t length)
@@ -275,14 +807,30 @@ static inline cbe_encode_status add_int_small(cbe_encode_process* const process,
     return CBE_ENCODE_STATUS_OK;
 }
 
+static inline cbe_encode_status add_key_reference(cbe_encode_process* const process, const int id)
+{
+    KSLOG_DEBUG("(process %p, id %d)", process, id);
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, rvlq_encoded_size_64((uint64_t)id));
+
+    add_primitive_type(process, TYPE_KEY_REFERENCE);
+    add_primitive_rvlq(process, (uint64_t)id);
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
 #define DEFINE_ADD_SCALAR_FUNCTION(DATA_TYPE, NAME, DEFINITION_TYPE, CBE_TYPE) \
     static inline cbe_encode_status add_ ## NAME(cbe_encode_process* const process, const DATA_TYPE value) \
     { \
         KSLOG_DEBUG("(process %p)", process); \
     \
         STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
-        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, sizeof(value)); \
+        const int padding = get_scalar_alignment_padding(process, sizeof(value)); \
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, padding + sizeof(value)); \
     \
+        add_primitive_padding(process, padding); \
         add_primitive_type(process, CBE_TYPE); \
         add_primitive_ ## DEFINITION_TYPE(process, value); \
     \
@@ -299,6 +847,7 @@ ANSI_EXTENSION static inline cbe_encode_status add_float_decimal(cbe_encode_proc
 
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 1);
+    reserve_for_variable_length_scalar(process);
 
     uint8_t* old_position = process->buffer.position;
 
@@ -317,175 +866,1402 @@ ANSI_EXTENSION static inline cbe_encode_status add_float_decimal(cbe_encode_proc
     return CBE_ENCODE_STATUS_OK;
 }
 
-#define DEFINE_ADD_INT_FUNCTION(DATA_TYPE, NAME, DEFINITION_TYPE, CBE_TYPE) \
-    static inline cbe_encode_status add_ ## NAME(cbe_encode_process* const process, const int is_negative, const DATA_TYPE value) \
-    { \
-        KSLOG_DEBUG("(process %p)", process); \
-    \
-        STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
-        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, sizeof(value)); \
-    \
-        add_primitive_type(process, CBE_TYPE + is_negative); \
-        add_primitive_ ## DEFINITION_TYPE(process, value); \
-    \
-        swap_map_key_value_status(process); \
-    \
-        return CBE_ENCODE_STATUS_OK; \
+// Decimal floats are written straight in compact float form: an exponent field
+// of (exponent magnitude << 2) | (exponent sign << 1) | significand sign,
+// followed by the significand, both as RVLQ. Zero has no significand.
+static inline uint64_t get_decimal_exponent_field(const bool is_negative, const uint64_t significand, const int exponent)
+{
+    unlikely_if(significand == 0)
+    {
+        return 2 | is_negative;
     }
-DEFINE_ADD_INT_FUNCTION(uint8_t,  int_8,  uint8,  TYPE_INT_POS_8)
-DEFINE_ADD_INT_FUNCTION(uint16_t, int_16, uint16, TYPE_INT_POS_16)
-DEFINE_ADD_INT_FUNCTION(uint32_t, int_32, uint32, TYPE_INT_POS_32)
-DEFINE_ADD_INT_FUNCTION(uint64_t, int_64, uint64, TYPE_INT_POS_64)
+    const uint64_t magnitude = exponent < 0 ? -(int64_t)exponent : exponent;
+    return (magnitude << 2) | ((exponent < 0) << 1) | is_negative;
+}
 
-static inline cbe_encode_status add_int(cbe_encode_process* const process, const int is_negative, const uint64_t value)
+static inline int get_decimal_encoded_size(const bool is_negative, const uint64_t significand, const int exponent)
 {
-    KSLOG_DEBUG("(process %p)", process);
+    const int exponent_size = rvlq_encoded_size_64(get_decimal_exponent_field(is_negative, significand, exponent));
+    return significand == 0 ? exponent_size : exponent_size + rvlq_encoded_size_64(significand);
+}
+
+static inline cbe_encode_status add_float_decimal_parts(cbe_encode_process* const process,
+                                                        const bool is_negative,
+                                                        const uint64_t significand,
+                                                        const int exponent)
+{
+    KSLOG_DEBUG("(process %p, is_negative %d, significand %llu, exponent %d)", process, is_negative, significand, exponent);
 
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, rvlq_encoded_size_64(value));
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, get_decimal_encoded_size(is_negative, significand, exponent));
 
-    add_primitive_type(process, TYPE_INT_POS + is_negative);
-    add_primitive_rvlq(process, value);
+    add_primitive_type(process, TYPE_FLOAT_DECIMAL);
+    add_primitive_rvlq(process, get_decimal_exponent_field(is_negative, significand, exponent));
+    if(significand != 0)
+    {
+        add_primitive_rvlq(process, significand);
+    }
 
     swap_map_key_value_status(process);
 
     return CBE_ENCODE_STATUS_OK;
 }
 
-static inline cbe_encode_status encode_string_header(cbe_encode_process* const process,
-                                                     const int64_t byte_count,
-                                                     const bool should_reserve_payload)
+// For significands too wide for add_float_decimal_parts().
+static inline int get_decimal_encoded_size_128(const bool is_negative, const uint128_ct significand, const int exponent)
 {
-    KSLOG_DEBUG("(process %p, byte_count %d, should_reserve_payload %d)",
-        process, byte_count, should_reserve_payload);
+    return rvlq_encoded_size_64(get_decimal_exponent_field(is_negative, 1, exponent)) + rvlq_encoded_size_128(significand);
+}
 
-    cbe_type_field type = 0;
-    int reserved_count = 0;
+static inline cbe_encode_status add_float_decimal_parts_128(cbe_encode_process* const process,
+                                                            const bool is_negative,
+                                                            const uint128_ct significand,
+                                                            const int exponent)
+{
+    KSLOG_DEBUG("(process %p, is_negative %d, exponent %d)", process, is_negative, exponent);
 
-    if(byte_count > 15)
-    {
-        type = TYPE_STRING;
-        reserved_count = get_array_length_field_width(byte_count);
-    }
-    else
-    {
-        type = TYPE_STRING_0 + byte_count;
-    }
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, get_decimal_encoded_size_128(is_negative, significand, exponent));
 
-    if(should_reserve_payload)
-    {
-        reserved_count += byte_count;
-    }
+    add_primitive_type(process, TYPE_FLOAT_DECIMAL);
+    add_primitive_rvlq(process, get_decimal_exponent_field(is_negative, 1, exponent));
+    add_primitive_rvlq_128(process, significand);
 
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, reserved_count);
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+#define MAX_SHORTEST_DECIMAL_DIGITS 15
+
+// floor(log10(2^exponent)), exact for the exponents of a double.
+static inline int get_log10_of_power_of_2(const int exponent)
+{
+    return exponent >= 0 ? (exponent * 78913) >> 18 : -((-exponent * 78913 + (1 << 18) - 1) >> 18);
+}
+
+// Find the decimal form with the fewest significant digits (up to 15) that
+// converts back to exactly this positive, finite double, as long as it
+// encodes into at most max_byte_count bytes.
+//
+// A double's rounding interval is narrower than the gap between 15 digit
+// decimals, so at most one decimal of the widest allowed digit count converts
+// back to it, and any shorter one is that same decimal with its trailing zeros
+// removed. This means only one candidate ever needs checking.
+static inline bool find_shortest_decimal(const double value,
+                                         const int max_byte_count,
+                                         uint64_t* const significand,
+                                         int* const exponent)
+{
+    // The widest significand that fits beside a one byte exponent field.
+    int digit_count = (max_byte_count - 1) * 2 + 1;
+    unlikely_if(digit_count > MAX_SHORTEST_DECIMAL_DIGITS)
+    {
+        digit_count = MAX_SHORTEST_DECIMAL_DIGITS;
+    }
+
+    // This can be one below the real leading exponent, which gives one digit
+    // too many and is fixed up below.
+    int binary_exponent = 0;
+    frexp(value, &binary_exponent);
+    int candidate_exponent = get_log10_of_power_of_2(binary_exponent - 1) - digit_count + 1;
+    unlikely_if(candidate_exponent < -CBE_MAX_EXACT_POWER_OF_10)
+    {
+        candidate_exponent = -CBE_MAX_EXACT_POWER_OF_10;
+    }
+
+    uint64_t candidate = 0;
+    for(;;)
+    {
+        unlikely_if(candidate_exponent > CBE_MAX_EXACT_POWER_OF_10)
+        {
+            return false;
+        }
+        // The scaling may be off by an ulp, so the result is only a candidate.
+        const double scaled = candidate_exponent < 0 ? value * cbe_exact_powers_of_10[-candidate_exponent]
+                                                     : value / cbe_exact_powers_of_10[candidate_exponent];
+        candidate = (uint64_t)llround(scaled);
+        likely_if(candidate < (uint64_t)cbe_exact_powers_of_10[digit_count])
+        {
+            break;
+        }
+        candidate_exponent++;
+    }
+
+    while(candidate != 0 && candidate % 10 == 0)
+    {
+        candidate /= 10;
+        candidate_exponent++;
+    }
+    double converted = 0;
+    unlikely_if(get_decimal_encoded_size(false, candidate, candidate_exponent) > max_byte_count ||
+                !cbe_decimal_parts_to_double(1, candidate, candidate_exponent, &converted) || converted != value)
+    {
+        return false;
+    }
+    *significand = candidate;
+    *exponent = candidate_exponent;
+    return true;
+}
+
+#define DEFINE_ADD_INT_FUNCTION(DATA_TYPE, NAME, DEFINITION_TYPE, CBE_TYPE) \
+    static inline cbe_encode_status add_ ## NAME(cbe_encode_process* const process, const int is_negative, const DATA_TYPE value) \
+    { \
+        KSLOG_DEBUG("(process %p)", process); \
+    \
+        STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
+        const int padding = get_scalar_alignment_padding(process, sizeof(value)); \
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, padding + sizeof(value)); \
+    \
+        add_primitive_padding(process, padding); \
+        add_primitive_type(process, CBE_TYPE + is_negative); \
+        add_primitive_ ## DEFINITION_TYPE(process, value); \
+    \
+        swap_map_key_value_status(process); \
+    \
+        return CBE_ENCODE_STATUS_OK; \
+    }
+DEFINE_ADD_INT_FUNCTION(uint8_t,  int_8,  uint8,  TYPE_INT_POS_8)
+DEFINE_ADD_INT_FUNCTION(uint16_t, int_16, uint16, TYPE_INT_POS_16)
+DEFINE_ADD_INT_FUNCTION(uint32_t, int_32, uint32, TYPE_INT_POS_32)
+DEFINE_ADD_INT_FUNCTION(uint64_t, int_64, uint64, TYPE_INT_POS_64)
+
+static inline cbe_encode_status add_int(cbe_encode_process* const process, const int is_negative, const uint64_t value)
+{
+    KSLOG_DEBUG("(process %p)", process);
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, rvlq_encoded_size_64(value));
+
+    add_primitive_type(process, TYPE_INT_POS + is_negative);
+    add_primitive_rvlq(process, value);
+
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static inline cbe_encode_status add_int_128(cbe_encode_process* const process, const int is_negative, const uint128_ct value)
+{
+    KSLOG_DEBUG("(process %p)", process);
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, rvlq_encoded_size_128(value));
+
+    add_primitive_type(process, TYPE_INT_POS + is_negative);
+    add_primitive_rvlq_128(process, value);
+
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+// The fixed width 128-bit types are followed by the value's 16 bytes, little endian.
+static inline cbe_encode_status add_fixed_128(cbe_encode_process* const process, const cbe_type_field type, const uint128_ct bits)
+{
+    KSLOG_DEBUG("(process %p, type %02x)", process, type);
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    const int padding = get_scalar_alignment_padding(process, sizeof(bits));
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, padding + sizeof(bits));
+
+    add_primitive_padding(process, padding);
+    add_primitive_type(process, type);
+    add_primitive_uint128(process, bits);
+
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static inline uint128_ct get_float_128_bits(const float128_ct value)
+{
+    uint128_ct bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline uint128_ct get_decimal_128_bits(const dec128_ct value)
+{
+    uint128_ct bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Encoded size and positive type of an integer too big for a small int,
+// indexed by the bit width of its absolute value. The RVLQ sizes are
+// 7 bits per byte, plus the type field.
+static const uint8_t integer_size_by_bit_width[65] =
+{
+    2, 2, 2, 2, 2, 2, 2, 2, 2,
+    3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8,
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+};
+static const uint8_t integer_type_by_bit_width[65] =
+{
+    TYPE_INT_POS_8,  TYPE_INT_POS_8,  TYPE_INT_POS_8,  TYPE_INT_POS_8,  TYPE_INT_POS_8,
+    TYPE_INT_POS_8,  TYPE_INT_POS_8,  TYPE_INT_POS_8,  TYPE_INT_POS_8,
+    TYPE_INT_POS_16, TYPE_INT_POS_16, TYPE_INT_POS_16, TYPE_INT_POS_16,
+    TYPE_INT_POS_16, TYPE_INT_POS_16, TYPE_INT_POS_16, TYPE_INT_POS_16,
+    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,
+    TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32,
+    TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32, TYPE_INT_POS_32,
+    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,
+    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,
+    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,    TYPE_INT_POS,
+    TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64,
+    TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64,
+    TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64, TYPE_INT_POS_64,
+};
+
+// Integer lists are checked for runs of small ints this many values at a time.
+#define INTEGER_LIST_BLOCK_SIZE 16
+
+// Type field plus a 64-bit payload: the largest integer or float list entry.
+#define MAX_LIST_ENTRY_SIZE 9
+
+static inline int get_bit_width(const uint64_t value)
+{
+    return 64 - __builtin_clzll(value | 1);
+}
+
+static inline uint64_t get_int64_magnitude(const int64_t value)
+{
+    const uint64_t sign_mask = (uint64_t)RSHIFT_MAX(value);
+    return ((uint64_t)value ^ sign_mask) - sign_mask;
+}
+
+static inline int get_int64_is_negative(const int64_t value)
+{
+    return (int)((uint64_t)value >> 63);
+}
+
+static inline uint64_t get_uint64_magnitude(const uint64_t value)
+{
+    return value;
+}
+
+static inline int get_uint64_is_negative(const uint64_t value)
+{
+    (void)value;
+    return 0;
+}
+
+// The positive type used for an integer too big for a small int. Every
+// integer encoder picks its width here so that they all agree.
+static inline uint8_t get_integer_type(const uint64_t magnitude)
+{
+    return integer_type_by_bit_width[get_bit_width(magnitude)];
+}
+
+// Matches the encoding chosen by cbe_encode_add_integer(), without branching.
+static inline int get_integer_encoded_size(const uint64_t magnitude)
+{
+    return integer_size_by_bit_width[get_bit_width(magnitude)] - FITS_IN_INT_SMALL(magnitude);
+}
+
+// Writes the payload that follows an integer type from get_integer_type().
+static inline void add_integer_payload(cbe_encode_process* const process, const uint8_t type, const uint64_t magnitude)
+{
+    switch(type)
+    {
+        case TYPE_INT_POS_8:  add_primitive_uint8(process, magnitude); break;
+        case TYPE_INT_POS_16: add_primitive_uint16(process, magnitude); break;
+        case TYPE_INT_POS_32: add_primitive_uint32(process, magnitude); break;
+        case TYPE_INT_POS:    add_primitive_rvlq(process, magnitude); break;
+        default:              add_primitive_uint64(process, magnitude); break;
+    }
+}
+
+// In paged mode, only make room when the current page is full.
+static inline void make_room_for_list_entry(cbe_encode_process* const process, const int byte_count)
+{
+    unlikely_if(buff_remaining_length(process) < byte_count)
+    {
+        grow_buffer(process, byte_count);
+    }
+}
+
+static inline void add_integer_list_entry(cbe_encode_process* const process,
+                                          const int is_negative,
+                                          const uint64_t magnitude,
+                                          const uint8_t small_int_byte)
+{
+    const int bit_width = get_bit_width(magnitude);
+    const int is_small = FITS_IN_INT_SMALL(magnitude);
+    const int byte_count = integer_size_by_bit_width[bit_width] - is_small;
+    const uint8_t type = get_integer_type(magnitude);
+    make_room_for_list_entry(process, byte_count);
+
+    unlikely_if(type == TYPE_INT_POS)
+    {
+        add_primitive_type(process, type + is_negative);
+        add_integer_payload(process, type, magnitude);
+        return;
+    }
+    likely_if(buff_remaining_length(process) >= MAX_LIST_ENTRY_SIZE)
+    {
+        // Write a full 64-bit payload whatever the width, and only keep the
+        // bytes that belong to it.
+        process->buffer.position[0] = is_small ? small_int_byte : (uint8_t)(type + is_negative);
+        write_uint64_le(magnitude, process->buffer.position + 1);
+        process->buffer.position += byte_count;
+        return;
+    }
+    unlikely_if(is_small)
+    {
+        add_primitive_uint8(process, small_int_byte);
+        return;
+    }
+    add_primitive_type(process, type + is_negative);
+    add_integer_payload(process, type, magnitude);
+}
+
+// A list's values are never split across pages, so up to a value's worth of
+// each page may go unused.
+static inline bool paged_list_will_fit(cbe_encode_process* const process, const int64_t byte_count)
+{
+    const int64_t page_size = cbe_page_pool_get_page_size(process->page_pool);
+    const int64_t available = buff_remaining_length(process) + cbe_page_pool_get_free_byte_count(process->page_pool);
+    unlikely_if(page_size <= MAX_LIST_ENTRY_SIZE)
+    {
+        return buff_remaining_length(process) >= byte_count;
+    }
+    return available >= byte_count + MAX_LIST_ENTRY_SIZE * (byte_count / (page_size - MAX_LIST_ENTRY_SIZE) + 1);
+}
+
+#define DEFINE_ADD_INTEGER_LIST_FUNCTION(DATA_TYPE, NAME) \
+    static cbe_encode_status add_ ## NAME ## _list(cbe_encode_process* const process, \
+                                                   const DATA_TYPE* const values, \
+                                                   const int64_t count) \
+    { \
+        KSLOG_DEBUG("(process %p, values %p, count %d)", process, values, count); \
+    \
+        STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
+        STOP_AND_EXIT_IF_IS_WRONG_MAP_KEY_TYPE(process); \
+        STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(process); \
+    \
+        /* List begin and end markers. */ \
+        int64_t byte_count = 2; \
+        for(int64_t i = 0; i < count; i++) \
+        { \
+            byte_count += get_integer_encoded_size(get_ ## NAME ## _magnitude(values[i])); \
+        } \
+        likely_if(!process->measure.is_measuring) \
+        { \
+            STOP_AND_EXIT_IF_LIST_WONT_FIT(process, byte_count); \
+        } \
+        note_unkeyable_object(process); \
+        note_container_begin(process); \
+        unlikely_if(process->measure.is_measuring) \
+        { \
+            add_measured_bytes(process, byte_count); \
+            swap_map_key_value_status(process); \
+            return CBE_ENCODE_STATUS_OK; \
+        } \
+    \
+        make_room_for_list_entry(process, 1); \
+        add_primitive_type(process, TYPE_LIST); \
+        int64_t i = 0; \
+        for(; i + INTEGER_LIST_BLOCK_SIZE <= count; i += INTEGER_LIST_BLOCK_SIZE) \
+        { \
+            /* Written as plain loops over a fixed-size block so that the \
+               compiler can vectorize them. */ \
+            const DATA_TYPE* const block = values + i; \
+            bool has_large_value = false; \
+            for(int j = 0; j < INTEGER_LIST_BLOCK_SIZE; j++) \
+            { \
+                has_large_value |= !FITS_IN_INT_SMALL(get_ ## NAME ## _magnitude(block[j])); \
+            } \
+            likely_if(!has_large_value && buff_remaining_length(process) >= INTEGER_LIST_BLOCK_SIZE) \
+            { \
+                for(int j = 0; j < INTEGER_LIST_BLOCK_SIZE; j++) \
+                { \
+                    process->buffer.position[j] = (uint8_t)block[j]; \
+                } \
+                process->buffer.position += INTEGER_LIST_BLOCK_SIZE; \
+                continue; \
+            } \
+            for(int j = 0; j < INTEGER_LIST_BLOCK_SIZE; j++) \
+            { \
+                add_integer_list_entry(process, \
+                                       get_ ## NAME ## _is_negative(block[j]), \
+                                       get_ ## NAME ## _magnitude(block[j]), \
+                                       (uint8_t)block[j]); \
+            } \
+        } \
+        for(; i < count; i++) \
+        { \
+            add_integer_list_entry(process, \
+                                   get_ ## NAME ## _is_negative(values[i]), \
+                                   get_ ## NAME ## _magnitude(values[i]), \
+                                   (uint8_t)values[i]); \
+        } \
+        make_room_for_list_entry(process, 1); \
+        add_primitive_type(process, TYPE_END_CONTAINER); \
+    \
+        swap_map_key_value_status(process); \
+    \
+        return CBE_ENCODE_STATUS_OK; \
+    }
+DEFINE_ADD_INTEGER_LIST_FUNCTION(int64_t,  int64)
+DEFINE_ADD_INTEGER_LIST_FUNCTION(uint64_t, uint64)
+
+static inline void add_float_list_entry(cbe_encode_process* const process, const double value)
+{
+    const int fits_in_float_32 = FITS_IN_FLOAT_32(value);
+    const int byte_count = MAX_LIST_ENTRY_SIZE - 4 * fits_in_float_32;
+    make_room_for_list_entry(process, byte_count);
+
+    likely_if(buff_remaining_length(process) >= MAX_LIST_ENTRY_SIZE)
+    {
+        // Write a full 64-bit payload whatever the width, and only keep the
+        // bytes that belong to it.
+        const float value_32 = (float)value;
+        uint32_t bits_32;
+        uint64_t bits_64;
+        memcpy(&bits_32, &value_32, sizeof(bits_32));
+        memcpy(&bits_64, &value, sizeof(bits_64));
+        const uint64_t float_32_mask = -(uint64_t)fits_in_float_32;
+        process->buffer.position[0] = (uint8_t)(TYPE_FLOAT_BINARY_64 - fits_in_float_32);
+        write_uint64_le((bits_32 & float_32_mask) | (bits_64 & ~float_32_mask), process->buffer.position + 1);
+        process->buffer.position += byte_count;
+        return;
+    }
+    if(fits_in_float_32)
+    {
+        add_primitive_type(process, TYPE_FLOAT_BINARY_32);
+        add_primitive_float32(process, value);
+        return;
+    }
+    add_primitive_type(process, TYPE_FLOAT_BINARY_64);
+    add_primitive_float64(process, value);
+}
+
+static cbe_encode_status add_float_list(cbe_encode_process* const process,
+                                        const double* const values,
+                                        const int64_t count)
+{
+    KSLOG_DEBUG("(process %p, values %p, count %d)", process, values, count);
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_IS_WRONG_MAP_KEY_TYPE(process);
+    STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(process);
+
+    // Kept to a bare count so that the float 32 exactness test compiles
+    // without branches, and can be vectorized.
+    int64_t float_32_count = 0;
+    for(int64_t i = 0; i < count; i++)
+    {
+        float_32_count += FITS_IN_FLOAT_32(values[i]);
+    }
+    // List begin and end markers, plus the values.
+    const int64_t byte_count = 2 + count * MAX_LIST_ENTRY_SIZE - float_32_count * 4;
+    likely_if(!process->measure.is_measuring)
+    {
+        STOP_AND_EXIT_IF_LIST_WONT_FIT(process, byte_count);
+    }
+    note_unkeyable_object(process);
+    note_container_begin(process);
+    unlikely_if(process->measure.is_measuring)
+    {
+        add_measured_bytes(process, byte_count);
+        swap_map_key_value_status(process);
+        return CBE_ENCODE_STATUS_OK;
+    }
+
+    make_room_for_list_entry(process, 1);
+    add_primitive_type(process, TYPE_LIST);
+    for(int64_t i = 0; i < count; i++)
+    {
+        add_float_list_entry(process, values[i]);
+    }
+    make_room_for_list_entry(process, 1);
+    add_primitive_type(process, TYPE_END_CONTAINER);
+
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static inline cbe_encode_status add_aligned_int64_entry(cbe_encode_process* const process, const int64_t value)
+{
+    return cbe_encode_add_integer(process, get_int64_is_negative(value) ? -1 : 1, get_int64_magnitude(value));
+}
+
+static inline cbe_encode_status add_aligned_uint64_entry(cbe_encode_process* const process, const uint64_t value)
+{
+    return cbe_encode_add_integer(process, 1, value);
+}
+
+static inline cbe_encode_status add_aligned_float_entry(cbe_encode_process* const process, const double value)
+{
+    return cbe_encode_add_float(process, value, 0);
+}
+
+// When aligning, any value may need padding before it, so the list is built
+// one value at a time instead. Either the whole list is added, or none of it.
+#define DEFINE_ADD_ALIGNED_LIST_FUNCTION(DATA_TYPE, NAME) \
+    static cbe_encode_status add_aligned_ ## NAME ## _list(cbe_encode_process* const process, \
+                                                           const DATA_TYPE* const values, \
+                                                           const int64_t count) \
+    { \
+        KSLOG_DEBUG("(process %p, values %p, count %d)", process, values, count); \
+    \
+        struct cbe_savepoint savepoint; \
+        cbe_encode_savepoint(process, &savepoint); \
+        cbe_encode_status status = cbe_encode_list_begin(process); \
+        for(int64_t i = 0; i < count && status == CBE_ENCODE_STATUS_OK; i++) \
+        { \
+            status = add_aligned_ ## NAME ## _entry(process, values[i]); \
+        } \
+        likely_if(status == CBE_ENCODE_STATUS_OK) \
+        { \
+            status = cbe_encode_container_end(process); \
+        } \
+        unlikely_if(status != CBE_ENCODE_STATUS_OK) \
+        { \
+            cbe_encode_rollback(process, &savepoint); \
+        } \
+        return status; \
+    }
+DEFINE_ADD_ALIGNED_LIST_FUNCTION(int64_t,  int64)
+DEFINE_ADD_ALIGNED_LIST_FUNCTION(uint64_t, uint64)
+DEFINE_ADD_ALIGNED_LIST_FUNCTION(double,   float)
+
+static inline cbe_encode_status encode_string_header(cbe_encode_process* const process,
+                                                     const int64_t byte_count,
+                                                     const bool should_reserve_payload)
+{
+    KSLOG_DEBUG("(process %p, byte_count %d, should_reserve_payload %d)",
+        process, byte_count, should_reserve_payload);
+
+    cbe_type_field type = 0;
+    int reserved_count = 0;
+
+    if(byte_count > 15)
+    {
+        type = TYPE_STRING;
+        reserved_count = get_array_length_field_width(byte_count);
+    }
+    else
+    {
+        type = TYPE_STRING_0 + byte_count;
+    }
+
+    if(should_reserve_payload)
+    {
+        reserved_count += byte_count;
+    }
+
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, reserved_count);
 
     add_primitive_type(process, type);
     if(byte_count > 15)
     {
         add_array_length_field(process, byte_count);
     }
-    begin_array(process, ARRAY_TYPE_STRING, byte_count);
+    begin_array(process, ARRAY_TYPE_STRING, byte_count);
+
+    swap_map_key_value_status_at_begin(process);
+    unlikely_if(byte_count == 0)
+    {
+        end_array(process);
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static bool is_valid_array_chunk(cbe_encode_process* const process,
+                                 const uint8_t* const start,
+                                 const int64_t byte_count)
+{
+    KSLOG_DEBUG("Type: %d", process->array.type);
+    switch(process->array.type)
+    {
+        case ARRAY_TYPE_STRING:
+            return cbe_validate_string_chunk(&process->array.utf8_context, start, byte_count);
+        case ARRAY_TYPE_URI:
+            return cbe_validate_uri(start, byte_count);
+        case ARRAY_TYPE_COMMENT:
+            return cbe_validate_comment_chunk(&process->array.utf8_context, start, byte_count);
+        case ARRAY_TYPE_BYTES:
+        case ARRAY_TYPE_TYPED:
+            // Nothing to do
+            break;
+    }
+    return true;
+}
+
+static cbe_encode_status encode_array_contents(cbe_encode_process* const process, 
+                                               const uint8_t* const start,
+                                               int64_t* const byte_count)
+{
+    KSLOG_DEBUG("(process %p, start %p, byte_count %d)", process, start, *byte_count);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, 0);
+
+    likely_if(*byte_count > 0)
+    {
+        const int64_t want_to_copy = *byte_count;
+        // Canonical output leaves comments out, but they're still validated.
+        unlikely_if(process->canonical.is_enabled && process->array.type == ARRAY_TYPE_COMMENT)
+        {
+            unlikely_if(!is_valid_array_chunk(process, start, want_to_copy))
+            {
+                KSLOG_DEBUG("invalid data");
+                return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
+            }
+            process->array.current_offset += want_to_copy;
+            if(process->array.current_offset == process->array.byte_count)
+            {
+                end_array(process);
+            }
+            return CBE_ENCODE_STATUS_OK;
+        }
+
+        unlikely_if(process->allocator.realloc != NULL && buff_remaining_length(process) < want_to_copy)
+        {
+            grow_buffer(process, want_to_copy);
+        }
+
+        unlikely_if(should_reference_array_data(process, process->array.type, want_to_copy))
+        {
+            unlikely_if(process->array.type == ARRAY_TYPE_STRING &&
+                        !cbe_validate_string_chunk(&process->array.utf8_context, start, want_to_copy))
+            {
+                KSLOG_DEBUG("invalid data");
+                return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
+            }
+            KSLOG_DEBUG("Referencing %d bytes instead of copying", want_to_copy);
+            cbe_page_pool_add_reference(process->page_pool, process->buffer.position, start, want_to_copy);
+            process->buffer.document_offset += want_to_copy;
+            process->array.current_offset += want_to_copy;
+            if(process->array.current_offset == process->array.byte_count)
+            {
+                end_array(process);
+            }
+            return CBE_ENCODE_STATUS_OK;
+        }
+
+        unlikely_if(process->measure.is_measuring)
+        {
+            unlikely_if(!is_valid_array_chunk(process, start, want_to_copy))
+            {
+                KSLOG_DEBUG("invalid data");
+                return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
+            }
+            add_measured_bytes(process, want_to_copy);
+            process->array.current_offset += want_to_copy;
+            if(process->array.current_offset == process->array.byte_count)
+            {
+                end_array(process);
+            }
+            return CBE_ENCODE_STATUS_OK;
+        }
+
+        // In paged mode, array data continues onto the next page.
+        int64_t bytes_copied = 0;
+        for(;;)
+        {
+            const uint8_t* const chunk_start = start + bytes_copied;
+            const int64_t bytes_to_copy = minimum_int64(want_to_copy - bytes_copied, buff_remaining_length(process));
+
+            unlikely_if(!is_valid_array_chunk(process, chunk_start, bytes_to_copy))
+            {
+                KSLOG_DEBUG("invalid data");
+                return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
+            }
+
+            add_primitive_bytes(process, chunk_start, bytes_to_copy);
+            process->array.current_offset += bytes_to_copy;
+            bytes_copied += bytes_to_copy;
+            KSLOG_DEBUG("Streamed %d bytes into array", bytes_to_copy);
+
+            if(bytes_copied == want_to_copy || !grow_buffer(process, 1))
+            {
+                break;
+            }
+        }
+        *byte_count = bytes_copied;
+
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, want_to_copy - bytes_copied);
+    }
+
+    if(process->array.current_offset == process->array.byte_count)
+    {
+        KSLOG_DEBUG("Array has ended");
+        end_array(process);
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+// Add already encoded bytes, which may span pages. Either all of them are
+// added, or none are.
+static cbe_encode_status add_raw_bytes(cbe_encode_process* const process,
+                                       const uint8_t* const data,
+                                       const int64_t byte_count)
+{
+    KSLOG_DEBUG("(process %p, data %p, byte_count %d)", process, data, byte_count);
+
+    unlikely_if(process->measure.is_measuring)
+    {
+        add_measured_bytes(process, byte_count);
+    }
+    else unlikely_if(process->page_pool != NULL)
+    {
+        unlikely_if(process->reference_threshold > 0 &&
+                    byte_count >= process->reference_threshold &&
+                    cbe_page_pool_can_add_reference(process->page_pool))
+        {
+            KSLOG_DEBUG("Referencing %d raw bytes instead of copying", byte_count);
+            cbe_page_pool_add_reference(process->page_pool, process->buffer.position, data, byte_count);
+            process->buffer.document_offset += byte_count;
+        }
+        else
+        {
+            // The bytes continue onto the next page, so undo any pages
+            // they took if the pool runs out.
+            struct cbe_savepoint savepoint;
+            cbe_encode_savepoint(process, &savepoint);
+            int64_t bytes_copied = 0;
+            for(;;)
+            {
+                const int64_t bytes_to_copy = minimum_int64(byte_count - bytes_copied,
+                                                            buff_remaining_length(process));
+                add_primitive_bytes(process, data + bytes_copied, bytes_to_copy);
+                bytes_copied += bytes_to_copy;
+                if(bytes_copied == byte_count)
+                {
+                    break;
+                }
+                unlikely_if(!grow_buffer(process, 1))
+                {
+                    cbe_encode_rollback(process, &savepoint);
+                    return CBE_ENCODE_STATUS_NEED_MORE_ROOM;
+                }
+            }
+        }
+    }
+    else
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, byte_count);
+        add_primitive_bytes(process, data, byte_count);
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+// Slot values are written straight into the gaps in the skeleton, with none
+// of the bookkeeping of the public add functions: the skeleton already
+// accounts for their key/value status, and templates can't be used with
+// alignment or a key dictionary.
+static cbe_encode_status add_slot_integer(cbe_encode_process* const process, const int64_t value)
+{
+    const uint64_t magnitude = get_int64_magnitude(value);
+
+    if(FITS_IN_INT_SMALL(magnitude))
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
+        add_primitive_int8(process, (int8_t)value);
+        return CBE_ENCODE_STATUS_OK;
+    }
+
+    const uint8_t type = get_integer_type(magnitude);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, get_integer_encoded_size(magnitude));
+    add_primitive_type(process, type + get_int64_is_negative(value));
+    add_integer_payload(process, type, magnitude);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static cbe_encode_status add_slot_float(cbe_encode_process* const process, const double value)
+{
+    if(FITS_IN_FLOAT_32(value))
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, sizeof(float));
+        add_primitive_type(process, TYPE_FLOAT_BINARY_32);
+        add_primitive_float32(process, (float)value);
+    }
+    else
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, sizeof(double));
+        add_primitive_type(process, TYPE_FLOAT_BINARY_64);
+        add_primitive_float64(process, value);
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+static cbe_encode_status add_slot_string(cbe_encode_process* const process,
+                                         const char* const string_start,
+                                         const int64_t byte_count)
+{
+    unlikely_if(byte_count < 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    unlikely_if(!cbe_validate_string((const uint8_t*)string_start, byte_count))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
+    }
+
+    if(byte_count > 15)
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, get_array_length_field_width(byte_count));
+        add_primitive_type(process, TYPE_STRING);
+        add_array_length_field(process, byte_count);
+    }
+    else
+    {
+        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
+        add_primitive_type(process, TYPE_STRING_0 + byte_count);
+    }
+
+    return add_raw_bytes(process, (const uint8_t*)string_start, byte_count);
+}
+
+static cbe_encode_status add_slot_value(cbe_encode_process* const process,
+                                        const cbe_slot_type type,
+                                        const cbe_slot_value* const value)
+{
+    switch(type)
+    {
+        case CBE_SLOT_TYPE_INTEGER:
+            return add_slot_integer(process, value->integer);
+        case CBE_SLOT_TYPE_FLOAT:
+            return add_slot_float(process, value->floating_point);
+        case CBE_SLOT_TYPE_BOOLEAN:
+            STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
+            add_primitive_type(process, value->boolean ? TYPE_TRUE : TYPE_FALSE);
+            return CBE_ENCODE_STATUS_OK;
+        default:
+            return add_slot_string(process, value->string.start, value->string.byte_count);
+    }
+}
+
+
+// Write out everything before the outermost open sorted map, and move the
+// open maps to the start of the buffer so that they can still be sorted.
+static bool write_before_sorted_maps(cbe_encode_process* const process, const int fd)
+{
+    canonical_slot* const index = process->canonical.index;
+    const int64_t byte_count = index[0].frame.contents_start;
+    unlikely_if(!cbe_write_fully(fd, process->buffer.start, byte_count))
+    {
+        return false;
+    }
+
+    uint8_t* const start = (uint8_t*)process->buffer.start;
+    memmove(start, start + byte_count, (size_t)(process->buffer.position - start - byte_count));
+    process->buffer.position -= byte_count;
+    process->buffer.document_offset += byte_count;
+    // Savepoints now point to the wrong place.
+    process->buffer.generation++;
+
+    // The frames are linked from the innermost one, and everything else is an entry.
+    int64_t frame = process->canonical.frame;
+    for(int64_t i = process->canonical.count - 1; i >= 0; i--)
+    {
+        if(i == frame)
+        {
+            index[i].frame.contents_start -= byte_count;
+            index[i].frame.buffer_generation = process->buffer.generation;
+            frame = index[i].frame.previous;
+        }
+        else
+        {
+            index[i].entry.start -= byte_count;
+            index[i].entry.value_start -= byte_count;
+            index[i].entry.end -= byte_count;
+        }
+    }
+    return true;
+}
+
+
+// ========
+// Internal
+// ========
+
+bool cbe_encode_write_buffered(cbe_encode_process* const process, const int fd)
+{
+    KSLOG_DEBUG("(process %p, fd %d)", process, fd);
+    unlikely_if(process->canonical.count > 0)
+    {
+        return write_before_sorted_maps(process, fd);
+    }
+    likely_if(process->page_pool == NULL)
+    {
+        unlikely_if(!cbe_write_fully(fd, process->buffer.start, process->buffer.position - process->buffer.start))
+        {
+            return false;
+        }
+        process->buffer.document_offset = get_document_offset(process);
+        process->buffer.position = (uint8_t*)process->buffer.start;
+        process->buffer.generation++;
+        return true;
+    }
+    return cbe_encode_flush_pages(process, fd) >= 0;
+}
+
+bool cbe_encode_is_sorting_map(cbe_encode_process* const process)
+{
+    return process->canonical.count > 0;
+}
+
+void cbe_encode_absorb_shard(cbe_encode_process* const process, cbe_encode_process* const shard)
+{
+    KSLOG_DEBUG("(process %p, shard %p)", process, shard);
+    if(shard->container.deepest_level > process->container.deepest_level)
+    {
+        process->container.deepest_level = shard->container.deepest_level;
+    }
+    if(process->container.level == 0)
+    {
+        // The shard's positions are counted from its own first object.
+        const uint8_t positions = shard->container.unkeyable_top_level_positions;
+        process->container.unkeyable_top_level_positions |= process->container.next_object_is_map_key
+            ? (uint8_t)(((positions & 1) << 1) | (positions >> 1))
+            : positions;
+    }
+    process->container.next_object_is_map_key = process->container.next_object_is_map_key !=
+                                                 shard->container.next_object_is_map_key;
+    shard->container.next_object_is_map_key = false;
+    shard->container.unkeyable_top_level_positions = 0;
+    // The shard's flushed output is now part of the process's document.
+    process->buffer.document_offset += shard->buffer.document_offset;
+    shard->buffer.document_offset = 0;
+}
+
+
+// ===
+// API
+// ===
+
+int cbe_encode_process_size(const int max_container_depth)
+{
+    KSLOG_TRACE("(max_container_depth %d)", max_container_depth);
+    return sizeof(cbe_encode_process) + get_max_container_depth_or_default(max_container_depth);
+}
+
+int cbe_encode_measure_process_size(const int max_container_depth)
+{
+    KSLOG_TRACE("(max_container_depth %d)", max_container_depth);
+    return cbe_encode_process_size(max_container_depth) + MEASURE_SCRATCH_SIZE;
+}
+
+
+cbe_encode_status cbe_encode_begin(struct cbe_encode_process* const process,
+                                   uint8_t* const document_buffer,
+                                   const int64_t byte_count,
+                                   const int max_container_depth)
+{
+    KSLOG_TRACE("(process %p, document_buffer %p, byte_count %d, max_container_depth %d)",
+        process, document_buffer, byte_count, max_container_depth);
+    unlikely_if(process == NULL || document_buffer == NULL || byte_count < 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    zero_memory(process, sizeof(*process) + 1);
+    cbe_encode_status status = cbe_encode_set_buffer(process, document_buffer, byte_count);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        return status;
+    }
+    process->container.max_depth = get_max_container_depth_or_default(max_container_depth);
+
+    return status;
+}
+
+cbe_encode_status cbe_encode_begin_growable(struct cbe_encode_process* const process,
+                                            const int64_t initial_byte_count,
+                                            const cbe_realloc_function realloc_function,
+                                            void* const allocator_context,
+                                            const int max_container_depth)
+{
+    KSLOG_TRACE("(process %p, initial_byte_count %d, realloc_function %p, allocator_context %p, max_container_depth %d)",
+        process, initial_byte_count, realloc_function, allocator_context, max_container_depth);
+    unlikely_if(process == NULL || realloc_function == NULL || initial_byte_count < 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    zero_memory(process, sizeof(*process) + 1);
+    process->allocator.realloc = realloc_function;
+    process->allocator.context = allocator_context;
+    process->container.max_depth = get_max_container_depth_or_default(max_container_depth);
+
+    unlikely_if(!grow_buffer(process, initial_byte_count))
+    {
+        return CBE_ENCODE_STATUS_NEED_MORE_ROOM;
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_begin_paged(struct cbe_encode_process* const process,
+                                         struct cbe_page_pool* const page_pool,
+                                         const int max_container_depth)
+{
+    KSLOG_TRACE("(process %p, page_pool %p, max_container_depth %d)", process, page_pool, max_container_depth);
+    unlikely_if(process == NULL || page_pool == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    zero_memory(process, sizeof(*process) + 1);
+    process->page_pool = page_pool;
+    process->container.max_depth = get_max_container_depth_or_default(max_container_depth);
+    uint8_t* const page = cbe_page_pool_rewind(page_pool);
+    process->buffer.start = page;
+    process->buffer.position = page;
+    process->buffer.end = page + cbe_page_pool_get_page_size(page_pool);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_begin_measure(struct cbe_encode_process* const process,
+                                           const int max_container_depth)
+{
+    KSLOG_TRACE("(process %p, max_container_depth %d)", process, max_container_depth);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    zero_memory(process, sizeof(*process) + 1);
+    process->measure.is_measuring = true;
+    process->container.max_depth = get_max_container_depth_or_default(max_container_depth);
+    uint8_t* const scratch = (uint8_t*)process->is_inside_map + process->container.max_depth;
+    process->buffer.start = scratch;
+    process->buffer.position = scratch;
+    process->buffer.end = scratch + MEASURE_SCRATCH_SIZE;
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+int64_t cbe_encode_get_measured_byte_count(struct cbe_encode_process* const process)
+{
+    KSLOG_DEBUG("(process %p)", process);
+    unlikely_if(!process->measure.is_measuring)
+    {
+        return -1;
+    }
+    return process->measure.byte_count + (process->buffer.position - process->buffer.start);
+}
+
+void cbe_encode_set_reference_threshold(struct cbe_encode_process* const process, const int64_t threshold)
+{
+    KSLOG_DEBUG("(process %p, threshold %d)", process, threshold);
+    process->reference_threshold = threshold;
+}
+
+cbe_encode_status cbe_encode_set_alignment(struct cbe_encode_process* const process, const int alignment)
+{
+    KSLOG_DEBUG("(process %p, alignment %d)", process, alignment);
+    unlikely_if(process == NULL || alignment < 0 || alignment > MAX_ALIGNMENT || (alignment & (alignment - 1)) != 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    unlikely_if(alignment != 0 && process->canonical.is_enabled)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    process->alignment = alignment;
+    return CBE_ENCODE_STATUS_OK;
+}
+
+int64_t cbe_encode_canonical_index_size(const int64_t max_entry_count, const int max_map_depth)
+{
+    KSLOG_TRACE("(max_entry_count %d, max_map_depth %d)", max_entry_count, max_map_depth);
+    return (max_entry_count + max_map_depth) * (int64_t)sizeof(canonical_slot);
+}
+
+cbe_encode_status cbe_encode_set_canonical(struct cbe_encode_process* const process,
+                                           const bool is_canonical,
+                                           void* const map_index,
+                                           const int64_t map_index_byte_count)
+{
+    KSLOG_DEBUG("(process %p, is_canonical %d, map_index %p, map_index_byte_count %d)",
+        process, is_canonical, map_index, map_index_byte_count);
+    unlikely_if(process == NULL || process->page_pool != NULL || process->container.level != 0 ||
+                (is_canonical && map_index == NULL && !process->measure.is_measuring) ||
+                map_index_byte_count < 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+
+    process->canonical.is_enabled = is_canonical;
+    process->canonical.is_index_full = false;
+    process->canonical.index = (canonical_slot*)map_index;
+    process->canonical.capacity = map_index == NULL ? 0 : map_index_byte_count / (int64_t)sizeof(canonical_slot);
+    process->canonical.count = 0;
+    process->canonical.frame = 0;
+    unlikely_if(is_canonical)
+    {
+        process->alignment = 0;
+    }
+    return CBE_ENCODE_STATUS_OK;
+}
+
+int cbe_encode_get_segment_count(struct cbe_encode_process* const process)
+{
+    KSLOG_DEBUG("(process %p)", process);
+    unlikely_if(process->page_pool == NULL)
+    {
+        return 0;
+    }
+    return cbe_page_pool_get_segment_count(process->page_pool, process->buffer.position);
+}
+
+const uint8_t* cbe_encode_get_segment(struct cbe_encode_process* const process,
+                                      const int index,
+                                      int64_t* const byte_count)
+{
+    KSLOG_DEBUG("(process %p, index %d)", process, index);
+    unlikely_if(index < 0 || index >= cbe_encode_get_segment_count(process))
+    {
+        return NULL;
+    }
+    return cbe_page_pool_get_segment(process->page_pool, process->buffer.position, index, byte_count);
+}
 
-    swap_map_key_value_status(process);
-    unlikely_if(byte_count == 0)
+int64_t cbe_encode_flush_pages(struct cbe_encode_process* const process, const int fd)
+{
+    KSLOG_DEBUG("(process %p, fd %d)", process, fd);
+    unlikely_if(process->page_pool == NULL)
     {
-        end_array(process);
+        return -1;
+    }
+    const int64_t bytes_written = cbe_page_pool_write(process->page_pool, process->buffer.position, fd);
+    unlikely_if(bytes_written < 0)
+    {
+        return bytes_written;
     }
 
-    return CBE_ENCODE_STATUS_OK;
+    process->buffer.document_offset = get_document_offset(process);
+    uint8_t* const page = cbe_page_pool_rewind(process->page_pool);
+    process->buffer.start = page;
+    process->buffer.position = page;
+    process->buffer.end = page + cbe_page_pool_get_page_size(process->page_pool);
+    process->buffer.generation++;
+    return bytes_written;
 }
 
-static cbe_encode_status encode_array_contents(cbe_encode_process* const process, 
-                                               const uint8_t* const start,
-                                               int64_t* const byte_count)
+uint8_t* cbe_encode_take_buffer(struct cbe_encode_process* const process, int64_t* const byte_count)
 {
-    KSLOG_DEBUG("(process %p, start %p, byte_count %d)", process, start, *byte_count);
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, 0);
+    KSLOG_DEBUG("(process %p)", process);
+    uint8_t* const buffer = (uint8_t*)process->buffer.start;
+    *byte_count = process->buffer.position - process->buffer.start;
 
-    likely_if(*byte_count > 0)
+    process->allocator.realloc = NULL;
+    process->allocator.context = NULL;
+    process->buffer.start = NULL;
+    process->buffer.position = NULL;
+    process->buffer.end = NULL;
+    process->buffer.generation++;
+
+    return buffer;
+}
+
+cbe_encode_status cbe_encode_savepoint(cbe_encode_process* const process, struct cbe_savepoint* const savepoint)
+{
+    KSLOG_DEBUG("(process %p, savepoint %p)", process, savepoint);
+    unlikely_if(process == NULL || savepoint == NULL)
     {
-        const int64_t want_to_copy = *byte_count;
-        const int64_t space_in_buffer = buff_remaining_length(process);
-        const int64_t bytes_to_copy = minimum_int64(want_to_copy, space_in_buffer);
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
 
-        KSLOG_DEBUG("Type: %d", process->array.type);
-        switch(process->array.type)
-        {
-            case ARRAY_TYPE_STRING:
-                unlikely_if(!cbe_validate_string(start, bytes_to_copy))
-                {
-                    KSLOG_DEBUG("invalid data");
-                    return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
-                }
-                break;
-            case ARRAY_TYPE_URI:
-                unlikely_if(!cbe_validate_uri(start, bytes_to_copy))
-                {
-                    KSLOG_DEBUG("invalid data");
-                    return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
-                }
-                break;
-            case ARRAY_TYPE_COMMENT:
-                unlikely_if(!cbe_validate_comment(start, bytes_to_copy))
-                {
-                    KSLOG_DEBUG("invalid data");
-                    return CBE_ENCODE_ERROR_INVALID_ARRAY_DATA;
-                }
-                break;
-            case ARRAY_TYPE_BYTES:
-                // Nothing to do
-                break;
-        }
+    encode_savepoint* const state = (encode_savepoint*)savepoint;
+    state->buffer_offset = process->buffer.position - process->buffer.start;
+    state->document_offset = process->buffer.document_offset;
+    state->measured_byte_count = process->measure.byte_count;
+    state->array_current_offset = process->array.current_offset;
+    state->array_byte_count = process->array.byte_count;
+    state->canonical_count = process->canonical.count;
+    state->canonical_frame = process->canonical.frame;
+    state->enclosing_maps = 0;
+    for(int i = 0; i < SAVEPOINT_MAX_ENCLOSING_MAPS && i <= process->container.level; i++)
+    {
+        state->enclosing_maps |= (uint64_t)process->is_inside_map[process->container.level - i] << i;
+    }
+    state->key_dictionary = process->key_dictionary.table;
+    state->page_pool_mark = (cbe_page_pool_mark){0};
+    if(process->page_pool != NULL)
+    {
+        state->page_pool_mark = cbe_page_pool_get_mark(process->page_pool);
+    }
+    state->utf8_context = process->array.utf8_context;
+    state->buffer_generation = process->buffer.generation;
+    state->container_level = process->container.level;
+    state->deepest_level = process->container.deepest_level;
+    state->key_dictionary_entry_count = process->key_dictionary.entry_count;
+    state->array_type = process->array.type;
+    state->is_inside_array = process->array.is_inside_array;
+    state->next_object_is_map_key = process->container.next_object_is_map_key;
+    state->top_level_status_after_container = process->container.top_level_status_after_container;
+    state->unkeyable_top_level_positions = process->container.unkeyable_top_level_positions;
+    state->canonical_is_index_full = process->canonical.is_index_full;
 
-        add_primitive_bytes(process, start, bytes_to_copy);
-        process->array.current_offset += bytes_to_copy;
-        *byte_count = bytes_to_copy;
+    return CBE_ENCODE_STATUS_OK;
+}
 
-        KSLOG_DEBUG("Streamed %d bytes into array", bytes_to_copy);
-        STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, want_to_copy - bytes_to_copy);
+cbe_encode_status cbe_encode_rollback(cbe_encode_process* const process, const struct cbe_savepoint* const savepoint)
+{
+    KSLOG_DEBUG("(process %p, savepoint %p)", process, savepoint);
+    unlikely_if(process == NULL || savepoint == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
     }
 
-    if(process->array.current_offset == process->array.byte_count)
+    const encode_savepoint* const state = (const encode_savepoint*)savepoint;
+    unlikely_if(state->buffer_generation != process->buffer.generation)
     {
-        KSLOG_DEBUG("Array has ended");
-        end_array(process);
+        KSLOG_DEBUG("The buffer was flushed or replaced after the savepoint");
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
     }
+    unlikely_if(state->container_level - process->container.level > SAVEPOINT_MAX_ENCLOSING_MAPS)
+    {
+        KSLOG_DEBUG("More containers were closed after the savepoint than it can restore");
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    if(process->page_pool != NULL)
+    {
+        uint8_t* const page = cbe_page_pool_rollback(process->page_pool, state->page_pool_mark);
+        process->buffer.start = page;
+        process->buffer.end = page + cbe_page_pool_get_page_size(process->page_pool);
+    }
+    process->buffer.position = (uint8_t*)process->buffer.start + state->buffer_offset;
+    process->buffer.document_offset = state->document_offset;
+    process->measure.byte_count = state->measured_byte_count;
+    process->array.current_offset = state->array_current_offset;
+    process->array.byte_count = state->array_byte_count;
+    process->canonical.count = state->canonical_count;
+    process->canonical.frame = state->canonical_frame;
+    process->canonical.is_index_full = state->canonical_is_index_full;
+    process->key_dictionary.table = state->key_dictionary;
+    process->key_dictionary.entry_count = state->key_dictionary_entry_count;
+    process->array.utf8_context = state->utf8_context;
+    process->array.type = state->array_type;
+    process->array.is_inside_array = state->is_inside_array;
+    // Containers opened after the savepoint are forgotten along with their contents.
+    for(int level = state->container_level + 1; level <= process->container.level; level++)
+    {
+        process->is_inside_map[level] = false;
+    }
+    for(int i = 0; i < SAVEPOINT_MAX_ENCLOSING_MAPS && i <= state->container_level; i++)
+    {
+        process->is_inside_map[state->container_level - i] = (state->enclosing_maps >> i) & 1;
+    }
+    process->container.level = state->container_level;
+    process->container.deepest_level = state->deepest_level;
+    process->container.next_object_is_map_key = state->next_object_is_map_key;
+    process->container.top_level_status_after_container = state->top_level_status_after_container;
+    process->container.unkeyable_top_level_positions = state->unkeyable_top_level_positions;
 
     return CBE_ENCODE_STATUS_OK;
 }
 
-// ===
-// API
-// ===
+// Undoing a whole array or template added in one call only needs the buffer
+// position and array state back, unless it may have crossed pages or recorded
+// a sorted map index entry, which takes a full savepoint.
+typedef struct
+{
+    int64_t buffer_offset;
+    int64_t measured_byte_count;
+    bool next_object_is_map_key;
+    uint8_t unkeyable_top_level_positions;
+    bool is_full;
+    struct cbe_savepoint savepoint;
+} undo_mark;
+
+static inline void set_undo_mark(cbe_encode_process* const process, undo_mark* const mark)
+{
+    mark->is_full = process->page_pool != NULL || process->canonical.count > 0;
+    unlikely_if(mark->is_full)
+    {
+        cbe_encode_savepoint(process, &mark->savepoint);
+        return;
+    }
+    mark->buffer_offset = process->buffer.position - process->buffer.start;
+    mark->measured_byte_count = process->measure.byte_count;
+    mark->next_object_is_map_key = process->container.next_object_is_map_key;
+    mark->unkeyable_top_level_positions = process->container.unkeyable_top_level_positions;
+}
 
-int cbe_encode_process_size(const int max_container_depth)
+static inline void undo_to_mark(cbe_encode_process* const process, const undo_mark* const mark)
 {
-    KSLOG_TRACE("(max_container_depth %d)", max_container_depth);
-    return sizeof(cbe_encode_process) + get_max_container_depth_or_default(max_container_depth);
+    unlikely_if(mark->is_full)
+    {
+        cbe_encode_rollback(process, &mark->savepoint);
+        return;
+    }
+    // A growable buffer may have moved, so the position is kept as an offset.
+    process->buffer.position = (uint8_t*)process->buffer.start + mark->buffer_offset;
+    process->measure.byte_count = mark->measured_byte_count;
+    process->container.next_object_is_map_key = mark->next_object_is_map_key;
+    process->container.unkeyable_top_level_positions = mark->unkeyable_top_level_positions;
+    process->array.is_inside_array = false;
+    process->array.current_offset = 0;
+    process->array.byte_count = 0;
 }
 
+cbe_encode_status cbe_encode_get_fragment(cbe_encode_process* const process, struct cbe_fragment* const fragment)
+{
+    KSLOG_DEBUG("(process %p, fragment %p)", process, fragment);
+    unlikely_if(process == NULL || fragment == NULL ||
+                process->page_pool != NULL || process->measure.is_measuring)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
 
-cbe_encode_status cbe_encode_begin(struct cbe_encode_process* const process,
-                                   uint8_t* const document_buffer,
-                                   const int64_t byte_count,
-                                   const int max_container_depth)
+    STOP_AND_EXIT_IF_IS_INSIDE_CONTAINER(process);
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+
+    fragment->data = process->buffer.start;
+    fragment->byte_count = process->buffer.position - process->buffer.start;
+    fragment->container_depth = process->container.deepest_level;
+    fragment->has_odd_object_count = process->container.next_object_is_map_key;
+    fragment->unkeyable_positions = process->container.unkeyable_top_level_positions;
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_begin_shard(cbe_encode_process* const process,
+                                         struct cbe_page_pool* const page_pool,
+                                         cbe_encode_process* const parent)
 {
-    KSLOG_TRACE("(process %p, document_buffer %p, byte_count %d, max_container_depth %d)",
-        process, document_buffer, byte_count, max_container_depth);
-    unlikely_if(process == NULL || document_buffer == NULL || byte_count < 0)
+    KSLOG_DEBUG("(process %p, page_pool %p, parent %p)", process, page_pool, parent);
+    unlikely_if(process == NULL || page_pool == NULL || parent == NULL ||
+                parent->measure.is_measuring || parent->is_inside_map[parent->container.level] ||
+                parent->canonical.is_enabled)
     {
         return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
     }
 
-    zero_memory(process, sizeof(*process) + 1);
-    cbe_encode_status status = cbe_encode_set_buffer(process, document_buffer, byte_count);
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(parent);
+
+    cbe_encode_status status = cbe_encode_begin_paged(process, page_pool, parent->container.max_depth);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
         return status;
     }
-    process->container.max_depth = get_max_container_depth_or_default(max_container_depth);
+    process->container.level = parent->container.level;
+    process->container.base_level = parent->container.level;
+    process->is_inside_map[process->container.level] = false;
+    process->reference_threshold = parent->reference_threshold;
+    process->timezone_table = parent->timezone_table;
+    process->key_dictionary = parent->key_dictionary;
 
-    return status;
+    return CBE_ENCODE_STATUS_OK;
 }
 
 cbe_encode_status cbe_encode_set_buffer(cbe_encode_process* const process,
@@ -499,9 +2275,15 @@ cbe_encode_status cbe_encode_set_buffer(cbe_encode_process* const process,
         return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
     }
 
+    process->buffer.document_offset = get_document_offset(process);
+    process->allocator.realloc = NULL;
+    process->allocator.context = NULL;
+    process->page_pool = NULL;
+    process->measure.is_measuring = false;
     process->buffer.start = document_buffer;
     process->buffer.position = document_buffer;
     process->buffer.end = document_buffer + byte_count;
+    process->buffer.generation++;
 
     return CBE_ENCODE_STATUS_OK;
 }
@@ -518,6 +2300,55 @@ int cbe_encode_get_container_level(cbe_encode_process* const process)
     return process->container.level;    
 }
 
+cbe_encode_status cbe_encode_add_key_dictionary(cbe_encode_process* const process,
+                                                const struct cbe_string_table* const key_dictionary)
+{
+    KSLOG_DEBUG("(process %p, key_dictionary %p)", process, key_dictionary);
+    unlikely_if(process == NULL || key_dictionary == NULL || process->key_dictionary.table != NULL ||
+                process->container.level != 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    struct cbe_savepoint savepoint;
+    cbe_encode_savepoint(process, &savepoint);
+
+    #define ADD_OR_ROLL_BACK(...) \
+    { \
+        const cbe_encode_status status = __VA_ARGS__; \
+        unlikely_if(status != CBE_ENCODE_STATUS_OK) \
+        { \
+            cbe_encode_rollback(process, &savepoint); \
+            return status; \
+        } \
+    }
+
+    const int entry_count = cbe_string_table_get_entry_count(key_dictionary);
+    ADD_OR_ROLL_BACK(cbe_encode_metadata_map_begin(process));
+    ADD_OR_ROLL_BACK(cbe_encode_add_string(process, KEY_DICTIONARY_METADATA_KEY, sizeof(KEY_DICTIONARY_METADATA_KEY) - 1));
+    ADD_OR_ROLL_BACK(cbe_encode_list_begin(process));
+    for(int id = 0; id < entry_count; id++)
+    {
+        int64_t byte_count = 0;
+        const char* const key = cbe_string_table_get(key_dictionary, id, &byte_count);
+        ADD_OR_ROLL_BACK(cbe_encode_add_string(process, key, byte_count));
+    }
+    ADD_OR_ROLL_BACK(cbe_encode_container_end(process));
+    ADD_OR_ROLL_BACK(cbe_encode_container_end(process));
+    #undef ADD_OR_ROLL_BACK
+
+    process->key_dictionary.table = key_dictionary;
+    process->key_dictionary.entry_count = entry_count;
+    return CBE_ENCODE_STATUS_OK;
+}
+
+void cbe_encode_set_timezone_table(cbe_encode_process* const process,
+                                   const struct cbe_string_table* const timezone_table)
+{
+    KSLOG_DEBUG("(process %p, timezone_table %p)", process, timezone_table);
+    process->timezone_table = timezone_table;
+}
+
 cbe_encode_status cbe_encode_add_padding(cbe_encode_process* const process, const int byte_count)
 {
     KSLOG_DEBUG("(process %p, byte_count %d)", process, byte_count);
@@ -527,12 +2358,18 @@ cbe_encode_status cbe_encode_add_padding(cbe_encode_process* const process, cons
     }
 
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, byte_count);
-
-    for(int i = 0; i < byte_count; i++)
+    unlikely_if(process->canonical.is_enabled)
     {
-        add_primitive_uint8(process, TYPE_PADDING);
+        return CBE_ENCODE_STATUS_OK;
     }
+    unlikely_if(process->measure.is_measuring)
+    {
+        add_measured_bytes(process, byte_count);
+        return CBE_ENCODE_STATUS_OK;
+    }
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, byte_count);
+
+    add_primitive_padding(process, byte_count);
 
     return CBE_ENCODE_STATUS_OK;
 }
@@ -549,6 +2386,7 @@ cbe_encode_status cbe_encode_add_nil(cbe_encode_process* const process)
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
 
+    note_unkeyable_object(process);
     add_primitive_type(process, TYPE_NIL);
     swap_map_key_value_status(process);
 
@@ -587,21 +2425,76 @@ cbe_encode_status cbe_encode_add_integer(cbe_encode_process* const process, cons
 
     int is_negative = RSHIFT_MAX((unsigned)sign);
 
-    if(FITS_IN_UINT_21(value))
+    switch(get_integer_type(value))
     {
-        if(FITS_IN_UINT_16(value))
-        {
-            if(FITS_IN_UINT_8(value)) return add_int_8(process, is_negative, value);
-            return add_int_16(process, is_negative, value);
-        }
-        return add_int(process, is_negative, value);
+        case TYPE_INT_POS_8:  return add_int_8(process, is_negative, value);
+        case TYPE_INT_POS_16: return add_int_16(process, is_negative, value);
+        case TYPE_INT_POS_32: return add_int_32(process, is_negative, value);
+        case TYPE_INT_POS:    return add_int(process, is_negative, value);
+        default:              return add_int_64(process, is_negative, value);
+    }
+}
+
+cbe_encode_status cbe_encode_add_integer_128(cbe_encode_process* const process, const int sign, const uint128_ct value)
+{
+    KSLOG_DEBUG("(process %p, sign %d)", process, sign);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    likely_if(FITS_IN_UINT_64(value))
+    {
+        return cbe_encode_add_integer(process, sign, (uint64_t)value);
+    }
+    return add_int_128(process, RSHIFT_MAX((unsigned)sign), value);
+}
+
+cbe_encode_status cbe_encode_add_integer_128_fixed(cbe_encode_process* const process, const int sign, const uint128_ct value)
+{
+    KSLOG_DEBUG("(process %p, sign %d)", process, sign);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    unlikely_if(process->canonical.is_enabled)
+    {
+        return cbe_encode_add_integer_128(process, sign, value);
+    }
+    return add_fixed_128(process, TYPE_INT_POS_128 + RSHIFT_MAX((unsigned)sign), value);
+}
+
+cbe_encode_status cbe_encode_add_integer_list(cbe_encode_process* const process,
+                                              const int64_t* const values,
+                                              const int64_t count)
+{
+    KSLOG_DEBUG("(process %p, values %p, count %d)", process, values, count);
+    unlikely_if(process == NULL || count < 0 || (values == NULL && count > 0))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    unlikely_if(process->alignment != 0)
+    {
+        return add_aligned_int64_list(process, values, count);
+    }
+    return add_int64_list(process, values, count);
+}
+
+cbe_encode_status cbe_encode_add_unsigned_integer_list(cbe_encode_process* const process,
+                                                       const uint64_t* const values,
+                                                       const int64_t count)
+{
+    KSLOG_DEBUG("(process %p, values %p, count %d)", process, values, count);
+    unlikely_if(process == NULL || count < 0 || (values == NULL && count > 0))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
     }
-    if(FITS_IN_UINT_49(value))
+    unlikely_if(process->alignment != 0)
     {
-        if(FITS_IN_UINT_32(value)) return add_int_32(process, is_negative, value);
-        return add_int(process, is_negative, value);
+        return add_aligned_uint64_list(process, values, count);
     }
-    return add_int_64(process, is_negative, value);
+    return add_uint64_list(process, values, count);
 }
 
 cbe_encode_status cbe_encode_add_float(cbe_encode_process* const process, const double value, int significant_digits)
@@ -621,15 +2514,190 @@ cbe_encode_status cbe_encode_add_float(cbe_encode_process* const process, const
     return add_float_decimal(process, value, significant_digits);
 }
 
-cbe_encode_status cbe_encode_add_decimal_float(cbe_encode_process* const process, const dec64_ct value, int significant_digits)
+cbe_encode_status cbe_encode_add_float_shortest(cbe_encode_process* const process, const double value)
+{
+    KSLOG_DEBUG("(process %p, value %.17g)", process, value);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    const bool fits_in_float_32 = FITS_IN_FLOAT_32(value);
+    const bool is_negative = signbit(value) != 0;
+    if(value == 0)
+    {
+        return add_float_decimal_parts(process, is_negative, 0, 0);
+    }
+    // A decimal is only worth it if it's smaller than the binary form.
+    const int max_decimal_byte_count = fits_in_float_32 ? 3 : 7;
+    uint64_t significand = 0;
+    int exponent = 0;
+    likely_if(isfinite(value) && find_shortest_decimal(fabs(value), max_decimal_byte_count, &significand, &exponent))
+    {
+        return add_float_decimal_parts(process, is_negative, significand, exponent);
+    }
+    if(fits_in_float_32)
+    {
+        return add_float_32(process, value);
+    }
+    return add_float_64(process, value);
+}
+
+cbe_encode_status cbe_encode_add_float_128(cbe_encode_process* const process, const float128_ct value)
+{
+    KSLOG_DEBUG("(process %p, value ~ %.17g)", process, (double)value);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    const double narrowed = (double)value;
+    // NaN never compares equal, so a NaN keeps its full payload here.
+    likely_if((float128_ct)narrowed == value)
+    {
+        return cbe_encode_add_float(process, narrowed, 0);
+    }
+    return add_fixed_128(process, TYPE_FLOAT_BINARY_128, get_float_128_bits(value));
+}
+
+cbe_encode_status cbe_encode_add_float_128_fixed(cbe_encode_process* const process, const float128_ct value)
+{
+    KSLOG_DEBUG("(process %p, value ~ %.17g)", process, (double)value);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    unlikely_if(process->canonical.is_enabled)
+    {
+        return cbe_encode_add_float_128(process, value);
+    }
+    return add_fixed_128(process, TYPE_FLOAT_BINARY_128, get_float_128_bits(value));
+}
+
+cbe_encode_status cbe_encode_add_float_list(cbe_encode_process* const process,
+                                            const double* const values,
+                                            const int64_t count)
+{
+    KSLOG_DEBUG("(process %p, values %p, count %d)", process, values, count);
+    unlikely_if(process == NULL || count < 0 || (values == NULL && count > 0))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    unlikely_if(process->alignment != 0)
+    {
+        return add_aligned_float_list(process, values, count);
+    }
+    return add_float_list(process, values, count);
+}
+
+cbe_encode_status cbe_encode_add_decimal_float(cbe_encode_process* const process, const dec64_ct value, int significant_digits)
+{
+    KSLOG_DEBUG("(process %p, value ~= %.16g)", process, (double)value);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    return add_float_decimal(process, value, significant_digits);
+}
+
+cbe_encode_status cbe_encode_add_decimal_parts(cbe_encode_process* const process,
+                                               const int sign,
+                                               uint64_t significand,
+                                               int exponent)
+{
+    KSLOG_DEBUG("(process %p, sign %d, significand %llu, exponent %d)", process, sign, significand, exponent);
+    // A 64-bit significand has at most 19 trailing zeros, and a 64-bit decimal
+    // float can take up to 15 of them back from a large exponent.
+    unlikely_if(process == NULL ||
+                exponent < MIN_DECIMAL_64_EXPONENT - 19 ||
+                exponent > MAX_DECIMAL_64_EXPONENT + 15)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    while(significand != 0 && significand % 10 == 0)
+    {
+        significand /= 10;
+        exponent++;
+    }
+
+    // The range applies to the value, so check it the way a 64-bit decimal
+    // float would hold it: with zeros moved back out of an exponent that's too large.
+    uint64_t stored_significand = significand;
+    int stored_exponent = exponent;
+    while(stored_exponent > MAX_DECIMAL_64_EXPONENT && stored_significand <= MAX_DECIMAL_64_SIGNIFICAND / 10)
+    {
+        stored_significand *= 10;
+        stored_exponent--;
+    }
+    unlikely_if(significand > MAX_DECIMAL_64_SIGNIFICAND ||
+                exponent < MIN_DECIMAL_64_EXPONENT ||
+                stored_exponent > MAX_DECIMAL_64_EXPONENT)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    return add_float_decimal_parts(process, sign < 0, significand, exponent);
+}
+
+cbe_encode_status cbe_encode_add_decimal_float_128(cbe_encode_process* const process, const dec128_ct value)
+{
+    KSLOG_DEBUG("(process %p)", process);
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    bool is_negative = false;
+    uint128_ct significand = 0;
+    int exponent = 0;
+    unlikely_if(!get_decimal_128_parts(value, &is_negative, &significand, &exponent))
+    {
+        // Infinities and NaNs keep their payload in the fixed width form.
+        return add_fixed_128(process, TYPE_FLOAT_DECIMAL_128, get_decimal_128_bits(value));
+    }
+    unlikely_if(significand == 0)
+    {
+        return add_float_decimal_parts(process, is_negative, 0, 0);
+    }
+
+    while(!FITS_IN_UINT_64(significand) && significand % 10 == 0)
+    {
+        significand /= 10;
+        exponent++;
+    }
+    likely_if(FITS_IN_UINT_64(significand))
+    {
+        uint64_t narrow_significand = (uint64_t)significand;
+        while(narrow_significand % 10 == 0)
+        {
+            narrow_significand /= 10;
+            exponent++;
+        }
+        return add_float_decimal_parts(process, is_negative, narrow_significand, exponent);
+    }
+    unlikely_if(get_decimal_encoded_size_128(is_negative, significand, exponent) > (int)sizeof(value))
+    {
+        return add_fixed_128(process, TYPE_FLOAT_DECIMAL_128, get_decimal_128_bits(value));
+    }
+    return add_float_decimal_parts_128(process, is_negative, significand, exponent);
+}
+
+cbe_encode_status cbe_encode_add_decimal_float_128_fixed(cbe_encode_process* const process, const dec128_ct value)
 {
-    KSLOG_DEBUG("(process %p, value ~= %.16g)", process, (double)value);
+    KSLOG_DEBUG("(process %p)", process);
     unlikely_if(process == NULL)
     {
         return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
     }
 
-    return add_float_decimal(process, value, significant_digits);
+    unlikely_if(process->canonical.is_enabled)
+    {
+        return cbe_encode_add_decimal_float_128(process, value);
+    }
+    return add_fixed_128(process, TYPE_FLOAT_DECIMAL_128, get_decimal_128_bits(value));
 }
 
 #define FILL_TZ_STRING(TZ_PTR, TZ_STRING) \
@@ -649,12 +2717,7 @@ cbe_encode_status cbe_encode_add_decimal_float(cbe_encode_process* const process
         (TZ_PTR)->as_string[length] = 0; \
     }
 
-#define ADD_TIME_COMMON(NAME_LOWER, NAME_UPPER) \
-    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 1); \
-    uint8_t* old_position = process->buffer.position; \
-    \
-    add_primitive_type(process, TYPE_##NAME_UPPER); \
+#define ENCODE_TIME_VALUE(NAME_LOWER) \
     int bytes_encoded = ct_##NAME_LOWER##_encode(&NAME_LOWER, process->buffer.position, buff_remaining_length(process)); \
     if(bytes_encoded < 1) \
     { \
@@ -668,6 +2731,33 @@ cbe_encode_status cbe_encode_add_decimal_float(cbe_encode_process* const process
     \
     return CBE_ENCODE_STATUS_OK
 
+#define ADD_TIME_COMMON(NAME_LOWER, NAME_UPPER) \
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 1); \
+    reserve_for_variable_length_scalar(process); \
+    uint8_t* old_position = process->buffer.position; \
+    \
+    add_primitive_type(process, TYPE_##NAME_UPPER); \
+    ENCODE_TIME_VALUE(NAME_LOWER)
+
+// The timezone is written as its ID in the timezone table, and the value itself has none.
+#define ADD_TIME_WITH_ZONE_ID_COMMON(NAME_LOWER, NAME_UPPER, TZ_ID) \
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process); \
+    unlikely_if(process->timezone_table == NULL || \
+                (TZ_ID) < 0 || \
+                (TZ_ID) >= cbe_string_table_get_entry_count(process->timezone_table)) \
+    { \
+        KSLOG_DEBUG("Invalid timezone ID %d", TZ_ID); \
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT; \
+    } \
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, rvlq_encoded_size_64((uint64_t)(TZ_ID)) + 1); \
+    reserve_for_variable_length_scalar(process); \
+    uint8_t* old_position = process->buffer.position; \
+    \
+    add_primitive_type(process, TYPE_##NAME_UPPER##_ZONE_ID); \
+    add_primitive_rvlq(process, (uint64_t)(TZ_ID)); \
+    ENCODE_TIME_VALUE(NAME_LOWER)
+
 cbe_encode_status cbe_encode_add_date(struct cbe_encode_process* const process, int year, int month, int day)
 {
     KSLOG_DEBUG("(process %p, date = %d.%02d.%02d)", process, year, month, day);
@@ -770,6 +2860,98 @@ cbe_encode_status cbe_encode_add_timestamp_loc(struct cbe_encode_process* const
     ADD_TIME_COMMON(timestamp, TIMESTAMP);
 }
 
+cbe_encode_status cbe_encode_add_time_tzid(struct cbe_encode_process* const process, int hour, int minute, int second, int nanosecond, int timezone_id)
+{
+    KSLOG_DEBUG("(process %p, time = %d:%02d:%02d.%09d/#%d)", process, hour, minute, second, nanosecond, timezone_id);
+    ct_time time = {
+        .hour = hour,
+        .minute = minute,
+        .second = second,
+        .nanosecond = nanosecond,
+        .timezone =
+        {
+            .type = CT_TZ_ZERO,
+        },
+    };
+
+    ADD_TIME_WITH_ZONE_ID_COMMON(time, TIME, timezone_id);
+}
+
+cbe_encode_status cbe_encode_add_timestamp_tzid(struct cbe_encode_process* const process, int year, int month, int day, int hour, int minute, int second, int nanosecond, int timezone_id)
+{
+    KSLOG_DEBUG("(process %p, ts = %d.%02d.%02d-%d:%02d:%02d.%09d/#%d)", process, year, month, day, hour, minute, second, nanosecond, timezone_id);
+    ct_timestamp timestamp =
+    {
+        .date = {
+            .year = year,
+            .month = month,
+            .day = day,
+        },
+        .time = {
+            .hour = hour,
+            .minute = minute,
+            .second = second,
+            .nanosecond = nanosecond,
+            .timezone =
+            {
+                .type = CT_TZ_ZERO,
+            },
+        }
+    };
+
+    ADD_TIME_WITH_ZONE_ID_COMMON(timestamp, TIMESTAMP, timezone_id);
+}
+
+cbe_encode_status cbe_encode_add_smalltime(struct cbe_encode_process* const process, const smalltime value)
+{
+    KSLOG_DEBUG("(process %p, smalltime = %016llx)", process, (unsigned long long)value);
+    ct_timestamp timestamp =
+    {
+        .date = {
+            .year = smalltime_get_year(value),
+            .month = smalltime_get_month(value),
+            .day = smalltime_get_day(value),
+        },
+        .time = {
+            .hour = smalltime_get_hour(value),
+            .minute = smalltime_get_minute(value),
+            .second = smalltime_get_second(value),
+            .nanosecond = smalltime_get_microsecond(value) * 1000,
+            .timezone =
+            {
+                .type = CT_TZ_ZERO,
+            },
+        }
+    };
+
+    ADD_TIME_COMMON(timestamp, TIMESTAMP);
+}
+
+cbe_encode_status cbe_encode_add_nanotime(struct cbe_encode_process* const process, const nanotime value)
+{
+    KSLOG_DEBUG("(process %p, nanotime = %016llx)", process, (unsigned long long)value);
+    ct_timestamp timestamp =
+    {
+        .date = {
+            .year = nanotime_get_year(value),
+            .month = nanotime_get_month(value),
+            .day = nanotime_get_day(value),
+        },
+        .time = {
+            .hour = nanotime_get_hour(value),
+            .minute = nanotime_get_minute(value),
+            .second = nanotime_get_second(value),
+            .nanosecond = nanotime_get_nanosecond(value),
+            .timezone =
+            {
+                .type = CT_TZ_ZERO,
+            },
+        }
+    };
+
+    ADD_TIME_COMMON(timestamp, TIMESTAMP);
+}
+
 cbe_encode_status cbe_encode_list_begin(cbe_encode_process* const process)
 {
     KSLOG_DEBUG("(process %p)", process);
@@ -783,9 +2965,11 @@ cbe_encode_status cbe_encode_list_begin(cbe_encode_process* const process)
     STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
 
+    note_unkeyable_object(process);
     add_primitive_type(process, TYPE_LIST);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
 
+    note_container_begin(process);
     process->container.level++;
     process->is_inside_map[process->container.level] = false;
     process->container.next_object_is_map_key = false;
@@ -804,14 +2988,21 @@ cbe_encode_status cbe_encode_unordered_map_begin(cbe_encode_process* const proce
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
     STOP_AND_EXIT_IF_IS_WRONG_MAP_KEY_TYPE(process);
     STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(process);
+    STOP_AND_EXIT_IF_MAP_INDEX_IS_FULL(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
 
+    note_unkeyable_object(process);
     add_primitive_type(process, TYPE_MAP_UNORDERED);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
 
+    note_container_begin(process);
     process->container.level++;
     process->is_inside_map[process->container.level] = true;
     process->container.next_object_is_map_key = true;
+    unlikely_if(should_sort_maps(process))
+    {
+        begin_sorted_map(process);
+    }
 
     return CBE_ENCODE_STATUS_OK;
 }
@@ -829,9 +3020,11 @@ cbe_encode_status cbe_encode_ordered_map_begin(cbe_encode_process* const process
     STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
 
+    note_unkeyable_object(process);
     add_primitive_type(process, TYPE_MAP_ORDERED);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
 
+    note_container_begin(process);
     process->container.level++;
     process->is_inside_map[process->container.level] = true;
     process->container.next_object_is_map_key = true;
@@ -850,14 +3043,21 @@ cbe_encode_status cbe_encode_metadata_map_begin(cbe_encode_process* const proces
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
     STOP_AND_EXIT_IF_IS_WRONG_MAP_KEY_TYPE(process);
     STOP_AND_EXIT_IF_MAX_CONTAINER_DEPTH_EXCEEDED(process);
+    STOP_AND_EXIT_IF_MAP_INDEX_IS_FULL(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
 
+    note_unkeyable_object(process);
     add_primitive_type(process, TYPE_MAP_METADATA);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
 
+    note_container_begin(process);
     process->container.level++;
     process->is_inside_map[process->container.level] = true;
     process->container.next_object_is_map_key = true;
+    unlikely_if(should_sort_maps(process))
+    {
+        begin_sorted_map(process);
+    }
 
     return CBE_ENCODE_STATUS_OK;
 }
@@ -874,10 +3074,26 @@ cbe_encode_status cbe_encode_container_end(cbe_encode_process* const process)
     STOP_AND_EXIT_IF_IS_NOT_INSIDE_CONTAINER(process);
     STOP_AND_EXIT_IF_MAP_VALUE_MISSING(process);
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, 0);
+    unlikely_if(is_inside_sorted_map(process))
+    {
+        const cbe_encode_status status = end_sorted_map(process);
+        unlikely_if(status != CBE_ENCODE_STATUS_OK)
+        {
+            return status;
+        }
+    }
 
     add_primitive_type(process, TYPE_END_CONTAINER);
     process->container.level--;
     process->container.next_object_is_map_key = process->is_inside_map[process->container.level];
+    unlikely_if(process->container.level == 0)
+    {
+        process->container.next_object_is_map_key = process->container.top_level_status_after_container;
+    }
+    unlikely_if(process->canonical.count > 0)
+    {
+        note_sorted_map_object_end(process);
+    }
 
     return CBE_ENCODE_STATUS_OK;
 }
@@ -891,12 +3107,15 @@ cbe_encode_status cbe_encode_bytes_begin(cbe_encode_process* const process, cons
     }
 
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
-    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, get_array_length_field_width(byte_count));
+    const int length_field_width = get_array_length_field_width(byte_count);
+    const int padding = get_array_alignment_padding(process, sizeof(cbe_encoded_type_field) + length_field_width, 1);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, padding + length_field_width);
 
+    add_primitive_padding(process, padding);
     add_primitive_type(process, TYPE_BYTES);
     add_array_length_field(process, byte_count);
     begin_array(process, ARRAY_TYPE_BYTES, byte_count);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
     unlikely_if(byte_count == 0)
     {
         end_array(process);
@@ -933,7 +3152,7 @@ cbe_encode_status cbe_encode_uri_begin(cbe_encode_process* const process, const
     add_primitive_type(process, TYPE_URI);
     add_array_length_field(process, byte_count);
     begin_array(process, ARRAY_TYPE_URI, byte_count);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
     unlikely_if(byte_count == 0)
     {
         end_array(process);
@@ -951,12 +3170,28 @@ cbe_encode_status cbe_encode_comment_begin(cbe_encode_process* const process, co
     }
 
     STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    unlikely_if(process->canonical.is_enabled)
+    {
+        // Comments take up a key or value position in a map, so dropping
+        // one from there would pair up the wrong objects.
+        unlikely_if(process->is_inside_map[process->container.level])
+        {
+            return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+        }
+        // The contents are validated and then dropped.
+        begin_array(process, ARRAY_TYPE_COMMENT, byte_count);
+        unlikely_if(byte_count == 0)
+        {
+            end_array(process);
+        }
+        return CBE_ENCODE_STATUS_OK;
+    }
     STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM_WITH_TYPE(process, get_array_length_field_width(byte_count));
 
     add_primitive_type(process, TYPE_COMMENT);
     add_array_length_field(process, byte_count);
     begin_array(process, ARRAY_TYPE_COMMENT, byte_count);
-    swap_map_key_value_status(process);
+    swap_map_key_value_status_at_begin(process);
     unlikely_if(byte_count == 0)
     {
         end_array(process);
@@ -965,6 +3200,40 @@ cbe_encode_status cbe_encode_comment_begin(cbe_encode_process* const process, co
     return CBE_ENCODE_STATUS_OK;
 }
 
+cbe_encode_status cbe_encode_typed_array_begin(cbe_encode_process* const process,
+                                               const cbe_typed_array_type type,
+                                               const int64_t element_count)
+{
+    KSLOG_DEBUG("(process %p, type %d, element_count %d)", process, type, element_count);
+    const int element_size_shift = get_typed_array_element_size_shift(type);
+    unlikely_if(process == NULL || element_size_shift < 0 || element_count < 0 ||
+                element_count > (INT64_MAX >> element_size_shift))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_IS_WRONG_MAP_KEY_TYPE(process);
+    // Type, element type, and element count.
+    const int header_size = sizeof(cbe_encoded_type_field) + 1 + get_array_length_field_width(element_count);
+    const int padding = get_array_alignment_padding(process, header_size, 1 << element_size_shift);
+    STOP_AND_EXIT_IF_NOT_ENOUGH_ROOM(process, padding + header_size);
+
+    note_unkeyable_object(process);
+    add_primitive_padding(process, padding);
+    add_primitive_type(process, TYPE_TYPED_ARRAY);
+    add_primitive_uint8(process, (uint8_t)type);
+    add_array_length_field(process, element_count);
+    begin_array(process, ARRAY_TYPE_TYPED, element_count << element_size_shift);
+    swap_map_key_value_status_at_begin(process);
+    unlikely_if(element_count == 0)
+    {
+        end_array(process);
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
 cbe_encode_status cbe_encode_add_data(cbe_encode_process* const process,
                                       const uint8_t* const start,
                                       int64_t* const byte_count)
@@ -995,7 +3264,20 @@ cbe_encode_status cbe_encode_add_string(cbe_encode_process* const process,
                                         const char* const string_start,
                                         const int64_t byte_count)
 {
-    uint8_t* const last_position = process->buffer.position;
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    unlikely_if(may_be_declared_key(process, byte_count))
+    {
+        const int id = find_declared_key(process, (const uint8_t*)string_start, byte_count);
+        if(id >= 0)
+        {
+            return add_key_reference(process, id);
+        }
+    }
+    undo_mark mark;
+    set_undo_mark(process, &mark);
     cbe_encode_status status = cbe_encode_string_begin(process, byte_count);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
@@ -1005,7 +3287,7 @@ cbe_encode_status cbe_encode_add_string(cbe_encode_process* const process,
     status = cbe_encode_add_data(process, (const uint8_t*)string_start, &byte_count_copy);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
-        process->buffer.position = last_position;
+        undo_to_mark(process, &mark);
     }
     return status;
 }
@@ -1014,7 +3296,12 @@ cbe_encode_status cbe_encode_add_bytes(cbe_encode_process* const process,
                                         const uint8_t* const data,
                                         const int64_t byte_count)
 {
-    uint8_t* const last_position = process->buffer.position;
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    undo_mark mark;
+    set_undo_mark(process, &mark);
     cbe_encode_status status = cbe_encode_bytes_begin(process, byte_count);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
@@ -1024,16 +3311,208 @@ cbe_encode_status cbe_encode_add_bytes(cbe_encode_process* const process,
     status = cbe_encode_add_data(process, data, &byte_count_copy);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
-        process->buffer.position = last_position;
+        undo_to_mark(process, &mark);
+    }
+    return status;
+}
+
+cbe_encode_status cbe_encode_add_typed_array(cbe_encode_process* const process,
+                                             const cbe_typed_array_type type,
+                                             const void* const elements,
+                                             const int64_t element_count)
+{
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    undo_mark mark;
+    set_undo_mark(process, &mark);
+    cbe_encode_status status = cbe_encode_typed_array_begin(process, type, element_count);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        return status;
+    }
+    int64_t byte_count = element_count * cbe_typed_array_element_size(type);
+    status = cbe_encode_add_data(process, elements, &byte_count);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        undo_to_mark(process, &mark);
     }
     return status;
 }
 
+cbe_encode_status cbe_encode_add_bytes_from_fd(cbe_encode_process* const process,
+                                               const int source_fd,
+                                               const int64_t byte_count,
+                                               const int output_fd)
+{
+    KSLOG_DEBUG("(process %p, source_fd %d, byte_count %d, output_fd %d)", process, source_fd, byte_count, output_fd);
+    // An open sorted map has to stay in the buffer until it ends.
+    unlikely_if(source_fd < 0 || output_fd < 0 || (process != NULL && process->canonical.count > 0))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    cbe_encode_status status = cbe_encode_bytes_begin(process, byte_count);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK || byte_count == 0)
+    {
+        return status;
+    }
+    unlikely_if(process->measure.is_measuring)
+    {
+        add_measured_bytes(process, byte_count);
+        end_array(process);
+        return CBE_ENCODE_STATUS_OK;
+    }
+
+    // The array header and everything before it must reach output_fd before
+    // the contents do.
+    unlikely_if(!cbe_encode_write_buffered(process, output_fd))
+    {
+        return CBE_ENCODE_ERROR_FILE_IO;
+    }
+
+    unlikely_if(!cbe_copy_between_fds(output_fd, source_fd, byte_count))
+    {
+        return CBE_ENCODE_ERROR_FILE_IO;
+    }
+    process->buffer.document_offset += byte_count;
+    process->array.current_offset += byte_count;
+    end_array(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_add_raw(cbe_encode_process* const process, const struct cbe_fragment* const fragment)
+{
+    KSLOG_DEBUG("(process %p, fragment %p)", process, fragment);
+    unlikely_if(process == NULL || fragment == NULL || fragment->byte_count < 0 ||
+                (fragment->data == NULL && fragment->byte_count > 0) || process->canonical.is_enabled)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_FRAGMENT_IS_MISPLACED(process, fragment);
+
+    cbe_encode_status status = add_raw_bytes(process, fragment->data, fragment->byte_count);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        return status;
+    }
+
+    if(fragment->has_odd_object_count)
+    {
+        swap_map_key_value_status(process);
+    }
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_add_slot(cbe_encode_process* const process,
+                                      struct cbe_template* const encode_template,
+                                      const char* const name,
+                                      const cbe_slot_type type)
+{
+    KSLOG_DEBUG("(process %p, template %p, name %s, type %d)", process, encode_template, name, type);
+    unlikely_if(process == NULL || encode_template == NULL ||
+                type < CBE_SLOT_TYPE_INTEGER || type > CBE_SLOT_TYPE_STRING ||
+                process->page_pool != NULL || process->measure.is_measuring || process->canonical.is_enabled ||
+                process->alignment > 0 || process->key_dictionary.entry_count > 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    unlikely_if(!cbe_template_add_slot(encode_template, name, type, process->buffer.position - process->buffer.start))
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    swap_map_key_value_status(process);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_end_template(cbe_encode_process* const process, struct cbe_template* const encode_template)
+{
+    KSLOG_DEBUG("(process %p, template %p)", process, encode_template);
+    unlikely_if(encode_template == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    struct cbe_fragment skeleton;
+    cbe_encode_status status = cbe_encode_get_fragment(process, &skeleton);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        return status;
+    }
+    cbe_template_set_skeleton(encode_template, &skeleton);
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
+cbe_encode_status cbe_encode_add_template(cbe_encode_process* const process,
+                                          const struct cbe_template* const encode_template,
+                                          const cbe_slot_value* const values)
+{
+    KSLOG_DEBUG("(process %p, template %p, values %p)", process, encode_template, values);
+    unlikely_if(process == NULL || encode_template == NULL ||
+                (values == NULL && cbe_template_get_slot_count(encode_template) > 0) ||
+                process->canonical.is_enabled || process->alignment > 0 ||
+                process->key_dictionary.entry_count > 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    const struct cbe_fragment* const skeleton = cbe_template_get_skeleton(encode_template);
+    const cbe_template_slot* const slots = cbe_template_get_slots(encode_template);
+    const int slot_count = cbe_template_get_slot_count(encode_template);
+
+    STOP_AND_EXIT_IF_IS_INSIDE_ARRAY(process);
+    STOP_AND_EXIT_IF_FRAGMENT_IS_MISPLACED(process, skeleton);
+
+    // The slot values swap key/value status as they go, but the skeleton
+    // already accounts for them.
+    const bool next_object_is_map_key = process->container.next_object_is_map_key;
+    undo_mark mark;
+    set_undo_mark(process, &mark);
+
+    cbe_encode_status status = CBE_ENCODE_STATUS_OK;
+    int64_t offset = 0;
+    for(int i = 0; i < slot_count && status == CBE_ENCODE_STATUS_OK; i++)
+    {
+        status = add_raw_bytes(process, skeleton->data + offset, slots[i].offset - offset);
+        likely_if(status == CBE_ENCODE_STATUS_OK)
+        {
+            status = add_slot_value(process, slots[i].type, &values[i]);
+        }
+        offset = slots[i].offset;
+    }
+    likely_if(status == CBE_ENCODE_STATUS_OK)
+    {
+        status = add_raw_bytes(process, skeleton->data + offset, skeleton->byte_count - offset);
+    }
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        undo_to_mark(process, &mark);
+        return status;
+    }
+
+    process->container.next_object_is_map_key = next_object_is_map_key != skeleton->has_odd_object_count;
+
+    return CBE_ENCODE_STATUS_OK;
+}
+
 cbe_encode_status cbe_encode_add_uri(cbe_encode_process* const process,
                                         const char* const uri_start,
                                         const int64_t byte_count)
 {
-    uint8_t* const last_position = process->buffer.position;
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    undo_mark mark;
+    set_undo_mark(process, &mark);
     cbe_encode_status status = cbe_encode_uri_begin(process, byte_count);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
@@ -1043,7 +3522,7 @@ cbe_encode_status cbe_encode_add_uri(cbe_encode_process* const process,
     status = cbe_encode_add_data(process, (const uint8_t*)uri_start, &byte_count_copy);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
-        process->buffer.position = last_position;
+        undo_to_mark(process, &mark);
     }
     return status;
 }
@@ -1052,7 +3531,12 @@ cbe_encode_status cbe_encode_add_comment(cbe_encode_process* const process,
                                         const char* const comment_start,
                                         const int64_t byte_count)
 {
-    uint8_t* const last_position = process->buffer.position;
+    unlikely_if(process == NULL)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+    undo_mark mark;
+    set_undo_mark(process, &mark);
     cbe_encode_status status = cbe_encode_comment_begin(process, byte_count);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
@@ -1062,7 +3546,7 @@ cbe_encode_status cbe_encode_add_comment(cbe_encode_process* const process,
     status = cbe_encode_add_data(process, (const uint8_t*)comment_start, &byte_count_copy);
     unlikely_if(status != CBE_ENCODE_STATUS_OK)
     {
-        process->buffer.position = last_position;
+        undo_to_mark(process, &mark);
     }
     return status;
 }
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include "cbe_internal.h"
+#include <errno.h>
+#include <unistd.h>
+#if defined(__linux__)
+    #include <sys/sendfile.h>
+#endif
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+
+// ====
+// Data
+// ====
+
+// Size of the bounce buffer used when the kernel can't copy between the fds.
+#define COPY_BUFFER_SIZE 32768
+
+
+// ==============
+// Utility Macros
+// ==============
+
+#define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
+#define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
+
+
+// =======
+// Utility
+// =======
+
+#if defined(__linux__)
+// These mean the kernel can't do an in-kernel copy between this pair of fds,
+// and we should try something else.
+static inline bool is_unsupported_copy_error(const int error)
+{
+    return error == EXDEV || error == EINVAL || error == ENOSYS ||
+           error == EOPNOTSUPP || error == EBADF || error == ESPIPE;
+}
+
+typedef ssize_t (*kernel_copy_function)(int output_fd, int source_fd, size_t byte_count);
+
+static ssize_t copy_with_copy_file_range(const int output_fd, const int source_fd, const size_t byte_count)
+{
+    return copy_file_range(source_fd, NULL, output_fd, NULL, byte_count, 0);
+}
+
+static ssize_t copy_with_sendfile(const int output_fd, const int source_fd, const size_t byte_count)
+{
+    return sendfile(output_fd, source_fd, NULL, byte_count);
+}
+
+// Copy using an in-kernel copy function.
+// Returns the number of bytes copied before the function became unusable,
+// or -1 on a real error.
+static int64_t copy_in_kernel(const kernel_copy_function copy,
+                              const int output_fd,
+                              const int source_fd,
+                              const int64_t byte_count)
+{
+    int64_t bytes_copied = 0;
+    while(bytes_copied < byte_count)
+    {
+        const ssize_t result = copy(output_fd, source_fd, (size_t)(byte_count - bytes_copied));
+        unlikely_if(result < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            if(is_unsupported_copy_error(errno))
+            {
+                KSLOG_DEBUG("In-kernel copy unsupported (errno %d) after %d bytes", errno, bytes_copied);
+                break;
+            }
+            KSLOG_DEBUG("In-kernel copy failed with errno %d", errno);
+            return -1;
+        }
+        unlikely_if(result == 0)
+        {
+            // The source ended early. Let the read/write loop report it.
+            break;
+        }
+        bytes_copied += result;
+    }
+    return bytes_copied;
+}
+#endif
+
+
+// ========
+// Internal
+// ========
+
+bool cbe_write_fully(const int fd, const uint8_t* data, int64_t byte_count)
+{
+    while(byte_count > 0)
+    {
+        const ssize_t bytes_written = write(fd, data, (size_t)byte_count);
+        unlikely_if(bytes_written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            KSLOG_DEBUG("write failed with errno %d", errno);
+            return false;
+        }
+        data += bytes_written;
+        byte_count -= bytes_written;
+    }
+    return true;
+}
+
+bool cbe_copy_between_fds(const int output_fd, const int source_fd, int64_t byte_count)
+{
+    KSLOG_DEBUG("(output_fd %d, source_fd %d, byte_count %d)", output_fd, source_fd, byte_count);
+
+#if defined(__linux__)
+    static const kernel_copy_function kernel_copies[] =
+    {
+        copy_with_copy_file_range,
+        copy_with_sendfile,
+    };
+    for(size_t i = 0; i < sizeof(kernel_copies) / sizeof(*kernel_copies) && byte_count > 0; i++)
+    {
+        const int64_t bytes_copied = copy_in_kernel(kernel_copies[i], output_fd, source_fd, byte_count);
+        unlikely_if(bytes_copied < 0)
+        {
+            return false;
+        }
+        byte_count -= bytes_copied;
+    }
+#endif
+
+    uint8_t buffer[COPY_BUFFER_SIZE];
+    while(byte_count > 0)
+    {
+        const size_t bytes_to_read = byte_count < COPY_BUFFER_SIZE ? (size_t)byte_count : COPY_BUFFER_SIZE;
+        const ssize_t bytes_read = read(source_fd, buffer, bytes_to_read);
+        unlikely_if(bytes_read < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            KSLOG_DEBUG("read failed with errno %d", errno);
+            return false;
+        }
+        unlikely_if(bytes_read == 0)
+        {
+            KSLOG_DEBUG("Source ended with %d bytes still to copy", byte_count);
+            errno = ENODATA;
+            return false;
+        }
+        unlikely_if(!cbe_write_fully(output_fd, buffer, bytes_read))
+        {
+            return false;
+        }
+        byte_count -= bytes_read;
+    }
+    return true;
+}
@@ -11,13 +11,44 @@ const char* cbe_version()
     return EXPAND_AND_QUOTE(PROJECT_VERSION);
 }
 
-typedef struct
+const double cbe_exact_powers_of_10[CBE_MAX_EXACT_POWER_OF_10 + 1] =
 {
-    int bytes_remaining;
-    int accumulator;
-} utf8_context;
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
 
-static bool validate_utf8(utf8_context* context, uint8_t ch)
+int cbe_typed_array_element_size(const cbe_typed_array_type type)
+{
+    const int shift = get_typed_array_element_size_shift(type);
+    return shift < 0 ? 0 : 1 << shift;
+}
+
+bool cbe_decimal_parts_to_double(const int sign, uint64_t significand, int exponent, double* const result)
+{
+    // Clinger's fast path: with an exact significand and an exact power of 10,
+    // one IEEE multiply or divide gives the correctly rounded result.
+    if(significand == 0)
+    {
+        *result = sign < 0 ? -0.0 : 0.0;
+        return true;
+    }
+    const uint64_t max_exact_significand = 1ULL << 53;
+    while(exponent > CBE_MAX_EXACT_POWER_OF_10 && significand < max_exact_significand / 10)
+    {
+        significand *= 10;
+        exponent--;
+    }
+    if(significand >= max_exact_significand || exponent > CBE_MAX_EXACT_POWER_OF_10 || exponent < -CBE_MAX_EXACT_POWER_OF_10)
+    {
+        return false;
+    }
+    const double magnitude = exponent < 0 ? (double)significand / cbe_exact_powers_of_10[-exponent]
+                                          : (double)significand * cbe_exact_powers_of_10[exponent];
+    *result = sign < 0 ? -magnitude : magnitude;
+    return true;
+}
+
+static bool validate_utf8(cbe_utf8_context* context, uint8_t ch)
 {
     // UTF-8 Character Bit Patterns
     //
@@ -100,11 +131,36 @@ static bool validate_comment(int ch)
 }
 
 bool cbe_validate_string(const uint8_t* const start, const int64_t byte_count)
+{
+    cbe_utf8_context context = {0};
+    return cbe_validate_string_chunk(&context, start, byte_count);
+}
+
+bool cbe_validate_string_chunk(cbe_utf8_context* const context, const uint8_t* const start, const int64_t byte_count)
+{
+    KSLOG_DEBUG("start %p, byte_count %d", start, byte_count);
+    const uint8_t* ptr = start;
+    const uint8_t* const end = ptr + byte_count;
+
+    while(ptr < end)
+    {
+        uint8_t ch = *ptr++;
+        if(!validate_utf8(context, ch))
+        {
+            KSLOG_DEBUG("UTF-8 validation failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool cbe_validate_string_and_hash(const uint8_t* const start, const int64_t byte_count, uint32_t* const hash)
 {
     KSLOG_DEBUG("start %p, byte_count %d", start, byte_count);
     const uint8_t* ptr = start;
     const uint8_t* const end = ptr + byte_count;
-    utf8_context context = {0};
+    cbe_utf8_context context = {0};
+    uint32_t accumulated_hash = STRING_TABLE_HASH_INIT;
 
     while(ptr < end)
     {
@@ -114,7 +170,9 @@ bool cbe_validate_string(const uint8_t* const start, const int64_t byte_count)
             KSLOG_DEBUG("UTF-8 validation failed");
             return false;
         }
+        accumulated_hash = cbe_string_table_hash_step(accumulated_hash, ch);
     }
+    *hash = accumulated_hash;
     return true;
 }
 
@@ -176,23 +234,28 @@ bool cbe_validate_uri(const uint8_t* const start, const int64_t byte_count)
 }
 
 bool cbe_validate_comment(const uint8_t* const start, const int64_t byte_count)
+{
+    cbe_utf8_context context = {0};
+    return cbe_validate_comment_chunk(&context, start, byte_count);
+}
+
+bool cbe_validate_comment_chunk(cbe_utf8_context* const context, const uint8_t* const start, const int64_t byte_count)
 {
     KSLOG_DEBUG("start %p, byte_count %d", start, byte_count);
     const uint8_t* ptr = start;
     const uint8_t* const end = ptr + byte_count;
-    utf8_context context = {0};
 
     while(ptr < end)
     {
         uint8_t ch = *ptr++;
-        if(!validate_utf8(&context, ch))
+        if(!validate_utf8(context, ch))
         {
             KSLOG_DEBUG("UTF-8 validation failed");
             return false;
         }
-        if(context.bytes_remaining == 0)
+        if(context->bytes_remaining == 0)
         {
-            if(!validate_comment(context.accumulator))
+            if(!validate_comment(context->accumulator))
             {
                 KSLOG_DEBUG("Comment validation failed");
                 return false;
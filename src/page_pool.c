@@ -0,0 +1,270 @@
+#include "cbe_internal.h"
+#include <errno.h>
+#include <sys/uio.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+
+// ====
+// Data
+// ====
+
+// A run of bytes to be written out: either part of a page, or caller memory
+// that was referenced rather than copied.
+typedef struct
+{
+    const uint8_t* start;
+    int64_t byte_count;
+} page_pool_segment;
+
+struct cbe_page_pool
+{
+    int page_count;
+    int current_page;
+    int max_references;
+    int reference_count;
+    int segment_count;
+    int64_t page_size;
+    // Start of the segment that is still being written in the current page.
+    const uint8_t* open_segment_start;
+    page_pool_segment* segments;
+    uint8_t* pages;
+    page_pool_segment data[];
+};
+typedef struct cbe_page_pool cbe_page_pool;
+
+// The number of segments handed to each writev() call.
+#define WRITE_BATCH_SIZE 64
+
+
+// ==============
+// Utility Macros
+// ==============
+
+#define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
+#define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
+
+
+// =======
+// Utility
+// =======
+
+static inline int get_max_segment_count(const int page_count, const int max_references)
+{
+    // Each reference splits the page it's in, and adds its own segment.
+    return page_count + max_references * 2;
+}
+
+static inline uint8_t* get_page(const cbe_page_pool* const pool, const int index)
+{
+    return pool->pages + pool->page_size * index;
+}
+
+static inline void add_segment(cbe_page_pool* const pool, const uint8_t* const start, const int64_t byte_count)
+{
+    likely_if(byte_count > 0)
+    {
+        pool->segments[pool->segment_count].start = start;
+        pool->segments[pool->segment_count].byte_count = byte_count;
+        pool->segment_count++;
+    }
+}
+
+static inline void close_open_segment(cbe_page_pool* const pool, const uint8_t* const position)
+{
+    add_segment(pool, pool->open_segment_start, position - pool->open_segment_start);
+    pool->open_segment_start = position;
+}
+
+// Write all of the batch, retrying on short writes and interrupts.
+static bool write_batch(const int fd, struct iovec* vectors, int vector_count)
+{
+    while(vector_count > 0)
+    {
+        ssize_t bytes_written = writev(fd, vectors, vector_count);
+        unlikely_if(bytes_written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            KSLOG_DEBUG("writev failed with errno %d", errno);
+            return false;
+        }
+        while(vector_count > 0 && (size_t)bytes_written >= vectors->iov_len)
+        {
+            bytes_written -= vectors->iov_len;
+            vectors++;
+            vector_count--;
+        }
+        if(vector_count > 0)
+        {
+            vectors->iov_base = (uint8_t*)vectors->iov_base + bytes_written;
+            vectors->iov_len -= bytes_written;
+        }
+    }
+    return true;
+}
+
+
+// ========
+// Internal
+// ========
+
+uint8_t* cbe_page_pool_rewind(cbe_page_pool* const pool)
+{
+    pool->current_page = 0;
+    pool->reference_count = 0;
+    pool->segment_count = 0;
+    pool->open_segment_start = get_page(pool, 0);
+    return get_page(pool, 0);
+}
+
+uint8_t* cbe_page_pool_next_page(cbe_page_pool* const pool, const uint8_t* const position)
+{
+    KSLOG_DEBUG("(pool %p, position %p)", pool, position);
+    unlikely_if(pool->current_page + 1 >= pool->page_count)
+    {
+        KSLOG_DEBUG("Page pool exhausted");
+        return NULL;
+    }
+    close_open_segment(pool, position);
+    pool->current_page++;
+    pool->open_segment_start = get_page(pool, pool->current_page);
+    return get_page(pool, pool->current_page);
+}
+
+bool cbe_page_pool_can_add_reference(const cbe_page_pool* const pool)
+{
+    return pool->reference_count < pool->max_references;
+}
+
+bool cbe_page_pool_add_reference(cbe_page_pool* const pool,
+                                 const uint8_t* const position,
+                                 const uint8_t* const start,
+                                 const int64_t byte_count)
+{
+    KSLOG_DEBUG("(pool %p, position %p, start %p, byte_count %d)", pool, position, start, byte_count);
+    unlikely_if(!cbe_page_pool_can_add_reference(pool))
+    {
+        return false;
+    }
+    close_open_segment(pool, position);
+    add_segment(pool, start, byte_count);
+    pool->reference_count++;
+    return true;
+}
+
+int64_t cbe_page_pool_get_page_size(const cbe_page_pool* const pool)
+{
+    return pool->page_size;
+}
+
+int64_t cbe_page_pool_get_free_byte_count(const cbe_page_pool* const pool)
+{
+    return (pool->page_count - pool->current_page - 1) * pool->page_size;
+}
+
+int cbe_page_pool_get_segment_count(const cbe_page_pool* const pool, const uint8_t* const position)
+{
+    return pool->segment_count + (position > pool->open_segment_start ? 1 : 0);
+}
+
+const uint8_t* cbe_page_pool_get_segment(const cbe_page_pool* const pool,
+                                         const uint8_t* const position,
+                                         const int index,
+                                         int64_t* const byte_count)
+{
+    if(index == pool->segment_count)
+    {
+        *byte_count = position - pool->open_segment_start;
+        return pool->open_segment_start;
+    }
+    *byte_count = pool->segments[index].byte_count;
+    return pool->segments[index].start;
+}
+
+cbe_page_pool_mark cbe_page_pool_get_mark(const cbe_page_pool* const pool)
+{
+    return (cbe_page_pool_mark)
+    {
+        .current_page = pool->current_page,
+        .reference_count = pool->reference_count,
+        .segment_count = pool->segment_count,
+        .open_segment_offset = pool->open_segment_start - get_page(pool, pool->current_page),
+    };
+}
+
+uint8_t* cbe_page_pool_rollback(cbe_page_pool* const pool, const cbe_page_pool_mark mark)
+{
+    KSLOG_DEBUG("(pool %p, page %d, segment_count %d)", pool, mark.current_page, mark.segment_count);
+    pool->current_page = mark.current_page;
+    pool->reference_count = mark.reference_count;
+    pool->segment_count = mark.segment_count;
+    pool->open_segment_start = get_page(pool, pool->current_page) + mark.open_segment_offset;
+    return get_page(pool, pool->current_page);
+}
+
+int64_t cbe_page_pool_write(cbe_page_pool* const pool, const uint8_t* const position, const int fd)
+{
+    KSLOG_DEBUG("(pool %p, position %p, fd %d)", pool, position, fd);
+    close_open_segment(pool, position);
+
+    struct iovec vectors[WRITE_BATCH_SIZE];
+    int64_t total_bytes = 0;
+    int vector_count = 0;
+    for(int i = 0; i < pool->segment_count; i++)
+    {
+        vectors[vector_count].iov_base = (void*)pool->segments[i].start;
+        vectors[vector_count].iov_len = (size_t)pool->segments[i].byte_count;
+        total_bytes += pool->segments[i].byte_count;
+        vector_count++;
+        if(vector_count == WRITE_BATCH_SIZE || i == pool->segment_count - 1)
+        {
+            unlikely_if(!write_batch(fd, vectors, vector_count))
+            {
+                return -1;
+            }
+            vector_count = 0;
+        }
+    }
+
+    cbe_page_pool_rewind(pool);
+    return total_bytes;
+}
+
+
+// ===
+// API
+// ===
+
+int64_t cbe_page_pool_size(const int page_count, const int64_t page_size, const int max_references)
+{
+    KSLOG_TRACE("(page_count %d, page_size %d, max_references %d)", page_count, page_size, max_references);
+    unlikely_if(page_count < 1 || page_size < 1 || max_references < 0)
+    {
+        return 0;
+    }
+    return sizeof(cbe_page_pool) +
+           sizeof(page_pool_segment) * get_max_segment_count(page_count, max_references) +
+           page_size * page_count;
+}
+
+bool cbe_page_pool_begin(cbe_page_pool* const pool, const int page_count, const int64_t page_size, const int max_references)
+{
+    KSLOG_DEBUG("(pool %p, page_count %d, page_size %d, max_references %d)", pool, page_count, page_size, max_references);
+    unlikely_if(pool == NULL || page_count < 1 || page_size < 1 || max_references < 0)
+    {
+        return false;
+    }
+
+    pool->page_count = page_count;
+    pool->max_references = max_references;
+    pool->page_size = page_size;
+    pool->segments = pool->data;
+    pool->pages = (uint8_t*)(pool->segments + get_max_segment_count(page_count, max_references));
+    cbe_page_pool_rewind(pool);
+
+    return true;
+}
@@ -0,0 +1,265 @@
+#include "cbe_internal.h"
+#include <pthread.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+
+// ====
+// Data
+// ====
+
+#define MAX_SHARD_COUNT 256
+
+// Each shard has a thread for the whole parallel encode, which waits for
+// batches to be handed to it one at a time.
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    bool is_threaded;
+    bool has_batch;
+    bool should_stop;
+    struct cbe_encode_process* process;
+    cbe_encode_elements_function encode_elements;
+    void* context;
+    int64_t first_index;
+    int64_t element_count;
+    cbe_encode_status status;
+} shard_worker;
+
+
+// ==============
+// Utility Macros
+// ==============
+
+#define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
+#define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
+
+
+// =======
+// Utility
+// =======
+
+static inline int64_t minimum_int64(const int64_t a, const int64_t b)
+{
+    return a < b ? a : b;
+}
+
+static void encode_batch(shard_worker* const worker)
+{
+    worker->status = worker->encode_elements(worker->process,
+                                             worker->first_index,
+                                             worker->element_count,
+                                             worker->context);
+}
+
+static void* run_worker(void* const arg)
+{
+    shard_worker* const worker = (shard_worker*)arg;
+    pthread_mutex_lock(&worker->mutex);
+    for(;;)
+    {
+        while(!worker->has_batch && !worker->should_stop)
+        {
+            pthread_cond_wait(&worker->condition, &worker->mutex);
+        }
+        if(!worker->has_batch)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&worker->mutex);
+        encode_batch(worker);
+        pthread_mutex_lock(&worker->mutex);
+        worker->has_batch = false;
+        pthread_cond_signal(&worker->condition);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return NULL;
+}
+
+static void start_worker(shard_worker* const worker)
+{
+    worker->has_batch = false;
+    worker->should_stop = false;
+    worker->element_count = 0;
+    worker->is_threaded = pthread_mutex_init(&worker->mutex, NULL) == 0;
+    unlikely_if(!worker->is_threaded)
+    {
+        return;
+    }
+    worker->is_threaded = pthread_cond_init(&worker->condition, NULL) == 0;
+    unlikely_if(!worker->is_threaded)
+    {
+        pthread_mutex_destroy(&worker->mutex);
+        return;
+    }
+    worker->is_threaded = pthread_create(&worker->thread, NULL, run_worker, worker) == 0;
+    unlikely_if(!worker->is_threaded)
+    {
+        KSLOG_DEBUG("Couldn't start a thread for shard %p. Encoding its batches here instead.", worker->process);
+        pthread_cond_destroy(&worker->condition);
+        pthread_mutex_destroy(&worker->mutex);
+    }
+}
+
+// Lets a batch that's in progress finish first.
+static void stop_worker(shard_worker* const worker)
+{
+    unlikely_if(!worker->is_threaded)
+    {
+        return;
+    }
+    pthread_mutex_lock(&worker->mutex);
+    worker->should_stop = true;
+    pthread_cond_signal(&worker->condition);
+    pthread_mutex_unlock(&worker->mutex);
+    pthread_join(worker->thread, NULL);
+    pthread_cond_destroy(&worker->condition);
+    pthread_mutex_destroy(&worker->mutex);
+}
+
+static void hand_out_batch(shard_worker* const worker, const int64_t first_index, const int64_t element_count)
+{
+    worker->first_index = first_index;
+    worker->element_count = element_count;
+    worker->status = CBE_ENCODE_STATUS_OK;
+    unlikely_if(!worker->is_threaded)
+    {
+        encode_batch(worker);
+        return;
+    }
+    pthread_mutex_lock(&worker->mutex);
+    worker->has_batch = true;
+    pthread_cond_signal(&worker->condition);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+static void wait_for_batch(shard_worker* const worker)
+{
+    unlikely_if(!worker->is_threaded)
+    {
+        return;
+    }
+    pthread_mutex_lock(&worker->mutex);
+    while(worker->has_batch)
+    {
+        pthread_cond_wait(&worker->condition, &worker->mutex);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+// Write a shard's finished batch, and hand its objects over to the parent
+// process.
+static cbe_encode_status write_batch(struct cbe_encode_process* const process,
+                                     shard_worker* const worker,
+                                     const int output_fd)
+{
+    unlikely_if(worker->status != CBE_ENCODE_STATUS_OK)
+    {
+        KSLOG_DEBUG("Shard %p failed with status %d", worker->process, worker->status);
+        return worker->status;
+    }
+    cbe_encode_status status = cbe_encode_end(worker->process);
+    unlikely_if(status != CBE_ENCODE_STATUS_OK)
+    {
+        return status;
+    }
+    unlikely_if(cbe_encode_flush_pages(worker->process, output_fd) < 0)
+    {
+        return CBE_ENCODE_ERROR_FILE_IO;
+    }
+    cbe_encode_absorb_shard(process, worker->process);
+    return CBE_ENCODE_STATUS_OK;
+}
+
+// Batches go to the shards in turn, and are written in the same order. As
+// soon as a shard's batch is written, the shard starts on its next one, so
+// later shards keep encoding while earlier ones are being written.
+static cbe_encode_status encode_batches(struct cbe_encode_process* const process,
+                                        shard_worker* const workers,
+                                        const int shard_count,
+                                        const int64_t element_count,
+                                        const int64_t batch_size,
+                                        const int output_fd)
+{
+    int64_t next_index = 0;
+    for(int i = 0; i < shard_count && next_index < element_count; i++)
+    {
+        const int64_t count = minimum_int64(batch_size, element_count - next_index);
+        hand_out_batch(&workers[i], next_index, count);
+        next_index += count;
+    }
+    for(int i = 0; workers[i].element_count > 0; i = (i + 1) % shard_count)
+    {
+        shard_worker* const worker = &workers[i];
+        wait_for_batch(worker);
+        cbe_encode_status status = write_batch(process, worker, output_fd);
+        unlikely_if(status != CBE_ENCODE_STATUS_OK)
+        {
+            return status;
+        }
+        worker->element_count = 0;
+        if(next_index < element_count)
+        {
+            const int64_t count = minimum_int64(batch_size, element_count - next_index);
+            hand_out_batch(worker, next_index, count);
+            next_index += count;
+        }
+    }
+    return CBE_ENCODE_STATUS_OK;
+}
+
+
+// ===
+// API
+// ===
+
+cbe_encode_status cbe_encode_add_parallel(struct cbe_encode_process* const process,
+                                          const int64_t element_count,
+                                          const int64_t batch_size,
+                                          const cbe_encode_elements_function encode_elements,
+                                          void* const context,
+                                          const struct cbe_encode_shard* const shards,
+                                          const int shard_count,
+                                          const int output_fd)
+{
+    KSLOG_DEBUG("(process %p, element_count %d, batch_size %d, shard_count %d, output_fd %d)",
+        process, element_count, batch_size, shard_count, output_fd);
+    unlikely_if(process == NULL || element_count < 0 || batch_size < 1 || encode_elements == NULL ||
+                shards == NULL || shard_count < 1 || shard_count > MAX_SHARD_COUNT || output_fd < 0)
+    {
+        return CBE_ENCODE_ERROR_INVALID_ARGUMENT;
+    }
+
+    shard_worker workers[MAX_SHARD_COUNT];
+    for(int i = 0; i < shard_count; i++)
+    {
+        cbe_encode_status status = cbe_encode_begin_shard(shards[i].process, shards[i].page_pool, process);
+        unlikely_if(status != CBE_ENCODE_STATUS_OK)
+        {
+            return status;
+        }
+        workers[i].process = shards[i].process;
+        workers[i].encode_elements = encode_elements;
+        workers[i].context = context;
+    }
+
+    unlikely_if(!cbe_encode_write_buffered(process, output_fd))
+    {
+        return CBE_ENCODE_ERROR_FILE_IO;
+    }
+
+    for(int i = 0; i < shard_count; i++)
+    {
+        start_worker(&workers[i]);
+    }
+    cbe_encode_status status = encode_batches(process, workers, shard_count, element_count, batch_size, output_fd);
+    for(int i = 0; i < shard_count; i++)
+    {
+        stop_worker(&workers[i]);
+    }
+
+    return status;
+}
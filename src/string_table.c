@@ -0,0 +1,231 @@
+#include "cbe_internal.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+
+// ====
+// Data
+// ====
+
+typedef struct
+{
+    uint32_t hash;
+    int64_t offset;
+    int64_t byte_count;
+} string_table_entry;
+
+struct cbe_string_table
+{
+    int max_entries;
+    int entry_count;
+    uint32_t slot_mask;
+    int64_t max_total_bytes;
+    int64_t total_bytes;
+    int64_t longest_byte_count;
+    string_table_entry* entries;
+    int32_t* slots;
+    char* strings;
+    string_table_entry data[];
+};
+typedef struct cbe_string_table cbe_string_table;
+
+
+// ==============
+// Utility Macros
+// ==============
+
+#define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
+#define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
+
+
+// =======
+// Utility
+// =======
+
+static inline uint32_t get_slot_count(const int max_entries)
+{
+    // Keep the load factor at or below 50% so that probe sequences stay short.
+    uint32_t slot_count = 2;
+    while(slot_count < (uint32_t)max_entries * 2)
+    {
+        slot_count <<= 1;
+    }
+    return slot_count;
+}
+
+static inline bool entry_matches(const cbe_string_table* const table,
+                                 const string_table_entry* const entry,
+                                 const uint32_t hash,
+                                 const uint8_t* const start,
+                                 const int64_t byte_count)
+{
+    return entry->hash == hash &&
+           entry->byte_count == byte_count &&
+           memcmp(table->strings + entry->offset, start, byte_count) == 0;
+}
+
+
+// ========
+// Internal
+// ========
+
+int cbe_string_table_find_hashed(const cbe_string_table* const table,
+                                 const uint32_t hash,
+                                 const uint8_t* const start,
+                                 const int64_t byte_count)
+{
+    KSLOG_TRACE("(table %p, hash %08x, byte_count %d)", table, hash, byte_count);
+    unlikely_if(table == NULL || byte_count > table->longest_byte_count)
+    {
+        return -1;
+    }
+
+    for(uint32_t slot = hash & table->slot_mask;; slot = (slot + 1) & table->slot_mask)
+    {
+        const int32_t index = table->slots[slot] - 1;
+        if(index < 0)
+        {
+            return -1;
+        }
+        if(entry_matches(table, &table->entries[index], hash, start, byte_count))
+        {
+            return index;
+        }
+    }
+}
+
+int64_t cbe_string_table_get_longest_byte_count(const cbe_string_table* const table)
+{
+    return table->longest_byte_count;
+}
+
+uint32_t cbe_string_table_get_hash(const cbe_string_table* const table, const int id)
+{
+    return table->entries[id].hash;
+}
+
+
+// ===
+// API
+// ===
+
+int64_t cbe_string_table_size(const int max_entries, const int64_t max_total_bytes)
+{
+    KSLOG_TRACE("(max_entries %d, max_total_bytes %d)", max_entries, max_total_bytes);
+    unlikely_if(max_entries < 0 || max_total_bytes < 0)
+    {
+        return 0;
+    }
+    return sizeof(cbe_string_table) +
+           sizeof(string_table_entry) * max_entries +
+           sizeof(int32_t) * get_slot_count(max_entries) +
+           max_total_bytes + max_entries;
+}
+
+bool cbe_string_table_begin(cbe_string_table* const table, const int max_entries, const int64_t max_total_bytes)
+{
+    KSLOG_DEBUG("(table %p, max_entries %d, max_total_bytes %d)", table, max_entries, max_total_bytes);
+    unlikely_if(table == NULL || max_entries < 0 || max_total_bytes < 0)
+    {
+        return false;
+    }
+
+    const uint32_t slot_count = get_slot_count(max_entries);
+    table->max_entries = max_entries;
+    table->entry_count = 0;
+    table->slot_mask = slot_count - 1;
+    table->max_total_bytes = max_total_bytes;
+    table->total_bytes = 0;
+    table->longest_byte_count = -1;
+    table->entries = table->data;
+    table->slots = (int32_t*)(table->entries + max_entries);
+    table->strings = (char*)(table->slots + slot_count);
+    zero_memory(table->slots, sizeof(*table->slots) * slot_count);
+
+    return true;
+}
+
+int cbe_string_table_add(cbe_string_table* const table, const char* const string_start, const int64_t byte_count)
+{
+    KSLOG_DEBUG("(table %p, string_start %p, byte_count %d)", table, string_start, byte_count);
+    unlikely_if(table == NULL || byte_count < 0 || (string_start == NULL && byte_count > 0))
+    {
+        return -1;
+    }
+
+    const uint8_t* const start = (const uint8_t*)string_start;
+    const uint32_t hash = cbe_string_table_hash(start, byte_count);
+    const int existing_id = cbe_string_table_find_hashed(table, hash, start, byte_count);
+    if(existing_id >= 0)
+    {
+        return existing_id;
+    }
+
+    unlikely_if(table->entry_count >= table->max_entries ||
+                table->total_bytes + byte_count > table->max_total_bytes)
+    {
+        KSLOG_DEBUG("String table is full");
+        return -1;
+    }
+
+    const int id = table->entry_count++;
+    string_table_entry* const entry = &table->entries[id];
+    entry->hash = hash;
+    entry->offset = table->total_bytes + id;
+    entry->byte_count = byte_count;
+    memcpy(table->strings + entry->offset, start, byte_count);
+    table->strings[entry->offset + byte_count] = 0;
+    table->total_bytes += byte_count;
+    if(byte_count > table->longest_byte_count)
+    {
+        table->longest_byte_count = byte_count;
+    }
+
+    uint32_t slot = hash & table->slot_mask;
+    while(table->slots[slot] != 0)
+    {
+        slot = (slot + 1) & table->slot_mask;
+    }
+    table->slots[slot] = id + 1;
+
+    return id;
+}
+
+int cbe_string_table_find(const cbe_string_table* const table, const char* const string_start, const int64_t byte_count)
+{
+    KSLOG_TRACE("(table %p, string_start %p, byte_count %d)", table, string_start, byte_count);
+    unlikely_if(table == NULL || byte_count < 0 || (string_start == NULL && byte_count > 0))
+    {
+        return -1;
+    }
+
+    const uint8_t* const start = (const uint8_t*)string_start;
+    return cbe_string_table_find_hashed(table, cbe_string_table_hash(start, byte_count), start, byte_count);
+}
+
+const char* cbe_string_table_get(const cbe_string_table* const table, const int id, int64_t* const byte_count)
+{
+    KSLOG_TRACE("(table %p, id %d)", table, id);
+    unlikely_if(table == NULL || id < 0 || id >= table->entry_count)
+    {
+        return NULL;
+    }
+
+    const string_table_entry* const entry = &table->entries[id];
+    if(byte_count != NULL)
+    {
+        *byte_count = entry->byte_count;
+    }
+    return table->strings + entry->offset;
+}
+
+int cbe_string_table_get_entry_count(const cbe_string_table* const table)
+{
+    KSLOG_TRACE("(table %p)", table);
+    unlikely_if(table == NULL)
+    {
+        return 0;
+    }
+    return table->entry_count;
+}
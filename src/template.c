@@ -0,0 +1,118 @@
+#include "cbe_internal.h"
+#include <string.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+
+// ====
+// Data
+// ====
+
+struct cbe_template
+{
+    struct cbe_fragment skeleton;
+    int max_slot_count;
+    int slot_count;
+    cbe_template_slot slots[];
+};
+typedef struct cbe_template cbe_template;
+
+
+// ==============
+// Utility Macros
+// ==============
+
+#define likely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 1))
+#define unlikely_if(TEST_FOR_TRUTH) if(__builtin_expect(TEST_FOR_TRUTH, 0))
+
+
+// ========
+// Internal
+// ========
+
+bool cbe_template_add_slot(cbe_template* const encode_template,
+                           const char* const name,
+                           const cbe_slot_type type,
+                           const int64_t offset)
+{
+    KSLOG_DEBUG("(template %p, name %s, type %d, offset %d)", encode_template, name, type, offset);
+    unlikely_if(encode_template->slot_count >= encode_template->max_slot_count)
+    {
+        KSLOG_DEBUG("Template is full");
+        return false;
+    }
+    cbe_template_slot* const slot = &encode_template->slots[encode_template->slot_count++];
+    slot->name = name;
+    slot->offset = offset;
+    slot->type = type;
+    return true;
+}
+
+void cbe_template_set_skeleton(cbe_template* const encode_template, const struct cbe_fragment* const skeleton)
+{
+    encode_template->skeleton = *skeleton;
+}
+
+const struct cbe_fragment* cbe_template_get_skeleton(const cbe_template* const encode_template)
+{
+    return &encode_template->skeleton;
+}
+
+const cbe_template_slot* cbe_template_get_slots(const cbe_template* const encode_template)
+{
+    return encode_template->slots;
+}
+
+
+// ===
+// API
+// ===
+
+int cbe_template_size(const int max_slot_count)
+{
+    KSLOG_TRACE("(max_slot_count %d)", max_slot_count);
+    unlikely_if(max_slot_count < 0)
+    {
+        return 0;
+    }
+    return sizeof(cbe_template) + sizeof(cbe_template_slot) * max_slot_count;
+}
+
+bool cbe_template_begin(cbe_template* const encode_template, const int max_slot_count)
+{
+    KSLOG_DEBUG("(template %p, max_slot_count %d)", encode_template, max_slot_count);
+    unlikely_if(encode_template == NULL || max_slot_count < 0)
+    {
+        return false;
+    }
+
+    encode_template->skeleton = (struct cbe_fragment){0};
+    encode_template->max_slot_count = max_slot_count;
+    encode_template->slot_count = 0;
+
+    return true;
+}
+
+int cbe_template_get_slot_count(const cbe_template* const encode_template)
+{
+    return encode_template->slot_count;
+}
+
+int cbe_template_find_slot(const cbe_template* const encode_template, const char* const name)
+{
+    KSLOG_DEBUG("(template %p, name %s)", encode_template, name);
+    unlikely_if(name == NULL)
+    {
+        return -1;
+    }
+    for(int i = 0; i < encode_template->slot_count; i++)
+    {
+        const char* const slot_name = encode_template->slots[i].name;
+        if(slot_name != NULL && strcmp(slot_name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,244 @@
+#include "helpers/test_helpers.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static std::vector<uint8_t> make_byte_pattern()
+{
+    std::vector<uint8_t> bytes(100);
+    for(size_t i = 0; i < bytes.size(); i++)
+    {
+        bytes[i] = (uint8_t)(i ^ 0x5a);
+    }
+    return bytes;
+}
+
+static const std::vector<uint8_t> g_bytes = make_byte_pattern();
+static const double g_elements[] = {1.25, -2.5, 3.75, 1e100};
+static const int64_t g_integers[] = {1, 1000, -3000000, 1LL << 62, -5};
+static const double g_floats[] = {0.5, 0.1, -1e300};
+static const uint128_ct g_integer_128 = (uint128_ct)0x0123456789abcdefULL << 64 | 0xfedcba9876543210ULL;
+
+static enc make_document()
+{
+    const uint8_t* elements = (const uint8_t*)g_elements;
+    return list()
+        .str("a")
+        .i(1000)
+        .bin(g_bytes)
+        .f(0.1, 0)
+        .ta(CBE_TYPED_ARRAY_FLOAT64, {elements, elements + sizeof(g_elements)})
+        .ilist({std::begin(g_integers), std::end(g_integers)})
+        .i(1LL << 60)
+        .flist({std::begin(g_floats), std::end(g_floats)})
+        .i128f(1, g_integer_128)
+        .end();
+}
+
+static std::vector<uint8_t> encode(int alignment, const enc& document)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(10000);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, alignment));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    return buffer;
+}
+
+// Hands the buffer back to the caller whenever it fills up, as a streaming
+// encoder would.
+static std::vector<uint8_t> encode_streamed(int alignment, const enc& document, int buffer_size)
+{
+    encoder encoder(buffer_size, 0);
+    encoder.set_alignment(alignment);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, encoder.encode(document));
+    return encoder.encoded_data();
+}
+
+static std::vector<uint8_t> encode_paged(int alignment, const enc& document)
+{
+    cbe_test::page_pool pool(16, 128, 4);
+    cbe_test::encode_process process;
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, alignment));
+    cbe_encode_set_reference_threshold(process, 32);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    return cbe_test::gather_segments(process);
+}
+
+static int64_t find(const std::vector<uint8_t>& document, const void* data, size_t byte_count)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    auto found = std::search(document.begin(), document.end(), bytes, bytes + byte_count);
+    EXPECT_NE(document.end(), found);
+    return found - document.begin();
+}
+
+class event_log
+{
+public:
+    event_log()
+    {
+        callbacks.on_integer = on_integer;
+        callbacks.on_float = on_float;
+        callbacks.on_list_begin = on_list_begin;
+        callbacks.on_container_end = on_container_end;
+        callbacks.on_string_begin = on_string_begin;
+        callbacks.on_bytes_begin = on_bytes_begin;
+        callbacks.on_array_data = on_array_data;
+        callbacks.on_typed_array_begin = on_typed_array_begin;
+        callbacks.on_typed_array_data = on_typed_array_data;
+        callbacks.on_integer_128 = on_integer_128;
+    }
+
+    cbe_decode_status decode(const std::vector<uint8_t>& document)
+    {
+        return cbe_decode(&callbacks, this, document.data(), document.size(), 0);
+    }
+
+    cbe_decode_callbacks callbacks = {};
+    std::string events;
+
+private:
+    static void add(cbe_decode_process* process, const std::string& event)
+    {
+        ((event_log*)cbe_decode_get_user_context(process))->events += event + " ";
+    }
+
+    static bool on_integer(cbe_decode_process* p, int sign, uint64_t value) { add(p, std::to_string(sign * (int64_t)value)); return true; }
+    static bool on_float(cbe_decode_process* p, double value) { add(p, std::to_string(value)); return true; }
+    static bool on_list_begin(cbe_decode_process* p) { add(p, "["); return true; }
+    static bool on_container_end(cbe_decode_process* p) { add(p, "]"); return true; }
+    static bool on_string_begin(cbe_decode_process* p, int64_t byte_count) { add(p, "s" + std::to_string(byte_count)); return true; }
+    static bool on_bytes_begin(cbe_decode_process* p, int64_t byte_count) { add(p, "b" + std::to_string(byte_count)); return true; }
+    static bool on_array_data(cbe_decode_process* p, const uint8_t* start, int64_t byte_count)
+    {
+        add(p, std::string((const char*)start, byte_count));
+        return true;
+    }
+    static bool on_typed_array_begin(cbe_decode_process* p, cbe_typed_array_type type, int64_t element_count)
+    {
+        add(p, "t" + std::to_string(type) + ":" + std::to_string(element_count));
+        return true;
+    }
+    static bool on_typed_array_data(cbe_decode_process* p, const uint8_t* start, int64_t element_count)
+    {
+        add(p, std::string((const char*)start, element_count * 8));
+        return true;
+    }
+    static bool on_integer_128(cbe_decode_process* p, int sign, uint128_ct value)
+    {
+        add(p, std::to_string(sign) + ":" + std::to_string((uint64_t)(value >> 64)) + ":" + std::to_string((uint64_t)value));
+        return true;
+    }
+};
+
+static enc make_scalar_document()
+{
+    return list().i(1000).i(3000000).f(0.5, 0).f(0.1, 0).i(1LL << 60).end();
+}
+
+TEST(Alignment, scalars)
+{
+    const std::vector<uint8_t> expected = {
+        0x77,
+        0x6a, 0xe8, 0x03,
+        0x7f, 0x7f, 0x7f, 0x6c, 0xc0, 0xc6, 0x2d, 0x00,
+        0x7f, 0x7f, 0x7f, 0x70, 0x00, 0x00, 0x00, 0x3f,
+        0x7f, 0x7f, 0x7f, 0x71, 0x9a, 0x99, 0x99, 0x99, 0x99, 0x99, 0xb9, 0x3f,
+        0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x6e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+        0x7b,
+    };
+    EXPECT_EQ(expected, encode(1, make_scalar_document()));
+}
+
+TEST(Alignment, off)
+{
+    const std::vector<uint8_t> expected = {
+        0x77,
+        0x6a, 0xe8, 0x03,
+        0x6c, 0xc0, 0xc6, 0x2d, 0x00,
+        0x70, 0x00, 0x00, 0x00, 0x3f,
+        0x71, 0x9a, 0x99, 0x99, 0x99, 0x99, 0x99, 0xb9, 0x3f,
+        0x6e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10,
+        0x7b,
+    };
+    EXPECT_EQ(expected, encode(0, make_scalar_document()));
+}
+
+TEST(Alignment, payloads)
+{
+    for(int alignment: {1, 8, 64})
+    {
+        const std::vector<uint8_t> document = encode(alignment, make_document());
+        EXPECT_EQ(0, find(document, g_bytes.data(), g_bytes.size()) % alignment) << "alignment " << alignment;
+        EXPECT_EQ(0, find(document, g_elements, sizeof(g_elements)) % std::max(alignment, 8)) << "alignment " << alignment;
+        EXPECT_EQ(0, find(document, &g_integer_128, sizeof(g_integer_128)) % 16) << "alignment " << alignment;
+        const uint64_t large_integer = 1ULL << 62;
+        EXPECT_EQ(0, find(document, &large_integer, sizeof(large_integer)) % 8) << "alignment " << alignment;
+        const double large_float = -1e300;
+        EXPECT_EQ(0, find(document, &large_float, sizeof(large_float)) % 8) << "alignment " << alignment;
+    }
+}
+
+TEST(Alignment, decodes_to_same_values)
+{
+    event_log unaligned;
+    event_log aligned;
+    ASSERT_EQ(CBE_DECODE_STATUS_OK, unaligned.decode(encode(0, make_document())));
+    ASSERT_EQ(CBE_DECODE_STATUS_OK, aligned.decode(encode(64, make_document())));
+    EXPECT_EQ(unaligned.events, aligned.events);
+}
+
+TEST(Alignment, streamed)
+{
+    const std::vector<uint8_t> expected = encode(64, make_document());
+    EXPECT_EQ(expected, encode_streamed(64, make_document(), 200));
+}
+
+TEST(Alignment, paged)
+{
+    const std::vector<uint8_t> expected = encode(64, make_document());
+    EXPECT_EQ(expected, encode_paged(64, make_document()));
+}
+
+TEST(Alignment, measure)
+{
+    cbe_test::measure_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_measure(process, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 64));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, make_document()));
+    EXPECT_EQ((int64_t)encode(64, make_document()).size(), cbe_encode_get_measured_byte_count(process));
+}
+
+TEST(Alignment, list_wont_fit)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(20);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 1));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, ilist({std::begin(g_integers), std::end(g_integers)})));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+}
+
+TEST(Alignment, invalid)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_alignment(process, -1));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_alignment(process, 3));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_alignment(process, 8192));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_alignment(NULL, 8));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 4096));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 0));
+}
@@ -0,0 +1,108 @@
+#include "helpers/test_helpers.h"
+#include <unistd.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+using cbe_test::read_file;
+
+static std::vector<uint8_t> sample_contents(size_t byte_count)
+{
+    std::vector<uint8_t> contents(byte_count);
+    for(size_t i = 0; i < byte_count; i++)
+    {
+        contents[i] = (uint8_t)(i * 31 + 7);
+    }
+    return contents;
+}
+
+static FILE* make_source_file(const std::vector<uint8_t>& contents)
+{
+    FILE* file = tmpfile();
+    EXPECT_NE(nullptr, file);
+    EXPECT_EQ(contents.size(), fwrite(contents.data(), 1, contents.size(), file));
+    fflush(file);
+    rewind(file);
+    return file;
+}
+
+// The document that the tests build around the file contents.
+static std::vector<uint8_t> encode_expected(const std::vector<uint8_t>& contents)
+{
+    return cbe_test::encode_document(list().i(1000).bin(contents).i(-5).end());
+}
+
+static void assert_file_contents_embedded(size_t byte_count)
+{
+    const std::vector<uint8_t> contents = sample_contents(byte_count);
+    FILE* source = make_source_file(contents);
+    FILE* output = tmpfile();
+    ASSERT_NE(nullptr, output);
+
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list().i(1000)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_bytes_from_fd(process, fileno(source), contents.size(), fileno(output)));
+    if(byte_count > 0)
+    {
+        EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, i(-5).end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    ASSERT_EQ((ssize_t)cbe_encode_get_buffer_offset(process),
+              write(fileno(output), buffer.data(), cbe_encode_get_buffer_offset(process)));
+
+    EXPECT_EQ(encode_expected(contents), read_file(output));
+    fclose(source);
+    fclose(output);
+}
+
+TEST(BytesFromFd, small) { assert_file_contents_embedded(10); }
+TEST(BytesFromFd, larger_than_buffer) { assert_file_contents_embedded(100000); }
+TEST(BytesFromFd, empty) { assert_file_contents_embedded(0); }
+
+TEST(BytesFromFd, paged)
+{
+    const std::vector<uint8_t> contents = sample_contents(5000);
+    FILE* source = make_source_file(contents);
+    FILE* output = tmpfile();
+    ASSERT_NE(nullptr, output);
+
+    cbe_test::page_pool pool(4, 64);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list().i(1000)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_bytes_from_fd(process, fileno(source), contents.size(), fileno(output)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, i(-5).end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    ASSERT_GT(cbe_encode_flush_pages(process, fileno(output)), 0);
+
+    EXPECT_EQ(encode_expected(contents), read_file(output));
+    fclose(source);
+    fclose(output);
+}
+
+TEST(BytesFromFd, source_too_short)
+{
+    FILE* source = make_source_file(sample_contents(10));
+    FILE* output = tmpfile();
+    ASSERT_NE(nullptr, output);
+
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_FILE_IO, cbe_encode_add_bytes_from_fd(process, fileno(source), 20, fileno(output)));
+    fclose(source);
+    fclose(output);
+}
+
+TEST(BytesFromFd, invalid)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_bytes_from_fd(process, -1, 10, 1));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_bytes_from_fd(process, 0, -1, 1));
+}
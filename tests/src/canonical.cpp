@@ -0,0 +1,309 @@
+#include "helpers/test_helpers.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static const uint128_ct g_integer_128 = (uint128_ct)0x0123456789abcdefULL << 64 | 0xfedcba9876543210ULL;
+
+static void append(enc& document, const enc& part)
+{
+    for(const auto& v: part.values)
+    {
+        document.values.push_back(v);
+    }
+}
+
+// A document with nested maps, whose entries are given in the order of entry_order.
+static enc make_document(std::vector<int> entry_order)
+{
+    const enc entries[] =
+    {
+        str("name").str("canonical"),
+        i(10).f(0.5, 0),
+        str("nested").umap().str("z").i(1).str("y").i(-2)
+            .str("x").omap().str("b").i(1).str("a").i(2).end()
+            .end(),
+        str("list").list()
+            .umap().str("d").i(4).str("c").i(3).end()
+            .i(1000).end(),
+        str("big").i128(1, g_integer_128),
+        str("a").b(true),
+    };
+    enc document = mmap().str("version").i(1).end().umap();
+    for(int index: entry_order)
+    {
+        append(document, entries[index]);
+    }
+    append(document, end());
+    return document;
+}
+
+static std::vector<uint64_t> make_map_index(int64_t max_entry_count, int max_map_depth)
+{
+    return std::vector<uint64_t>(cbe_encode_canonical_index_size(max_entry_count, max_map_depth) / sizeof(uint64_t));
+}
+
+static std::vector<uint8_t> encode(const enc& document, bool is_canonical)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100000);
+    std::vector<uint64_t> map_index = make_map_index(20, 5);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, is_canonical, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    return buffer;
+}
+
+static std::vector<uint8_t> encode_canonical(const enc& document)
+{
+    return encode(document, true);
+}
+
+static FILE* make_file(const std::vector<uint8_t>& contents)
+{
+    FILE* file = tmpfile();
+    EXPECT_NE(nullptr, file);
+    EXPECT_EQ(contents.size(), fwrite(contents.data(), 1, contents.size(), file));
+    fflush(file);
+    rewind(file);
+    return file;
+}
+
+static std::vector<uint8_t> canonicalize(const std::vector<uint8_t>& document,
+                                         int buffer_size,
+                                         int64_t max_entry_count,
+                                         cbe_decode_status expected_status,
+                                         cbe_encode_status expected_encode_status)
+{
+    FILE* input = make_file(document);
+    FILE* output = tmpfile();
+    EXPECT_NE(nullptr, output);
+    std::vector<uint8_t> buffer(buffer_size);
+    std::vector<uint64_t> map_index = make_map_index(max_entry_count, 5);
+    cbe_encode_status encode_status = CBE_ENCODE_STATUS_OK;
+    EXPECT_EQ(expected_status, cbe_canonicalize(fileno(input), fileno(output),
+                                                buffer.data(), buffer.size(),
+                                                map_index.data(), map_index.size() * sizeof(uint64_t),
+                                                0, &encode_status));
+    EXPECT_EQ(expected_encode_status, encode_status);
+    std::vector<uint8_t> result = cbe_test::read_file(output);
+    fclose(input);
+    fclose(output);
+    return result;
+}
+
+TEST(Canonical, keys_sorted_by_encoded_bytes)
+{
+    // 10 encodes as [0a], "a" as [81 61], and "b" as [81 62].
+    std::vector<uint8_t> expected = {0x78, 0x0a, 0x81, 0x78, 0x81, 0x61, 0x02, 0x81, 0x62, 0x01, 0x7b};
+    EXPECT_EQ(expected, encode_canonical(umap().str("b").i(1).str("a").i(2).i(10).str("x").end()));
+}
+
+TEST(Canonical, insertion_order_doesnt_matter)
+{
+    const std::vector<uint8_t> expected = encode_canonical(make_document({0, 1, 2, 3, 4, 5}));
+    EXPECT_EQ(expected, encode_canonical(make_document({5, 4, 3, 2, 1, 0})));
+    EXPECT_EQ(expected, encode_canonical(make_document({3, 0, 5, 1, 4, 2})));
+    EXPECT_NE(encode(make_document({0, 1, 2, 3, 4, 5}), false), encode(make_document({5, 4, 3, 2, 1, 0}), false));
+}
+
+TEST(Canonical, ordered_map_keeps_order)
+{
+    const enc document = omap().str("b").i(1).str("a").i(2).end();
+    EXPECT_EQ(encode(document, false), encode_canonical(document));
+}
+
+TEST(Canonical, drops_padding_and_comments)
+{
+    const enc plain = umap().str("b").i(1).str("a").list().i(2).end().end();
+    const enc decorated = com("first")
+        .umap().str("b").pad(3).i(1).str("a")
+            .list().com("inner").i(2).com("").end()
+        .end();
+    EXPECT_EQ(encode_canonical(plain), encode_canonical(decorated));
+}
+
+TEST(Canonical, fixed_width_is_compact)
+{
+    EXPECT_EQ(encode_canonical(i(5)), encode_canonical(i128f(1, 5)));
+    EXPECT_EQ(encode_canonical(f(0.5, 0)), encode_canonical(f128f(0.5)));
+}
+
+TEST(Canonical, rollback)
+{
+    const std::vector<uint8_t> expected = encode_canonical(umap().str("b").i(1).str("a").i(2).end());
+
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    std::vector<uint64_t> map_index = make_map_index(10, 2);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap().str("b").i(1)));
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, str("0").umap().str("c")));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, str("a").i(2).end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(expected, buffer);
+}
+
+static void* test_realloc(void* context, void* ptr, size_t size)
+{
+    (void)context;
+    return realloc(ptr, size);
+}
+
+TEST(Canonical, growable)
+{
+    cbe_test::encode_process process;
+    std::vector<uint64_t> map_index = make_map_index(20, 5);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_growable(process, 0, test_realloc, NULL, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, make_document({5, 4, 3, 2, 1, 0})));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    int64_t byte_count = 0;
+    uint8_t* data = cbe_encode_take_buffer(process, &byte_count);
+    EXPECT_EQ(encode_canonical(make_document({0, 1, 2, 3, 4, 5})), std::vector<uint8_t>(data, data + byte_count));
+    free(data);
+}
+
+TEST(Canonical, measure)
+{
+    const enc document = make_document({5, 4, 3, 2, 1, 0});
+    cbe_test::measure_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_measure(process, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, true, NULL, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, com("not counted")));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ((int64_t)encode_canonical(document).size(), cbe_encode_get_measured_byte_count(process));
+}
+
+TEST(Canonical, index_too_small)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    std::vector<uint64_t> map_index = make_map_index(1, 1);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap().str("b")));
+    EXPECT_EQ(CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT, add_encoding(process, umap()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, i(1).str("a").i(2)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT, add_encoding(process, end()));
+}
+
+TEST(Canonical, needs_room_to_sort)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(10);
+    std::vector<uint64_t> map_index = make_map_index(2, 1);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap().str("b").i(1).str("a").i(2)));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, end()));
+
+    // The map's start is no longer in the buffer.
+    std::vector<uint8_t> next_buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_buffer(process, next_buffer.data(), next_buffer.size()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT, add_encoding(process, end()));
+}
+
+TEST(Canonical, invalid)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    std::vector<uint64_t> map_index = make_map_index(10, 2);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_canonical(NULL, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_canonical(process, true, NULL, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 8));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_alignment(process, 8));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 0));
+
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_unordered_map_begin(process));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_comment(process, "x", 1));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_container_end(process));
+
+    const uint8_t raw[] = {0x01};
+    const struct cbe_fragment fragment = {raw, sizeof(raw), 0, true, 0};
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_raw(process, &fragment));
+
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_list_begin(process));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_canonical(process, false, NULL, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_container_end(process));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_canonical(process, false, NULL, 0));
+
+    cbe_test::page_pool pool(2, 100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_set_canonical(process, true, map_index.data(), map_index.size() * sizeof(uint64_t)));
+}
+
+TEST(Canonicalize, rewrites_document)
+{
+    // comment "hi", {"b": int32 5, padding, "a": float64 0.5}
+    const std::vector<uint8_t> document = {0x93, 0x02, 0x68, 0x69,
+                                           0x78,
+                                           0x81, 0x62, 0x6c, 0x05, 0x00, 0x00, 0x00,
+                                           0x7f,
+                                           0x81, 0x61, 0x71, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe0, 0x3f,
+                                           0x7b};
+    const std::vector<uint8_t> expected = {0x78,
+                                           0x81, 0x61, 0x70, 0x00, 0x00, 0x00, 0x3f,
+                                           0x81, 0x62, 0x05,
+                                           0x7b};
+    EXPECT_EQ(expected, canonicalize(document, 100, 10, CBE_DECODE_STATUS_OK, CBE_ENCODE_STATUS_OK));
+}
+
+TEST(Canonicalize, matches_canonical_encoding)
+{
+    const enc document = make_document({2, 5, 0, 3, 1, 4});
+    const std::vector<uint8_t> expected = encode_canonical(document);
+    enc decorated = com("header").pad(5);
+    append(decorated, document);
+    EXPECT_EQ(expected, canonicalize(encode(decorated, false), 1000, 20, CBE_DECODE_STATUS_OK, CBE_ENCODE_STATUS_OK));
+    EXPECT_EQ(expected, canonicalize(expected, 1000, 20, CBE_DECODE_STATUS_OK, CBE_ENCODE_STATUS_OK));
+}
+
+TEST(Canonicalize, streams_through_small_buffer)
+{
+    enc document = list();
+    for(int index = 0; index < 200; index++)
+    {
+        append(document, umap().i(index).str("value").str("key").i(-index).end()
+                         .str("a longer string that spans buffers"));
+    }
+    append(document, end());
+    const std::vector<uint8_t> expected = encode_canonical(document);
+    EXPECT_EQ(expected, canonicalize(encode(document, false), 32, 4, CBE_DECODE_STATUS_OK, CBE_ENCODE_STATUS_OK));
+}
+
+TEST(Canonicalize, map_too_large)
+{
+    const std::vector<uint8_t> document = encode(make_document({0, 1, 2, 3, 4, 5}), false);
+    canonicalize(document, 32, 20, CBE_DECODE_STATUS_STOPPED_IN_CALLBACK, CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT);
+    canonicalize(document, 1000, 1, CBE_DECODE_STATUS_STOPPED_IN_CALLBACK, CBE_ENCODE_ERROR_MAP_TOO_LARGE_TO_SORT);
+}
+
+TEST(Canonicalize, buffer_smaller_than_object)
+{
+    const std::vector<uint8_t> document = encode(f(1.0123, 0), false);
+    canonicalize(document, 4, 20, CBE_DECODE_STATUS_STOPPED_IN_CALLBACK, CBE_ENCODE_ERROR_BUFFER_TOO_SMALL);
+}
+
+TEST(Canonicalize, invalid_document)
+{
+    std::vector<uint8_t> document = encode(make_document({0, 1, 2, 3, 4, 5}), false);
+    document.pop_back();
+    canonicalize(document, 1000, 20, CBE_DECODE_ERROR_UNBALANCED_CONTAINERS, CBE_ENCODE_STATUS_OK);
+}
@@ -0,0 +1,131 @@
+#include "helpers/test_helpers.h"
+#include <cmath>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static std::vector<uint8_t> encode_parts(int sign, uint64_t significand, int exponent)
+{
+    return cbe_test::encode_document(dp(sign, significand, exponent));
+}
+
+struct decoded_parts
+{
+    int call_count;
+    int sign;
+    uint64_t significand;
+    int exponent;
+    double decimal_float;
+};
+
+static decoded_parts g_decoded;
+
+static bool on_decimal_parts(cbe_decode_process* process, int sign, uint64_t significand, int exponent)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.sign = sign;
+    g_decoded.significand = significand;
+    g_decoded.exponent = exponent;
+    return true;
+}
+
+static bool on_decimal_float(cbe_decode_process* process, dec64_ct value)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.decimal_float = (double)value;
+    return true;
+}
+
+static decoded_parts decode(const std::vector<uint8_t>& document, bool use_parts)
+{
+    cbe_decode_callbacks callbacks = {};
+    callbacks.on_decimal_float = on_decimal_float;
+    if(use_parts)
+    {
+        callbacks.on_decimal_parts = on_decimal_parts;
+    }
+    g_decoded = decoded_parts();
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode(&callbacks, NULL, document.data(), document.size(), 0));
+    EXPECT_EQ(1, g_decoded.call_count);
+    return g_decoded;
+}
+
+static void assert_parts_round_trip(int sign, uint64_t significand, int exponent, const std::vector<uint8_t>& expected)
+{
+    const std::vector<uint8_t> document = encode_parts(sign, significand, exponent);
+    EXPECT_EQ(expected, document);
+    const decoded_parts decoded = decode(document, true);
+    EXPECT_EQ(sign, decoded.sign);
+    EXPECT_EQ(significand, decoded.significand);
+    EXPECT_EQ(exponent, decoded.exponent);
+}
+
+TEST(DecimalParts, encode_decode)
+{
+    assert_parts_round_trip( 1,   1999,  -2, {0x65, 0x0a, 0x8f, 0x4f});
+    assert_parts_round_trip(-1,   1999,  -2, {0x65, 0x0b, 0x8f, 0x4f});
+    assert_parts_round_trip( 1, 921424,  75, {0x65, 0x82, 0x2c, 0xb8, 0x9e, 0x50});
+    assert_parts_round_trip( 1,      0,   0, {0x65, 0x02});
+    assert_parts_round_trip(-1,      0,   0, {0x65, 0x03});
+}
+
+TEST(DecimalParts, trailing_zeros_move_to_exponent)
+{
+    EXPECT_EQ(encode_parts(1, 921424, 75), encode_parts(1, 92142400, 73));
+    EXPECT_EQ(encode_parts(1, 0, 0), encode_parts(1, 0, 10));
+}
+
+TEST(DecimalParts, range_applies_to_the_value)
+{
+    EXPECT_EQ(encode_parts(1, 1, 372), encode_parts(1, 1000, 369));
+    EXPECT_EQ(encode_parts(1, 1, 370), encode_parts(1, 10, 369));
+    EXPECT_EQ(encode_parts(1, 1, 384), encode_parts(1, 1000000000000000ULL, 369));
+    EXPECT_EQ(encode_parts(1, 1, 16), encode_parts(1, 10000000000000000ULL, 0));
+    EXPECT_EQ(encode_parts(1, 1, -390), encode_parts(1, 100000000ULL, -398));
+    EXPECT_EQ(encode_parts(1, 1, -391), encode_parts(1, 10000000000000000000ULL, -410));
+}
+
+TEST(DecimalParts, decimal_float_callback)
+{
+    const decoded_parts decoded = decode(encode_parts(-1, 1999, -2), false);
+    EXPECT_DOUBLE_EQ(-19.99, decoded.decimal_float);
+}
+
+TEST(DecimalParts, to_double)
+{
+    double value = 0;
+    EXPECT_TRUE(cbe_decimal_parts_to_double(1, 1999, -2, &value));
+    EXPECT_EQ(19.99, value);
+    EXPECT_TRUE(cbe_decimal_parts_to_double(-1, 5, -1, &value));
+    EXPECT_EQ(-0.5, value);
+    EXPECT_TRUE(cbe_decimal_parts_to_double(1, 123456789012345, -22, &value));
+    EXPECT_EQ(123456789012345e-22, value);
+    EXPECT_TRUE(cbe_decimal_parts_to_double(1, 15, 29, &value));
+    EXPECT_EQ(15e29, value);
+    EXPECT_TRUE(cbe_decimal_parts_to_double(-1, 0, 500, &value));
+    EXPECT_TRUE(std::signbit(value));
+    EXPECT_EQ(0.0, value);
+
+    EXPECT_FALSE(cbe_decimal_parts_to_double(1, 1, -23, &value));
+    EXPECT_FALSE(cbe_decimal_parts_to_double(1, 123456789012345, 30, &value));
+    EXPECT_FALSE(cbe_decimal_parts_to_double(1, 1ULL << 53, 0, &value));
+}
+
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(DecimalParts, in_list, 6, list().dp(1, 1999, -2).dp(1, 921424, 75).end(), list().df(19.99dd, 0).df(921424e75dd, 0).end())
+
+TEST_ENCODE_STATUS(DecimalParts, not_enough_room, 3, 9, CBE_ENCODE_STATUS_NEED_MORE_ROOM, dp(1, 1999, -2))
+TEST_ENCODE_STATUS(DecimalParts, too_many_digits, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, dp(1, 10000000000000001ULL, 0))
+TEST_ENCODE_STATUS(DecimalParts, exponent_too_big, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, dp(1, 1, 385))
+TEST_ENCODE_STATUS(DecimalParts, value_too_big, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, dp(1, 11, 384))
+TEST_ENCODE_STATUS(DecimalParts, exponent_too_small, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, dp(1, 1, -399))
+TEST_ENCODE_STATUS(DecimalParts, exponent_max, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, dp(1, 1, INT32_MAX))
+TEST_ENCODE_STATUS(DecimalParts, exponent_min, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, dp(1, 10, INT32_MIN))
+
+TEST(DecimalParts, invalid)
+{
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_decimal_parts(NULL, 1, 1, 0));
+}
@@ -0,0 +1,82 @@
+#include "helpers/test_helpers.h"
+#include <limits>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static std::vector<double> sample_values()
+{
+    std::vector<double> values =
+    {
+        0.0, -0.0, 1.0, -1.5, 0.1, 1.0e100, -1.0e-100, 3.4028234663852886e38,
+        std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(),
+    };
+    for(int i = 0; i < 100; i++)
+    {
+        values.push_back(i * 0.25);
+        values.push_back(i * 0.1);
+    }
+    return values;
+}
+
+// The same list, encoded one value at a time.
+static enc one_by_one(const std::vector<double>& values)
+{
+    enc document = list();
+    for(double value: values)
+    {
+        document.f(value, 0);
+    }
+    return document.end();
+}
+
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(FloatList, matches_single_values, 0, flist(sample_values()), one_by_one(sample_values()))
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(FloatList, empty, 0, flist({}), list().end())
+// NaN never compares equal, so only the encoded data can be checked.
+TEST_ENCODE_DATA(FloatList, nan, 99, 9, flist({std::numeric_limits<double>::quiet_NaN()}),
+    cbe_test::encode_document(one_by_one({std::numeric_limits<double>::quiet_NaN()})))
+
+TEST(FloatList, not_enough_room_adds_nothing)
+{
+    const std::vector<uint8_t> expected = cbe_test::encode_document(one_by_one(sample_values()));
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(expected.size() - 1);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, flist(sample_values())));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+}
+
+TEST(FloatList, not_enough_room_leaves_fragment_state)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(2);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, flist({1.5, 0.1})));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, i(5)));
+    cbe_fragment fragment;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_get_fragment(process, &fragment));
+    EXPECT_EQ(0, fragment.container_depth);
+    EXPECT_EQ(0, fragment.unkeyable_positions);
+}
+
+TEST(FloatList, across_pages)
+{
+    cbe_test::page_pool pool(100, 32);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, flist(sample_values())));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ(cbe_test::encode_document(one_by_one(sample_values())), cbe_test::gather_segments(process));
+}
+
+TEST(FloatList, invalid)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_float_list(process, NULL, 1));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_float_list(process, NULL, -1));
+}
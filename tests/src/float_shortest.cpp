@@ -0,0 +1,140 @@
+#include "helpers/test_helpers.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static std::vector<uint8_t> encode_shortest(double value)
+{
+    return cbe_test::encode_document(fs(value));
+}
+
+static std::vector<uint8_t> encode_binary(double value)
+{
+    return cbe_test::encode_document(f(value, 0));
+}
+
+static double g_decoded_value;
+
+static bool on_decimal_float(cbe_decode_process* process, dec64_ct value)
+{
+    (void)process;
+    g_decoded_value = (double)value;
+    return true;
+}
+
+static bool on_float(cbe_decode_process* process, double value)
+{
+    (void)process;
+    g_decoded_value = value;
+    return true;
+}
+
+static double decode(const std::vector<uint8_t>& document)
+{
+    cbe_decode_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.on_decimal_float = on_decimal_float;
+    callbacks.on_float = on_float;
+    g_decoded_value = 0;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode(&callbacks, NULL, document.data(), document.size(), 0));
+    return g_decoded_value;
+}
+
+static void assert_round_trips(double value, int expected_byte_count)
+{
+    const std::vector<uint8_t> document = encode_shortest(value);
+    EXPECT_EQ(expected_byte_count, (int)document.size()) << "value " << value;
+    EXPECT_LE(document.size(), encode_binary(value).size()) << "value " << value;
+    const double decoded = decode(document);
+    EXPECT_EQ(0, memcmp(&value, &decoded, sizeof(value))) << "value " << value << " decoded as " << decoded;
+}
+
+TEST(FloatShortest, decimal_is_smaller)
+{
+    assert_round_trips(0.1, 3);
+    assert_round_trips(19.99, 4);
+    assert_round_trips(-0.07, 3);
+    assert_round_trips(1.5e20, 3);
+    assert_round_trips(123456.78, 6);
+}
+
+TEST(FloatShortest, float_32_is_smaller)
+{
+    assert_round_trips(0.5, 3);
+    assert_round_trips(1.0 / 1024, 5);
+    assert_round_trips(16777215.0, 5);
+}
+
+TEST(FloatShortest, float_64_is_smaller)
+{
+    assert_round_trips(0.1 + 0.2, 9);
+    assert_round_trips(M_PI, 9);
+    assert_round_trips(1.0 / 3, 9);
+    // Too far out of range to check exactly without decimal arithmetic.
+    assert_round_trips(1.0e300, 9);
+}
+
+TEST(FloatShortest, special_values)
+{
+    EXPECT_EQ(encode_binary(std::numeric_limits<double>::infinity()), encode_shortest(std::numeric_limits<double>::infinity()));
+    EXPECT_EQ(encode_binary(-std::numeric_limits<double>::infinity()), encode_shortest(-std::numeric_limits<double>::infinity()));
+    EXPECT_EQ(encode_binary(std::numeric_limits<double>::quiet_NaN()), encode_shortest(std::numeric_limits<double>::quiet_NaN()));
+    const std::vector<uint8_t> negative_zero = encode_shortest(-0.0);
+    EXPECT_TRUE(std::signbit(decode(negative_zero)));
+}
+
+TEST(FloatShortest, never_larger_than_binary)
+{
+    double value = 0.01;
+    for(int i = 0; i < 2000; i++)
+    {
+        const std::vector<uint8_t> document = encode_shortest(value);
+        EXPECT_LE(document.size(), encode_binary(value).size()) << "value " << value;
+        const double decoded = decode(document);
+        EXPECT_EQ(0, memcmp(&value, &decoded, sizeof(value))) << "value " << value << " decoded as " << decoded;
+        value = value * 1.37 + 0.01;
+        if(value > 1.0e12)
+        {
+            value = -value / 1.0e15;
+        }
+    }
+}
+
+TEST(FloatShortest, finds_fewest_digits)
+{
+    // Prices with two decimal places, encoded with their trailing zeros dropped.
+    for(int64_t cents = 1; cents < 2000000; cents += 97)
+    {
+        const double value = cents / 100.0;
+        int64_t significand = cents;
+        while(significand % 10 == 0)
+        {
+            significand /= 10;
+        }
+        int significand_byte_count = 1;
+        while(significand >> (7 * significand_byte_count) != 0)
+        {
+            significand_byte_count++;
+        }
+        const int binary_byte_count = value == (float)value ? 5 : 9;
+        const int decimal_byte_count = 2 + significand_byte_count;
+        assert_round_trips(value, decimal_byte_count < binary_byte_count ? decimal_byte_count : binary_byte_count);
+    }
+}
+
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(FloatShortest, in_list, 9, list().fs(0.1).fs(1.0 / 3).end(), list().df(0.1dd, 0).f(1.0 / 3, 0).end())
+
+TEST(FloatShortest, not_enough_room)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(2);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, fs(19.99)));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_float_shortest(NULL, 1.5));
+}
@@ -0,0 +1,88 @@
+#include "helpers/test_helpers.h"
+#include <cstdlib>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+struct test_allocator
+{
+    size_t max_byte_count;
+    int realloc_count;
+    void* last_buffer;
+};
+
+static void* test_realloc(void* context, void* buffer, size_t byte_count)
+{
+    test_allocator* allocator = (test_allocator*)context;
+    if(byte_count > allocator->max_byte_count)
+    {
+        return NULL;
+    }
+    allocator->realloc_count++;
+    allocator->last_buffer = realloc(buffer, byte_count);
+    return allocator->last_buffer;
+}
+
+static enc sample_document()
+{
+    enc document = list();
+    for(int i = 0; i < 1000; i++)
+    {
+        document.u((uint64_t)i * 100003);
+    }
+    return document
+        .str(std::string(5000, 'x'))
+        .t(8, 30, 0, 0, "America/Argentina/ComodRivadavia")
+        .end();
+}
+
+TEST(GrowableBuffer, grows_from_default_size)
+{
+    test_allocator allocator = {1000000, 0, NULL};
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_growable(process, 0, test_realloc, &allocator, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, sample_document()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+
+    int64_t byte_count = 0;
+    uint8_t* buffer = cbe_encode_take_buffer(process, &byte_count);
+    EXPECT_EQ(allocator.last_buffer, buffer);
+    EXPECT_EQ(cbe_test::encode_document(sample_document()), std::vector<uint8_t>(buffer, buffer + byte_count));
+    // Geometric growth from 64 bytes to ~10k.
+    EXPECT_LE(allocator.realloc_count, 10);
+    free(buffer);
+}
+
+TEST(GrowableBuffer, initial_size_is_honored)
+{
+    test_allocator allocator = {1000000, 0, NULL};
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_growable(process, 100000, test_realloc, &allocator, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, sample_document()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ(1, allocator.realloc_count);
+
+    int64_t byte_count = 0;
+    free(cbe_encode_take_buffer(process, &byte_count));
+}
+
+TEST(GrowableBuffer, allocator_failure)
+{
+    test_allocator allocator = {128, 0, NULL};
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_growable(process, 0, test_realloc, &allocator, 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, list().pad(200)));
+    EXPECT_EQ(1, cbe_encode_get_buffer_offset(process));
+
+    int64_t byte_count = 0;
+    free(cbe_encode_take_buffer(process, &byte_count));
+    EXPECT_EQ(1, byte_count);
+}
+
+TEST(GrowableBuffer, null_allocator)
+{
+    cbe_test::encode_process process;
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_begin_growable(process, 0, NULL, NULL, 0));
+}
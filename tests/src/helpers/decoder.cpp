@@ -3,6 +3,7 @@
 // #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
 #include <kslog/kslog.h>
 
+#include "encoder.h"
 #include "test_utils.h"
 
 static decoder* get_decoder(struct cbe_decode_process* process)
@@ -86,6 +87,16 @@ ANSI_EXTENSION static const cbe_decode_callbacks g_callbacks =
     on_uri_begin: on_uri_begin,
     on_comment_begin: on_comment_begin,
     on_array_data: on_array_data,
+    on_nanotime: NULL,
+    on_time_tzid: NULL,
+    on_timestamp_tzid: NULL,
+    on_map_key_symbol: NULL,
+    on_decimal_parts: NULL,
+    on_typed_array_begin: NULL,
+    on_typed_array_data: NULL,
+    on_integer_128: NULL,
+    on_float_128: NULL,
+    on_decimal_float_128: NULL,
 };
 
 decoder::decoder(int max_container_depth, bool forced_callback_return_value)
@@ -107,19 +118,30 @@ encoding::enc decoder::decoded()
 }
 
 cbe_decode_status decoder::feed(const std::vector<uint8_t>& data)
+{
+    int64_t bytes_consumed = 0;
+    return feed(data, bytes_consumed);
+}
+
+cbe_decode_status decoder::feed(const std::vector<uint8_t>& data, int64_t& bytes_consumed)
 {
     KSLOG_DEBUG("Feeding %d bytes", data.size());
     KSLOG_TRACE("Feeding %s", as_string(data).c_str());
     _received_data.insert(_received_data.begin(), data.begin(), data.end());
-    int64_t byte_count = data.size();
-    cbe_decode_status status = cbe_decode_feed(_process, data.data(), &byte_count);
-    _read_offset += byte_count;
+    bytes_consumed = data.size();
+    cbe_decode_status status = cbe_decode_feed(_process, data.data(), &bytes_consumed);
+    _read_offset += bytes_consumed;
     return status;
 }
 
 cbe_decode_status decoder::begin()
 {
-    return cbe_decode_begin(_process, &g_callbacks, (void*)this, _max_container_depth);
+    cbe_decode_status status = cbe_decode_begin(_process, &g_callbacks, (void*)this, _max_container_depth);
+    if(status == CBE_DECODE_STATUS_OK)
+    {
+        cbe_decode_set_timezone_table(_process, encoding_timezone_table());
+    }
+    return status;
 }
 
 cbe_decode_status decoder::end()
@@ -133,6 +155,11 @@ cbe_decode_status decoder::end()
     return cbe_decode_end(_process);
 }
 
+int64_t decoder::stream_offset()
+{
+    return cbe_decode_get_stream_offset(_process);
+}
+
 cbe_decode_status decoder::decode(const std::vector<uint8_t>& document)
 {
     return cbe_decode(&g_callbacks, (void*)this, document.data(), document.size(), _max_container_depth);
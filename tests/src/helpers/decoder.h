@@ -64,9 +64,15 @@ public:
     // Feed data to be decoded.
     cbe_decode_status feed(const std::vector<uint8_t>& data);
 
+    // Feed data to be decoded, reporting how many bytes were consumed.
+    cbe_decode_status feed(const std::vector<uint8_t>& data, int64_t& bytes_consumed);
+
     // End the decoding process.
     cbe_decode_status end();
 
+    // Get the total number of bytes the decoder has consumed.
+    int64_t stream_offset();
+
     // Decode an entire document
     cbe_decode_status decode(const std::vector<uint8_t>& document);
 
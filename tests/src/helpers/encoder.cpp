@@ -3,6 +3,15 @@
 // #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
 #include <kslog/kslog.h>
 
+static const int timezone_table_max_entries = 16;
+static const int64_t timezone_table_max_total_bytes = 1000;
+static const char* const g_timezones[] =
+{
+    "Europe/Berlin",
+    "America/Vancouver",
+    "Asia/Tokyo",
+};
+
 bool encoder::flush_buffer()
 {
     bool result = false;
@@ -33,6 +42,43 @@ cbe_encode_status encoder::flush_and_retry(std::function<cbe_encode_status()> my
     return status;
 }
 
+static std::vector<uint64_t> make_timezone_table()
+{
+    std::vector<uint64_t> backing_store(cbe_string_table_size(timezone_table_max_entries, timezone_table_max_total_bytes) / sizeof(uint64_t) + 1);
+    cbe_string_table* table = (cbe_string_table*)backing_store.data();
+    cbe_string_table_begin(table, timezone_table_max_entries, timezone_table_max_total_bytes);
+    for(const char* timezone: g_timezones)
+    {
+        cbe_string_table_add(table, timezone, strlen(timezone));
+    }
+    return backing_store;
+}
+
+const cbe_string_table* encoding_timezone_table()
+{
+    static const std::vector<uint64_t> backing_store = make_timezone_table();
+    return (const cbe_string_table*)backing_store.data();
+}
+
+static int timezone_id(const std::string& timezone)
+{
+    return cbe_string_table_find(encoding_timezone_table(), timezone.data(), timezone.size());
+}
+
+// An element type the library doesn't know has no size, so its byte count is passed through.
+static int64_t typed_array_element_count(const encoding::value& v)
+{
+    const int element_size = cbe_typed_array_element_size((cbe_typed_array_type)v.i);
+    return element_size > 0 ? (int64_t)v.bin.size() / element_size : (int64_t)v.bin.size();
+}
+
+template<typename T> static T bits_to(const encoding::value& v)
+{
+    T result;
+    memcpy(&result, v.bin.data(), sizeof(result));
+    return result;
+}
+
 cbe_encode_status encoder::stream_array(const std::vector<uint8_t>& data)
 {
     const uint8_t* data_pointer = data.data();
@@ -60,84 +106,128 @@ cbe_encode_status encoder::stream_array(const std::vector<uint8_t>& data)
 }
 
 
+// Begin encoding a value. Array contents are left for the caller to add.
+static cbe_encode_status begin_value(cbe_encode_process* process, const encoding::value& v)
+{
+    switch(v.type)
+    {
+        case encoding::value::type_int_pos:
+            return cbe_encode_add_integer(process, 1, v.i);
+        case encoding::value::type_int_neg:
+            return cbe_encode_add_integer(process, -1, v.i);
+        case encoding::value::type_float:
+            return cbe_encode_add_float(process, v.f, v.i);
+        case encoding::value::type_decfloat:
+            return cbe_encode_add_decimal_float(process, v.df, v.i);
+        case encoding::value::type_bool:
+            return cbe_encode_add_boolean(process, v.b);
+        case encoding::value::type_date:
+            return cbe_encode_add_date(process, v.d.year, v.d.month, v.d.day);
+        case encoding::value::type_time:
+            switch(v.t.tz.type)
+            {
+                case encoding::tz_zero:
+                    return cbe_encode_add_time_tz(process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, NULL);
+                case encoding::tz_zone:
+                    return cbe_encode_add_time_tz(process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, v.t.tz.zone.c_str());
+                default:
+                    break;
+            }
+            return cbe_encode_add_time_loc(process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, v.t.tz.latitude, v.t.tz.longitude);
+        case encoding::value::type_ts:
+            switch(v.ts.tz.type)
+            {
+                case encoding::tz_zero:
+                    return cbe_encode_add_timestamp_tz(process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, NULL);
+                case encoding::tz_zone:
+                    return cbe_encode_add_timestamp_tz(process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, v.ts.tz.zone.c_str());
+                default:
+                    break;
+            }
+            return cbe_encode_add_timestamp_loc(process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, v.ts.tz.latitude, v.ts.tz.longitude);
+        case encoding::value::type_str:
+            return cbe_encode_string_begin(process, v.str.size());
+        case encoding::value::type_bin:
+            return cbe_encode_bytes_begin(process, v.bin.size());
+        case encoding::value::type_uri:
+            return cbe_encode_uri_begin(process, v.str.size());
+        case encoding::value::type_com:
+            return cbe_encode_comment_begin(process, v.str.size());
+        case encoding::value::type_strh:
+            return cbe_encode_string_begin(process, v.i);
+        case encoding::value::type_urih:
+            return cbe_encode_uri_begin(process, v.i);
+        case encoding::value::type_comh:
+            return cbe_encode_comment_begin(process, v.i);
+        case encoding::value::type_binh:
+            return cbe_encode_bytes_begin(process, v.i);
+        case encoding::value::type_data:
+            // Contents handled outside
+            return CBE_ENCODE_STATUS_OK;
+        case encoding::value::type_list:
+            return cbe_encode_list_begin(process);
+        case encoding::value::type_map_u:
+            return cbe_encode_unordered_map_begin(process);
+        case encoding::value::type_map_o:
+            return cbe_encode_ordered_map_begin(process);
+        case encoding::value::type_map_m:
+            return cbe_encode_metadata_map_begin(process);
+        case encoding::value::type_end:
+            return cbe_encode_container_end(process);
+        case encoding::value::type_nil:
+            return cbe_encode_add_nil(process);
+        case encoding::value::type_pad:
+            return cbe_encode_add_padding(process, v.i);
+        case encoding::value::type_nanotime:
+            return cbe_encode_add_nanotime(process, (nanotime)v.i);
+        case encoding::value::type_smalltime:
+            return cbe_encode_add_smalltime(process, (smalltime)v.i);
+        case encoding::value::type_time_tzid:
+            return cbe_encode_add_time_tzid(process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, timezone_id(v.t.tz.zone));
+        case encoding::value::type_ts_tzid:
+            return cbe_encode_add_timestamp_tzid(process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, timezone_id(v.ts.tz.zone));
+        case encoding::value::type_int_list:
+            return cbe_encode_add_integer_list(process, (const int64_t*)v.il.data(), v.il.size());
+        case encoding::value::type_uint_list:
+            return cbe_encode_add_unsigned_integer_list(process, v.il.data(), v.il.size());
+        case encoding::value::type_float_list:
+            return cbe_encode_add_float_list(process, v.fl.data(), v.fl.size());
+        case encoding::value::type_float_shortest:
+            return cbe_encode_add_float_shortest(process, v.f);
+        case encoding::value::type_decimal_parts:
+            return cbe_encode_add_decimal_parts(process, (int)(int64_t)v.il[0], v.il[1], (int)(int64_t)v.il[2]);
+        case encoding::value::type_typed_array:
+            return cbe_encode_typed_array_begin(process, (cbe_typed_array_type)v.i, typed_array_element_count(v));
+        case encoding::value::type_typed_array_header:
+            return cbe_encode_typed_array_begin(process, (cbe_typed_array_type)v.il[0], (int64_t)v.il[1]);
+        case encoding::value::type_int_128:
+            return cbe_encode_add_integer_128(process, (int)(int64_t)v.i, bits_to<uint128_ct>(v));
+        case encoding::value::type_int_128_fixed:
+            return cbe_encode_add_integer_128_fixed(process, (int)(int64_t)v.i, bits_to<uint128_ct>(v));
+        case encoding::value::type_float_128:
+            return cbe_encode_add_float_128(process, bits_to<float128_ct>(v));
+        case encoding::value::type_float_128_fixed:
+            return cbe_encode_add_float_128_fixed(process, bits_to<float128_ct>(v));
+        case encoding::value::type_decfloat_128:
+            return cbe_encode_add_decimal_float_128(process, bits_to<dec128_ct>(v));
+        case encoding::value::type_decfloat_128_fixed:
+            return cbe_encode_add_decimal_float_128_fixed(process, bits_to<dec128_ct>(v));
+        case encoding::value::type_raw:
+            return cbe_encode_add_raw(process, (const cbe_fragment*)(uintptr_t)v.i);
+        case encoding::value::type_key_dictionary:
+            return cbe_encode_add_key_dictionary(process, (const cbe_string_table*)(uintptr_t)v.i);
+        default:
+            break;
+    }
+    KSLOG_ERROR("Unknown value type %d", v.type);
+    return (cbe_encode_status)1999999;
+}
+
 cbe_encode_status encoder::encode(const encoding::value& v)
 {
     cbe_encode_status status = flush_and_retry([&]
     {
-        switch(v.type)
-        {
-            case encoding::value::type_int_pos:
-                return cbe_encode_add_integer(_process, 1, v.i);
-            case encoding::value::type_int_neg:
-                return cbe_encode_add_integer(_process, -1, v.i);
-            case encoding::value::type_float:
-                return cbe_encode_add_float(_process, v.f, v.i);
-            case encoding::value::type_decfloat:
-                return cbe_encode_add_decimal_float(_process, v.df, v.i);
-            case encoding::value::type_bool:
-                return cbe_encode_add_boolean(_process, v.b);
-            case encoding::value::type_date:
-                return cbe_encode_add_date(_process, v.d.year, v.d.month, v.d.day);
-            case encoding::value::type_time:
-                switch(v.t.tz.type)
-                {
-                    case encoding::tz_zero:
-                        return cbe_encode_add_time_tz(_process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, NULL);
-                    case encoding::tz_zone:
-                        return cbe_encode_add_time_tz(_process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, v.t.tz.zone.c_str());
-                    default:
-                        break;
-                }
-                return cbe_encode_add_time_loc(_process, v.t.hour, v.t.minute, v.t.second, v.t.nanosecond, v.t.tz.latitude, v.t.tz.longitude);
-            case encoding::value::type_ts:
-                switch(v.ts.tz.type)
-                {
-                    case encoding::tz_zero:
-                        return cbe_encode_add_timestamp_tz(_process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, NULL);
-                    case encoding::tz_zone:
-                        return cbe_encode_add_timestamp_tz(_process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, v.ts.tz.zone.c_str());
-                    default:
-                        break;
-                }
-                return cbe_encode_add_timestamp_loc(_process, v.ts.year, v.ts.month, v.ts.day, v.ts.hour, v.ts.minute, v.ts.second, v.ts.nanosecond, v.ts.tz.latitude, v.ts.tz.longitude);
-            case encoding::value::type_str:
-                return cbe_encode_string_begin(_process, v.str.size());
-            case encoding::value::type_bin:
-                return cbe_encode_bytes_begin(_process, v.bin.size());
-            case encoding::value::type_uri:
-                return cbe_encode_uri_begin(_process, v.str.size());
-            case encoding::value::type_com:
-                return cbe_encode_comment_begin(_process, v.str.size());
-            case encoding::value::type_strh:
-                return cbe_encode_string_begin(_process, v.i);
-            case encoding::value::type_urih:
-                return cbe_encode_uri_begin(_process, v.i);
-            case encoding::value::type_comh:
-                return cbe_encode_comment_begin(_process, v.i);
-            case encoding::value::type_binh:
-                return cbe_encode_bytes_begin(_process, v.i);
-            case encoding::value::type_data:
-                // Contents handled outside
-                return CBE_ENCODE_STATUS_OK;
-            case encoding::value::type_list:
-                return cbe_encode_list_begin(_process);
-            case encoding::value::type_map_u:
-                return cbe_encode_unordered_map_begin(_process);
-            case encoding::value::type_map_o:
-                return cbe_encode_ordered_map_begin(_process);
-            case encoding::value::type_map_m:
-                return cbe_encode_metadata_map_begin(_process);
-            case encoding::value::type_end:
-                return cbe_encode_container_end(_process);
-            case encoding::value::type_nil:
-                return cbe_encode_add_nil(_process);
-            case encoding::value::type_pad:
-                return cbe_encode_add_padding(_process, v.i);
-            default:
-                break;
-        }
-        KSLOG_ERROR("Unknown value type %d", v.type);
-        return (cbe_encode_status)1999999;
+        return begin_value(_process, v);
     });
 
     if(status != CBE_ENCODE_STATUS_OK)
@@ -153,6 +243,7 @@ cbe_encode_status encoder::encode(const encoding::value& v)
             return stream_array(std::vector<uint8_t>(v.str.begin(), v.str.end()));
         case encoding::value::type_bin:
         case encoding::value::type_data:
+        case encoding::value::type_typed_array:
             return stream_array(std::vector<uint8_t>(v.bin.begin(), v.bin.end()));
         default:
             break;
@@ -212,6 +303,15 @@ cbe_encode_status encoder::encode(const encoding::enc& enc)
     {
         return result;
     }
+    cbe_encode_set_timezone_table(_process, encoding_timezone_table());
+    if(_alignment != 0)
+    {
+        result = cbe_encode_set_alignment(_process, _alignment);
+        if(result != CBE_ENCODE_STATUS_OK)
+        {
+            return result;
+        }
+    }
 
     for(auto i: enc.values)
     {
@@ -239,7 +339,46 @@ encoder::encoder(int64_t buffer_size,
 , _process((cbe_encode_process*)_process_backing_store.data())
 , _buffer(buffer_size)
 , _max_container_depth(max_container_depth)
+, _alignment(0)
 , _on_data_ready(on_data_ready)
 {
     KSLOG_DEBUG("New encoder with buffer size %d", _buffer.size());
 }
+
+cbe_encode_status add_encoding(cbe_encode_process* process, const encoding::enc& enc)
+{
+    for(auto& v: enc.values)
+    {
+        cbe_encode_status status = CBE_ENCODE_STATUS_OK;
+        int64_t byte_count = v.bin.size();
+        switch(v.type)
+        {
+            case encoding::value::type_str:
+                status = cbe_encode_add_string(process, v.str.data(), v.str.size());
+                break;
+            case encoding::value::type_uri:
+                status = cbe_encode_add_uri(process, v.str.data(), v.str.size());
+                break;
+            case encoding::value::type_com:
+                status = cbe_encode_add_comment(process, v.str.data(), v.str.size());
+                break;
+            case encoding::value::type_bin:
+                status = cbe_encode_add_bytes(process, v.bin.data(), v.bin.size());
+                break;
+            case encoding::value::type_data:
+                status = cbe_encode_add_data(process, v.bin.data(), &byte_count);
+                break;
+            case encoding::value::type_typed_array:
+                status = cbe_encode_add_typed_array(process, (cbe_typed_array_type)v.i, v.bin.data(), typed_array_element_count(v));
+                break;
+            default:
+                status = begin_value(process, v);
+                break;
+        }
+        if(status != CBE_ENCODE_STATUS_OK)
+        {
+            return status;
+        }
+    }
+    return CBE_ENCODE_STATUS_OK;
+}
@@ -12,6 +12,7 @@ private:
     std::vector<uint8_t> _buffer;
     std::vector<uint8_t> _encoded_data;
     int _max_container_depth;
+    int _alignment;
     std::function<bool(uint8_t* data_start, int64_t length)> _on_data_ready;
 
 private:
@@ -27,6 +28,9 @@ public:
                 [](uint8_t* data_start, int64_t length)
                 {(void)data_start; (void)length; return true;});
 
+    // Align payloads in documents encoded from now on (see cbe_encode_set_alignment()).
+    void set_alignment(int alignment) {_alignment = alignment;}
+
     // Encode an encoding object and all linked objects.
     cbe_encode_status encode(const encoding::enc& enc);
 
@@ -42,3 +46,12 @@ public:
     // Get the complete raw encoded data.
     std::vector<uint8_t>& encoded_data() {return _encoded_data;}
 };
+
+// Add an encoding object to a process that the caller has already begun.
+// Arrays are added whole. Nothing is flushed: the first status other than
+// OK is returned as-is.
+cbe_encode_status add_encoding(cbe_encode_process* process, const encoding::enc& enc);
+
+// The timezone table that tid() and tsid() values are encoded with and decoded
+// against. Their timezones must be one of the ones registered here.
+const cbe_string_table* encoding_timezone_table();
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -281,6 +282,25 @@ public:
         type_end,
         type_nil,
         type_pad,
+        type_nanotime,
+        type_smalltime,
+        type_time_tzid,
+        type_ts_tzid,
+        type_int_list,
+        type_uint_list,
+        type_float_list,
+        type_raw,
+        type_float_shortest,
+        type_decimal_parts,
+        type_typed_array,
+        type_typed_array_header,
+        type_int_128,
+        type_int_128_fixed,
+        type_float_128,
+        type_float_128_fixed,
+        type_decfloat_128,
+        type_decfloat_128_fixed,
+        type_key_dictionary,
     } value_type;
 
     const value_type type;
@@ -294,16 +314,21 @@ public:
     const bool b;
     const std::string str;
     const std::vector<unsigned char> bin;
-
-    value(value_type type_in, uint64_t value): type(type_in), i(value), f(), df(), d(), t(), ts(), b(), str(), bin() {}
-    value(value_type type_in, double value, int digits): type(type_in), i(digits), f(value), df(), d(), t(), ts(), b(), str(), bin() {}
-    value(value_type type_in, dec64_ct value, int digits): type(type_in), i(digits), f(), df(value), d(), t(), ts(), b(), str(), bin() {}
-    value(value_type type_in, date value): type(type_in), i(), f(), df(), d(value), t(), ts(), b(), str(), bin() {}
-    value(value_type type_in, time value): type(type_in), i(), f(), df(), d(), t(value), ts(), b(), str(), bin() {}
-    value(value_type type_in, timestamp value): type(type_in), i(), f(), df(), d(), t(), ts(value), b(), str(), bin() {}
-    value(value_type type_in, bool value): type(type_in), i(), f(), df(), d(), t(), ts(), b(value), str(), bin() {}
-    value(value_type type_in, std::string value): type(type_in), i(), f(), df(), d(), t(), ts(), b(), str(value), bin() {}
-    value(value_type type_in, std::vector<unsigned char> value): type(type_in), i(), f(), df(), d(), t(), ts(), b(), str(), bin(value) {}
+    const std::vector<uint64_t> il;
+    const std::vector<double> fl;
+
+    value(value_type type_in, uint64_t value): type(type_in), i(value), f(), df(), d(), t(), ts(), b(), str(), bin(), il(), fl() {}
+    value(value_type type_in, double value, int digits): type(type_in), i(digits), f(value), df(), d(), t(), ts(), b(), str(), bin(), il(), fl() {}
+    value(value_type type_in, dec64_ct value, int digits): type(type_in), i(digits), f(), df(value), d(), t(), ts(), b(), str(), bin(), il(), fl() {}
+    value(value_type type_in, date value): type(type_in), i(), f(), df(), d(value), t(), ts(), b(), str(), bin(), il(), fl() {}
+    value(value_type type_in, time value): type(type_in), i(), f(), df(), d(), t(value), ts(), b(), str(), bin(), il(), fl() {}
+    value(value_type type_in, timestamp value): type(type_in), i(), f(), df(), d(), t(), ts(value), b(), str(), bin(), il(), fl() {}
+    value(value_type type_in, bool value): type(type_in), i(), f(), df(), d(), t(), ts(), b(value), str(), bin(), il(), fl() {}
+    value(value_type type_in, std::string value): type(type_in), i(), f(), df(), d(), t(), ts(), b(), str(value), bin(), il(), fl() {}
+    value(value_type type_in, std::vector<unsigned char> value): type(type_in), i(), f(), df(), d(), t(), ts(), b(), str(), bin(value), il(), fl() {}
+    value(value_type type_in, uint64_t subtype, std::vector<unsigned char> value): type(type_in), i(subtype), f(), df(), d(), t(), ts(), b(), str(), bin(value), il(), fl() {}
+    value(value_type type_in, std::vector<uint64_t> value): type(type_in), i(), f(), df(), d(), t(), ts(), b(), str(), bin(), il(value), fl() {}
+    value(value_type type_in, std::vector<double> value): type(type_in), i(), f(), df(), d(), t(), ts(), b(), str(), bin(), il(), fl(value) {}
 
     bool operator==(const value& them) const
     {
@@ -312,7 +337,7 @@ public:
         {
             return EQ(type) && EQ(f) && EQ(df);
         }
-        return EQ(type) && EQ(i) && EQ(f) && EQ(d) && EQ(df) && EQ(t) && EQ(ts) && EQ(b) && EQ(str) && EQ(bin);
+        return EQ(type) && EQ(i) && EQ(f) && EQ(d) && EQ(df) && EQ(t) && EQ(ts) && EQ(b) && EQ(str) && EQ(bin) && EQ(il) && EQ(fl);
     }
 
     std::string to_string() const
@@ -392,6 +417,80 @@ public:
             case type_pad:
                 stream << "pad(" << i << ")";
                 break;
+            case type_nanotime:
+                stream << "nt(" << i << ")";
+                break;
+            case type_smalltime:
+                stream << "st(" << (int64_t)i << ")";
+                break;
+            case type_time_tzid:
+                stream << "tid(" << t << ")";
+                break;
+            case type_ts_tzid:
+                stream << "tsid(" << ts << ")";
+                break;
+            case type_int_list:
+            case type_uint_list:
+                stream << (type == type_int_list ? "ilist({" : "ulist({");
+                for(int index = 0; index < (int)il.size(); index++)
+                {
+                    if(type == type_int_list)
+                    {
+                        stream << (int64_t)il[index];
+                    }
+                    else
+                    {
+                        stream << il[index];
+                    }
+                    stream << (index < (int)il.size() - 1 ? ", " : "");
+                }
+                stream << "})";
+                break;
+            case type_float_shortest:
+                stream << "fs(" << std::setprecision(16) << f << ")";
+                break;
+            case type_decimal_parts:
+                stream << "dp(" << (int64_t)il[0] << ", " << il[1] << ", " << (int64_t)il[2] << ")";
+                break;
+            case type_typed_array:
+                stream << "ta(" << i << ", {" << bin << "})";
+                break;
+            case type_typed_array_header:
+                stream << "tah(" << il[0] << ", " << il[1] << ")";
+                break;
+            // 128-bit values are kept as their in-memory bits.
+            case type_int_128:
+                stream << "i128(" << (int64_t)i << ", {" << bin << "})";
+                break;
+            case type_int_128_fixed:
+                stream << "i128f(" << (int64_t)i << ", {" << bin << "})";
+                break;
+            case type_float_128:
+                stream << "f128({" << bin << "})";
+                break;
+            case type_float_128_fixed:
+                stream << "f128f({" << bin << "})";
+                break;
+            case type_decfloat_128:
+                stream << "df128({" << bin << "})";
+                break;
+            case type_decfloat_128_fixed:
+                stream << "df128f({" << bin << "})";
+                break;
+            case type_raw:
+                stream << "raw(" << (const void*)(uintptr_t)i << ")";
+                break;
+            case type_key_dictionary:
+                stream << "kd(" << (const void*)(uintptr_t)i << ")";
+                break;
+            case type_float_list:
+                stream << "flist({" << std::setprecision(16);
+                for(int index = 0; index < (int)fl.size(); index++)
+                {
+                    stream << fl[index] << (index < (int)fl.size() - 1 ? ", " : "");
+                }
+                stream << "})";
+                break;
         }
         return stream.str();
     }
@@ -451,6 +550,33 @@ public:
     static value endv() {return value(type_end, (uint64_t)0);}
     static value nilv() {return value(type_nil, (uint64_t)0);}
     static value padv(unsigned bytes) {return value(type_pad, (uint64_t)bytes);}
+    static value ntv(nanotime v) {return value(type_nanotime, (uint64_t)v);}
+    static value stv(smalltime v) {return value(type_smalltime, (uint64_t)v);}
+    static value tidv(int hour, int minute, int second, int nanosecond, const char* tz)
+    {return value(type_time_tzid, time(hour, minute, second, nanosecond, timezone(tz)));}
+    static value tsidv(int year, int month, int day, int hour, int minute, int second, int nanosecond, const char* tz)
+    {return value(type_ts_tzid, timestamp(year, month, day, hour, minute, second, nanosecond, timezone(tz)));}
+    static value ilistv(std::vector<int64_t> v) {return value(type_int_list, std::vector<uint64_t>(v.begin(), v.end()));}
+    static value ulistv(std::vector<uint64_t> v) {return value(type_uint_list, v);}
+    static value flistv(std::vector<double> v) {return value(type_float_list, v);}
+    static value rawv(const cbe_fragment* v) {return value(type_raw, (uint64_t)(uintptr_t)v);}
+    static value kdv(const cbe_string_table* v) {return value(type_key_dictionary, (uint64_t)(uintptr_t)v);}
+    static value fsv(double v) {return value(type_float_shortest, v, 0);}
+    static value tav(cbe_typed_array_type type, std::vector<uint8_t> elements) {return value(type_typed_array, (uint64_t)type, elements);}
+    static value tahv(cbe_typed_array_type type, int64_t element_count) {return value(type_typed_array_header, std::vector<uint64_t>{(uint64_t)type, (uint64_t)element_count});}
+    template<typename T> static std::vector<uint8_t> bits_of(const T& v)
+    {
+        std::vector<uint8_t> bits(sizeof(v));
+        memcpy(bits.data(), &v, sizeof(v));
+        return bits;
+    }
+    static value i128v(int sign, uint128_ct v) {return value(type_int_128, (uint64_t)(int64_t)sign, bits_of(v));}
+    static value i128fv(int sign, uint128_ct v) {return value(type_int_128_fixed, (uint64_t)(int64_t)sign, bits_of(v));}
+    static value f128v(float128_ct v) {return value(type_float_128, 0, bits_of(v));}
+    static value f128fv(float128_ct v) {return value(type_float_128_fixed, 0, bits_of(v));}
+    static value df128v(dec128_ct v) {return value(type_decfloat_128, 0, bits_of(v));}
+    static value df128fv(dec128_ct v) {return value(type_decfloat_128_fixed, 0, bits_of(v));}
+    static value dpv(int sign, uint64_t significand, int exponent) {return value(type_decimal_parts, std::vector<uint64_t>{(uint64_t)(int64_t)sign, significand, (uint64_t)(int64_t)exponent});}
 };
 
 
@@ -517,12 +643,29 @@ public:
     DEFINE_INITIATOR_0(end)
     DEFINE_INITIATOR_0(nil)
     DEFINE_INITIATOR_1(pad, unsigned)
+    DEFINE_INITIATOR_1(nt, nanotime)
+    DEFINE_INITIATOR_1(st, smalltime)
+    DEFINE_INITIATOR_1(ilist, std::vector<int64_t>)
+    DEFINE_INITIATOR_1(ulist, std::vector<uint64_t>)
+    DEFINE_INITIATOR_1(flist, std::vector<double>)
+    DEFINE_INITIATOR_1(raw, const cbe_fragment*)
+    DEFINE_INITIATOR_1(kd, const cbe_string_table*)
+    DEFINE_INITIATOR_1(fs, double)
+    DEFINE_INITIATOR_1(f128, float128_ct)
+    DEFINE_INITIATOR_1(f128f, float128_ct)
+    DEFINE_INITIATOR_1(df128, dec128_ct)
+    DEFINE_INITIATOR_1(df128f, dec128_ct)
     #undef DEFINE_INITIATOR_0
     #undef DEFINE_INITIATOR_1
 
     enc i(int sign, uint64_t v) {return add(value::iv(sign, v));}
     enc f(double v, int digits) {return add(value::fv(v, digits));}
     enc df(dec64_ct v, int digits) {return add(value::dfv(v, digits));}
+    enc dp(int sign, uint64_t significand, int exponent) {return add(value::dpv(sign, significand, exponent));}
+    enc ta(cbe_typed_array_type type, std::vector<uint8_t> elements) {return add(value::tav(type, elements));}
+    enc i128(int sign, uint128_ct v) {return add(value::i128v(sign, v));}
+    enc i128f(int sign, uint128_ct v) {return add(value::i128fv(sign, v));}
+    enc tah(cbe_typed_array_type type, int64_t element_count) {return add(value::tahv(type, element_count));}
     enc d(int year, int month, int day) {return add(value::dv(year, month, day));}
     enc t(int hour, int minute, int second, int nanosecond)
     {return add(value::tv(hour, minute, second, nanosecond));}
@@ -536,6 +679,10 @@ public:
     {return add(value::tsv(year, month, day, hour, minute, second, nanosecond, tz));}
     enc ts(int year, int month, int day, int hour, int minute, int second, int nanosecond, int latitude, int longitude)
     {return add(value::tsv(year, month, day, hour, minute, second, nanosecond, latitude, longitude));}
+    enc tid(int hour, int minute, int second, int nanosecond, const char* tz)
+    {return add(value::tidv(hour, minute, second, nanosecond, tz));}
+    enc tsid(int year, int month, int day, int hour, int minute, int second, int nanosecond, const char* tz)
+    {return add(value::tsidv(year, month, day, hour, minute, second, nanosecond, tz));}
 };
 
 
@@ -563,12 +710,29 @@ DEFINE_INITIATOR_0(mmap)
 DEFINE_INITIATOR_0(end)
 DEFINE_INITIATOR_0(nil)
 DEFINE_INITIATOR_1(pad, unsigned)
+DEFINE_INITIATOR_1(nt, nanotime)
+DEFINE_INITIATOR_1(st, smalltime)
+DEFINE_INITIATOR_1(ilist, std::vector<int64_t>)
+DEFINE_INITIATOR_1(ulist, std::vector<uint64_t>)
+DEFINE_INITIATOR_1(flist, std::vector<double>)
+DEFINE_INITIATOR_1(raw, const cbe_fragment*)
+DEFINE_INITIATOR_1(kd, const cbe_string_table*)
+DEFINE_INITIATOR_1(fs, double)
+DEFINE_INITIATOR_1(f128, float128_ct)
+DEFINE_INITIATOR_1(f128f, float128_ct)
+DEFINE_INITIATOR_1(df128, dec128_ct)
+DEFINE_INITIATOR_1(df128f, dec128_ct)
 #undef DEFINE_INITIATOR_0
 #undef DEFINE_INITIATOR_1
 
 static enc i(int sign, uint64_t v) {return enc().add(value::iv(sign, v));}
 static enc f(double v, int digits) {return enc().add(value::fv(v, digits));}
 static enc df(dec64_ct v, int digits) {return enc().add(value::dfv(v, digits));}
+static enc dp(int sign, uint64_t significand, int exponent) {return enc().add(value::dpv(sign, significand, exponent));}
+static enc ta(cbe_typed_array_type type, std::vector<uint8_t> elements) {return enc().add(value::tav(type, elements));}
+static enc i128(int sign, uint128_ct v) {return enc().add(value::i128v(sign, v));}
+static enc i128f(int sign, uint128_ct v) {return enc().add(value::i128fv(sign, v));}
+static enc tah(cbe_typed_array_type type, int64_t element_count) {return enc().add(value::tahv(type, element_count));}
 static enc d(int year, int month, int day) {return enc().add(value::dv(year, month, day));}
 static enc t(int hour, int minute, int second, int nanosecond)
 {return enc().add(value::tv(hour, minute, second, nanosecond));}
@@ -582,6 +746,10 @@ static enc ts(int year, int month, int day, int hour, int minute, int second, in
 {return enc().add(value::tsv(year, month, day, hour, minute, second, nanosecond, tz));}
 static enc ts(int year, int month, int day, int hour, int minute, int second, int nanosecond, int latitude, int longitude)
 {return enc().add(value::tsv(year, month, day, hour, minute, second, nanosecond, latitude, longitude));}
+static enc tid(int hour, int minute, int second, int nanosecond, const char* tz)
+{return enc().add(value::tidv(hour, minute, second, nanosecond, tz));}
+static enc tsid(int year, int month, int day, int hour, int minute, int second, int nanosecond, const char* tz)
+{return enc().add(value::tsidv(year, month, day, hour, minute, second, nanosecond, tz));}
 
 #pragma GCC diagnostic pop
 }
@@ -42,6 +42,8 @@ static encoding::enc decode_data(int buffer_size,
         return decoder.decoded();
     }
 
+    // Bytes that the decoder didn't consume are carried over to the front of the next feed.
+    std::vector<uint8_t> buffer;
     for(unsigned offset = 0; offset < data.size(); offset += buffer_size)
     {
         auto begin = data.begin() + offset;
@@ -51,12 +53,14 @@ static encoding::enc decode_data(int buffer_size,
             end = data.begin() + offset + buffer_size;
         }
         KSLOG_DEBUG("Decoding data from %d for %d bytes", offset, buffer_size);
-        std::vector<uint8_t> buffer(begin, end);
-        status = decoder.feed(buffer);
+        buffer.insert(buffer.end(), begin, end);
+        int64_t bytes_consumed = 0;
+        status = decoder.feed(buffer, bytes_consumed);
         if(status != CBE_DECODE_STATUS_OK && status != CBE_DECODE_STATUS_NEED_MORE_DATA)
         {
             break;
         }
+        buffer.erase(buffer.begin(), buffer.begin() + bytes_consumed);
     }
     // Also checking NEED_MORE_DATA to allow testing for premature end of data.
     if(status == CBE_DECODE_STATUS_OK || status == CBE_DECODE_STATUS_NEED_MORE_DATA)
@@ -220,4 +224,82 @@ void expect_encode_decode_with_shrinking_buffer_size(int min_buffer_size,
     }
 }
 
+std::vector<uint8_t> encode_document(const encoding::enc& document)
+{
+    const int buffer_size = 1000;
+    const int max_container_depth = 500;
+    encoder encoder(buffer_size, max_container_depth);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, encoder.encode(document));
+    return encoder.encoded_data();
+}
+
+int64_t measure_document(const encoding::enc& document)
+{
+    const int max_container_depth = 500;
+    measure_process process(max_container_depth);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_measure(process, max_container_depth));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    return cbe_encode_get_measured_byte_count(process);
+}
+
+string_table::string_table(int max_entries, int64_t max_total_bytes, const std::vector<std::string>& strings)
+: _backing_store(cbe_string_table_size(max_entries, max_total_bytes) / sizeof(uint64_t) + 1)
+{
+    EXPECT_TRUE(cbe_string_table_begin(*this, max_entries, max_total_bytes));
+    for(const std::string& str: strings)
+    {
+        EXPECT_LE(0, add(str));
+    }
+}
+
+int string_table::add(const std::string& str)
+{
+    return cbe_string_table_add(*this, str.data(), str.size());
+}
+
+int string_table::find(const std::string& str)
+{
+    return cbe_string_table_find(*this, str.data(), str.size());
+}
+
+page_pool::page_pool(int page_count, int64_t page_size, int max_references)
+: _backing_store(cbe_page_pool_size(page_count, page_size, max_references) / sizeof(uint64_t) + 1)
+{
+    EXPECT_TRUE(cbe_page_pool_begin(*this, page_count, page_size, max_references));
+}
+
+fragment::fragment(const encoding::enc& document)
+: _buffer(1000)
+, _fragment()
+{
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(_process, _buffer.data(), _buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(_process, document));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_get_fragment(_process, &_fragment));
+}
+
+std::vector<uint8_t> gather_segments(cbe_encode_process* process)
+{
+    std::vector<uint8_t> result;
+    for(int i = 0; i < cbe_encode_get_segment_count(process); i++)
+    {
+        int64_t byte_count = 0;
+        const uint8_t* segment = cbe_encode_get_segment(process, i, &byte_count);
+        result.insert(result.end(), segment, segment + byte_count);
+    }
+    return result;
+}
+
+std::vector<uint8_t> read_file(FILE* file)
+{
+    std::vector<uint8_t> result;
+    rewind(file);
+    int ch;
+    while((ch = fgetc(file)) != EOF)
+    {
+        result.push_back((uint8_t)ch);
+    }
+    return result;
+}
+
 } // namespace cbe_test
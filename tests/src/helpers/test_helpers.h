@@ -1,6 +1,7 @@
 #pragma once
 
 #include <gtest/gtest.h>
+#include <cstdio>
 #include "encoder.h"
 #include "decoder.h"
 #include "test_utils.h"
@@ -53,6 +54,104 @@ void expect_encode_decode_with_shrinking_buffer_size(int min_buffer_size,
                                                      const encoding::enc& original_encoding,
                                                      const encoding::enc& expected_encoding,
                                                      const std::vector<uint8_t> expected_memory);
+
+// Encode a document that is expected to succeed, and get the encoded data.
+std::vector<uint8_t> encode_document(const encoding::enc& document);
+
+// Measure a document that is expected to succeed, and get its encoded size.
+int64_t measure_document(const encoding::enc& document);
+
+// Memory for an encode process, for tests that call the encoder API directly.
+class encode_process
+{
+public:
+    explicit encode_process(int max_container_depth = 0)
+    : _backing_store(cbe_encode_process_size(max_container_depth))
+    {}
+
+    operator cbe_encode_process*() {return (cbe_encode_process*)_backing_store.data();}
+
+private:
+    std::vector<char> _backing_store;
+};
+
+// Memory for an encode process that can also be used for measuring.
+class measure_process
+{
+public:
+    explicit measure_process(int max_container_depth = 0)
+    : _backing_store(cbe_encode_measure_process_size(max_container_depth))
+    {}
+
+    operator cbe_encode_process*() {return (cbe_encode_process*)_backing_store.data();}
+
+private:
+    std::vector<char> _backing_store;
+};
+
+// Memory for a decode process, for tests that call the decoder API directly.
+class decode_process
+{
+public:
+    explicit decode_process(int max_container_depth = 0)
+    : _backing_store(cbe_decode_process_size(max_container_depth))
+    {}
+
+    operator cbe_decode_process*() {return (cbe_decode_process*)_backing_store.data();}
+
+private:
+    std::vector<char> _backing_store;
+};
+
+// A string table, optionally filled with an initial set of strings.
+class string_table
+{
+public:
+    string_table(int max_entries, int64_t max_total_bytes, const std::vector<std::string>& strings = {});
+
+    int add(const std::string& str);
+    int find(const std::string& str);
+
+    operator cbe_string_table*() {return (cbe_string_table*)_backing_store.data();}
+
+private:
+    std::vector<uint64_t> _backing_store;
+};
+
+// A page pool for paged encoding.
+class page_pool
+{
+public:
+    page_pool(int page_count, int64_t page_size, int max_references = 0);
+
+    operator cbe_page_pool*() {return (cbe_page_pool*)_backing_store.data();}
+
+private:
+    std::vector<uint64_t> _backing_store;
+};
+
+// A fragment holding an encoded document, to be added with the raw() builder op.
+class fragment
+{
+public:
+    fragment(const encoding::enc& document);
+    fragment(const fragment&) = delete;
+    fragment& operator=(const fragment&) = delete;
+
+    operator const cbe_fragment*() const {return &_fragment;}
+    int64_t byte_count() const {return _fragment.byte_count;}
+
+private:
+    encode_process _process;
+    std::vector<uint8_t> _buffer;
+    cbe_fragment _fragment;
+};
+
+// Get the contents of all segments of a paged encode process, in order.
+std::vector<uint8_t> gather_segments(cbe_encode_process* process);
+
+// Read the entire contents of a file from the beginning.
+std::vector<uint8_t> read_file(FILE* file);
 } // namespace cbe_test
 
 
@@ -149,6 +248,16 @@ TEST(TESTCASE, NAME) \
     cbe_test::expect_encode_decode_with_shrinking_buffer_size(MIN_BUFFER_SIZE, ENCODING, ENCODING, __VA_ARGS__); \
 }
 
+// Test that encoding produces the same memory as an equivalent encoding, and decodes to that encoding.
+#define TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(TESTCASE, NAME, MIN_BUFFER_SIZE, ENCODING, EQUIVALENT_ENCODING) \
+TEST(TESTCASE, NAME) \
+{ \
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(MIN_BUFFER_SIZE, \
+                                                              ENCODING, \
+                                                              EQUIVALENT_ENCODING, \
+                                                              cbe_test::encode_document(EQUIVALENT_ENCODING)); \
+}
+
 // Test that decoding results in the specified status code.
 #define TEST_STOP_IN_CALLBACK(TESTCASE, NAME, ENCODING) \
 TEST(TESTCASE, NAME) \
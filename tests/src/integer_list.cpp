@@ -0,0 +1,126 @@
+#include "helpers/test_helpers.h"
+#include <limits>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static std::vector<int64_t> sample_values()
+{
+    std::vector<int64_t> values;
+    // Boundaries of every integer encoding, on both sides of zero.
+    const int64_t boundaries[] =
+    {
+        0, 1, 100, 101, 255, 256, 65535, 65536, 0x1fffff, 0x200000,
+        0xffffffffLL, 0x100000000LL, 0x1ffffffffffffLL, 0x2000000000000LL,
+        std::numeric_limits<int64_t>::max(),
+    };
+    for(int64_t boundary: boundaries)
+    {
+        values.push_back(boundary);
+        values.push_back(-boundary);
+    }
+    values.push_back(std::numeric_limits<int64_t>::min());
+    // Runs of small ints, long enough to take the block path.
+    for(int i = -100; i <= 100; i++)
+    {
+        values.push_back(i);
+    }
+    for(int i = 0; i < 40; i++)
+    {
+        values.push_back(i * 1000003);
+    }
+    return values;
+}
+
+static std::vector<uint64_t> unsigned_sample_values()
+{
+    std::vector<uint64_t> values;
+    for(int64_t value: sample_values())
+    {
+        if(value >= 0)
+        {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// The same list, encoded one value at a time.
+static enc one_by_one(const std::vector<int64_t>& values)
+{
+    enc document = list();
+    for(int64_t value: values)
+    {
+        document.i(value);
+    }
+    return document.end();
+}
+
+static enc one_by_one(const std::vector<uint64_t>& values)
+{
+    enc document = list();
+    for(uint64_t value: values)
+    {
+        document.u(value);
+    }
+    return document.end();
+}
+
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(IntegerList, matches_single_values, 0, ilist(sample_values()), one_by_one(sample_values()))
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(IntegerList, unsigned_matches_single_values, 0, ulist(unsigned_sample_values()), one_by_one(unsigned_sample_values()))
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(IntegerList, empty, 0, ilist({}), list().end())
+
+TEST(IntegerList, not_enough_room_adds_nothing)
+{
+    const std::vector<uint8_t> expected = cbe_test::encode_document(one_by_one(sample_values()));
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(expected.size() - 1);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, ilist(sample_values())));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+}
+
+TEST_ENCODE_STATUS(IntegerList, as_map_key, 99, 9, CBE_ENCODE_ERROR_INCORRECT_MAP_KEY_TYPE, umap().ilist({1, 1000}))
+
+TEST(IntegerList, in_map)
+{
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(6,
+        umap().i(5).ilist({1, 1000}).end(),
+        umap().i(5).list().i(1).i(1000).end().end(),
+        {0x78, 0x05, 0x77, 0x01, 0x6a, 0xe8, 0x03, 0x7b, 0x7b});
+}
+
+TEST(IntegerList, not_enough_room_leaves_fragment_state)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(2);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, ilist({1, 1000})));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, i(5)));
+    cbe_fragment fragment;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_get_fragment(process, &fragment));
+    EXPECT_EQ(0, fragment.container_depth);
+    EXPECT_EQ(0, fragment.unkeyable_positions);
+}
+
+TEST(IntegerList, across_pages)
+{
+    cbe_test::page_pool pool(100, 32);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, ilist(sample_values())));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ(cbe_test::encode_document(one_by_one(sample_values())), cbe_test::gather_segments(process));
+}
+
+TEST(IntegerList, invalid)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_integer_list(process, NULL, 1));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_unsigned_integer_list(process, NULL, 1));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_integer_list(process, NULL, 0));
+}
@@ -0,0 +1,303 @@
+#include "helpers/test_helpers.h"
+#include <algorithm>
+#include <string>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static enc add_records(enc document)
+{
+    return document
+        .umap().str("id").i(1).str("name").str("name").str("other").i(2).end()
+        .umap().str("id").i(2).str("name").str("name").str("other").i(2).end();
+}
+
+// Strings are added whole so that declared keys get encoded as references.
+static std::vector<uint8_t> encode(const enc& document)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    return buffer;
+}
+
+static std::vector<uint8_t> encode_records(const cbe_string_table* key_dictionary)
+{
+    return encode(add_records(key_dictionary != NULL ? kd(key_dictionary) : enc()));
+}
+
+struct key_events
+{
+    std::vector<std::string> events;
+    std::string current_string;
+    int64_t remaining_byte_count = 0;
+};
+
+static bool on_map_key_symbol(struct cbe_decode_process* process, int symbol_id)
+{
+    ((key_events*)cbe_decode_get_user_context(process))->events.push_back("#" + std::to_string(symbol_id));
+    return true;
+}
+
+static bool on_string_begin(struct cbe_decode_process* process, int64_t byte_count)
+{
+    key_events* result = (key_events*)cbe_decode_get_user_context(process);
+    result->current_string.clear();
+    result->remaining_byte_count = byte_count;
+    return true;
+}
+
+static bool on_array_data(struct cbe_decode_process* process, const uint8_t* start, int64_t byte_count)
+{
+    key_events* result = (key_events*)cbe_decode_get_user_context(process);
+    result->current_string.append((const char*)start, byte_count);
+    result->remaining_byte_count -= byte_count;
+    if(result->remaining_byte_count == 0)
+    {
+        result->events.push_back(result->current_string);
+    }
+    return true;
+}
+
+static bool on_integer(struct cbe_decode_process* process, int, uint64_t value)
+{
+    ((key_events*)cbe_decode_get_user_context(process))->events.push_back(std::to_string(value));
+    return true;
+}
+
+static bool on_container_begin(struct cbe_decode_process* process)
+{
+    ((key_events*)cbe_decode_get_user_context(process))->events.push_back("{");
+    return true;
+}
+
+static bool on_container_end(struct cbe_decode_process* process)
+{
+    ((key_events*)cbe_decode_get_user_context(process))->events.push_back("}");
+    return true;
+}
+
+// Feeds the document in chunks, growing the window when nothing could be
+// consumed (a declared key waiting to be buffered whole).
+static cbe_decode_status decode(cbe_string_table* key_dictionary,
+                                const cbe_string_table* map_key_table,
+                                const std::vector<uint8_t>& document,
+                                int64_t chunk_size,
+                                std::vector<std::string>* events)
+{
+    cbe_decode_callbacks callbacks = {};
+    callbacks.on_map_key_symbol = on_map_key_symbol;
+    callbacks.on_string_begin = on_string_begin;
+    callbacks.on_array_data = on_array_data;
+    callbacks.on_integer = on_integer;
+    callbacks.on_list_begin = on_container_begin;
+    callbacks.on_unordered_map_begin = on_container_begin;
+    callbacks.on_metadata_map_begin = on_container_begin;
+    callbacks.on_container_end = on_container_end;
+    key_events result;
+
+    cbe_test::decode_process process;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode_begin(process, &callbacks, &result, 0));
+    cbe_decode_set_key_dictionary(process, key_dictionary);
+    cbe_decode_set_map_key_table(process, map_key_table);
+
+    int64_t offset = 0;
+    int64_t window = chunk_size;
+    cbe_decode_status status = CBE_DECODE_STATUS_OK;
+    while((status == CBE_DECODE_STATUS_OK || status == CBE_DECODE_STATUS_NEED_MORE_DATA) &&
+          offset < (int64_t)document.size())
+    {
+        int64_t byte_count = std::min(window, (int64_t)document.size() - offset);
+        status = cbe_decode_feed(process, document.data() + offset, &byte_count);
+        offset += byte_count;
+        window = byte_count == 0 ? window + chunk_size : chunk_size;
+    }
+    if(status == CBE_DECODE_STATUS_OK || status == CBE_DECODE_STATUS_NEED_MORE_DATA)
+    {
+        status = cbe_decode_end(process);
+    }
+    if(events != NULL)
+    {
+        *events = result.events;
+    }
+    return status;
+}
+
+static const std::vector<std::string> g_declaration = {"{", "_keys", "{", "id", "name", "other", "}", "}"};
+static const std::vector<std::string> g_records = {"{", "id", "1", "name", "name", "other", "2", "}",
+                                                   "{", "id", "2", "name", "name", "other", "2", "}"};
+
+static std::vector<std::string> join(std::vector<std::string> a, const std::vector<std::string>& b)
+{
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+TEST(KeyDictionary, encoding)
+{
+    cbe_test::string_table keys(10, 100, {"a", "b"});
+    std::vector<uint8_t> expected = {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'a', 0x81, 'b', 0x7b, 0x7b,
+                                     0x78, 0x95, 0x01, 0x01, 0x81, 'c', 0x81, 'a', 0x7b};
+    EXPECT_EQ(expected, encode(kd(keys).umap().str("b").i(1).str("c").str("a").end()));
+}
+
+TEST(KeyDictionary, shrinks_records)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    const std::vector<uint8_t> plain = encode_records(NULL);
+    const std::vector<uint8_t> with_dictionary = encode_records(keys);
+    const int64_t declaration_size = 24;
+    EXPECT_EQ((int64_t)plain.size() - 2 * 8 + declaration_size, (int64_t)with_dictionary.size());
+}
+
+TEST(KeyDictionary, decode)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    cbe_test::string_table decoded(3, 100);
+    std::vector<std::string> events;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(decoded, NULL, encode_records(keys), 1000, &events));
+    EXPECT_EQ(join(g_declaration, g_records), events);
+    EXPECT_EQ(3, cbe_string_table_get_entry_count(decoded));
+    EXPECT_STREQ("other", cbe_string_table_get(decoded, 2, NULL));
+}
+
+TEST(KeyDictionary, decode_chunked)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    const std::vector<std::string> expected = join(g_declaration, g_records);
+    for(int chunk_size = 1; chunk_size < 8; chunk_size++)
+    {
+        cbe_test::string_table decoded(3, 100);
+        std::vector<std::string> events;
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(decoded, NULL, encode_records(keys), chunk_size, &events));
+        EXPECT_EQ(expected, events) << "chunk size " << chunk_size;
+    }
+}
+
+TEST(KeyDictionary, decode_to_symbols)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    cbe_test::string_table symbols(10, 100, {"other", "name"});
+    cbe_test::string_table decoded(3, 100);
+    std::vector<std::string> events;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(decoded, symbols, encode_records(keys), 1000, &events));
+    std::vector<std::string> expected = {"{", "_keys", "{", "id", "name", "other", "}", "}",
+                                         "{", "id", "1", "#1", "name", "#0", "2", "}",
+                                         "{", "id", "2", "#1", "name", "#0", "2", "}"};
+    EXPECT_EQ(expected, events);
+}
+
+TEST(KeyDictionary, decode_without_table)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    EXPECT_EQ(CBE_DECODE_ERROR_INVALID_KEY_REFERENCE, decode(NULL, NULL, encode_records(keys), 1000, NULL));
+
+    // Without references, the declaration is just metadata.
+    std::vector<std::string> events;
+    std::vector<uint8_t> document = encode(kd(keys));
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(NULL, NULL, document, 1000, &events));
+    EXPECT_EQ(g_declaration, events);
+}
+
+TEST(KeyDictionary, later_declaration_adds_keys)
+{
+    std::vector<uint8_t> document = {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'a', 0x7b, 0x7b,
+                                     0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'b', 0x7b, 0x7b,
+                                     0x78, 0x95, 0x01, 0x01, 0x95, 0x00, 0x02, 0x7b};
+    cbe_test::string_table decoded(2, 100);
+    std::vector<std::string> events;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(decoded, NULL, document, 1000, &events));
+    std::vector<std::string> expected = {"{", "_keys", "{", "a", "}", "}", "{", "_keys", "{", "b", "}", "}",
+                                         "{", "b", "1", "a", "2", "}"};
+    EXPECT_EQ(expected, events);
+}
+
+TEST(KeyDictionary, invalid_declaration)
+{
+    const std::vector<std::vector<uint8_t>> documents =
+    {
+        // Not a list
+        {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x01, 0x7b},
+        // Not a string
+        {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'a', 0x01, 0x7b, 0x7b},
+        // Duplicate
+        {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'a', 0x81, 'a', 0x7b, 0x7b},
+        // Too many for the table
+        {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'a', 0x81, 'b', 0x81, 'c', 0x7b, 0x7b},
+    };
+    for(const std::vector<uint8_t>& document: documents)
+    {
+        cbe_test::string_table decoded(2, 100);
+        EXPECT_EQ(CBE_DECODE_ERROR_INVALID_KEY_DICTIONARY, decode(decoded, NULL, document, 1000, NULL));
+    }
+
+    // Only the top level metadata map declares keys.
+    cbe_test::string_table decoded(2, 100);
+    std::vector<uint8_t> nested = {0x78, 0x85, '_', 'k', 'e', 'y', 's', 0x01, 0x7b};
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(decoded, NULL, nested, 1000, NULL));
+    EXPECT_EQ(0, cbe_string_table_get_entry_count(decoded));
+}
+
+TEST(KeyDictionary, invalid_reference)
+{
+    const std::vector<uint8_t> declaration = {0x7a, 0x85, '_', 'k', 'e', 'y', 's', 0x77, 0x81, 'a', 0x7b, 0x7b};
+    const std::vector<std::vector<uint8_t>> references =
+    {
+        // Undeclared
+        {0x78, 0x95, 0x01, 0x01, 0x7b},
+        // Map value
+        {0x78, 0x95, 0x00, 0x95, 0x00, 0x7b},
+        // List entry
+        {0x77, 0x95, 0x00, 0x7b},
+        // Top level
+        {0x95, 0x00},
+    };
+    for(const std::vector<uint8_t>& reference: references)
+    {
+        std::vector<uint8_t> document = declaration;
+        document.insert(document.end(), reference.begin(), reference.end());
+        cbe_test::string_table decoded(2, 100);
+        EXPECT_EQ(CBE_DECODE_ERROR_INVALID_KEY_REFERENCE, decode(decoded, NULL, document, 1000, NULL));
+    }
+}
+
+TEST(KeyDictionary, encode_invalid)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_key_dictionary(process, NULL));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, add_encoding(process, kd(keys)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, kd(keys)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, add_encoding(process, kd(keys)));
+}
+
+TEST(KeyDictionary, rollback)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, kd(keys)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, add_records(enc())));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(encode_records(NULL), buffer);
+}
+
+TEST(KeyDictionary, measure)
+{
+    cbe_test::string_table keys(10, 100, {"id", "name", "other"});
+    EXPECT_EQ((int64_t)encode_records(keys).size(), cbe_test::measure_document(add_records(kd(keys))));
+}
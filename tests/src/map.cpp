@@ -8,6 +8,8 @@ using namespace encoding;
 TEST_ENCODE_DECODE_SHRINKING(Map, size_0, 1, umap().end(), {0x78, 0x7b})
 TEST_ENCODE_DECODE_SHRINKING(Map, size_1, 1, umap().str("1").i(1).end(), {0x78, 0x81, 0x31, 0x01, 0x7b})
 TEST_ENCODE_DECODE_SHRINKING(Map, size_2, 1, umap().str("1").i(1).str("2").i(2).end(), {0x78, 0x81, 0x31, 0x01, 0x81, 0x32, 0x02, 0x7b})
+TEST_ENCODE_DECODE_DATA(Map, vlq_int_value, 99, 9, umap().str("1").i(1, 0x10000).str("2").i(2).end(), {0x78, 0x81, 0x31, 0x66, 0x84, 0x80, 0x00, 0x81, 0x32, 0x02, 0x7b})
+TEST_ENCODE_DECODE_DATA(Map, date_value,    99, 9, umap().str("1").d(2015, 1, 15).str("2").i(2).end(), {0x78, 0x81, 0x31, 0x99, 0x2f, 0x00, 0x1e, 0x81, 0x32, 0x02, 0x7b})
 
 TEST_ENCODE_DECODE_STATUS(Map, unterminated,   99, 9, CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, CBE_DECODE_ERROR_UNBALANCED_CONTAINERS, umap())
 TEST_ENCODE_DECODE_STATUS(Map, unterminated_2, 99, 9, CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, CBE_DECODE_ERROR_UNBALANCED_CONTAINERS, umap().f(0.1, 0).i(1))
@@ -48,6 +50,7 @@ TEST_DECODE_STATUS(Map, decode_missing_value_i32,         99, 9, true, CBE_DECOD
 TEST_DECODE_STATUS(Map, decode_missing_value_i64,         99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x6e, 0xff, 0xff, 0xff, 0xff, 0x0f, 0x00, 0x00, 0x00, 0x7b})
 // TEST_DECODE_STATUS(Map, decode_missing_value_i128,        99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x6e, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7b})
 TEST_DECODE_STATUS(Map, decode_missing_value_f32,         99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x70, 0xcd, 0xcc, 0xcc, 0x3d, 0x7b})
+TEST_DECODE_STATUS(Map, decode_missing_value_vlq,         99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x66, 0x84, 0x80, 0x00, 0x7b})
 TEST_DECODE_STATUS(Map, decode_missing_value_f64,         99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x71, 0x51, 0xda, 0x1b, 0x7c, 0x61, 0x32, 0xf0, 0x3f, 0x7b})
 // TEST_DECODE_STATUS(Map, decode_missing_value_f128,        99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x74, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x5e, 0x0c, 0xe5, 0x44, 0xbb, 0x0a, 0x29, 0x03, 0xff, 0x3f, 0x7b})
 // TEST_DECODE_STATUS(Map, decode_missing_value_d32,         99, 9, true, CBE_DECODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, {0x78, 0x75, 0x01, 0x00, 0x00, 0x32, 0x7b})
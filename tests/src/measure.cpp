@@ -0,0 +1,60 @@
+#include "helpers/test_helpers.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static enc sample_document()
+{
+    enc document = umap();
+    for(int i = 0; i < 200; i++)
+    {
+        document.u((uint64_t)i * 1000003).f(i * 0.1, 0);
+    }
+    return document
+        .str("long").str(std::string(3000, 's'))
+        .str("bytes").bin(std::vector<uint8_t>(5000, 0x12))
+        .str("decimal").f(1.23456789, 9)
+        .str("date").d(2020, 1, 15)
+        .str("uri").uri("http://example.com")
+        .pad(500)
+        .str("lists").list()
+            .com("a comment")
+            .ilist({1, -1000, 100000000, 0x7fffffffffffLL})
+            .flist({1.5, 0.1})
+            .end()
+        .end();
+}
+
+TEST(Measure, matches_encoded_size)
+{
+    EXPECT_EQ((int64_t)cbe_test::encode_document(sample_document()).size(), cbe_test::measure_document(sample_document()));
+}
+
+TEST(Measure, streamed_array)
+{
+    enc document = strh(1000);
+    for(int i = 0; i < 10; i++)
+    {
+        document.data(std::vector<uint8_t>(100, 'x'));
+    }
+    EXPECT_EQ((int64_t)cbe_test::encode_document(document).size(), cbe_test::measure_document(document));
+}
+
+TEST(Measure, same_errors)
+{
+    cbe_test::measure_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_measure(process, 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, add_encoding(process, end()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARRAY_DATA, add_encoding(process, str(std::string(500, 'a') + "\xff")));
+}
+
+TEST(Measure, not_measuring)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(-1, cbe_encode_get_measured_byte_count(process));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_begin_measure(NULL, 0));
+}
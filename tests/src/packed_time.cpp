@@ -0,0 +1,42 @@
+#include "helpers/test_helpers.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(PackedTime, nanotime, 0,
+    nt(nanotime_new(2020, 8, 30, 15, 33, 14, 19577323)),
+    ts(2020, 8, 30, 15, 33, 14, 19577323))
+TEST_ENCODE_DECODE_SHRINKING_EQUIVALENT(PackedTime, smalltime, 0,
+    st(smalltime_new(1985, 10, 26, 1, 22, 16, 123456)),
+    ts(1985, 10, 26, 1, 22, 16, 123456000))
+
+TEST(PackedTime, in_map)
+{
+    const int largest_value_size = cbe_test::encode_document(ts(2020, 8, 30, 15, 33, 14, 19577323)).size();
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(largest_value_size,
+        umap().str("when").nt(nanotime_new(2020, 8, 30, 15, 33, 14, 19577323)).end(),
+        umap().str("when").ts(2020, 8, 30, 15, 33, 14, 19577323).end(),
+        cbe_test::encode_document(umap().str("when").ts(2020, 8, 30, 15, 33, 14, 19577323).end()));
+}
+
+TEST_STOP_IN_CALLBACK(PackedTime, stop_in_callback, nt(nanotime_new(2020, 8, 30, 15, 33, 14, 19577323)))
+
+static bool on_nanotime(struct cbe_decode_process* process, nanotime value)
+{
+    *(nanotime*)cbe_decode_get_user_context(process) = value;
+    return true;
+}
+
+TEST(PackedTime, decode_nanotime)
+{
+    nanotime expected = nanotime_new(2020, 8, 30, 15, 33, 14, 19577323);
+    const std::vector<uint8_t> document = cbe_test::encode_document(nt(expected));
+
+    cbe_decode_callbacks callbacks = {};
+    callbacks.on_nanotime = on_nanotime;
+    nanotime actual = 0;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode(&callbacks, &actual, document.data(), document.size(), 0));
+    EXPECT_EQ(expected, actual);
+}
@@ -0,0 +1,134 @@
+#include "helpers/test_helpers.h"
+#include <unistd.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+using cbe_test::gather_segments;
+using cbe_test::read_file;
+
+static enc sample_document()
+{
+    enc document = list();
+    for(int i = 0; i < 500; i++)
+    {
+        document.u((uint64_t)i * 100003);
+    }
+    return document
+        .str(std::string(3000, 'x'))
+        .t(8, 30, 0, 0, "Europe/Berlin")
+        .end();
+}
+
+TEST(PagePool, continues_onto_next_page)
+{
+    cbe_test::page_pool pool(100, 256);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, sample_document()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_GT(cbe_encode_get_segment_count(process), 10);
+    EXPECT_EQ(cbe_test::encode_document(sample_document()), gather_segments(process));
+}
+
+TEST(PagePool, flush_when_pool_is_exhausted)
+{
+    cbe_test::page_pool pool(16, 256);
+    cbe_test::encode_process process;
+    FILE* file = tmpfile();
+    ASSERT_NE(nullptr, file);
+
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    int flush_count = 0;
+    for(const auto& v: sample_document().values)
+    {
+        const enc value = enc().add(v);
+        cbe_encode_status status = add_encoding(process, value);
+        if(status == CBE_ENCODE_STATUS_NEED_MORE_ROOM)
+        {
+            ASSERT_GT(cbe_encode_flush_pages(process, fileno(file)), 0);
+            flush_count++;
+            status = add_encoding(process, value);
+        }
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, status);
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    ASSERT_GE(cbe_encode_flush_pages(process, fileno(file)), 0);
+    EXPECT_GT(flush_count, 0);
+    EXPECT_EQ(cbe_test::encode_document(sample_document()), read_file(file));
+    fclose(file);
+}
+
+TEST(PagePool, references_large_payloads)
+{
+    const enc document = list()
+        .bin(std::vector<uint8_t>(3000, 0xaa))
+        .i(5)
+        .str(std::string(3000, 't'))
+        .bin(std::vector<uint8_t>(10, 0xaa))
+        .end();
+    const std::vector<uint8_t> expected = cbe_test::encode_document(document);
+    cbe_test::page_pool pool(2, 64, 4);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    cbe_encode_set_reference_threshold(process, 1000);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+
+    // header, blob, int + header, text, small bytes + end
+    ASSERT_EQ(5, cbe_encode_get_segment_count(process));
+    int64_t byte_count = 0;
+    EXPECT_EQ(document.values[1].bin.data(), cbe_encode_get_segment(process, 1, &byte_count));
+    EXPECT_EQ(3000, byte_count);
+    EXPECT_EQ((const uint8_t*)document.values[3].str.data(), cbe_encode_get_segment(process, 3, &byte_count));
+    EXPECT_EQ(expected, gather_segments(process));
+
+    FILE* file = tmpfile();
+    ASSERT_NE(nullptr, file);
+    EXPECT_EQ((int64_t)expected.size(), cbe_encode_flush_pages(process, fileno(file)));
+    EXPECT_EQ(expected, read_file(file));
+    EXPECT_EQ(0, cbe_encode_get_segment_count(process));
+    fclose(file);
+}
+
+TEST(PagePool, copies_when_references_are_used_up)
+{
+    const std::vector<uint8_t> blob(500, 0x55);
+    const enc document = list().bin(blob).bin(blob).end();
+    cbe_test::page_pool pool(8, 256, 1);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    cbe_encode_set_reference_threshold(process, 100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, document));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ(cbe_test::encode_document(document), gather_segments(process));
+}
+
+TEST(PagePool, referenced_string_is_validated)
+{
+    const std::string text = std::string(2000, 'a') + "\xff";
+    cbe_test::page_pool pool(2, 64, 4);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    cbe_encode_set_reference_threshold(process, 1000);
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARRAY_DATA, add_encoding(process, str(text)));
+}
+
+TEST(PagePool, object_larger_than_page)
+{
+    cbe_test::page_pool pool(4, 64);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, list().pad(100)));
+    EXPECT_EQ(1, cbe_encode_get_segment_count(process));
+}
+
+TEST(PagePool, invalid)
+{
+    EXPECT_EQ(0, cbe_page_pool_size(0, 100, 0));
+    EXPECT_EQ(0, cbe_page_pool_size(10, 0, 0));
+    EXPECT_EQ(0, cbe_page_pool_size(10, 100, -1));
+    cbe_test::encode_process process;
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_begin_paged(process, NULL, 0));
+}
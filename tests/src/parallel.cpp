@@ -0,0 +1,161 @@
+#include "helpers/test_helpers.h"
+#include <unistd.h>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static enc row_document(int64_t index)
+{
+    return umap()
+        .str("id").u(index * 1000)
+        .str("name").str("row " + std::to_string(index))
+        .end();
+}
+
+static cbe_encode_status encode_rows(cbe_encode_process* process, int64_t first_index, int64_t element_count, void* context)
+{
+    (void)context;
+    for(int64_t i = first_index; i < first_index + element_count; i++)
+    {
+        cbe_encode_status status = add_encoding(process, row_document(i));
+        if(status != CBE_ENCODE_STATUS_OK)
+        {
+            return status;
+        }
+    }
+    return CBE_ENCODE_STATUS_OK;
+}
+
+class Shards
+{
+public:
+    Shards(int shard_count, int page_count = 16, int64_t page_size = 1024)
+    {
+        processes.reserve(shard_count);
+        pools.reserve(shard_count);
+        for(int i = 0; i < shard_count; i++)
+        {
+            processes.emplace_back();
+            pools.emplace_back(page_count, page_size);
+            shards.push_back({processes[i], pools[i]});
+        }
+    }
+
+    const cbe_encode_shard* get() const
+    {
+        return shards.data();
+    }
+
+    int size() const
+    {
+        return shards.size();
+    }
+
+private:
+    std::vector<cbe_test::encode_process> processes;
+    std::vector<cbe_test::page_pool> pools;
+    std::vector<cbe_encode_shard> shards;
+};
+
+// The rows encoded one after the other by a single process.
+static enc rows_document(int64_t row_count, bool is_in_list)
+{
+    enc document;
+    if(is_in_list)
+    {
+        document.list();
+    }
+    for(int64_t i = 0; i < row_count; i++)
+    {
+        for(const value& v: row_document(i).values)
+        {
+            document.values.push_back(v);
+        }
+    }
+    if(is_in_list)
+    {
+        document.end();
+    }
+    return document;
+}
+
+static void assert_parallel_matches_serial(int64_t row_count, int shard_count, int64_t batch_size, bool is_in_list)
+{
+    Shards shards(shard_count);
+    FILE* output = tmpfile();
+    ASSERT_NE(nullptr, output);
+
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    if(is_in_list)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_parallel(process, row_count, batch_size, encode_rows, NULL,
+                                                            shards.get(), shards.size(), fileno(output)));
+    if(is_in_list)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    ASSERT_EQ((ssize_t)cbe_encode_get_buffer_offset(process),
+              write(fileno(output), buffer.data(), cbe_encode_get_buffer_offset(process)));
+
+    EXPECT_EQ(cbe_test::encode_document(rows_document(row_count, is_in_list)), cbe_test::read_file(output));
+    fclose(output);
+}
+
+TEST(Parallel, list) { assert_parallel_matches_serial(10000, 4, 200, true); }
+TEST(Parallel, top_level) { assert_parallel_matches_serial(1001, 3, 50, false); }
+TEST(Parallel, fewer_rows_than_shards) { assert_parallel_matches_serial(2, 8, 10, true); }
+TEST(Parallel, no_rows) { assert_parallel_matches_serial(0, 2, 10, true); }
+
+static cbe_encode_status encode_unbalanced(cbe_encode_process* process, int64_t first_index, int64_t element_count, void* context)
+{
+    (void)first_index;
+    (void)element_count;
+    (void)context;
+    return add_encoding(process, list());
+}
+
+static cbe_encode_status close_parent(cbe_encode_process* process, int64_t first_index, int64_t element_count, void* context)
+{
+    (void)first_index;
+    (void)element_count;
+    (void)context;
+    return add_encoding(process, end());
+}
+
+TEST(Parallel, errors)
+{
+    Shards shards(2, 1, 64);
+    FILE* output = tmpfile();
+    ASSERT_NE(nullptr, output);
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, cbe_encode_add_parallel(process, 100, 10, encode_rows, NULL,
+                                                                        shards.get(), shards.size(), fileno(output)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, cbe_encode_add_parallel(process, 10, 1, encode_unbalanced, NULL,
+                                                                              shards.get(), shards.size(), fileno(output)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, cbe_encode_add_parallel(process, 10, 1, close_parent, NULL,
+                                                                              shards.get(), shards.size(), fileno(output)));
+    fclose(output);
+}
+
+TEST(Parallel, invalid)
+{
+    Shards shards(1);
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_parallel(process, 10, 0, encode_rows, NULL, shards.get(), 1, 1));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_parallel(process, 10, 1, encode_rows, NULL, shards.get(), 0, 1));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_parallel(process, 10, 1, encode_rows, NULL, shards.get(), 1, 1));
+}
@@ -0,0 +1,100 @@
+#include "helpers/test_helpers.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static const enc key_and_map = str("settings").umap().u(1).f(1.5, 0).end();
+
+// A map with the middle part surrounded by other entries.
+static enc document_around(const enc& middle)
+{
+    enc document = umap().u(10).b(true);
+    for(const value& v: middle.values)
+    {
+        document.add(v);
+    }
+    return document.u(11).b(false).end();
+}
+
+TEST(RawFragment, key_and_value_in_map)
+{
+    const cbe_test::fragment fragment(key_and_map);
+    const enc expected = document_around(key_and_map);
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(fragment.byte_count(),
+                                                              document_around(raw(fragment)),
+                                                              expected,
+                                                              cbe_test::encode_document(expected));
+}
+
+TEST(RawFragment, value_in_map)
+{
+    const cbe_test::fragment fragment(list().end());
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INCORRECT_MAP_KEY_TYPE, add_encoding(process, raw(fragment)));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, u(1)));
+    EXPECT_EQ(CBE_ENCODE_ERROR_MAP_MISSING_VALUE_FOR_KEY, add_encoding(process, end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, raw(fragment).end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(std::vector<uint8_t>({0x78, 0x01, 0x77, 0x7b, 0x7b}), buffer);
+}
+
+TEST(RawFragment, max_depth)
+{
+    const cbe_test::fragment fragment(list().list().end().end());
+    cbe_test::encode_process process(3);
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 3));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, raw(fragment).list()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_MAX_CONTAINER_DEPTH_EXCEEDED, add_encoding(process, raw(fragment)));
+}
+
+TEST(RawFragment, not_enough_room_adds_nothing)
+{
+    const cbe_test::fragment fragment(key_and_map);
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(fragment.byte_count() + 1);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, list().u(1).raw(fragment)));
+    EXPECT_EQ(2, cbe_encode_get_buffer_offset(process));
+}
+
+TEST(RawFragment, across_pages)
+{
+    const cbe_test::fragment fragment(key_and_map);
+    enc expected = list();
+    enc by_fragment = list();
+    for(int i = 0; i < 10; i++)
+    {
+        for(const value& v: key_and_map.values)
+        {
+            expected.add(v);
+        }
+        by_fragment.raw(fragment);
+    }
+
+    cbe_test::page_pool pool(20, 16);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, by_fragment.end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ(cbe_test::encode_document(expected.end()), cbe_test::gather_segments(process));
+}
+
+TEST(RawFragment, invalid)
+{
+    cbe_test::measure_process process;
+    std::vector<uint8_t> buffer(100);
+    cbe_fragment fragment;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_raw(process, NULL));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, cbe_encode_get_fragment(process, &fragment));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_measure(process, 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_get_fragment(process, &fragment));
+}
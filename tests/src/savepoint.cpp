@@ -0,0 +1,199 @@
+#include "helpers/test_helpers.h"
+#include <cstdlib>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static enc good_record(int id)
+{
+    enc record = u(id).umap()
+        .str("name").str("a fairly long name value")
+        .str("values").list();
+    for(int i = 0; i < 20; i++)
+    {
+        record.u(i * 100003);
+    }
+    return record.end().end();
+}
+
+// Fails part way through a nested map.
+static const enc bad_record = u(99).umap()
+    .str("nested").list()
+    .u(1000000)
+    .strh(10).data({0xff});
+
+// A map of good records, which is what every batch should encode to.
+static enc batch_document()
+{
+    enc document = umap();
+    for(int i = 0; i < 10; i++)
+    {
+        for(const value& v: good_record(i).values)
+        {
+            document.add(v);
+        }
+    }
+    return document.end();
+}
+
+// Encodes a map of good records, rolling back a bad record after every good one.
+static void encode_batch(cbe_encode_process* process, bool include_bad_records)
+{
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap()));
+    for(int i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, good_record(i)));
+        if(include_bad_records)
+        {
+            struct cbe_savepoint savepoint;
+            ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+            ASSERT_EQ(CBE_ENCODE_ERROR_INVALID_ARRAY_DATA, add_encoding(process, bad_record));
+            ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+        }
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+}
+
+static void* test_realloc(void* context, void* buffer, size_t byte_count)
+{
+    (void)context;
+    return realloc(buffer, byte_count);
+}
+
+TEST(Savepoint, drop_bad_records)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(10000);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    encode_batch(process, true);
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(cbe_test::encode_document(batch_document()), buffer);
+}
+
+TEST(Savepoint, growable)
+{
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_growable(process, 0, test_realloc, NULL, 0));
+    encode_batch(process, true);
+    int64_t byte_count = 0;
+    uint8_t* buffer = cbe_encode_take_buffer(process, &byte_count);
+    EXPECT_EQ(cbe_test::encode_document(batch_document()), std::vector<uint8_t>(buffer, buffer + byte_count));
+    free(buffer);
+}
+
+TEST(Savepoint, paged)
+{
+    cbe_test::page_pool pool(100, 64);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    encode_batch(process, true);
+    EXPECT_EQ(cbe_test::encode_document(batch_document()), cbe_test::gather_segments(process));
+}
+
+TEST(Savepoint, inside_array)
+{
+    const uint8_t data[] = {'a', 'b', 'c', 'd', 'e', 'f'};
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_string_begin(process, 6));
+    int64_t byte_count = 3;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_data(process, data, &byte_count));
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_data(process, data, &byte_count));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INCOMPLETE_ARRAY_FIELD, cbe_encode_end(process));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_data(process, data + 3, &byte_count));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(std::vector<uint8_t>({0x86, 'a', 'b', 'c', 'd', 'e', 'f'}), buffer);
+}
+
+TEST(Savepoint, failed_add_string_leaves_no_trace)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARRAY_DATA, add_encoding(process, str("abc\xff")));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, str("k").u(1).end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(std::vector<uint8_t>({0x78, 0x81, 'k', 0x01, 0x7b}), buffer);
+}
+
+TEST(Savepoint, expired_by_new_buffer)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_buffer(process, buffer.data(), buffer.size()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_rollback(process, &savepoint));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_savepoint(process, NULL));
+}
+
+TEST(Savepoint, restores_fragment_state)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, u(1)));
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list().list().end().end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+
+    struct cbe_fragment fragment;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_get_fragment(process, &fragment));
+    EXPECT_EQ(1, fragment.byte_count);
+    EXPECT_EQ(0, fragment.container_depth);
+    EXPECT_TRUE(fragment.has_odd_object_count);
+    EXPECT_EQ(0, fragment.unkeyable_positions);
+}
+
+TEST(Savepoint, restores_closed_containers)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap().str("k").list()));
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end().end().list()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INCORRECT_MAP_KEY_TYPE, add_encoding(process, list()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    buffer.resize(cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(std::vector<uint8_t>({0x78, 0x81, 'k', 0x77, 0x7b, 0x7b}), buffer);
+}
+
+TEST(Savepoint, too_many_closed_containers)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    for(int i = 0; i < 70; i++)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    }
+    struct cbe_savepoint savepoint;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_savepoint(process, &savepoint));
+    for(int i = 0; i < 65; i++)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    }
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_rollback(process, &savepoint));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_rollback(process, &savepoint));
+}
@@ -0,0 +1,165 @@
+#include "helpers/test_helpers.h"
+#include "spec_examples_schema.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+#define ENCODE_SPECIALIZED(TYPE, VALUE) \
+    [](const TYPE& value) \
+    { \
+        std::vector<uint8_t> buffer(TYPE ## _max_encoded_size(&value)); \
+        int64_t byte_count = TYPE ## _encode(&value, buffer.data(), buffer.size()); \
+        EXPECT_GT(byte_count, 0); \
+        buffer.resize(byte_count); \
+        return buffer; \
+    }(VALUE)
+
+TEST(SchemaCompiler, spec_list)
+{
+    spec_list_values value = {1, 5000};
+    std::vector<uint8_t> expected = {0x77, 0x01, 0x6a, 0x88, 0x13, 0x7b};
+    std::vector<uint8_t> actual = ENCODE_SPECIALIZED(spec_list_values, value);
+    EXPECT_EQ(expected, actual);
+
+    spec_list_values decoded = {0, 0};
+    EXPECT_TRUE(spec_list_values_decode_fast(actual.data(), actual.size(), &decoded));
+    EXPECT_EQ(1, decoded.first);
+    EXPECT_EQ(5000, decoded.second);
+}
+
+TEST(SchemaCompiler, spec_umap)
+{
+    spec_umap value = {1, 2};
+    std::vector<uint8_t> expected = {0x78, 0x81, 0x61, 0x01, 0x81, 0x62, 0x02, 0x7b};
+    std::vector<uint8_t> actual = ENCODE_SPECIALIZED(spec_umap, value);
+    EXPECT_EQ(expected, actual);
+
+    spec_umap decoded = {0, 0};
+    EXPECT_TRUE(spec_umap_decode_fast(actual.data(), actual.size(), &decoded));
+    EXPECT_EQ(1, decoded.a);
+    EXPECT_EQ(2, decoded.b);
+}
+
+TEST(SchemaCompiler, spec_omap)
+{
+    spec_omap value = {1, 2};
+    std::vector<uint8_t> expected = {0x79, 0x81, 0x61, 0x01, 0x81, 0x62, 0x02, 0x7b};
+    std::vector<uint8_t> actual = ENCODE_SPECIALIZED(spec_omap, value);
+    EXPECT_EQ(expected, actual);
+
+    spec_omap decoded = {0, 0};
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, spec_omap_decode(actual.data(), actual.size(), &decoded));
+    EXPECT_EQ(1, decoded.a);
+    EXPECT_EQ(2, decoded.b);
+}
+
+TEST(SchemaCompiler, integer_widths_match_generic_encoder)
+{
+    const int64_t values[] =
+    {
+        0, 100, -100, 101, -101, 255, -255, 256, 65535, -65536, 0x1fffff, 0x200000,
+        0xffffffffLL, -0x100000000LL, 0x1ffffffffffffLL, 0x2000000000000LL, INT64_MAX, INT64_MIN,
+    };
+    for(int64_t first: values)
+    {
+        spec_list_values value = {first, -first / 3};
+        auto expected = cbe_test::encode_document(list().i(value.first).i(value.second).end());
+        auto actual = ENCODE_SPECIALIZED(spec_list_values, value);
+        EXPECT_EQ(expected, actual) << "value " << first;
+
+        spec_list_values decoded = {0, 0};
+        EXPECT_TRUE(spec_list_values_decode_fast(actual.data(), actual.size(), &decoded)) << "value " << first;
+        EXPECT_EQ(value.first, decoded.first);
+        EXPECT_EQ(value.second, decoded.second);
+    }
+}
+
+TEST(SchemaCompiler, nested_record)
+{
+    const uint8_t raw[] = {1, 2, 3};
+    const std::string label = "Rödelstraße";
+    for(double number: {0.5, 0.1})
+    {
+        spec_reading value = {};
+        value.id = 100000;
+        value.value = number;
+        value.is_valid = true;
+        value.label = label.data();
+        value.label_length = label.size();
+        value.raw = raw;
+        value.raw_length = sizeof(raw);
+        value.position_in_the_room.first = -5;
+        value.position_in_the_room.second = 70000;
+        value.offset = -1;
+
+        auto expected = cbe_test::encode_document(umap()
+            .str("id").u(value.id)
+            .str("value").f(value.value, 0)
+            .str("is_valid").b(value.is_valid)
+            .str("label").str(label)
+            .str("raw").bin(std::vector<uint8_t>(raw, raw + sizeof(raw)))
+            .str("position_in_the_room").list().i(value.position_in_the_room.first).i(value.position_in_the_room.second).end()
+            .str("offset").i(value.offset)
+            .end());
+        auto actual = ENCODE_SPECIALIZED(spec_reading, value);
+        EXPECT_EQ(expected, actual);
+
+        spec_reading decoded = {};
+        EXPECT_TRUE(spec_reading_decode_fast(actual.data(), actual.size(), &decoded));
+        EXPECT_EQ(value.id, decoded.id);
+        EXPECT_EQ(value.value, decoded.value);
+        EXPECT_EQ(value.is_valid, decoded.is_valid);
+        EXPECT_EQ(label, std::string(decoded.label, decoded.label_length));
+        EXPECT_EQ(std::vector<uint8_t>(raw, raw + sizeof(raw)), std::vector<uint8_t>(decoded.raw, decoded.raw + decoded.raw_length));
+        EXPECT_EQ(value.position_in_the_room.first, decoded.position_in_the_room.first);
+        EXPECT_EQ(value.position_in_the_room.second, decoded.position_in_the_room.second);
+        EXPECT_EQ(value.offset, decoded.offset);
+    }
+}
+
+TEST(SchemaCompiler, buffer_too_small)
+{
+    spec_umap value = {1, 2};
+    std::vector<uint8_t> buffer(spec_umap_max_encoded_size(&value) - 1);
+    EXPECT_EQ(-1, spec_umap_encode(&value, buffer.data(), buffer.size()));
+}
+
+TEST(SchemaCompiler, fallback_reordered_keys)
+{
+    auto document = cbe_test::encode_document(umap().str("b").i(2).str("a").i(-1).end());
+
+    spec_umap decoded = {0, 0};
+    EXPECT_FALSE(spec_umap_decode_fast(document.data(), document.size(), &decoded));
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, spec_umap_decode(document.data(), document.size(), &decoded));
+    EXPECT_EQ(-1, decoded.a);
+    EXPECT_EQ(2, decoded.b);
+}
+
+TEST(SchemaCompiler, fallback_nested)
+{
+    auto document = cbe_test::encode_document(umap()
+        .str("unknown").str("ignored")
+        .str("position_in_the_room").list().i(10).i(-20).end()
+        .pad(2)
+        .str("value").i(7)
+        .str("label").str("xyz")
+        .end());
+
+    spec_reading decoded = {};
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, spec_reading_decode(document.data(), document.size(), &decoded));
+    EXPECT_EQ(10, decoded.position_in_the_room.first);
+    EXPECT_EQ(-20, decoded.position_in_the_room.second);
+    EXPECT_EQ(7.0, decoded.value);
+    EXPECT_EQ("xyz", std::string(decoded.label, decoded.label_length));
+    EXPECT_EQ(0u, decoded.id);
+}
+
+TEST(SchemaCompiler, fallback_wrong_type)
+{
+    auto document = cbe_test::encode_document(umap().str("a").str("not an int").str("b").i(2).end());
+
+    spec_umap decoded = {0, 0};
+    EXPECT_EQ(CBE_DECODE_STATUS_STOPPED_IN_CALLBACK, spec_umap_decode(document.data(), document.size(), &decoded));
+}
@@ -0,0 +1,119 @@
+#include "helpers/test_helpers.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+#include <memory>
+
+using namespace encoding;
+
+// Feeds the document in chunks the way a network receiver would: any bytes
+// the decoder didn't consume are carried over to the front of the next chunk.
+static enc decode_in_chunks(const std::vector<uint8_t>& data, int chunk_size, int& resume_count)
+{
+    decoder decoder(9, true);
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decoder.begin());
+    std::vector<uint8_t> pending;
+    cbe_decode_status status = CBE_DECODE_STATUS_OK;
+    resume_count = 0;
+    for(size_t offset = 0; offset < data.size(); offset += chunk_size)
+    {
+        const size_t end = std::min(offset + chunk_size, data.size());
+        pending.insert(pending.end(), data.begin() + offset, data.begin() + end);
+        int64_t bytes_consumed = 0;
+        status = decoder.feed(pending, bytes_consumed);
+        EXPECT_TRUE(status == CBE_DECODE_STATUS_OK || status == CBE_DECODE_STATUS_NEED_MORE_DATA)
+            << "status " << status << " at chunk size " << chunk_size;
+        resume_count += status == CBE_DECODE_STATUS_NEED_MORE_DATA;
+        pending.erase(pending.begin(), pending.begin() + bytes_consumed);
+    }
+    EXPECT_TRUE(pending.empty());
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decoder.end());
+    return decoder.decoded();
+}
+
+TEST(Streaming, incomplete_scalars_are_not_consumed)
+{
+    const enc document = umap()
+        .str("i16").i(1000)
+        .str("i32").i(100000000)
+        .str("i64").i(1, 0x1000000000000000L)
+        .str("vlq").i(-1, 0x10000)
+        .str("f64").f(1.0123, 0)
+        .str("date").d(2015, 1, 15)
+        .str("list").list().i(-1000).str("a longer string value").end()
+        .end();
+    const std::vector<uint8_t> data = cbe_test::encode_document(document);
+
+    for(int chunk_size = 1; chunk_size <= (int)data.size(); chunk_size++)
+    {
+        int resume_count = 0;
+        EXPECT_EQ(document, decode_in_chunks(data, chunk_size, resume_count)) << "chunk size " << chunk_size;
+    }
+}
+
+TEST(Streaming, whole_document_needs_no_resume)
+{
+    const enc document = list().i(100000000).str("abc").end();
+    const std::vector<uint8_t> data = cbe_test::encode_document(document);
+    int resume_count = 0;
+    EXPECT_EQ(document, decode_in_chunks(data, data.size(), resume_count));
+    EXPECT_EQ(0, resume_count);
+}
+
+TEST(Streaming, stream_offset_counts_each_byte_once)
+{
+    const std::vector<uint8_t> data = cbe_test::encode_document(list().str("a string split over two feeds").i(100000000).end());
+    const size_t split = data.size() / 2;
+    decoder decoder(9, true);
+    ASSERT_EQ(CBE_DECODE_STATUS_OK, decoder.begin());
+    int64_t bytes_consumed = 0;
+    EXPECT_EQ(CBE_DECODE_STATUS_NEED_MORE_DATA, decoder.feed(std::vector<uint8_t>(data.begin(), data.begin() + split), bytes_consumed));
+    EXPECT_EQ(bytes_consumed, decoder.stream_offset());
+    const std::vector<uint8_t> rest(data.begin() + bytes_consumed, data.end());
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decoder.feed(rest, bytes_consumed));
+    EXPECT_EQ((int64_t)data.size(), decoder.stream_offset());
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decoder.end());
+}
+
+TEST(Streaming, end_after_fed_byte_count_is_gone)
+{
+    std::vector<uint8_t> data = cbe_test::encode_document(list().i(1).str("abc").end());
+    data.pop_back();
+    decoder decoder(9, true);
+    ASSERT_EQ(CBE_DECODE_STATUS_OK, decoder.begin());
+    std::unique_ptr<int64_t> bytes_consumed(new int64_t(0));
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decoder.feed(data, *bytes_consumed));
+    EXPECT_EQ((int64_t)data.size(), *bytes_consumed);
+    bytes_consumed.reset();
+    EXPECT_EQ(CBE_DECODE_ERROR_UNBALANCED_CONTAINERS, decoder.end());
+    EXPECT_EQ((int64_t)data.size(), decoder.stream_offset());
+}
+
+TEST(Streaming, utf8_split_across_chunks)
+{
+    const enc document = list().str("\xe4\xb8\x96\xe7\x95\x8c \xf0\x9f\x98\x80 \xc3\xa9t\xc3\xa9").end();
+    const std::vector<uint8_t> data = cbe_test::encode_document(document);
+
+    for(int chunk_size = 1; chunk_size <= (int)data.size(); chunk_size++)
+    {
+        int resume_count = 0;
+        EXPECT_EQ(document, decode_in_chunks(data, chunk_size, resume_count)) << "chunk size " << chunk_size;
+    }
+}
+
+TEST(Streaming, encode_utf8_split_across_add_data)
+{
+    const std::vector<uint8_t> value = {0xe4, 0xb8, 0x96, 0xf0, 0x9f, 0x98, 0x80};
+    cbe_test::encode_process process(9);
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 9));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_string_begin(process, value.size()));
+    for(size_t i = 0; i < value.size(); i++)
+    {
+        int64_t byte_count = 1;
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_data(process, &value[i], &byte_count)) << "byte " << i;
+        ASSERT_EQ(1, byte_count);
+    }
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+}
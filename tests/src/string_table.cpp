@@ -0,0 +1,297 @@
+#include "helpers/test_helpers.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+using cbe_test::string_table;
+
+struct decoded_timezone
+{
+    int id = -100;
+    std::string name;
+};
+
+static bool on_time_tz(struct cbe_decode_process* process, int, int, int, int, const char* timezone)
+{
+    ((decoded_timezone*)cbe_decode_get_user_context(process))->name = timezone;
+    return true;
+}
+
+static bool on_time_tzid(struct cbe_decode_process* process, int, int, int, int, int timezone_id, const char* timezone)
+{
+    decoded_timezone* result = (decoded_timezone*)cbe_decode_get_user_context(process);
+    result->id = timezone_id;
+    result->name = timezone;
+    return true;
+}
+
+static bool on_timestamp_tzid(struct cbe_decode_process* process, int, int, int, int, int, int, int, int timezone_id, const char* timezone)
+{
+    decoded_timezone* result = (decoded_timezone*)cbe_decode_get_user_context(process);
+    result->id = timezone_id;
+    result->name = timezone;
+    return true;
+}
+
+static decoded_timezone decode_timezone(const cbe_string_table* timezone_table,
+                                        const std::vector<uint8_t>& document,
+                                        cbe_decode_status expected_status = CBE_DECODE_STATUS_OK)
+{
+    cbe_decode_callbacks callbacks = {};
+    callbacks.on_time_tz = on_time_tz;
+    callbacks.on_time_tzid = on_time_tzid;
+    callbacks.on_timestamp_tzid = on_timestamp_tzid;
+    decoded_timezone result;
+
+    cbe_test::decode_process process;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode_begin(process, &callbacks, &result, 0));
+    cbe_decode_set_timezone_table(process, timezone_table);
+    int64_t byte_count = document.size();
+    EXPECT_EQ(expected_status, cbe_decode_feed(process, document.data(), &byte_count));
+    if(expected_status == CBE_DECODE_STATUS_OK)
+    {
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode_end(process));
+    }
+    return result;
+}
+
+TEST(StringTable, add_find_get)
+{
+    string_table table(4, 100);
+    EXPECT_EQ(0, table.add("Europe/Berlin"));
+    EXPECT_EQ(1, table.add("America/Vancouver"));
+    EXPECT_EQ(0, table.add("Europe/Berlin"));
+    EXPECT_EQ(2, cbe_string_table_get_entry_count(table));
+
+    EXPECT_EQ(1, table.find("America/Vancouver"));
+    EXPECT_EQ(-1, table.find("America/Vancouve"));
+    EXPECT_EQ(-1, table.find("Asia/Tokyo"));
+
+    int64_t byte_count = 0;
+    EXPECT_STREQ("America/Vancouver", cbe_string_table_get(table, 1, &byte_count));
+    EXPECT_EQ(17, byte_count);
+    EXPECT_EQ(NULL, cbe_string_table_get(table, 2, &byte_count));
+}
+
+TEST(StringTable, full)
+{
+    string_table table(2, 10);
+    EXPECT_EQ(-1, table.add("Europe/Berlin"));
+    EXPECT_EQ(0, table.add("UTC"));
+    EXPECT_EQ(1, table.add("Etc/GMT"));
+    EXPECT_EQ(-1, table.add("E"));
+}
+
+TEST(StringTable, many)
+{
+    string_table table(1000, 10000);
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_EQ(i, table.add(std::to_string(i)));
+    }
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_EQ(i, table.find(std::to_string(i)));
+    }
+}
+
+// A value with a timezone ID is its type, the ID, then the value encoded without a timezone.
+static std::vector<uint8_t> with_timezone_id(uint8_t type, uint8_t timezone_id, const enc& zoneless)
+{
+    std::vector<uint8_t> document = cbe_test::encode_document(zoneless);
+    document[0] = type;
+    document.insert(document.begin() + 1, timezone_id);
+    return document;
+}
+
+TEST(StringTable, encode_time_tzid)
+{
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(0,
+        tid(23, 14, 43, 1000000, "Europe/Berlin"),
+        t(23, 14, 43, 1000000, "Europe/Berlin"),
+        with_timezone_id(0x96, 0, t(23, 14, 43, 1000000)));
+}
+
+TEST(StringTable, encode_timestamp_tzid)
+{
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(0,
+        tsid(2020, 8, 30, 15, 33, 14, 19577323, "America/Vancouver"),
+        ts(2020, 8, 30, 15, 33, 14, 19577323, "America/Vancouver"),
+        with_timezone_id(0x97, 1, ts(2020, 8, 30, 15, 33, 14, 19577323)));
+}
+
+TEST(StringTable, encode_repeated_tzid)
+{
+    const enc expected = list()
+        .t(1, 2, 3, 0, "Europe/Berlin")
+        .ts(2020, 8, 30, 15, 33, 14, 0, "Asia/Tokyo")
+        .t(4, 5, 6, 0, "Europe/Berlin")
+        .end();
+    const enc by_id = list()
+        .tid(1, 2, 3, 0, "Europe/Berlin")
+        .tsid(2020, 8, 30, 15, 33, 14, 0, "Asia/Tokyo")
+        .tid(4, 5, 6, 0, "Europe/Berlin")
+        .end();
+    std::vector<uint8_t> document = {0x77};
+    for(const std::vector<uint8_t>& value: {with_timezone_id(0x96, 0, t(1, 2, 3, 0)),
+                                            with_timezone_id(0x97, 2, ts(2020, 8, 30, 15, 33, 14, 0)),
+                                            with_timezone_id(0x96, 0, t(4, 5, 6, 0))})
+    {
+        document.insert(document.end(), value.begin(), value.end());
+    }
+    document.push_back(0x7b);
+    EXPECT_GT(cbe_test::encode_document(expected).size(), document.size());
+    const int largest_value_size = with_timezone_id(0x97, 2, ts(2020, 8, 30, 15, 33, 14, 0)).size();
+    cbe_test::expect_encode_decode_with_shrinking_buffer_size(largest_value_size, by_id, expected, document);
+}
+
+TEST(StringTable, encode_invalid_tzid)
+{
+    string_table table(4, 100);
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(100);
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_time_tzid(process, 1, 2, 3, 0, 0));
+    cbe_encode_set_timezone_table(process, table);
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_time_tzid(process, 1, 2, 3, 0, 0));
+}
+
+TEST(StringTable, decode_time_tzid)
+{
+    string_table table(4, 100, {"UTC", "Europe/Berlin"});
+    decoded_timezone result = decode_timezone(table, with_timezone_id(0x96, 1, t(23, 14, 43, 1000000)));
+    EXPECT_EQ(1, result.id);
+    EXPECT_EQ("Europe/Berlin", result.name);
+}
+
+TEST(StringTable, decode_timestamp_tzid)
+{
+    string_table table(4, 100, {"Europe/Berlin"});
+    decoded_timezone result = decode_timezone(table, with_timezone_id(0x97, 0, ts(2020, 8, 30, 15, 33, 14, 19577323)));
+    EXPECT_EQ(0, result.id);
+    EXPECT_EQ("Europe/Berlin", result.name);
+}
+
+TEST(StringTable, decode_timezone_string)
+{
+    string_table table(4, 100, {"Europe/Berlin"});
+    const std::vector<uint8_t> document = cbe_test::encode_document(t(23, 14, 43, 1000000, "Europe/Berlin"));
+    decoded_timezone result = decode_timezone(table, document);
+    EXPECT_EQ(-100, result.id);
+    EXPECT_EQ("Europe/Berlin", result.name);
+}
+
+TEST(StringTable, decode_invalid_tzid)
+{
+    string_table table(4, 100, {"Europe/Berlin"});
+    const std::vector<uint8_t> document = with_timezone_id(0x96, 1, t(23, 14, 43, 1000000));
+    decode_timezone(NULL, document, CBE_DECODE_ERROR_INVALID_TIMEZONE_ID);
+    decode_timezone(table, document, CBE_DECODE_ERROR_INVALID_TIMEZONE_ID);
+}
+
+struct map_key_events
+{
+    std::vector<std::string> events;
+    std::string current_string;
+};
+
+static bool on_map_key_symbol(struct cbe_decode_process* process, int symbol_id)
+{
+    ((map_key_events*)cbe_decode_get_user_context(process))->events.push_back("#" + std::to_string(symbol_id));
+    return true;
+}
+
+static bool on_string_begin(struct cbe_decode_process* process, int64_t)
+{
+    ((map_key_events*)cbe_decode_get_user_context(process))->current_string.clear();
+    return true;
+}
+
+static bool on_array_data(struct cbe_decode_process* process, const uint8_t* start, int64_t byte_count)
+{
+    map_key_events* result = (map_key_events*)cbe_decode_get_user_context(process);
+    result->current_string.append((const char*)start, byte_count);
+    if(result->current_string.size() == 0 || result->current_string.back() != '.')
+    {
+        return true;
+    }
+    result->events.push_back(result->current_string);
+    return true;
+}
+
+static bool on_integer(struct cbe_decode_process* process, int, uint64_t value)
+{
+    ((map_key_events*)cbe_decode_get_user_context(process))->events.push_back(std::to_string(value));
+    return true;
+}
+
+static bool on_map_begin(struct cbe_decode_process*) {return true;}
+static bool on_container_end(struct cbe_decode_process*) {return true;}
+
+static std::vector<std::string> decode_map_keys(const cbe_string_table* map_key_table,
+                                                const std::vector<uint8_t>& document,
+                                                int64_t chunk_size)
+{
+    cbe_decode_callbacks callbacks = {};
+    callbacks.on_map_key_symbol = on_map_key_symbol;
+    callbacks.on_string_begin = on_string_begin;
+    callbacks.on_array_data = on_array_data;
+    callbacks.on_integer = on_integer;
+    callbacks.on_unordered_map_begin = on_map_begin;
+    callbacks.on_container_end = on_container_end;
+    map_key_events result;
+
+    cbe_test::decode_process process;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode_begin(process, &callbacks, &result, 0));
+    cbe_decode_set_map_key_table(process, map_key_table);
+
+    int64_t offset = 0;
+    int64_t window = chunk_size;
+    cbe_decode_status status = CBE_DECODE_STATUS_OK;
+    while((status == CBE_DECODE_STATUS_OK || status == CBE_DECODE_STATUS_NEED_MORE_DATA) &&
+          offset < (int64_t)document.size())
+    {
+        int64_t byte_count = std::min(window, (int64_t)document.size() - offset);
+        status = cbe_decode_feed(process, document.data() + offset, &byte_count);
+        offset += byte_count;
+        // Grow the window when nothing could be consumed (a key waiting to be buffered whole).
+        window = byte_count == 0 ? window + chunk_size : chunk_size;
+    }
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, status);
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode_end(process));
+    return result.events;
+}
+
+static std::vector<uint8_t> encode_key_map()
+{
+    return cbe_test::encode_document(umap()
+        .str("name.").i(1)
+        .str("unknown.").i(2)
+        .str("id.").str("name.")
+        .str("a very long map key that cannot be a symbol.").i(3)
+        .end());
+}
+
+TEST(MapKeySymbol, decode)
+{
+    string_table table(4, 100, {"id.", "name.", "unknown-but-long."});
+    std::vector<std::string> expected = {"#1", "1", "unknown.", "2", "#0", "name.", "a very long map key that cannot be a symbol.", "3"};
+    EXPECT_EQ(expected, decode_map_keys(table, encode_key_map(), 1000));
+}
+
+TEST(MapKeySymbol, decode_chunked)
+{
+    string_table table(4, 100, {"id.", "name."});
+    std::vector<std::string> expected = {"#1", "1", "unknown.", "2", "#0", "name.", "a very long map key that cannot be a symbol.", "3"};
+    for(int chunk_size = 1; chunk_size < 8; chunk_size++)
+    {
+        EXPECT_EQ(expected, decode_map_keys(table, encode_key_map(), chunk_size)) << "chunk size " << chunk_size;
+    }
+}
+
+TEST(MapKeySymbol, no_table)
+{
+    std::vector<std::string> expected = {"name.", "1", "unknown.", "2", "id.", "name.", "a very long map key that cannot be a symbol.", "3"};
+    EXPECT_EQ(expected, decode_map_keys(NULL, encode_key_map(), 1000));
+}
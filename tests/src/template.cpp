@@ -0,0 +1,213 @@
+#include "helpers/test_helpers.h"
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+struct response
+{
+    int64_t id;
+    double score;
+    bool is_cached;
+    std::string name;
+};
+
+static const std::vector<response> sample_responses =
+{
+    {1, 0.5, true, "short"},
+    {-100000, 1.0 / 3, false, "a name that is longer than fifteen bytes"},
+    {0x7fffffffffffffffLL, -2.25, true, ""},
+};
+
+// The response as a normal document.
+static enc response_document(const response& r)
+{
+    return umap()
+        .str("status").str("ok")
+        .str("id").i(r.id)
+        .str("result").omap()
+            .str("score").f(r.score, 0)
+            .str("cached").b(r.is_cached)
+            .str("name").str(r.name)
+            .end()
+        .end();
+}
+
+// Responses in a container, with optional keys.
+static enc response_container(enc container, bool is_keyed)
+{
+    for(int i = 0; i < (int)sample_responses.size(); i++)
+    {
+        if(is_keyed)
+        {
+            container.u(i);
+        }
+        for(const value& v: response_document(sample_responses[i]).values)
+        {
+            container.add(v);
+        }
+    }
+    return container.end();
+}
+
+static std::vector<cbe_slot_value> slot_values(const response& r)
+{
+    std::vector<cbe_slot_value> values(4);
+    values[0].integer = r.id;
+    values[1].floating_point = r.score;
+    values[2].boolean = r.is_cached;
+    values[3].string.start = r.name.data();
+    values[3].string.byte_count = r.name.size();
+    return values;
+}
+
+class ResponseTemplate
+{
+public:
+    ResponseTemplate()
+    : template_backing_store(cbe_template_size(4) / sizeof(uint64_t) + 1)
+    , buffer(1000)
+    {
+        EXPECT_TRUE(cbe_template_begin(get(), 4));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap().str("status").str("ok").str("id")));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_slot(process, get(), "id", CBE_SLOT_TYPE_INTEGER));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, str("result").omap().str("score")));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_slot(process, get(), "score", CBE_SLOT_TYPE_FLOAT));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, str("cached")));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_slot(process, get(), "cached", CBE_SLOT_TYPE_BOOLEAN));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, str("name")));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_slot(process, get(), "name", CBE_SLOT_TYPE_STRING));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end().end()));
+        EXPECT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end_template(process, get()));
+    }
+
+    cbe_template* get()
+    {
+        return (cbe_template*)template_backing_store.data();
+    }
+
+private:
+    std::vector<uint64_t> template_backing_store;
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer;
+};
+
+TEST(Template, matches_normal_encoding)
+{
+    ResponseTemplate response_template;
+    for(const response& r: sample_responses)
+    {
+        cbe_test::encode_process process;
+        std::vector<uint8_t> actual(1000);
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, actual.data(), actual.size(), 0));
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_template(process, response_template.get(), slot_values(r).data()));
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+        actual.resize(cbe_encode_get_buffer_offset(process));
+
+        EXPECT_EQ(cbe_test::encode_document(response_document(r)), actual);
+    }
+}
+
+TEST(Template, find_slot)
+{
+    ResponseTemplate response_template;
+    EXPECT_EQ(4, cbe_template_get_slot_count(response_template.get()));
+    EXPECT_EQ(0, cbe_template_find_slot(response_template.get(), "id"));
+    EXPECT_EQ(3, cbe_template_find_slot(response_template.get(), "name"));
+    EXPECT_EQ(-1, cbe_template_find_slot(response_template.get(), "status"));
+    EXPECT_EQ(-1, cbe_template_find_slot(response_template.get(), NULL));
+}
+
+TEST(Template, map_values)
+{
+    ResponseTemplate response_template;
+    cbe_test::encode_process process;
+    std::vector<uint8_t> actual(1000);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, actual.data(), actual.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, umap()));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INCORRECT_MAP_KEY_TYPE,
+              cbe_encode_add_template(process, response_template.get(), slot_values(sample_responses[0]).data()));
+    for(int i = 0; i < 3; i++)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, u(i)));
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_template(process, response_template.get(), slot_values(sample_responses[i]).data()));
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    actual.resize(cbe_encode_get_buffer_offset(process));
+
+    EXPECT_EQ(cbe_test::encode_document(response_container(umap(), true)), actual);
+}
+
+TEST(Template, not_enough_room_adds_nothing)
+{
+    ResponseTemplate response_template;
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(70);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM,
+              cbe_encode_add_template(process, response_template.get(), slot_values(sample_responses[1]).data()));
+    EXPECT_EQ(1, cbe_encode_get_buffer_offset(process));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+}
+
+TEST(Template, across_pages)
+{
+    ResponseTemplate response_template;
+    cbe_test::page_pool pool(20, 64);
+    cbe_test::encode_process process;
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_paged(process, pool, 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    for(const response& r: sample_responses)
+    {
+        ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_template(process, response_template.get(), slot_values(r).data()));
+    }
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end(process));
+    EXPECT_EQ(cbe_test::encode_document(response_container(list(), false)), cbe_test::gather_segments(process));
+}
+
+TEST(Template, invalid)
+{
+    std::vector<uint64_t> template_backing_store(cbe_template_size(1) / sizeof(uint64_t) + 1);
+    cbe_template* encode_template = (cbe_template*)template_backing_store.data();
+    EXPECT_EQ(0, cbe_template_size(-1));
+    ASSERT_TRUE(cbe_template_begin(encode_template, 1));
+
+    cbe_test::measure_process process;
+    std::vector<uint8_t> buffer(100);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, list()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_slot(process, encode_template, "a", CBE_SLOT_TYPE_INTEGER));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_slot(process, encode_template, "b", CBE_SLOT_TYPE_INTEGER));
+    EXPECT_EQ(CBE_ENCODE_ERROR_UNBALANCED_CONTAINERS, cbe_encode_end_template(process, encode_template));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, end()));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_end_template(process, encode_template));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_template(process, encode_template, NULL));
+
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin_measure(process, 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_slot(process, encode_template, "c", CBE_SLOT_TYPE_INTEGER));
+}
+
+TEST(Template, rejected_with_alignment_or_key_dictionary)
+{
+    ResponseTemplate response_template;
+    const std::vector<cbe_slot_value> values = slot_values(sample_responses[0]);
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(1000);
+
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_set_alignment(process, 8));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_template(process, response_template.get(), values.data()));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+
+    cbe_test::string_table keys(1, 10, {"name"});
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_add_key_dictionary(process, keys));
+    const int64_t offset = cbe_encode_get_buffer_offset(process);
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_template(process, response_template.get(), values.data()));
+    EXPECT_EQ(offset, cbe_encode_get_buffer_offset(process));
+}
@@ -0,0 +1,169 @@
+#include "helpers/test_helpers.h"
+#include <algorithm>
+#include <cstring>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static std::vector<uint8_t> encode_typed_array(cbe_typed_array_type type, const void* elements, int64_t element_count)
+{
+    const uint8_t* start = (const uint8_t*)elements;
+    const std::vector<uint8_t> bytes(start, start + element_count * cbe_typed_array_element_size(type));
+    return cbe_test::encode_document(list().ta(type, bytes).end());
+}
+
+class typed_array_collector
+{
+public:
+    typed_array_collector()
+    : type(CBE_TYPED_ARRAY_INT8)
+    , element_count(-1)
+    , max_chunk_element_count(0)
+    {
+        callbacks.on_list_begin = on_container;
+        callbacks.on_container_end = on_container;
+        callbacks.on_typed_array_begin = on_typed_array_begin;
+        callbacks.on_typed_array_data = on_typed_array_data;
+    }
+
+    // Feeds the document chunk_size bytes at a time, carrying over any bytes
+    // the decoder didn't consume.
+    cbe_decode_status decode(const std::vector<uint8_t>& document, int chunk_size)
+    {
+        cbe_test::decode_process process;
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, cbe_decode_begin(process, &callbacks, this, 0));
+        std::vector<uint8_t> pending;
+        for(size_t offset = 0; offset < document.size(); offset += chunk_size)
+        {
+            const size_t end = std::min(offset + chunk_size, document.size());
+            pending.insert(pending.end(), document.begin() + offset, document.begin() + end);
+            int64_t byte_count = pending.size();
+            cbe_decode_status status = cbe_decode_feed(process, pending.data(), &byte_count);
+            if(status != CBE_DECODE_STATUS_OK && status != CBE_DECODE_STATUS_NEED_MORE_DATA)
+            {
+                return status;
+            }
+            pending.erase(pending.begin(), pending.begin() + byte_count);
+        }
+        return cbe_decode_end(process);
+    }
+
+    cbe_decode_callbacks callbacks = {};
+    cbe_typed_array_type type;
+    int64_t element_count;
+    int64_t max_chunk_element_count;
+    std::vector<uint8_t> data;
+
+private:
+    static typed_array_collector* get(cbe_decode_process* process)
+    {
+        return (typed_array_collector*)cbe_decode_get_user_context(process);
+    }
+
+    static bool on_container(cbe_decode_process* process)
+    {
+        (void)process;
+        return true;
+    }
+
+    static bool on_typed_array_begin(cbe_decode_process* process, cbe_typed_array_type type, int64_t element_count)
+    {
+        get(process)->type = type;
+        get(process)->element_count = element_count;
+        return true;
+    }
+
+    static bool on_typed_array_data(cbe_decode_process* process, const uint8_t* start, int64_t element_count)
+    {
+        typed_array_collector* collector = get(process);
+        const int64_t byte_count = element_count * cbe_typed_array_element_size(collector->type);
+        collector->data.insert(collector->data.end(), start, start + byte_count);
+        collector->max_chunk_element_count = std::max(collector->max_chunk_element_count, element_count);
+        return true;
+    }
+};
+
+TEST_ENCODE_DATA(TypedArray, int16, 99, 9, list().ta(CBE_TYPED_ARRAY_INT16, {0x01, 0x00, 0xfe, 0xff, 0x34, 0x12}).end(), {0x77, 0x94, 0x01, 0x03, 0x01, 0x00, 0xfe, 0xff, 0x34, 0x12, 0x7b})
+TEST_ENCODE_DATA(TypedArray, empty, 99, 9, list().ta(CBE_TYPED_ARRAY_FLOAT64, {}).end(), {0x77, 0x94, 0x07, 0x00, 0x7b})
+
+TEST(TypedArray, round_trip_all_types)
+{
+    std::vector<uint8_t> elements(100 * 8);
+    for(size_t i = 0; i < elements.size(); i++)
+    {
+        elements[i] = (uint8_t)(i * 37);
+    }
+    for(int type = CBE_TYPED_ARRAY_INT8; type <= CBE_TYPED_ARRAY_FLOAT64; type++)
+    {
+        const int element_size = cbe_typed_array_element_size((cbe_typed_array_type)type);
+        const std::vector<uint8_t> document = encode_typed_array((cbe_typed_array_type)type, elements.data(), 100);
+        typed_array_collector collector;
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, collector.decode(document, document.size())) << "type " << type;
+        EXPECT_EQ(type, collector.type);
+        EXPECT_EQ(100, collector.element_count);
+        EXPECT_EQ(std::vector<uint8_t>(elements.begin(), elements.begin() + 100 * element_size), collector.data) << "type " << type;
+    }
+}
+
+TEST(TypedArray, chunks_hold_whole_elements)
+{
+    std::vector<double> values(50);
+    for(size_t i = 0; i < values.size(); i++)
+    {
+        values[i] = i * 1.1;
+    }
+    const std::vector<uint8_t> document = encode_typed_array(CBE_TYPED_ARRAY_FLOAT64, values.data(), values.size());
+    for(int chunk_size = 1; chunk_size <= 30; chunk_size++)
+    {
+        typed_array_collector collector;
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, collector.decode(document, chunk_size)) << "chunk size " << chunk_size;
+        ASSERT_EQ(values.size() * sizeof(double), collector.data.size()) << "chunk size " << chunk_size;
+        EXPECT_EQ(0, memcmp(values.data(), collector.data.data(), collector.data.size())) << "chunk size " << chunk_size;
+        EXPECT_LE(collector.max_chunk_element_count, (chunk_size + 7) / 8 + 1) << "chunk size " << chunk_size;
+    }
+}
+
+TEST(TypedArray, streamed_data)
+{
+    const int32_t values[] = {10, 20, 30, 40, 50};
+    const uint8_t* bytes = (const uint8_t*)values;
+    EXPECT_EQ(encode_typed_array(CBE_TYPED_ARRAY_INT32, values, 5),
+              cbe_test::encode_document(list().tah(CBE_TYPED_ARRAY_INT32, 5).data({bytes, bytes + 6}).data({bytes + 6, bytes + 20}).end()));
+}
+
+TEST_ENCODE_STATUS(TypedArray, incomplete, 99, 9, CBE_ENCODE_ERROR_INCOMPLETE_ARRAY_FIELD, list().tah(CBE_TYPED_ARRAY_INT32, 5).data({1, 2, 3, 4, 5, 6}).end())
+
+TEST(TypedArray, smaller_than_float_list)
+{
+    std::vector<double> values(1000);
+    for(size_t i = 0; i < values.size(); i++)
+    {
+        values[i] = i + 0.1;
+    }
+    const std::vector<uint8_t> document = encode_typed_array(CBE_TYPED_ARRAY_FLOAT64, values.data(), values.size());
+    EXPECT_EQ(1000 * 8 + 2 + 2 + 2, (int)document.size());
+    EXPECT_LT((int64_t)document.size(), cbe_test::measure_document(list().flist(values).end()));
+}
+
+TEST_ENCODE_STATUS(TypedArray, unknown_type, 99, 9, CBE_ENCODE_ERROR_INVALID_ARGUMENT, ta((cbe_typed_array_type)8, {1, 2, 3}))
+TEST_ENCODE_STATUS(TypedArray, map_key, 99, 9, CBE_ENCODE_ERROR_INCORRECT_MAP_KEY_TYPE, umap().ta(CBE_TYPED_ARRAY_INT8, {1, 2, 3}))
+
+TEST(TypedArray, errors)
+{
+    const int8_t values[] = {1, 2, 3};
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(6);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_ERROR_INVALID_ARGUMENT, cbe_encode_add_typed_array(process, CBE_TYPED_ARRAY_INT8, NULL, 3));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, umap().i(1).ta(CBE_TYPED_ARRAY_INT8, {1, 2, 3})));
+    EXPECT_EQ(2, cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(0, cbe_typed_array_element_size((cbe_typed_array_type)-1));
+
+    // Decoders have to opt in.
+    typed_array_collector collector;
+    collector.callbacks.on_typed_array_begin = NULL;
+    EXPECT_EQ(CBE_DECODE_ERROR_INVALID_ARRAY_DATA, collector.decode(encode_typed_array(CBE_TYPED_ARRAY_INT8, values, 3), 100));
+}
@@ -0,0 +1,244 @@
+#include "helpers/test_helpers.h"
+#include <cstring>
+
+// #define KSLog_LocalMinLevel KSLOG_LEVEL_TRACE
+#include <kslog/kslog.h>
+
+using namespace encoding;
+
+static uint128_ct make_uint128(uint64_t high, uint64_t low)
+{
+    return (uint128_ct)high << 64 | low;
+}
+
+static uint128_ct get_bits(const void* value)
+{
+    uint128_ct bits = 0;
+    memcpy(&bits, value, sizeof(bits));
+    return bits;
+}
+
+// IEEE 754 BID encoding of a 128-bit decimal float with a canonical significand.
+static dec128_ct make_decimal_128(bool is_negative, uint128_ct significand, int exponent)
+{
+    const uint128_ct bits = (uint128_ct)is_negative << 127 | (uint128_ct)(exponent + 6176) << 113 | significand;
+    dec128_ct value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Largest decimal128 significand: 10^34 - 1
+static const uint128_ct max_decimal_significand = make_uint128(0x1ed09bead87c0ULL, 0x378d8e63ffffffffULL);
+
+struct decoded_value
+{
+    int call_count;
+    int sign;
+    uint128_ct integer;
+    double float_64;
+    uint128_ct bits;
+};
+
+static decoded_value g_decoded;
+
+static bool on_integer(cbe_decode_process* process, int sign, uint64_t value)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.sign = sign;
+    g_decoded.integer = value;
+    return true;
+}
+
+static bool on_integer_128(cbe_decode_process* process, int sign, uint128_ct value)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.sign = sign;
+    g_decoded.integer = value;
+    g_decoded.bits = 1;
+    return true;
+}
+
+static bool on_float(cbe_decode_process* process, double value)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.float_64 = value;
+    return true;
+}
+
+static bool on_float_128(cbe_decode_process* process, float128_ct value)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.bits = get_bits(&value);
+    return true;
+}
+
+static bool on_decimal_float_128(cbe_decode_process* process, dec128_ct value)
+{
+    (void)process;
+    g_decoded.call_count++;
+    g_decoded.bits = get_bits(&value);
+    return true;
+}
+
+static cbe_decode_status decode(const std::vector<uint8_t>& document, bool use_128_bit_callbacks)
+{
+    cbe_decode_callbacks callbacks = {};
+    callbacks.on_integer = on_integer;
+    callbacks.on_float = on_float;
+    if(use_128_bit_callbacks)
+    {
+        callbacks.on_integer_128 = on_integer_128;
+        callbacks.on_float_128 = on_float_128;
+        callbacks.on_decimal_float_128 = on_decimal_float_128;
+    }
+    g_decoded = decoded_value();
+    return cbe_decode(&callbacks, NULL, document.data(), document.size(), 0);
+}
+
+// 2^64 doesn't fit in 64 bits, so it becomes a 10 byte RVLQ.
+TEST_ENCODE_DATA(Value128, integer_2_64, 99, 9, i128(1, make_uint128(1, 0)), {0x66, 0x82, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00})
+TEST_ENCODE_DATA(Value128, integer_neg_2_64, 99, 9, i128(-1, make_uint128(1, 0)), {0x67, 0x82, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00})
+TEST_ENCODE_DATA(Value128, integer_fixed, 99, 9, i128f(-1, make_uint128(1ULL << 36, 5)), {0x73, 0x05, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10, 0, 0, 0})
+
+TEST(Value128, integer_encoding)
+{
+    EXPECT_EQ(cbe_test::encode_document(i(-1000000)), cbe_test::encode_document(i128(-1, 1000000)));
+}
+
+TEST(Value128, integer_round_trip)
+{
+    const uint128_ct values[] = {0, 1, 100, 0xffffffffffffffffULL, make_uint128(1, 0),
+                                 make_uint128(0x0123456789abcdefULL, 0xfedcba9876543210ULL),
+                                 make_uint128(0xffffffffffffffffULL, 0xffffffffffffffffULL)};
+    for(const uint128_ct value: values)
+    {
+        for(int sign = -1; sign <= 1; sign += 2)
+        {
+            EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(cbe_test::encode_document(i128(sign, value)), true));
+            EXPECT_EQ(1, g_decoded.call_count);
+            EXPECT_TRUE(g_decoded.integer == value);
+            EXPECT_EQ(value == 0 ? 1 : sign, g_decoded.sign);
+            EXPECT_EQ((value >> 64) != 0, g_decoded.bits == 1);
+
+            EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(cbe_test::encode_document(i128f(sign, value)), true));
+            EXPECT_EQ(1, g_decoded.call_count);
+            EXPECT_TRUE(g_decoded.integer == value);
+            EXPECT_EQ(sign, g_decoded.sign);
+        }
+    }
+}
+
+TEST(Value128, float_round_trip)
+{
+    EXPECT_EQ(cbe_test::encode_document(f(1.5, 0)), cbe_test::encode_document(f128((float128_ct)1.5)));
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(cbe_test::encode_document(f128((float128_ct)-0.1)), true));
+    EXPECT_EQ(-0.1, g_decoded.float_64);
+
+    const float128_ct third = (float128_ct)1 / 3;
+    const std::vector<uint8_t> document = cbe_test::encode_document(f128(third));
+    ASSERT_EQ(17, (int)document.size());
+    EXPECT_EQ(0x74, document[0]);
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(document, true));
+    EXPECT_EQ(1, g_decoded.call_count);
+    EXPECT_TRUE(g_decoded.bits == get_bits(&third));
+
+    const float128_ct one = 1;
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(cbe_test::encode_document(f128f(one)), true));
+    EXPECT_TRUE(g_decoded.bits == get_bits(&one));
+
+    // A NaN payload would be cut down by narrowing, so NaNs stay 128 bits.
+    const uint128_ct nan_bits = make_uint128(0x7fff800000000000ULL, 0x123456789ULL);
+    float128_ct nan;
+    memcpy(&nan, &nan_bits, sizeof(nan));
+    EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(cbe_test::encode_document(f128(nan)), true));
+    EXPECT_TRUE(g_decoded.bits == nan_bits);
+}
+
+TEST(Value128, decimal_compact)
+{
+    const dec128_ct price = make_decimal_128(false, 1234500, -4);
+    EXPECT_EQ(cbe_test::encode_document(dp(1, 12345, -2)), cbe_test::encode_document(df128(price)));
+
+    const dec128_ct values[] =
+    {
+        make_decimal_128(true, make_uint128(1, 1), 0),
+        make_decimal_128(false, 12345678901234567ULL, -3),
+        make_decimal_128(false, 5, -6176),
+        make_decimal_128(true, 7, 6111),
+    };
+    for(const dec128_ct& value: values)
+    {
+        const std::vector<uint8_t> document = cbe_test::encode_document(df128(value));
+        EXPECT_EQ(0x65, document[0]);
+        EXPECT_GT(17, (int)document.size());
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(document, true));
+        EXPECT_EQ(1, g_decoded.call_count);
+        EXPECT_TRUE(g_decoded.bits == get_bits(&value));
+    }
+}
+
+TEST(Value128, decimal_fixed)
+{
+    const dec128_ct values[] =
+    {
+        make_decimal_128(false, max_decimal_significand, -20),
+        make_decimal_128(true, 1234500, -4),
+    };
+    for(const dec128_ct& value: values)
+    {
+        const std::vector<uint8_t> document = cbe_test::encode_document(df128f(value));
+        ASSERT_EQ(17, (int)document.size());
+        EXPECT_EQ(0x75, document[0]);
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(document, true));
+        EXPECT_TRUE(g_decoded.bits == get_bits(&value));
+    }
+
+    // Infinities have no compact parts, and 34 digits take more room than the
+    // fixed width form, so both stay in fixed width form.
+    const uint128_ct infinity_bits = make_uint128(0x7800000000000000ULL, 0);
+    dec128_ct infinity;
+    memcpy(&infinity, &infinity_bits, sizeof(infinity));
+    const dec128_ct fixed_values[] = {infinity, values[0]};
+    for(const dec128_ct& value: fixed_values)
+    {
+        const std::vector<uint8_t> document = cbe_test::encode_document(df128(value));
+        ASSERT_EQ(17, (int)document.size());
+        EXPECT_EQ(0x75, document[0]);
+        EXPECT_EQ(CBE_DECODE_STATUS_OK, decode(document, true));
+        EXPECT_TRUE(g_decoded.bits == get_bits(&value));
+    }
+}
+
+TEST(Value128, callbacks_not_set)
+{
+    const dec128_ct wide_decimal = make_decimal_128(false, max_decimal_significand, 0);
+    const enc documents[] =
+    {
+        i128(1, make_uint128(1, 0)),
+        i128f(1, 1),
+        f128f(1),
+        df128(wide_decimal),
+        df128f(wide_decimal),
+    };
+    for(const enc& document: documents)
+    {
+        EXPECT_EQ(CBE_DECODE_ERROR_VALUE_OUT_OF_RANGE, decode(cbe_test::encode_document(document), false));
+        EXPECT_EQ(0, g_decoded.call_count);
+    }
+}
+
+TEST(Value128, not_enough_room)
+{
+    cbe_test::encode_process process;
+    std::vector<uint8_t> buffer(16);
+    ASSERT_EQ(CBE_ENCODE_STATUS_OK, cbe_encode_begin(process, buffer.data(), buffer.size(), 0));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, i128f(1, 1)));
+    EXPECT_EQ(CBE_ENCODE_STATUS_NEED_MORE_ROOM, add_encoding(process, f128((float128_ct)1 / 3)));
+    EXPECT_EQ(0, cbe_encode_get_buffer_offset(process));
+    EXPECT_EQ(CBE_ENCODE_STATUS_OK, add_encoding(process, i128(1, make_uint128(1, 0))));
+    EXPECT_EQ(11, cbe_encode_get_buffer_offset(process));
+}
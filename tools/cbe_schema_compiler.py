@@ -0,0 +1,1186 @@
+#!/usr/bin/env python3
+"""
+Generates a specialized CBE encoder and decoder for fixed-shape records.
+
+Usage: cbe_schema_compiler.py <schema.json> <output.h> <output.c>
+
+Schema format:
+
+    {
+        "prefix": "telemetry",
+        "records": [
+            {
+                "name": "reading",
+                "container": "unordered_map",
+                "fields": [
+                    {"name": "id",    "type": "uint"},
+                    {"name": "value", "type": "float"},
+                    {"name": "label", "type": "string"},
+                    {"name": "pos",   "type": "position"}
+                ]
+            },
+            {
+                "name": "position",
+                "container": "list",
+                "fields": [
+                    {"name": "x", "type": "int"},
+                    {"name": "y", "type": "int"}
+                ]
+            }
+        ]
+    }
+
+Containers: unordered_map, ordered_map, list (list records have no keys).
+Field types: bool, int, uint, float, string, bytes, or the name of another record.
+
+For each record <prefix>_<name>, the generated code provides:
+
+    int64_t <prefix>_<name>_max_encoded_size(const <prefix>_<name>* value);
+    int64_t <prefix>_<name>_encode(const <prefix>_<name>* value, uint8_t* buffer, int64_t buffer_size);
+    bool <prefix>_<name>_decode_fast(const uint8_t* document, int64_t byte_count, <prefix>_<name>* value);
+    cbe_decode_status <prefix>_<name>_decode(const uint8_t* document, int64_t byte_count, <prefix>_<name>* value);
+
+The encoder checks the buffer size once and then writes the record's known
+shape directly. The decoder matches the expected type bytes in sequence, and
+only falls back to the generic cbe_decode() path when the document deviates
+from the expected shape (different key order, other encodings, padding,
+comments, etc). Decoded strings and bytes point into the document.
+"""
+
+import json
+import sys
+
+TYPE_STRING_0 = 0x80
+TYPE_STRING = 0x90
+
+CONTAINER_TYPES = {
+    "unordered_map": "TYPE_MAP_UNORDERED",
+    "ordered_map": "TYPE_MAP_ORDERED",
+    "list": "TYPE_LIST",
+}
+
+SCALAR_TYPES = {
+    # type: (C member type, max encoded size, field kind)
+    "bool": ("bool", 1, "FIELD_BOOL"),
+    "int": ("int64_t", 9, "FIELD_INT"),
+    "uint": ("uint64_t", 9, "FIELD_UINT"),
+    "float": ("double", 9, "FIELD_FLOAT"),
+}
+
+ARRAY_TYPES = {
+    # type: (C pointer type, field kind)
+    "string": ("const char*", "FIELD_STRING"),
+    "bytes": ("const uint8_t*", "FIELD_BYTES"),
+}
+
+# Type field + the widest length field we support
+ARRAY_HEADER_MAX_SIZE = 1 + 10
+
+
+def fail(message):
+    sys.stderr.write("cbe_schema_compiler: %s\n" % message)
+    sys.exit(1)
+
+
+def encode_vlq(value):
+    groups = [value & 0x7f]
+    value >>= 7
+    while value > 0:
+        groups.insert(0, (value & 0x7f) | 0x80)
+        value >>= 7
+    return groups
+
+
+def encode_key(name):
+    data = list(name.encode("utf-8"))
+    if len(data) <= 15:
+        return [TYPE_STRING_0 + len(data)] + data
+    return [TYPE_STRING] + encode_vlq(len(data)) + data
+
+
+def c_bytes(data):
+    return ", ".join("0x%02x" % b for b in data)
+
+
+class Schema:
+    def __init__(self, document):
+        self.prefix = document.get("prefix")
+        if not self.prefix or not self.prefix.isidentifier():
+            fail("schema must have a valid 'prefix'")
+        self.records = document.get("records", [])
+        if not self.records:
+            fail("schema has no records")
+        self.records_by_name = {}
+        for record in self.records:
+            name = record.get("name")
+            if not name or not name.isidentifier():
+                fail("record has an invalid name: %r" % name)
+            if name in self.records_by_name:
+                fail("duplicate record %s" % name)
+            if record.get("container") not in CONTAINER_TYPES:
+                fail("record %s has an invalid container %r" % (name, record.get("container")))
+            self.records_by_name[name] = record
+        for record in self.records:
+            seen = set()
+            for field in record.get("fields", []):
+                fname = field.get("name")
+                if not fname or not fname.isidentifier():
+                    fail("record %s has a field with an invalid name: %r" % (record["name"], fname))
+                if fname in seen:
+                    fail("record %s has duplicate field %s" % (record["name"], fname))
+                seen.add(fname)
+                ftype = field.get("type")
+                if ftype not in SCALAR_TYPES and ftype not in ARRAY_TYPES and ftype not in self.records_by_name:
+                    fail("field %s.%s has an unknown type %r" % (record["name"], fname, ftype))
+        self.depths = {}
+        for record in self.records:
+            self.depth(record, [])
+
+    def depth(self, record, path):
+        name = record["name"]
+        if name in path:
+            fail("record %s is recursive" % name)
+        if name not in self.depths:
+            child_depth = 0
+            for field in record["fields"]:
+                if field["type"] in self.records_by_name:
+                    child = self.records_by_name[field["type"]]
+                    child_depth = max(child_depth, self.depth(child, path + [name]))
+            self.depths[name] = child_depth + 1
+        return self.depths[name]
+
+    def ordered_records(self):
+        """Records ordered so that every record follows the records it contains."""
+        ordered = []
+
+        def visit(record):
+            if record in ordered:
+                return
+            for field in record["fields"]:
+                if field["type"] in self.records_by_name:
+                    visit(self.records_by_name[field["type"]])
+            ordered.append(record)
+
+        for record in self.records:
+            visit(record)
+        return ordered
+
+    def c_name(self, record):
+        return "%s_%s" % (self.prefix, record["name"])
+
+    def is_map(self, record):
+        return record["container"] != "list"
+
+
+HEADER_TEMPLATE = """\
+// Generated by cbe_schema_compiler.py from {source}. DO NOT EDIT.
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {{
+#endif
+
+#include <cbe/cbe.h>
+
+{typedefs}
+{declarations}
+#ifdef __cplusplus
+}}
+#endif
+"""
+
+DECLARATION_TEMPLATE = """\
+/**
+ * Get the maximum encoded size of a {c_name}.
+ */
+int64_t {c_name}_max_encoded_size(const {c_name}* value);
+
+/**
+ * Encode a {c_name} as a complete CBE document.
+ *
+ * @return The number of bytes written, or -1 if buffer_size is less than {c_name}_max_encoded_size().
+ */
+int64_t {c_name}_encode(const {c_name}* value, uint8_t* buffer, int64_t buffer_size);
+
+/**
+ * Decode a {c_name} from a complete CBE document, but only if it has exactly
+ * the shape that {c_name}_encode() produces.
+ *
+ * @return true if the document matched.
+ */
+bool {c_name}_decode_fast(const uint8_t* document, int64_t byte_count, {c_name}* value);
+
+/**
+ * Decode a {c_name} from a complete CBE document, falling back to the generic
+ * decoder if the document's shape differs from what {c_name}_encode() produces.
+ * Strings and bytes in the decoded value point into the document.
+ *
+ * @return The decoder status.
+ */
+cbe_decode_status {c_name}_decode(const uint8_t* document, int64_t byte_count, {c_name}* value);
+
+"""
+
+SOURCE_PRELUDE = """\
+// Generated by cbe_schema_compiler.py from {source}. DO NOT EDIT.
+
+#include "{header}"
+#include <stddef.h>
+#include <string.h>
+
+#define MAX_RECORD_DEPTH {max_depth}
+#define RECORD_COUNT {record_count}
+
+enum
+{{
+    TYPE_SMALLINT_MIN    = -100,
+    TYPE_SMALLINT_MAX    =  100,
+    TYPE_INT_POS         = 0x66,
+    TYPE_INT_NEG         = 0x67,
+    TYPE_INT_POS_8       = 0x68,
+    TYPE_INT_NEG_8       = 0x69,
+    TYPE_INT_POS_16      = 0x6a,
+    TYPE_INT_NEG_16      = 0x6b,
+    TYPE_INT_POS_32      = 0x6c,
+    TYPE_INT_NEG_32      = 0x6d,
+    TYPE_INT_POS_64      = 0x6e,
+    TYPE_INT_NEG_64      = 0x6f,
+    TYPE_FLOAT_BINARY_32 = 0x70,
+    TYPE_FLOAT_BINARY_64 = 0x71,
+    TYPE_LIST            = 0x77,
+    TYPE_MAP_UNORDERED   = 0x78,
+    TYPE_MAP_ORDERED     = 0x79,
+    TYPE_END_CONTAINER   = 0x7b,
+    TYPE_FALSE           = 0x7c,
+    TYPE_TRUE            = 0x7d,
+    TYPE_STRING_0        = 0x80,
+    TYPE_STRING_15       = 0x8f,
+    TYPE_STRING          = 0x90,
+    TYPE_BYTES           = 0x91,
+}};
+
+
+// =======
+// Writers
+// =======
+
+static inline uint8_t* write_vlq(uint8_t* p, uint64_t value)
+{{
+    int shift = 0;
+    while(shift < 63 && (value >> (shift + 7)) != 0)
+    {{
+        shift += 7;
+    }}
+    for(; shift > 0; shift -= 7)
+    {{
+        *p++ = (uint8_t)(((value >> shift) & 0x7f) | 0x80);
+    }}
+    *p++ = (uint8_t)(value & 0x7f);
+    return p;
+}}
+
+static inline uint8_t* write_le(uint8_t* p, uint64_t value, int byte_count)
+{{
+    for(int i = 0; i < byte_count; i++)
+    {{
+        *p++ = (uint8_t)(value >> (i * 8));
+    }}
+    return p;
+}}
+
+static inline uint8_t* write_magnitude(uint8_t* p, const int is_negative, const uint64_t value)
+{{
+    if(value <= TYPE_SMALLINT_MAX)
+    {{
+        *p++ = (uint8_t)(is_negative ? -(int)value : (int)value);
+        return p;
+    }}
+    if(value <= 0x1fffff)
+    {{
+        if(value <= 0xff)
+        {{
+            *p++ = TYPE_INT_POS_8 + is_negative;
+            return write_le(p, value, 1);
+        }}
+        if(value <= 0xffff)
+        {{
+            *p++ = TYPE_INT_POS_16 + is_negative;
+            return write_le(p, value, 2);
+        }}
+        *p++ = TYPE_INT_POS + is_negative;
+        return write_vlq(p, value);
+    }}
+    if(value <= 0x1ffffffffffffULL)
+    {{
+        if(value <= 0xffffffff)
+        {{
+            *p++ = TYPE_INT_POS_32 + is_negative;
+            return write_le(p, value, 4);
+        }}
+        *p++ = TYPE_INT_POS + is_negative;
+        return write_vlq(p, value);
+    }}
+    *p++ = TYPE_INT_POS_64 + is_negative;
+    return write_le(p, value, 8);
+}}
+
+static inline uint8_t* write_int(uint8_t* p, const int64_t value)
+{{
+    return value < 0 ? write_magnitude(p, 1, -(uint64_t)value) : write_magnitude(p, 0, (uint64_t)value);
+}}
+
+static inline uint8_t* write_uint(uint8_t* p, const uint64_t value)
+{{
+    return write_magnitude(p, 0, value);
+}}
+
+static inline uint8_t* write_bool(uint8_t* p, const bool value)
+{{
+    *p++ = value ? TYPE_TRUE : TYPE_FALSE;
+    return p;
+}}
+
+static inline uint8_t* write_float(uint8_t* p, const double value)
+{{
+    if(value == (double)(float)value)
+    {{
+        const float value_32 = (float)value;
+        uint32_t bits = 0;
+        memcpy(&bits, &value_32, sizeof(bits));
+        *p++ = TYPE_FLOAT_BINARY_32;
+        return write_le(p, bits, sizeof(bits));
+    }}
+    uint64_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    *p++ = TYPE_FLOAT_BINARY_64;
+    return write_le(p, bits, sizeof(bits));
+}}
+
+static inline uint8_t* write_array(uint8_t* p, const uint8_t type, const void* const data, const int64_t byte_count)
+{{
+    if(type == TYPE_STRING && byte_count <= 15)
+    {{
+        *p++ = (uint8_t)(TYPE_STRING_0 + byte_count);
+    }}
+    else
+    {{
+        *p++ = type;
+        p = write_vlq(p, (uint64_t)byte_count);
+    }}
+    if(byte_count > 0)
+    {{
+        memcpy(p, data, byte_count);
+    }}
+    return p + byte_count;
+}}
+
+static inline uint8_t* write_string(uint8_t* p, const char* const data, const int64_t byte_count)
+{{
+    return write_array(p, TYPE_STRING, data, byte_count);
+}}
+
+static inline uint8_t* write_bytes(uint8_t* p, const uint8_t* const data, const int64_t byte_count)
+{{
+    return write_array(p, TYPE_BYTES, data, byte_count);
+}}
+
+
+// =======
+// Readers
+// =======
+
+static inline bool match_bytes(const uint8_t** pp, const uint8_t* end, const uint8_t* expected, int64_t byte_count)
+{{
+    if(end - *pp < byte_count || memcmp(*pp, expected, byte_count) != 0)
+    {{
+        return false;
+    }}
+    *pp += byte_count;
+    return true;
+}}
+
+static inline bool read_vlq(const uint8_t** pp, const uint8_t* end, uint64_t* value)
+{{
+    uint64_t accumulator = 0;
+    for(const uint8_t* p = *pp; p < end; p++)
+    {{
+        if(accumulator >> 57)
+        {{
+            return false;
+        }}
+        accumulator = (accumulator << 7) | (*p & 0x7f);
+        if((*p & 0x80) == 0)
+        {{
+            *pp = p + 1;
+            *value = accumulator;
+            return true;
+        }}
+    }}
+    return false;
+}}
+
+static inline bool read_le(const uint8_t** pp, const uint8_t* end, int byte_count, uint64_t* value)
+{{
+    if(end - *pp < byte_count)
+    {{
+        return false;
+    }}
+    uint64_t accumulator = 0;
+    for(int i = 0; i < byte_count; i++)
+    {{
+        accumulator |= (uint64_t)(*pp)[i] << (i * 8);
+    }}
+    *pp += byte_count;
+    *value = accumulator;
+    return true;
+}}
+
+static inline bool read_magnitude(const uint8_t** pp, const uint8_t* end, int* is_negative, uint64_t* value)
+{{
+    if(*pp >= end)
+    {{
+        return false;
+    }}
+    const uint8_t type = *(*pp)++;
+    const int8_t small_value = (int8_t)type;
+    if(small_value >= TYPE_SMALLINT_MIN && small_value <= TYPE_SMALLINT_MAX)
+    {{
+        *is_negative = small_value < 0;
+        *value = (uint64_t)(small_value < 0 ? -small_value : small_value);
+        return true;
+    }}
+    *is_negative = type & 1;
+    switch(type)
+    {{
+        case TYPE_INT_POS: case TYPE_INT_NEG:
+            return read_vlq(pp, end, value);
+        case TYPE_INT_POS_8: case TYPE_INT_NEG_8:
+            return read_le(pp, end, 1, value);
+        case TYPE_INT_POS_16: case TYPE_INT_NEG_16:
+            return read_le(pp, end, 2, value);
+        case TYPE_INT_POS_32: case TYPE_INT_NEG_32:
+            return read_le(pp, end, 4, value);
+        case TYPE_INT_POS_64: case TYPE_INT_NEG_64:
+            return read_le(pp, end, 8, value);
+        default:
+            return false;
+    }}
+}}
+
+static inline bool read_int(const uint8_t** pp, const uint8_t* end, int64_t* value)
+{{
+    int is_negative = 0;
+    uint64_t magnitude = 0;
+    if(!read_magnitude(pp, end, &is_negative, &magnitude))
+    {{
+        return false;
+    }}
+    if(is_negative)
+    {{
+        if(magnitude > (uint64_t)INT64_MAX + 1)
+        {{
+            return false;
+        }}
+        *value = (int64_t)(0 - magnitude);
+        return true;
+    }}
+    if(magnitude > (uint64_t)INT64_MAX)
+    {{
+        return false;
+    }}
+    *value = (int64_t)magnitude;
+    return true;
+}}
+
+static inline bool read_uint(const uint8_t** pp, const uint8_t* end, uint64_t* value)
+{{
+    int is_negative = 0;
+    return read_magnitude(pp, end, &is_negative, value) && (!is_negative || *value == 0);
+}}
+
+static inline bool read_bool(const uint8_t** pp, const uint8_t* end, bool* value)
+{{
+    if(*pp >= end || (**pp != TYPE_TRUE && **pp != TYPE_FALSE))
+    {{
+        return false;
+    }}
+    *value = *(*pp)++ == TYPE_TRUE;
+    return true;
+}}
+
+static inline bool read_float(const uint8_t** pp, const uint8_t* end, double* value)
+{{
+    if(*pp >= end)
+    {{
+        return false;
+    }}
+    uint64_t bits = 0;
+    switch(*(*pp)++)
+    {{
+        case TYPE_FLOAT_BINARY_32:
+        {{
+            if(!read_le(pp, end, 4, &bits))
+            {{
+                return false;
+            }}
+            const uint32_t bits_32 = (uint32_t)bits;
+            float value_32 = 0;
+            memcpy(&value_32, &bits_32, sizeof(value_32));
+            *value = value_32;
+            return true;
+        }}
+        case TYPE_FLOAT_BINARY_64:
+            if(!read_le(pp, end, 8, &bits))
+            {{
+                return false;
+            }}
+            memcpy(value, &bits, sizeof(*value));
+            return true;
+        default:
+            return false;
+    }}
+}}
+
+static bool is_valid_utf8(const uint8_t* p, const uint8_t* const end)
+{{
+    while(p < end)
+    {{
+        const uint8_t ch = *p++;
+        int continuation_count = 0;
+        if(ch < 0x80)
+        {{
+            continue;
+        }}
+        if((ch & 0xe0) == 0xc0) continuation_count = 1;
+        else if((ch & 0xf0) == 0xe0) continuation_count = 2;
+        else if((ch & 0xf8) == 0xf0) continuation_count = 3;
+        else return false;
+        if(end - p < continuation_count)
+        {{
+            return false;
+        }}
+        for(; continuation_count > 0; continuation_count--)
+        {{
+            if((*p++ & 0xc0) != 0x80)
+            {{
+                return false;
+            }}
+        }}
+    }}
+    return true;
+}}
+
+static inline bool read_array(const uint8_t** pp, const uint8_t* end, const uint8_t type, const uint8_t** data, int64_t* byte_count)
+{{
+    if(*pp >= end)
+    {{
+        return false;
+    }}
+    const uint8_t actual_type = *(*pp)++;
+    uint64_t length = 0;
+    if(type == TYPE_STRING && actual_type >= TYPE_STRING_0 && actual_type <= TYPE_STRING_15)
+    {{
+        length = actual_type - TYPE_STRING_0;
+    }}
+    else if(actual_type != type || !read_vlq(pp, end, &length))
+    {{
+        return false;
+    }}
+    if((uint64_t)(end - *pp) < length)
+    {{
+        return false;
+    }}
+    *data = *pp;
+    *byte_count = (int64_t)length;
+    *pp += length;
+    return true;
+}}
+
+static inline bool read_string(const uint8_t** pp, const uint8_t* end, const char** data, int64_t* byte_count)
+{{
+    const uint8_t* start = NULL;
+    if(!read_array(pp, end, TYPE_STRING, &start, byte_count) || !is_valid_utf8(start, start + *byte_count))
+    {{
+        return false;
+    }}
+    *data = (const char*)start;
+    return true;
+}}
+
+static inline bool read_bytes(const uint8_t** pp, const uint8_t* end, const uint8_t** data, int64_t* byte_count)
+{{
+    return read_array(pp, end, TYPE_BYTES, data, byte_count);
+}}
+
+
+// ==================
+// Generic (fallback)
+// ==================
+
+typedef enum
+{{
+    FIELD_BOOL,
+    FIELD_INT,
+    FIELD_UINT,
+    FIELD_FLOAT,
+    FIELD_STRING,
+    FIELD_BYTES,
+    FIELD_RECORD,
+}} field_kind;
+
+typedef struct
+{{
+    const char* name;
+    int64_t name_length;
+    field_kind kind;
+    size_t offset;
+    size_t length_offset;
+    int record_index;
+}} field_descriptor;
+
+typedef struct
+{{
+    bool is_map;
+    int field_count;
+    const field_descriptor* fields;
+}} record_descriptor;
+
+typedef enum
+{{
+    PENDING_NONE,
+    PENDING_KEY,
+    PENDING_VALUE,
+    PENDING_IGNORED,
+}} pending_array;
+
+typedef struct
+{{
+    const record_descriptor* record;
+    uint8_t* base;
+    int field_index;
+    bool is_expecting_key;
+}} record_frame;
+
+typedef struct
+{{
+    const record_descriptor* root;
+    record_frame frames[MAX_RECORD_DEPTH];
+    int depth;
+    pending_array pending;
+    int64_t pending_byte_count;
+}} fallback_context;
+
+static const record_descriptor g_records[RECORD_COUNT];
+
+static inline fallback_context* get_context(struct cbe_decode_process* process)
+{{
+    return (fallback_context*)cbe_decode_get_user_context(process);
+}}
+
+// Returns the field the next value is for, or NULL if it's a value for an unknown map key.
+// Sets *is_valid to false if no value is allowed here.
+static const field_descriptor* get_value_field(fallback_context* context, bool* is_valid)
+{{
+    *is_valid = false;
+    if(context->depth == 0)
+    {{
+        return NULL;
+    }}
+    record_frame* frame = &context->frames[context->depth - 1];
+    if(frame->record->is_map)
+    {{
+        if(frame->is_expecting_key)
+        {{
+            return NULL;
+        }}
+        *is_valid = true;
+        return frame->field_index < 0 ? NULL : &frame->record->fields[frame->field_index];
+    }}
+    if(frame->field_index >= frame->record->field_count)
+    {{
+        return NULL;
+    }}
+    *is_valid = true;
+    return &frame->record->fields[frame->field_index];
+}}
+
+static void end_value(fallback_context* context)
+{{
+    if(context->depth == 0)
+    {{
+        return;
+    }}
+    record_frame* frame = &context->frames[context->depth - 1];
+    if(frame->record->is_map)
+    {{
+        frame->is_expecting_key = true;
+    }}
+    else
+    {{
+        frame->field_index++;
+    }}
+}}
+
+#define BEGIN_SCALAR_FIELD(CONTEXT, FIELD) \\
+    fallback_context* CONTEXT = get_context(process); \\
+    bool is_valid = false; \\
+    const field_descriptor* FIELD = get_value_field(CONTEXT, &is_valid); \\
+    if(!is_valid) \\
+    {{ \\
+        return false; \\
+    }} \\
+    end_value(CONTEXT); \\
+    if(FIELD == NULL) \\
+    {{ \\
+        return true; \\
+    }} \\
+    uint8_t* const field_ptr = CONTEXT->frames[CONTEXT->depth - 1].base + FIELD->offset
+
+static bool on_boolean(struct cbe_decode_process* process, bool value)
+{{
+    BEGIN_SCALAR_FIELD(context, field);
+    if(field->kind != FIELD_BOOL)
+    {{
+        return false;
+    }}
+    *(bool*)field_ptr = value;
+    return true;
+}}
+
+static bool on_integer(struct cbe_decode_process* process, int sign, uint64_t value)
+{{
+    BEGIN_SCALAR_FIELD(context, field);
+    switch(field->kind)
+    {{
+        case FIELD_INT:
+            if(sign < 0 ? value > (uint64_t)INT64_MAX + 1 : value > (uint64_t)INT64_MAX)
+            {{
+                return false;
+            }}
+            *(int64_t*)field_ptr = sign < 0 ? (int64_t)(0 - value) : (int64_t)value;
+            return true;
+        case FIELD_UINT:
+            if(sign < 0 && value != 0)
+            {{
+                return false;
+            }}
+            *(uint64_t*)field_ptr = value;
+            return true;
+        case FIELD_FLOAT:
+            *(double*)field_ptr = sign < 0 ? -(double)value : (double)value;
+            return true;
+        default:
+            return false;
+    }}
+}}
+
+static bool on_float(struct cbe_decode_process* process, double value)
+{{
+    BEGIN_SCALAR_FIELD(context, field);
+    if(field->kind != FIELD_FLOAT)
+    {{
+        return false;
+    }}
+    *(double*)field_ptr = value;
+    return true;
+}}
+
+static bool on_decimal_float(struct cbe_decode_process* process, dec64_ct value)
+{{
+    return on_float(process, (double)value);
+}}
+
+static bool on_container_begin(struct cbe_decode_process* process, bool is_map)
+{{
+    fallback_context* context = get_context(process);
+    const record_descriptor* record = context->root;
+    uint8_t* base = NULL;
+    if(context->depth == 0)
+    {{
+        base = (uint8_t*)context->frames[0].base;
+    }}
+    else
+    {{
+        bool is_valid = false;
+        const field_descriptor* field = get_value_field(context, &is_valid);
+        if(field == NULL || field->kind != FIELD_RECORD || context->depth >= MAX_RECORD_DEPTH)
+        {{
+            return false;
+        }}
+        record = &g_records[field->record_index];
+        base = context->frames[context->depth - 1].base + field->offset;
+    }}
+    if(record->is_map != is_map)
+    {{
+        return false;
+    }}
+    record_frame* frame = &context->frames[context->depth++];
+    frame->record = record;
+    frame->base = base;
+    frame->field_index = is_map ? -1 : 0;
+    frame->is_expecting_key = is_map;
+    return true;
+}}
+
+static bool on_list_begin(struct cbe_decode_process* process)
+{{
+    return on_container_begin(process, false);
+}}
+
+static bool on_map_begin(struct cbe_decode_process* process)
+{{
+    return on_container_begin(process, true);
+}}
+
+static bool on_container_end(struct cbe_decode_process* process)
+{{
+    fallback_context* context = get_context(process);
+    context->depth--;
+    end_value(context);
+    return true;
+}}
+
+static bool on_array_begin(struct cbe_decode_process* process, int64_t byte_count, field_kind kind)
+{{
+    fallback_context* context = get_context(process);
+    context->pending_byte_count = byte_count;
+    if(context->depth > 0 && context->frames[context->depth - 1].is_expecting_key && kind == FIELD_STRING)
+    {{
+        context->pending = PENDING_KEY;
+        return true;
+    }}
+    bool is_valid = false;
+    const field_descriptor* field = get_value_field(context, &is_valid);
+    if(!is_valid || (field != NULL && field->kind != kind))
+    {{
+        return false;
+    }}
+    context->pending = field == NULL ? PENDING_IGNORED : PENDING_VALUE;
+    return true;
+}}
+
+static bool on_string_begin(struct cbe_decode_process* process, int64_t byte_count)
+{{
+    return on_array_begin(process, byte_count, FIELD_STRING);
+}}
+
+static bool on_bytes_begin(struct cbe_decode_process* process, int64_t byte_count)
+{{
+    return on_array_begin(process, byte_count, FIELD_BYTES);
+}}
+
+static bool on_comment_begin(struct cbe_decode_process* process, int64_t byte_count)
+{{
+    fallback_context* context = get_context(process);
+    context->pending = PENDING_NONE;
+    context->pending_byte_count = byte_count;
+    return true;
+}}
+
+static bool on_array_data(struct cbe_decode_process* process, const uint8_t* start, int64_t byte_count)
+{{
+    fallback_context* context = get_context(process);
+    if(byte_count < context->pending_byte_count)
+    {{
+        // Truncated document. The decoder will report that it needs more data.
+        return true;
+    }}
+    record_frame* frame = context->depth > 0 ? &context->frames[context->depth - 1] : NULL;
+    switch(context->pending)
+    {{
+        case PENDING_KEY:
+            frame->field_index = -1;
+            for(int i = 0; i < frame->record->field_count; i++)
+            {{
+                const field_descriptor* field = &frame->record->fields[i];
+                if(field->name_length == byte_count && memcmp(field->name, start, byte_count) == 0)
+                {{
+                    frame->field_index = i;
+                    break;
+                }}
+            }}
+            frame->is_expecting_key = false;
+            break;
+        case PENDING_VALUE:
+        {{
+            const field_descriptor* field = &frame->record->fields[frame->field_index];
+            *(const uint8_t**)(frame->base + field->offset) = start;
+            *(int64_t*)(frame->base + field->length_offset) = byte_count;
+            end_value(context);
+            break;
+        }}
+        case PENDING_IGNORED:
+            end_value(context);
+            break;
+        case PENDING_NONE:
+            break;
+    }}
+    context->pending = PENDING_NONE;
+    return true;
+}}
+
+static bool on_unsupported(struct cbe_decode_process* process)
+{{
+    (void)process;
+    return false;
+}}
+
+static bool on_unsupported_int_3(struct cbe_decode_process* process, int a, int b, int c)
+{{
+    (void)a; (void)b; (void)c;
+    return on_unsupported(process);
+}}
+
+static bool on_unsupported_time_tz(struct cbe_decode_process* process, int a, int b, int c, int d, const char* e)
+{{
+    (void)a; (void)b; (void)c; (void)d; (void)e;
+    return on_unsupported(process);
+}}
+
+static bool on_unsupported_time_loc(struct cbe_decode_process* process, int a, int b, int c, int d, int e, int f)
+{{
+    (void)a; (void)b; (void)c; (void)d; (void)e; (void)f;
+    return on_unsupported(process);
+}}
+
+static bool on_unsupported_timestamp_tz(struct cbe_decode_process* process, int a, int b, int c, int d, int e, int f, int g, const char* h)
+{{
+    (void)a; (void)b; (void)c; (void)d; (void)e; (void)f; (void)g; (void)h;
+    return on_unsupported(process);
+}}
+
+static bool on_unsupported_timestamp_loc(struct cbe_decode_process* process, int a, int b, int c, int d, int e, int f, int g, int h, int i)
+{{
+    (void)a; (void)b; (void)c; (void)d; (void)e; (void)f; (void)g; (void)h; (void)i;
+    return on_unsupported(process);
+}}
+
+static bool on_unsupported_array(struct cbe_decode_process* process, int64_t byte_count)
+{{
+    (void)byte_count;
+    return on_unsupported(process);
+}}
+
+static const cbe_decode_callbacks g_fallback_callbacks =
+{{
+    .on_nil = on_unsupported,
+    .on_boolean = on_boolean,
+    .on_integer = on_integer,
+    .on_float = on_float,
+    .on_decimal_float = on_decimal_float,
+    .on_date = on_unsupported_int_3,
+    .on_time_tz = on_unsupported_time_tz,
+    .on_time_loc = on_unsupported_time_loc,
+    .on_timestamp_tz = on_unsupported_timestamp_tz,
+    .on_timestamp_loc = on_unsupported_timestamp_loc,
+    .on_list_begin = on_list_begin,
+    .on_unordered_map_begin = on_map_begin,
+    .on_ordered_map_begin = on_map_begin,
+    .on_metadata_map_begin = on_unsupported,
+    .on_container_end = on_container_end,
+    .on_string_begin = on_string_begin,
+    .on_bytes_begin = on_bytes_begin,
+    .on_uri_begin = on_unsupported_array,
+    .on_comment_begin = on_comment_begin,
+    .on_array_data = on_array_data,
+}};
+
+static cbe_decode_status decode_generic(const uint8_t* document, int64_t byte_count, int record_index, void* value, size_t value_size)
+{{
+    memset(value, 0, value_size);
+    fallback_context context =
+    {{
+        .root = &g_records[record_index],
+        .depth = 0,
+        .pending = PENDING_NONE,
+    }};
+    context.frames[0].base = (uint8_t*)value;
+    return cbe_decode(&g_fallback_callbacks, &context, document, byte_count, MAX_RECORD_DEPTH + 1);
+}}
+
+"""
+
+
+class Generator:
+    def __init__(self, schema, source, header_name):
+        self.schema = schema
+        self.source = source
+        self.header_name = header_name
+
+    def member_lines(self, record):
+        lines = []
+        for field in record["fields"]:
+            ftype = field["type"]
+            if ftype in SCALAR_TYPES:
+                lines.append("    %s %s;" % (SCALAR_TYPES[ftype][0], field["name"]))
+            elif ftype in ARRAY_TYPES:
+                lines.append("    %s %s;" % (ARRAY_TYPES[ftype][0], field["name"]))
+                lines.append("    int64_t %s_length;" % field["name"])
+            else:
+                lines.append("    %s %s;" % (self.schema.c_name(self.schema.records_by_name[ftype]), field["name"]))
+        if not lines:
+            lines.append("    char unused;")
+        return lines
+
+    def header(self):
+        typedefs = []
+        declarations = []
+        for record in self.schema.ordered_records():
+            c_name = self.schema.c_name(record)
+            typedefs.append("typedef struct\n{\n%s\n} %s;\n" % ("\n".join(self.member_lines(record)), c_name))
+        for record in self.schema.records:
+            declarations.append(DECLARATION_TEMPLATE.format(c_name=self.schema.c_name(record)))
+        return HEADER_TEMPLATE.format(source=self.source,
+                                      typedefs="\n".join(typedefs),
+                                      declarations="".join(declarations))
+
+    def key_name(self, record, field):
+        return "g_key_%s_%s" % (record["name"], field["name"])
+
+    def keys(self):
+        lines = []
+        for record in self.schema.ordered_records():
+            if not self.schema.is_map(record):
+                continue
+            for field in record["fields"]:
+                lines.append("static const uint8_t %s[] = {%s};" % (self.key_name(record, field), c_bytes(encode_key(field["name"]))))
+        return "\n".join(lines) + "\n" if lines else ""
+
+    def descriptors(self):
+        out = []
+        records = self.schema.ordered_records()
+        indices = {record["name"]: index for index, record in enumerate(records)}
+        for record in records:
+            c_name = self.schema.c_name(record)
+            fields = []
+            for field in record["fields"]:
+                ftype = field["type"]
+                name = field["name"]
+                if ftype in SCALAR_TYPES:
+                    kind, length_offset, record_index = SCALAR_TYPES[ftype][2], "0", -1
+                elif ftype in ARRAY_TYPES:
+                    kind, length_offset, record_index = ARRAY_TYPES[ftype][1], "offsetof(%s, %s_length)" % (c_name, name), -1
+                else:
+                    kind, length_offset, record_index = "FIELD_RECORD", "0", indices[ftype]
+                fields.append("    {\"%s\", %d, %s, offsetof(%s, %s), %s, %d},"
+                              % (name, len(name.encode("utf-8")), kind, c_name, name, length_offset, record_index))
+            if fields:
+                out.append("static const field_descriptor g_fields_%s[] =\n{\n%s\n};\n" % (record["name"], "\n".join(fields)))
+        out.append("static const record_descriptor g_records[RECORD_COUNT] =\n{")
+        for record in records:
+            fields = "g_fields_%s" % record["name"] if record["fields"] else "NULL"
+            out.append("    {%s, %d, %s}," % ("true" if self.schema.is_map(record) else "false", len(record["fields"]), fields))
+        out.append("};\n")
+        return "\n".join(out) + "\n"
+
+    def max_size_expression(self, record, value):
+        fixed = 2  # Container begin + end
+        variable = []
+        for field in record["fields"]:
+            if self.schema.is_map(record):
+                fixed += len(encode_key(field["name"]))
+            ftype = field["type"]
+            member = "%s%s" % (value, field["name"])
+            if ftype in SCALAR_TYPES:
+                fixed += SCALAR_TYPES[ftype][1]
+            elif ftype in ARRAY_TYPES:
+                fixed += ARRAY_HEADER_MAX_SIZE
+                variable.append("%s_length" % member)
+            else:
+                child = self.schema.records_by_name[ftype]
+                child_fixed, child_variable = self.max_size_expression(child, member + ".")
+                fixed += child_fixed
+                variable += child_variable
+        return fixed, variable
+
+    def encode_lines(self, record, value, indent):
+        lines = ["%s*p++ = %s;" % (indent, CONTAINER_TYPES[record["container"]])]
+        for field in record["fields"]:
+            if self.schema.is_map(record):
+                key = self.key_name(record, field)
+                lines.append("%smemcpy(p, %s, sizeof(%s));" % (indent, key, key))
+                lines.append("%sp += sizeof(%s);" % (indent, key))
+            ftype = field["type"]
+            member = "%s%s" % (value, field["name"])
+            if ftype in SCALAR_TYPES:
+                lines.append("%sp = write_%s(p, %s);" % (indent, ftype, member))
+            elif ftype in ARRAY_TYPES:
+                lines.append("%sp = write_%s(p, %s, %s_length);" % (indent, ftype, member, member))
+            else:
+                lines += self.encode_lines(self.schema.records_by_name[ftype], member + ".", indent)
+        lines.append("%s*p++ = TYPE_END_CONTAINER;" % indent)
+        return lines
+
+    def decode_lines(self, record, value, indent):
+        fail_line = "%s{\n%s    return false;\n%s}" % (indent, indent, indent)
+        lines = ["%sif(p >= end || *p++ != %s)\n%s" % (indent, CONTAINER_TYPES[record["container"]], fail_line)]
+        for field in record["fields"]:
+            if self.schema.is_map(record):
+                key = self.key_name(record, field)
+                lines.append("%sif(!match_bytes(&p, end, %s, sizeof(%s)))\n%s" % (indent, key, key, fail_line))
+            ftype = field["type"]
+            member = "%s%s" % (value, field["name"])
+            if ftype in SCALAR_TYPES:
+                lines.append("%sif(!read_%s(&p, end, &%s))\n%s" % (indent, ftype, member, fail_line))
+            elif ftype in ARRAY_TYPES:
+                lines.append("%sif(!read_%s(&p, end, &%s, &%s_length))\n%s" % (indent, ftype, member, member, fail_line))
+            else:
+                lines += self.decode_lines(self.schema.records_by_name[ftype], member + ".", indent)
+        lines.append("%sif(p >= end || *p++ != TYPE_END_CONTAINER)\n%s" % (indent, fail_line))
+        return lines
+
+    def functions(self):
+        records = self.schema.ordered_records()
+        indices = {record["name"]: index for index, record in enumerate(records)}
+        out = []
+        for record in self.schema.records:
+            c_name = self.schema.c_name(record)
+            fixed, variable = self.max_size_expression(record, "value->")
+            size_expression = " + ".join([str(fixed)] + variable)
+            # Only records with variable length fields read the value.
+            unused_value = "" if variable else "    (void)value;\n"
+            out.append("int64_t %s_max_encoded_size(const %s* value)\n{\n%s    return %s;\n}\n"
+                       % (c_name, c_name, unused_value, size_expression))
+            out.append("int64_t %s_encode(const %s* value, uint8_t* buffer, int64_t buffer_size)\n{\n"
+                       "    if(buffer_size < %s_max_encoded_size(value))\n    {\n        return -1;\n    }\n"
+                       "    uint8_t* p = buffer;\n%s\n    return p - buffer;\n}\n"
+                       % (c_name, c_name, c_name, "\n".join(self.encode_lines(record, "value->", "    "))))
+            out.append("bool %s_decode_fast(const uint8_t* document, int64_t byte_count, %s* value)\n{\n"
+                       "    const uint8_t* p = document;\n    const uint8_t* const end = document + byte_count;\n%s\n"
+                       "    return p == end;\n}\n"
+                       % (c_name, c_name, "\n".join(self.decode_lines(record, "value->", "    "))))
+            out.append("cbe_decode_status %s_decode(const uint8_t* document, int64_t byte_count, %s* value)\n{\n"
+                       "    if(%s_decode_fast(document, byte_count, value))\n    {\n        return CBE_DECODE_STATUS_OK;\n    }\n"
+                       "    return decode_generic(document, byte_count, %d, value, sizeof(*value));\n}\n"
+                       % (c_name, c_name, c_name, indices[record["name"]]))
+        return "\n".join(out)
+
+    def source_file(self):
+        max_depth = max(self.schema.depths.values())
+        return (SOURCE_PRELUDE.format(source=self.source, header=self.header_name, max_depth=max_depth,
+                                    record_count=len(self.schema.records))
+                + "\n// ======\n// Schema\n// ======\n\n"
+                + self.keys() + "\n" + self.descriptors()
+                + "\n// ===\n// API\n// ===\n\n" + self.functions())
+
+
+def main(argv):
+    if len(argv) != 4:
+        sys.stderr.write("Usage: %s <schema.json> <output.h> <output.c>\n" % argv[0])
+        return 1
+    schema_path, header_path, source_path = argv[1:]
+    with open(schema_path) as f:
+        schema = Schema(json.load(f))
+    source_name = schema_path.replace("\\", "/").split("/")[-1]
+    header_name = header_path.replace("\\", "/").split("/")[-1]
+    generator = Generator(schema, source_name, header_name)
+    with open(header_path, "w") as f:
+        f.write(generator.header())
+    with open(source_path, "w") as f:
+        f.write(generator.source_file())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))